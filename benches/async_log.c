@@ -0,0 +1,70 @@
+///Times the call site of debug_log printing on the calling thread against the async_log backend,
+///both dropping and blocking when the ring is full, and prints p50/p99/p99.9 latency per call.
+///Everything is written to /dev/null, so the synchronous numbers are the formatting and the syscall, not a terminal.
+///Build: gcc -O2 -pthread -I../includes/includes async_log.c -o async_log -lm
+///Run:   ./async_log [calls]
+#include "bench.h"
+#include "debug.h"
+#include "async_log.h"
+#include <fcntl.h>
+
+void bench_print(str name, u64* latencies, u32 calls, u64 timer_ns, double dropped){
+    bench_sort_u64s(latencies, calls);
+    double p50 = (double)bench_percentile(latencies, calls, 500);
+    double p99 = (double)bench_percentile(latencies, calls, 990);
+    double p999 = (double)bench_percentile(latencies, calls, 999);
+    printf("%-24s %-10.0f %-10.0f %-10.0f %-10llu %-8.1f\n", name, p50 - timer_ns, p99 - timer_ns, p999 - timer_ns,
+        (unsigned long long)(latencies[calls - 1] - timer_ns), dropped * 100);
+}
+
+///Calls debug_log [calls] times, timing every call on its own
+void bench_calls(u64* latencies, u32 calls){
+    for(u32 i = 0; i < calls; i++){
+        u64 start = bench_now_ns();
+        debug_log("bench", "request %d took %.3f ms from %s", i, i * 0.001, "10.0.0.1");
+        latencies[i] = bench_now_ns() - start;
+    }
+}
+
+int main(int argc, char** argv){
+    u32 calls = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+    u64* latencies = malloc(sizeof(u64) * calls);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    ///What two clock reads in a row cost, taken off every number below
+    for(u32 i = 0; i < calls; i++){
+        u64 start = bench_now_ns();
+        latencies[i] = bench_now_ns() - start;
+    }
+    bench_sort_u64s(latencies, calls);
+    u64 timer_ns = bench_percentile(latencies, calls, 500);
+
+    printf("%u calls, ns per call with %llu ns of timing overhead taken off\n", calls, (unsigned long long)timer_ns);
+    printf("%-24s %-10s %-10s %-10s %-10s %-8s\n", "", "p50", "p99", "p99.9", "max", "dropped%");
+
+    ///Synchronous debug_log, with stdout pointed at /dev/null for the run
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    bench_calls(latencies, calls);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    bench_print("debug_log (sync)", latencies, calls, timer_ns, 0);
+
+    async_log_overflow policies[2] = { ASYNC_LOG_DROP, ASYNC_LOG_BLOCK };
+    str names[2] = { "async_log (drop)", "async_log (block)" };
+    for(u32 policy = 0; policy < 2; policy++){
+        async_log* log = async_log_init(null_fd, policies[policy]);
+        debug_log_set_backend(log);
+        bench_calls(latencies, calls);
+        async_log_flush(log);
+        debug_log_set_backend(NULL);
+        double dropped = (double)async_log_dropped(log) / calls;
+        async_log_deinit(log);
+        bench_print(names[policy], latencies, calls, timer_ns, dropped);
+    }
+    close(null_fd);
+    free(latencies);
+    return 0;
+}
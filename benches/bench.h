@@ -0,0 +1,382 @@
+#pragma once
+
+#include "commons.h"
+#include "perf_counters.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    A small harness for benchmarks that get compared from run to run, rather than read once.
+
+    A case is a body that does [ops] operations on a [size], with an untimed setup and teardown around it.
+    bench_case runs it [warmup] times without looking, then [reps] times timed, and keeps the spread of the
+    ns per operation over the reps: min, median, mean, standard deviation and max.
+
+    setup --> | body: ops operations | --> teardown        x warmup, then x reps
+                 ^ timed
+
+    With --counters, the cpu's counters (see perf_counters.h) are read around every timed run too, and the median of
+    each per operation is shown under the timings and kept in the JSON. Where the counters aren't there, like in most
+    VMs, that's printed once and the run goes on with the timings alone.
+
+    Every case prints a line as it finishes, and bench_finish writes them all as JSON with --json.
+    --compare old.json new.json reads two of those files and flags every case whose median got slower by more
+    than --threshold percent, and by more than the noise of either run, and exits with 1 if there are any.
+
+    Benches that time something else, like latency per call or throughput across threads, keep their own tables
+    but take bench_now_ns, bench_random and the percentile helpers from here.
+
+    Run:   ./bench [--reps N] [--warmup N] [--filter text] [--json out.json] [--counters]
+           ./bench --compare old.json new.json [--threshold percent]
+*/
+
+///How many cases one run can keep
+#define BENCH_MAX_RESULTS 512
+#define BENCH_MAX_REPS 1000
+///How many standard deviations a change has to be over before it counts, so noisy cases don't cry wolf
+#define BENCH_NOISE_SIGMAS 2
+
+typedef void (*bench_setup)(void* context, u32 size);
+typedef void (*bench_body)(void* context, u32 size, u32 ops);
+typedef void (*bench_teardown)(void* context);
+
+///The spread of one case, in ns per operation
+PUBLIC
+struct bench_result{
+    char name[64];
+    u32 size;
+    u32 ops;
+    u32 reps;
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double max;
+    ///The median of each counter per operation, or -1 for the ones that weren't counted
+    double counters[PERF_COUNTER_COUNT];
+};
+typedef struct bench_result bench_result;
+
+PUBLIC
+struct bench_suite{
+    u32 warmup;
+    u32 reps;
+    ///Only cases with this in their name are run, or every case if NULL
+    str filter;
+    ///Where bench_finish writes the results, or NULL
+    str json_path;
+    double threshold;
+    ///Set when the command line asked for a comparison instead of a run
+    str compare_old;
+    str compare_new;
+    ///Whether the counters are read around each timed run, which is only when --counters asked and any could be opened
+    bool counting;
+    perf_counters counters;
+    bench_result results[BENCH_MAX_RESULTS];
+    u32 result_count;
+};
+typedef struct bench_suite bench_suite;
+
+HELPER
+u64 bench_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+HELPER
+int bench_compare_doubles(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+HELPER
+int bench_compare_u64s(const void* a, const void* b){
+    u64 x = *(const u64*)a;
+    u64 y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+///Sorts [count] latencies, for bench_percentile to read
+PUBLIC
+void bench_sort_u64s(u64* samples, u32 count){
+    qsort(samples, count, sizeof(u64), bench_compare_u64s);
+}
+
+///The latency [per_mille] thousandths of the way up [count] sorted ones, so 500 is the median and 999 is p99.9
+PUBLIC
+u64 bench_percentile(u64* sorted, u32 count, u32 per_mille){
+    u64 index = (u64)count * per_mille / 1000;
+    return sorted[index < count ? index : count - 1];
+}
+
+///The state of bench_random. It starts the same every run, so every run gets the same numbers.
+INTERNAL
+u64 bench_rng = 0x9E3779B97F4A7C15ull;
+
+///A xorshift, for keys and deadlines that only need to look random
+PUBLIC
+u64 bench_random(){
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return bench_rng;
+}
+
+///Reads the command line. Unknown arguments are printed and ignored.
+PUBLIC
+bench_suite* bench_init(int argc, char** argv){
+    bench_suite* suite = calloc(1, sizeof(bench_suite));
+    if(suite == NULL){
+        return NULL;
+    }
+    suite->warmup = 2;
+    suite->reps = 10;
+    suite->threshold = 5;
+    for(int i = 1; i < argc; i++){
+        bool has_value = i + 1 < argc;
+        if(strcmp(argv[i], "--reps") == 0 && has_value){
+            suite->reps = (u32)atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--warmup") == 0 && has_value){
+            suite->warmup = (u32)atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--filter") == 0 && has_value){
+            suite->filter = argv[++i];
+        }else if(strcmp(argv[i], "--json") == 0 && has_value){
+            suite->json_path = argv[++i];
+        }else if(strcmp(argv[i], "--threshold") == 0 && has_value){
+            suite->threshold = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--counters") == 0){
+            suite->counting = perf_counters_open(&suite->counters);
+        }else if(strcmp(argv[i], "--compare") == 0 && i + 2 < argc){
+            suite->compare_old = argv[++i];
+            suite->compare_new = argv[++i];
+        }else{
+            printf("Ignoring argument %s\n", argv[i]);
+        }
+    }
+    if(suite->reps == 0){
+        suite->reps = 1;
+    }
+    if(suite->reps > BENCH_MAX_REPS){
+        suite->reps = BENCH_MAX_REPS;
+    }
+    if(suite->compare_old == NULL){
+        printf("%u warmup runs and %u timed runs per case, ns per operation\n", suite->warmup, suite->reps);
+        printf("%-28s %-8s %-8s %-10s %-10s %-8s %-10s %-10s\n", "", "size", "ops", "median", "mean", "+-%", "min", "max");
+    }
+    return suite;
+}
+
+///Runs one case, see bench_suite. [setup] and [teardown] may be NULL. Does nothing when the suite is comparing.
+PUBLIC
+RECEIVER(suite)
+void bench_case(bench_suite* suite, str name, u32 size, u32 ops, bench_setup setup, bench_body body, bench_teardown teardown, void* context){
+    if(suite->compare_old != NULL || (suite->filter != NULL && strstr(name, suite->filter) == NULL)){
+        return;
+    }
+    if(suite->result_count == BENCH_MAX_RESULTS){
+        printf("Cannot keep %s, there are already %i results\n", name, BENCH_MAX_RESULTS);
+        return;
+    }
+    double samples[BENCH_MAX_REPS];
+    static double counter_samples[PERF_COUNTER_COUNT][BENCH_MAX_REPS];
+    for(u32 rep = 0; rep < suite->warmup + suite->reps; rep++){
+        if(setup != NULL){
+            setup(context, size);
+        }
+        ///The counters are read outside the timing, so reading them doesn't show up in the ns
+        perf_sample before, after;
+        if(suite->counting){
+            perf_counters_read(&suite->counters, &before);
+        }
+        u64 start = bench_now_ns();
+        body(context, size, ops);
+        u64 elapsed = bench_now_ns() - start;
+        if(suite->counting){
+            perf_counters_read(&suite->counters, &after);
+        }
+        if(teardown != NULL){
+            teardown(context);
+        }
+        if(rep >= suite->warmup){
+            samples[rep - suite->warmup] = (double)elapsed / ops;
+            if(suite->counting){
+                perf_sample counts = perf_sample_delta(&after, &before);
+                for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+                    counter_samples[kind][rep - suite->warmup] = (double)counts.values[kind] / ops;
+                }
+            }
+        }
+    }
+    u32 reps = suite->reps;
+    qsort(samples, reps, sizeof(double), bench_compare_doubles);
+    bench_result* result = &suite->results[suite->result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->size = size;
+    result->ops = ops;
+    result->reps = reps;
+    result->min = samples[0];
+    result->max = samples[reps - 1];
+    result->median = reps % 2 == 1 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+    double sum = 0;
+    for(u32 i = 0; i < reps; i++){
+        sum += samples[i];
+    }
+    result->mean = sum / reps;
+    double squares = 0;
+    for(u32 i = 0; i < reps; i++){
+        squares += (samples[i] - result->mean) * (samples[i] - result->mean);
+    }
+    result->stddev = reps > 1 ? sqrt(squares / (reps - 1)) : 0;
+    printf("%-28s %-8u %-8u %-10.2f %-10.2f %-8.1f %-10.2f %-10.2f\n", result->name, size, ops, result->median, result->mean,
+        result->mean == 0 ? 0 : result->stddev / result->mean * 100, result->min, result->max);
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        result->counters[kind] = -1;
+        if(!suite->counting || !perf_counters_has(&suite->counters, (perf_counter_kind)kind)){
+            continue;
+        }
+        qsort(counter_samples[kind], reps, sizeof(double), bench_compare_doubles);
+        result->counters[kind] = reps % 2 == 1
+            ? counter_samples[kind][reps / 2]
+            : (counter_samples[kind][reps / 2 - 1] + counter_samples[kind][reps / 2]) / 2;
+    }
+    if(suite->counting){
+        printf("%-28s", "    per operation:");
+        for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+            if(result->counters[kind] >= 0){
+                printf(" %s %.2f", perf_counter_name((perf_counter_kind)kind), result->counters[kind]);
+            }
+        }
+        if(result->counters[PERF_CYCLES] > 0 && result->counters[PERF_INSTRUCTIONS] >= 0){
+            printf(" ipc %.2f", result->counters[PERF_INSTRUCTIONS] / result->counters[PERF_CYCLES]);
+        }
+        printf("\n");
+    }
+}
+
+///Writes every result to [path] as JSON, one case per line. Returns false if it can't.
+PUBLIC
+RECEIVER(suite)
+bool bench_write_json(bench_suite* suite, str path){
+    FILE* out = fopen(path, "w");
+    if(out == NULL){
+        printf("Could not open %s to write the results to\n", path);
+        return false;
+    }
+    fprintf(out, "{\"warmup\":%u,\"reps\":%u,\"results\":[\n", suite->warmup, suite->reps);
+    for(u32 i = 0; i < suite->result_count; i++){
+        bench_result* result = &suite->results[i];
+        fprintf(out, "{\"name\":\"%s\",\"size\":%u,\"ops\":%u,\"reps\":%u,\"min_ns\":%.3f,\"median_ns\":%.3f,\"mean_ns\":%.3f,\"stddev_ns\":%.3f,\"max_ns\":%.3f",
+            result->name, result->size, result->ops, result->reps, result->min, result->median, result->mean, result->stddev, result->max);
+        ///Only the counters that were counted, per operation
+        for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+            if(result->counters[kind] >= 0){
+                fprintf(out, ",\"%s\":%.3f", perf_counter_name((perf_counter_kind)kind), result->counters[kind]);
+            }
+        }
+        fprintf(out, "}%s\n", i + 1 < suite->result_count ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    return fclose(out) == 0;
+}
+
+///Reads the results bench_write_json wrote to [path] into [results]. Returns how many, or -1 if the file can't be read.
+INTERNAL
+i32 bench_read_json(str path, OUT bench_result* results, u32 capacity){
+    FILE* in = fopen(path, "r");
+    if(in == NULL){
+        printf("Could not open %s to compare\n", path);
+        return -1;
+    }
+    char line[512];
+    u32 count = 0;
+    while(count < capacity && fgets(line, sizeof(line), in) != NULL){
+        bench_result* result = &results[count];
+        if(sscanf(line, "{\"name\":\"%63[^\"]\",\"size\":%u,\"ops\":%u,\"reps\":%u,\"min_ns\":%lf,\"median_ns\":%lf,\"mean_ns\":%lf,\"stddev_ns\":%lf,\"max_ns\":%lf",
+            result->name, &result->size, &result->ops, &result->reps, &result->min, &result->median, &result->mean, &result->stddev, &result->max) == 9){
+            for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+                char key[32];
+                snprintf(key, sizeof(key), "\"%s\":", perf_counter_name((perf_counter_kind)kind));
+                str at = strstr(line, key);
+                result->counters[kind] = at == NULL ? -1 : atof(at + strlen(key));
+            }
+            count += 1;
+        }
+    }
+    fclose(in);
+    return (i32)count;
+}
+
+///Compares two runs case by case, and prints every case that got slower or faster by more than [threshold] percent
+///and more than the noise. Returns how many got slower, or -1 if either file can't be read.
+PUBLIC
+i32 bench_compare(str old_path, str new_path, double threshold){
+    bench_result* before = malloc(sizeof(bench_result) * BENCH_MAX_RESULTS * 2);
+    if(before == NULL){
+        return -1;
+    }
+    bench_result* after = before + BENCH_MAX_RESULTS;
+    i32 before_count = bench_read_json(old_path, before, BENCH_MAX_RESULTS);
+    i32 after_count = bench_read_json(new_path, after, BENCH_MAX_RESULTS);
+    if(before_count < 0 || after_count < 0){
+        free(before);
+        return -1;
+    }
+    printf("%-28s %-8s %-12s %-12s %-10s %s\n", "", "size", "old median", "new median", "change%", "");
+    i32 regressions = 0;
+    for(i32 i = 0; i < after_count; i++){
+        bench_result* now = &after[i];
+        bench_result* then = NULL;
+        for(i32 j = 0; j < before_count; j++){
+            if(before[j].size == now->size && strcmp(before[j].name, now->name) == 0){
+                then = &before[j];
+                break;
+            }
+        }
+        if(then == NULL){
+            printf("%-28s %-8u %-12s %-12.2f %-10s new\n", now->name, now->size, "", now->median, "");
+            continue;
+        }
+        double change = then->median == 0 ? 0 : (now->median - then->median) / then->median * 100;
+        double noise = BENCH_NOISE_SIGMAS * (then->stddev > now->stddev ? then->stddev : now->stddev);
+        str verdict = "";
+        if(fabs(change) > threshold && fabs(now->median - then->median) > noise){
+            verdict = change > 0 ? "REGRESSION" : "faster";
+            regressions += change > 0;
+        }
+        printf("%-28s %-8u %-12.2f %-12.2f %-+10.1f %s\n", now->name, now->size, then->median, now->median, change, verdict);
+        ///When both runs counted, show what the cpu did differently in the cases that changed
+        if(verdict[0] != 0){
+            for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+                if(then->counters[kind] >= 0 && now->counters[kind] >= 0){
+                    printf("    %-24s %-8s %-12.2f %-12.2f\n", perf_counter_name((perf_counter_kind)kind), "", then->counters[kind], now->counters[kind]);
+                }
+            }
+        }
+    }
+    printf("%i of %i cases got slower by more than %.1f%%\n", regressions, after_count, threshold);
+    free(before);
+    return regressions;
+}
+
+///Writes the JSON if it was asked for, or does the comparison if that's what was asked for, and frees the suite.
+///Returns what main should: 1 if anything failed or got slower, 0 otherwise.
+PUBLIC
+RECEIVER(suite)
+int bench_finish(bench_suite* suite){
+    int status = 0;
+    if(suite->compare_old != NULL){
+        status = bench_compare(suite->compare_old, suite->compare_new, suite->threshold) != 0;
+    }else if(suite->json_path != NULL && !bench_write_json(suite, suite->json_path)){
+        status = 1;
+    }
+    if(suite->counting){
+        perf_counters_close(&suite->counters);
+    }
+    free(suite);
+    return status;
+}
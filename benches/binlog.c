@@ -0,0 +1,96 @@
+///Times the call site of binlog against debug_log printing on the calling thread and against the async_log backend,
+///and prints p50/p99/p99.9 latency per call, and how many bytes each message costs on disk.
+///Text goes to /dev/null, so the text numbers are the formatting and the syscall, not a terminal or a disk.
+///Build: gcc -O2 -pthread -I../includes/includes binlog.c -o binlog -lm
+///Run:   ./binlog [calls] [binlog file]
+#include "bench.h"
+#include "debug.h"
+#include "async_log.h"
+#include "binlog.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+void bench_print(str name, u64* latencies, u32 calls, u64 timer_ns, double bytes){
+    bench_sort_u64s(latencies, calls);
+    double p50 = (double)bench_percentile(latencies, calls, 500);
+    double p99 = (double)bench_percentile(latencies, calls, 990);
+    double p999 = (double)bench_percentile(latencies, calls, 999);
+    printf("%-24s %-10.0f %-10.0f %-10.0f %-10.1f\n", name, p50 - timer_ns, p99 - timer_ns, p999 - timer_ns, bytes);
+}
+
+///Calls debug_log [calls] times, timing every call on its own
+void bench_text(u64* latencies, u32 calls){
+    for(u32 i = 0; i < calls; i++){
+        u64 start = bench_now_ns();
+        debug_log("bench", "request %d took %.3f ms from %s", i, i * 0.001, "10.0.0.1");
+        latencies[i] = bench_now_ns() - start;
+    }
+}
+
+///The same message as bench_text, into [log]
+void bench_binlog(binlog* log, u64* latencies, u32 calls){
+    for(u32 i = 0; i < calls; i++){
+        u64 start = bench_now_ns();
+        BINLOG_INFO(log, "request %d took %.3f ms from %s", i, i * 0.001, "10.0.0.1");
+        latencies[i] = bench_now_ns() - start;
+    }
+}
+
+int main(int argc, char** argv){
+    u32 calls = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+    str path = argc > 2 ? argv[2] : "bench.binlog";
+    u64* latencies = malloc(sizeof(u64) * calls);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    ///What two clock reads in a row cost, taken off every number below
+    for(u32 i = 0; i < calls; i++){
+        u64 start = bench_now_ns();
+        latencies[i] = bench_now_ns() - start;
+    }
+    bench_sort_u64s(latencies, calls);
+    u64 timer_ns = bench_percentile(latencies, calls, 500);
+
+    ///What one line of text takes, which is every line give or take a digit
+    char line[256];
+    double text_bytes = snprintf(line, sizeof(line), "[%s][%s]: request %d took %.3f ms from %s\n",
+        clock_date_string(clock_now_real_ns(), 6), "bench", calls / 2, calls / 2 * 0.001, "10.0.0.1");
+
+    printf("%u calls, ns per call with %llu ns of timing overhead taken off\n", calls, (unsigned long long)timer_ns);
+    printf("%-24s %-10s %-10s %-10s %-10s\n", "", "p50", "p99", "p99.9", "bytes/msg");
+
+    ///Synchronous debug_log, with stdout pointed at /dev/null for the run
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    bench_text(latencies, calls);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    bench_print("debug_log (sync)", latencies, calls, timer_ns, text_bytes);
+
+    async_log* async = async_log_init(null_fd, ASYNC_LOG_BLOCK);
+    debug_log_set_backend(async);
+    bench_text(latencies, calls);
+    async_log_flush(async);
+    debug_log_set_backend(NULL);
+    async_log_deinit(async);
+    bench_print("async_log (block)", latencies, calls, timer_ns, text_bytes);
+
+    binlog* log = binlog_open(path);
+    if(log == NULL){
+        exit(1);
+    }
+    bench_binlog(log, latencies, calls);
+    if(binlog_dropped(log) != 0){
+        printf("binlog dropped %llu messages!\n", (unsigned long long)binlog_dropped(log));
+        exit(1);
+    }
+    binlog_close(log);
+    struct stat info;
+    stat(path, &info);
+    bench_print("binlog", latencies, calls, timer_ns, (double)info.st_size / calls);
+
+    close(null_fd);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,159 @@
+///Times the SPSC channel between two pinned threads: throughput one element and a batch at a time,
+///and round trip latency ping-ponging over a pair of channels.
+///Build: gcc -O2 -pthread -I../includes/includes channel.c -o channel -lm
+///Run:   ./channel [elements] [round_trips]
+#define _GNU_SOURCE
+#include "bench.h"
+#include "channel.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define BENCH_SLOTS 4096
+#define BENCH_BATCH 64
+
+///Pins the calling thread to [cpu], wrapped around the cpus there are
+void bench_pin(u32 cpu){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (cpus > 0 ? (u32)cpus : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+channel* bench_create(){
+    deque_result created = deque_create_heap(sizeof(u64), BENCH_SLOTS, false);
+    return channel_init(created.data);
+}
+
+void bench_destroy(channel* chan){
+    deque_destroy(chan->deque);
+    channel_deinit(chan);
+}
+
+typedef struct{
+    channel* chan;
+    channel* reply;
+    u64 count;
+    bool batch;
+} bench_consumer;
+
+void* bench_consume(void* arg){
+    bench_consumer* consumer = arg;
+    bench_pin(1);
+    u64 expected = 0;
+    if(consumer->batch){
+        while(expected < consumer->count){
+            u32 available;
+            u64* slots = channel_peek(consumer->chan, BENCH_BATCH, &available);
+            if(slots == NULL){
+                channel_wait_readable(consumer->chan);
+                continue;
+            }
+            for(u32 i = 0; i < available; i++){
+                if(slots[i] != expected++){
+                    printf("batch lost order at %llu!\n", (unsigned long long)expected);
+                    exit(1);
+                }
+            }
+            channel_consume(consumer->chan, available);
+        }
+    }else{
+        u64 value;
+        while(channel_recv_wait(consumer->chan, &value)){
+            if(value != expected++){
+                printf("lost order at %llu!\n", (unsigned long long)expected);
+                exit(1);
+            }
+        }
+    }
+    return NULL;
+}
+
+///Sends [count] elements to a consumer thread and returns millions of elements per second
+double bench_throughput(u64 count, bool batch){
+    channel* chan = bench_create();
+    bench_consumer consumer = { chan, NULL, count, batch };
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_consume, &consumer);
+    bench_pin(0);
+    u64 start = bench_now_ns();
+    if(batch){
+        u64 next = 0;
+        while(next < count){
+            u32 wanted = count - next < BENCH_BATCH ? (u32)(count - next) : BENCH_BATCH;
+            u32 reserved;
+            ///Write straight into the slots, then publish them all with one store
+            u64* slots = channel_reserve(chan, wanted, &reserved);
+            if(slots == NULL){
+                channel_wait_writable(chan);
+                continue;
+            }
+            for(u32 i = 0; i < reserved; i++){
+                slots[i] = next++;
+            }
+            channel_commit(chan, reserved);
+        }
+    }else{
+        for(u64 i = 0; i < count; i++){
+            channel_send_wait(chan, &i);
+        }
+        channel_close(chan);
+    }
+    pthread_join(thread, NULL);
+    double seconds = (bench_now_ns() - start) / 1e9;
+    bench_destroy(chan);
+    return count / seconds / 1e6;
+}
+
+void* bench_echo(void* arg){
+    bench_consumer* echo = arg;
+    bench_pin(1);
+    u64 value;
+    while(channel_recv_wait(echo->chan, &value)){
+        channel_send_wait(echo->reply, &value);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv){
+    u64 count = argc > 1 ? (u64)atoll(argv[1]) : 20000000;
+    u32 round_trips = argc > 2 ? (u32)atoi(argv[2]) : 100000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus < 2){
+        printf("NOTE: only %ld cpu online, so both threads share it and every handoff parks\n", cpus);
+    }
+
+    printf("%llu u64 elements through %u slots\n", (unsigned long long)count, BENCH_SLOTS);
+    printf("%-28s %10.2f M/s\n", "send_wait/recv_wait", bench_throughput(count, false));
+    printf("%-28s %10.2f M/s\n", "reserve/commit, batch of 64", bench_throughput(count, true));
+
+    channel* ping = bench_create();
+    channel* pong = bench_create();
+    bench_consumer echo = { ping, pong, 0, false };
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_echo, &echo);
+    bench_pin(0);
+    u64* samples = malloc(sizeof(u64) * round_trips);
+    for(u32 i = 0; i < round_trips; i++){
+        u64 value = i;
+        u64 start = bench_now_ns();
+        channel_send_wait(ping, &value);
+        channel_recv_wait(pong, &value);
+        samples[i] = bench_now_ns() - start;
+    }
+    channel_close(ping);
+    pthread_join(thread, NULL);
+    bench_sort_u64s(samples, round_trips);
+    printf("\nround trip over %u ping-pongs (ns)\n", round_trips);
+    printf("%-8s %-8s %-8s %-8s %-8s\n", "min", "p50", "p99", "p99.9", "max");
+    printf("%-8llu %-8llu %-8llu %-8llu %-8llu\n",
+        (unsigned long long)samples[0],
+        (unsigned long long)bench_percentile(samples, round_trips, 500),
+        (unsigned long long)bench_percentile(samples, round_trips, 990),
+        (unsigned long long)bench_percentile(samples, round_trips, 999),
+        (unsigned long long)samples[round_trips - 1]);
+    free(samples);
+    bench_destroy(ping);
+    bench_destroy(pong);
+    return 0;
+}
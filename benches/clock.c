@@ -0,0 +1,78 @@
+///Times the ways of getting a timestamp and the ways of printing one, in ns per call, through bench.h:
+///the vDSO clocks against the coarse ones and the TSC, and the old time + localtime + asctime against the cached date text.
+///Build: gcc -O2 -pthread -I../includes/includes clock.c -o clock -lm
+///Run:   ./clock [--reps N] [--warmup N] [--filter text] [--json out.json] [--counters]
+///       ./clock --compare old.json new.json [--threshold percent]
+#include "bench.h"
+#include "timestr.h"
+
+///How many reads a case times per run
+#define BENCH_CALLS 1000000
+
+///Keeps the reads from being optimized out
+volatile u64 bench_sink;
+
+///Where clock_date_string starts from, so every call of it formats a different microsecond
+u64 bench_date_base;
+
+///A body that sums [expression] over [ops] calls, with [i] counting them
+#define BENCH_READ(name, expression) \
+void name(void* context, u32 size, u32 ops){ \
+    (void)context; \
+    (void)size; \
+    u64 sum = 0; \
+    for(u32 i = 0; i < ops; i++){ \
+        sum += (u64)(expression); \
+    } \
+    bench_sink = sum; \
+}
+
+///What get_now_time_string used to do on every call
+str bench_asctime(){
+    time_t now = time(NULL);
+    return asctime(localtime(&now));
+}
+
+BENCH_READ(bench_clock_mono_ns, clock_mono_ns())
+BENCH_READ(bench_clock_real_ns, clock_real_ns())
+BENCH_READ(bench_clock_coarse_real_ns, clock_coarse_real_ns())
+BENCH_READ(bench_clock_tsc, clock_tsc())
+BENCH_READ(bench_clock_now_real_ns, clock_now_real_ns())
+BENCH_READ(bench_clock_date_string, clock_date_string(bench_date_base + (u64)i * 1000, 6)[20])
+BENCH_READ(bench_get_now_time_string, get_now_time_string()[0])
+BENCH_READ(bench_old_time_string, bench_asctime()[0])
+
+int main(int argc, char** argv){
+    clock_init();
+
+    ///The counter turned into wall time has to stay with CLOCK_REALTIME
+    i64 worst = 0;
+    for(u32 i = 0; i < 1000; i++){
+        u64 before = clock_real_ns();
+        u64 now = clock_now_real_ns();
+        u64 after = clock_real_ns();
+        i64 off = now < before ? (i64)(now - before) : now > after ? (i64)(now - after) : 0;
+        worst = llabs(off) > llabs(worst) ? off : worst;
+    }
+    if(llabs(worst) > 1000000){
+        printf("the counter is %lld ns off CLOCK_REALTIME!\n", (long long)worst);
+        exit(1);
+    }
+    printf("%s, worst %lld ns off CLOCK_REALTIME\n", clock_has_tsc ? "invariant TSC" : "no invariant TSC", (long long)worst);
+
+    bench_suite* suite = bench_init(argc, argv);
+    if(suite == NULL){
+        return 1;
+    }
+    bench_date_base = clock_real_ns();
+    bench_case(suite, "clock_mono_ns", 0, BENCH_CALLS, NULL, bench_clock_mono_ns, NULL, NULL);
+    bench_case(suite, "clock_real_ns", 0, BENCH_CALLS, NULL, bench_clock_real_ns, NULL, NULL);
+    bench_case(suite, "clock_coarse_real_ns", 0, BENCH_CALLS, NULL, bench_clock_coarse_real_ns, NULL, NULL);
+    bench_case(suite, "clock_tsc", 0, BENCH_CALLS, NULL, bench_clock_tsc, NULL, NULL);
+    bench_case(suite, "clock_now_real_ns", 0, BENCH_CALLS, NULL, bench_clock_now_real_ns, NULL, NULL);
+    bench_case(suite, "clock_date_string (us)", 0, BENCH_CALLS, NULL, bench_clock_date_string, NULL, NULL);
+    bench_case(suite, "get_now_time_string", 0, BENCH_CALLS, NULL, bench_get_now_time_string, NULL, NULL);
+    ///A hundred times slower than the rest
+    bench_case(suite, "time + localtime + asctime", 0, BENCH_CALLS / 100, NULL, bench_old_time_string, NULL, NULL);
+    return bench_finish(suite);
+}
@@ -0,0 +1,312 @@
+///Times the basic operations of the allocators and containers across data sizes, through bench.h,
+///so a change to any of them can be compared against the run before it.
+///Build: gcc -O2 -I../includes/includes containers.c -o containers -lm
+///Run:   ./containers [--reps N] [--warmup N] [--filter text] [--json out.json] [--counters]
+///       ./containers --compare old.json new.json [--threshold percent]
+#include "bench.h"
+#include "arena.h"
+#include "deque.h"
+#include "lifo.h"
+#include "list.h"
+#include "map.h"
+#include "string_store.h"
+
+///How many operations a case times per run, unless it's bounded by its size
+#define BENCH_OPS 10000
+///The deque's batch size
+#define BENCH_BATCH 64
+
+///Everything a case sets up, so the timed body only does the operations
+typedef struct{
+    arena_alloc* arena;
+    lazy_arena_alloc* lazy_arena;
+    lifo_alloc* queue;
+    deque_alloc* deque;
+    map* map;
+    list* list;
+    stack_alloc stack;
+    u8 data[4096];
+    ///Written to by every body, so the compiler can't throw the operations away
+    u64 sink;
+} bench_context;
+
+void bench_teardown_all(void* context){
+    bench_context* c = context;
+    if(c->arena != NULL){
+        arena_deinit(c->arena);
+    }
+    if(c->lazy_arena != NULL){
+        lazy_arena_deinit(c->lazy_arena);
+    }
+    if(c->queue != NULL){
+        queue_deinit(c->queue);
+    }
+    deque_destroy(c->deque);
+    c->arena = NULL;
+    c->lazy_arena = NULL;
+    c->queue = NULL;
+    c->deque = NULL;
+    c->map = NULL;
+    c->list = NULL;
+}
+
+void bench_arena_setup(void* context, u32 size){
+    bench_context* c = context;
+    c->arena = arena_init(BENCH_OPS * size);
+}
+
+void bench_arena_put(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        c->sink += (u64)arena_put(c->arena, c->data, size);
+    }
+}
+
+void bench_arena_reserve(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        c->sink += (u64)arena_reserve(c->arena, size);
+    }
+}
+
+void bench_lazy_arena_setup(void* context, u32 size){
+    (void)size;
+    bench_context* c = context;
+    c->lazy_arena = lazy_arena_init(64 * 1024);
+}
+
+///Puts at offsets walking through the arena, wrapping around before the end
+void bench_lazy_arena_put(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    u32 offset = 0;
+    for(u32 i = 0; i < ops; i++){
+        if(offset + size > c->lazy_arena->size){
+            offset = 0;
+        }
+        c->sink += (u64)lazy_arena_put(c->lazy_arena, offset, c->data, size);
+        offset += size;
+    }
+}
+
+///The stack is 4 KB, so it starts over whenever the next push wouldn't fit
+void bench_stack_push(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    c->stack = create_stack_alloc();
+    for(u32 i = 0; i < ops; i++){
+        if(c->stack.stack_ptr + size > sizeof(c->stack.data)){
+            c->stack.stack_ptr = 0;
+        }
+        c->sink += (u64)stack_push(&c->stack, c->data, size);
+    }
+}
+
+///Strings of [size] characters, with no conversions, so vsprintf copies them as they are.
+///The store lives in the stack allocator, so it starts over whenever the next one wouldn't fit.
+void bench_string_store_setup(void* context, u32 size){
+    bench_context* c = context;
+    memset(c->data, 'a', size);
+    c->data[size] = 0;
+}
+
+void bench_string_store_put(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    u32 needed = sizeof(string) + size;
+    c->stack = create_stack_alloc();
+    string_store* store = string_store_create(&c->stack);
+    for(u32 i = 0; i < ops; i++){
+        if(c->stack.stack_ptr + needed > sizeof(c->stack.data)){
+            c->stack = create_stack_alloc();
+            store = string_store_create(&c->stack);
+        }
+        c->sink += string_store_put(store, (str)c->data)->length;
+    }
+}
+
+///Appends [size] characters to a string with room for 4 KB, starting it over whenever it's full
+void bench_string_store_concat_str(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    c->stack = create_stack_alloc();
+    string* dest = string_store_alloc(string_store_create(&c->stack));
+    dest->data = c->stack.data + c->stack.stack_ptr;
+    u32 room = sizeof(c->stack.data) - c->stack.stack_ptr;
+    for(u32 i = 0; i < ops; i++){
+        if(dest->length + size > room){
+            dest->length = 0;
+        }
+        string_store_concat_str(dest, (str)c->data);
+        c->sink += dest->length;
+    }
+}
+
+///The same as bench_string_store_concat_str, from a string instead of a str
+void bench_string_store_concat(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    c->stack = create_stack_alloc();
+    string* dest = string_store_alloc(string_store_create(&c->stack));
+    dest->data = c->stack.data + c->stack.stack_ptr;
+    u32 room = sizeof(c->stack.data) - c->stack.stack_ptr;
+    string src = { size, (str)c->data };
+    for(u32 i = 0; i < ops; i++){
+        if(dest->length + size > room){
+            dest->length = 0;
+        }
+        string_store_concat(dest, &src);
+        c->sink += dest->length;
+    }
+}
+
+///Room for [size] u32 key-value pairs, with generous room for the entries around them
+void bench_map_setup(void* context, u32 size){
+    bench_context* c = context;
+    c->arena = arena_init(size * 256 + 4096);
+    c->map = create_map(c->arena);
+}
+
+void bench_map_put(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 key = 0; key < ops; key++){
+        u32 value = key * 3;
+        c->sink += (u64)map_put(c->map, &key, sizeof(u32), U32, &value, sizeof(u32), U32);
+    }
+}
+
+void bench_map_filled_setup(void* context, u32 size){
+    bench_map_setup(context, size);
+    bench_map_put(context, size, size);
+}
+
+///Gets every key in turn, so the lookups land evenly across the map
+void bench_map_get(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        u32 key = i % size;
+        c->sink += (u64)map_get(c->map, &key, U32, sizeof(u32), NULL);
+    }
+}
+
+void bench_list_setup(void* context, u32 size){
+    bench_context* c = context;
+    c->arena = arena_init(BENCH_OPS * (sizeof(list_entry) + sizeof(u64)) + size * (sizeof(list_entry) + sizeof(u64)) + 4096);
+    c->list = create_list(c->arena);
+}
+
+void bench_list_add(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u64 i = 0; i < ops; i++){
+        c->sink += (u64)list_add(c->list, &i, sizeof(u64));
+    }
+}
+
+void bench_list_filled_setup(void* context, u32 size){
+    bench_list_setup(context, size);
+    bench_list_add(context, size, size);
+}
+
+void bench_list_get(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        c->sink += *(u64*)list_get(c->list, i % size);
+    }
+}
+
+///Removes from the middle, which is the average walk
+void bench_list_remove(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        c->sink += (u64)list_remove(c->list, c->list->element_count / 2);
+    }
+}
+
+void bench_queue_setup(void* context, u32 size){
+    (void)size;
+    bench_context* c = context;
+    c->queue = queue_init_full(64 * 1024);
+}
+
+///Pops everything whenever the next push wouldn't fit
+void bench_queue_push(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        if(c->queue->queue_ptr + size > c->queue->size){
+            queue_pop(c->queue, c->queue->queue_ptr - sizeof(lifo_alloc));
+        }
+        c->sink += (u64)queue_push(c->queue, c->data, size);
+    }
+}
+
+void bench_deque_setup(void* context, u32 size){
+    bench_context* c = context;
+    c->deque = deque_create_heap(size, BENCH_OPS, false).data;
+}
+
+///A push then a pop, at the tail, so the deque stays near empty
+void bench_deque_tail(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        deque_push_tail(c->deque, c->data);
+        c->sink += deque_pop_tail(c->deque, c->data).tag;
+    }
+}
+
+///Pushes at the head and pops at the tail, so the deque is used as a queue
+void bench_deque_head(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        deque_push_head(c->deque, c->data);
+        c->sink += deque_pop_tail(c->deque, c->data).tag;
+    }
+}
+
+///BENCH_BATCH elements pushed and popped at once, timed per element
+void bench_deque_batch(void* context, u32 size, u32 ops){
+    bench_context* c = context;
+    u32 batch = sizeof(c->data) / size < BENCH_BATCH ? sizeof(c->data) / size : BENCH_BATCH;
+    for(u32 i = 0; i < ops; i += batch){
+        deque_push_tail_n(c->deque, c->data, batch);
+        c->sink += deque_pop_head_n(c->deque, c->data, batch).tag;
+    }
+}
+
+int main(int argc, char** argv){
+    bench_suite* suite = bench_init(argc, argv);
+    if(suite == NULL){
+        return 1;
+    }
+    bench_context* c = calloc(1, sizeof(bench_context));
+    u32 sizes[] = { 8, 64, 512 };
+    for(u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        u32 size = sizes[i];
+        bench_case(suite, "arena_put", size, BENCH_OPS, bench_arena_setup, bench_arena_put, bench_teardown_all, c);
+        bench_case(suite, "arena_reserve", size, BENCH_OPS, bench_arena_setup, bench_arena_reserve, bench_teardown_all, c);
+        bench_case(suite, "lazy_arena_put", size, BENCH_OPS, bench_lazy_arena_setup, bench_lazy_arena_put, bench_teardown_all, c);
+        bench_case(suite, "stack_push", size, BENCH_OPS, NULL, bench_stack_push, NULL, c);
+        bench_case(suite, "string_store_put", size, BENCH_OPS, bench_string_store_setup, bench_string_store_put, NULL, c);
+        bench_case(suite, "string_store_concat_str", size, BENCH_OPS, bench_string_store_setup, bench_string_store_concat_str, NULL, c);
+        bench_case(suite, "string_store_concat", size, BENCH_OPS, bench_string_store_setup, bench_string_store_concat, NULL, c);
+        bench_case(suite, "queue_push", size, BENCH_OPS, bench_queue_setup, bench_queue_push, bench_teardown_all, c);
+        bench_case(suite, "deque_push_pop_tail", size, BENCH_OPS, bench_deque_setup, bench_deque_tail, bench_teardown_all, c);
+        bench_case(suite, "deque_push_head_pop_tail", size, BENCH_OPS, bench_deque_setup, bench_deque_head, bench_teardown_all, c);
+        bench_case(suite, "deque_push_pop_n", size, BENCH_OPS, bench_deque_setup, bench_deque_batch, bench_teardown_all, c);
+    }
+    ///The map and the list walk their entries, so these sizes are how many entries there are
+    u32 counts[] = { 16, 256, 2048 };
+    for(u32 i = 0; i < sizeof(counts) / sizeof(counts[0]); i++){
+        u32 count = counts[i];
+        bench_case(suite, "map_put", count, count, bench_map_setup, bench_map_put, bench_teardown_all, c);
+        bench_case(suite, "map_get", count, BENCH_OPS / 10, bench_map_filled_setup, bench_map_get, bench_teardown_all, c);
+        bench_case(suite, "list_add", count, count, bench_list_setup, bench_list_add, bench_teardown_all, c);
+        bench_case(suite, "list_get", count, BENCH_OPS / 10, bench_list_filled_setup, bench_list_get, bench_teardown_all, c);
+        bench_case(suite, "list_remove", count, count / 2, bench_list_filled_setup, bench_list_remove, bench_teardown_all, c);
+    }
+    if(c->sink == 0 && suite->compare_old == NULL && suite->result_count > 0){
+        printf("Every operation came back empty!\n");
+        exit(1);
+    }
+    free(c);
+    return bench_finish(suite);
+}
@@ -0,0 +1,112 @@
+///Times deque_create, single and batch push/pop, and growth.
+///Build: gcc -O2 -I../includes/includes deque.c -o deque -lm
+///Run:   ./deque [elements]
+#include "bench.h"
+#include "deque.h"
+
+#define BENCH_CREATE_RUNS 100000
+#define BENCH_BATCH 64
+
+///Prints min, median, p99, p99.9 and max of [count] sorted latencies
+void bench_print_latency(const char* name, u64* samples, u32 count){
+    bench_sort_u64s(samples, count);
+    printf("%-34s %8llu %8llu %8llu %8llu %10llu\n", name,
+        (unsigned long long)samples[0],
+        (unsigned long long)bench_percentile(samples, count, 500),
+        (unsigned long long)bench_percentile(samples, count, 990),
+        (unsigned long long)bench_percentile(samples, count, 999),
+        (unsigned long long)samples[count - 1]);
+}
+
+///Pushes and pops [count] elements of [slot_size] through a deque of 1024 slots, one at a time or [batch] at a time,
+///and returns nanoseconds per element
+double bench_fifo(u32 slot_size, u32 count, u32 batch){
+    deque_result created = deque_create_heap(slot_size, 1024, false);
+    deque_alloc* deque = created.data;
+    u8* buffer = calloc(BENCH_BATCH, slot_size);
+    u64 start = bench_now_ns();
+    for(u32 i = 0; i < count; i += batch){
+        ///Keep the deque half full, so head and tail wrap around the ring as they chase each other
+        if(batch == 1){
+            buffer[0] = (u8)i;
+            deque_push_tail(deque, buffer);
+            if(deque_count(deque) > 512){
+                deque_pop_head(deque, buffer);
+            }
+        }else{
+            deque_push_tail_n(deque, buffer, batch);
+            if(deque_count(deque) > 512){
+                deque_pop_head_n(deque, buffer, batch);
+            }
+        }
+    }
+    double ns = (double)(bench_now_ns() - start) / count;
+    free(buffer);
+    deque_destroy(deque);
+    return ns;
+}
+
+int main(int argc, char** argv){
+    u32 count = argc > 1 ? (u32)atoi(argv[1]) : 10000000;
+    u64* samples = malloc(sizeof(u64) * BENCH_CREATE_RUNS);
+
+    ///TODO.md notes deque_create taking anywhere from 35 ms to 6 seconds. It used to copy
+    ///sizeof(deque_alloc) + size bytes out of a stack variable, and printed on every lazy_arena_put.
+    ///Now it only writes the header, so it should be flat no matter the capacity.
+    printf("%-34s %8s %8s %8s %8s %10s\n", "latency (ns)", "min", "p50", "p99", "p99.9", "max");
+    u32 capacities[] = { 64, 4096, 1 << 20 };
+    for(u32 c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++){
+        u32 capacity = capacities[c];
+        lazy_arena_alloc* arena = lazy_arena_init(sizeof(deque_alloc) + DEQUE_ALIGN + capacity * sizeof(u64));
+        for(u32 i = 0; i < BENCH_CREATE_RUNS; i++){
+            u64 start = bench_now_ns();
+            deque_result result = deque_create(arena, sizeof(u64), capacity);
+            samples[i] = bench_now_ns() - start;
+            if(result.tag != SUCCESS){
+                printf("deque_create failed with %i!\n", result.tag);
+                return 1;
+            }
+        }
+        lazy_arena_deinit(arena);
+        char name[64];
+        snprintf(name, sizeof(name), "deque_create %u slots", capacity);
+        bench_print_latency(name, samples, BENCH_CREATE_RUNS);
+    }
+    ///The arena and the deque together, which is what the TODO.md note was measuring
+    for(u32 i = 0; i < BENCH_CREATE_RUNS / 10; i++){
+        u64 start = bench_now_ns();
+        lazy_arena_alloc* arena = lazy_arena_init(sizeof(deque_alloc) + DEQUE_ALIGN + 4096 * sizeof(u64));
+        deque_create(arena, sizeof(u64), 4096);
+        samples[i] = bench_now_ns() - start;
+        lazy_arena_deinit(arena);
+    }
+    bench_print_latency("lazy_arena_init + deque_create", samples, BENCH_CREATE_RUNS / 10);
+
+    printf("\n%u elements through a half full deque\n", count);
+    printf("%-10s %-14s %-14s %-8s\n", "slot", "single ns/op", "batch ns/op", "speedup");
+    u32 slot_sizes[] = { 8, 64 };
+    for(u32 s = 0; s < 2; s++){
+        double single = bench_fifo(slot_sizes[s], count, 1);
+        double batch = bench_fifo(slot_sizes[s], count, BENCH_BATCH);
+        printf("%-10u %-14.2f %-14.2f %6.2fx\n", slot_sizes[s], single, batch, single / batch);
+    }
+
+    deque_result created = deque_create_heap(sizeof(u64), 2, true);
+    deque_alloc* deque = created.data;
+    u64 start = bench_now_ns();
+    for(u64 i = 0; i < count; i++){
+        deque_push_tail(deque, &i);
+    }
+    double grow = (double)(bench_now_ns() - start) / count;
+    for(u64 i = 0; i < count; i++){
+        u64 value;
+        if(deque_pop_head(deque, &value).tag != SUCCESS || value != i){
+            printf("growing deque lost order at %llu!\n", (unsigned long long)i);
+            return 1;
+        }
+    }
+    printf("\ngrowing from 2 to %u slots: %.2f ns/push\n", deque_capacity(deque), grow);
+    deque_destroy(deque);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,164 @@
+///Times the d-ary heap at arities 2, 4 and 8, with and without handles, against a plain binary heap,
+///pushing then popping, heapifying then popping, and decreasing keys, at 10^6 and 10^7 entries.
+///Build: gcc -O2 -I../includes/includes dheap.c -o dheap -lm
+///Run:   ./dheap [max_elements]
+#include "bench.h"
+#include "dheap.h"
+
+///The baseline: the textbook binary heap, with no handles to keep up to date
+typedef struct{
+    dheap_entry* entries;
+    u32 count;
+} binary_heap;
+
+void binary_push(binary_heap* heap, u64 key, u64 value){
+    u32 pos = heap->count++;
+    while(pos != 0){
+        u32 parent = (pos - 1) / 2;
+        if(heap->entries[parent].key <= key){
+            break;
+        }
+        heap->entries[pos] = heap->entries[parent];
+        pos = parent;
+    }
+    heap->entries[pos] = (dheap_entry){ key, value };
+}
+
+void binary_sift_down(binary_heap* heap, u32 pos){
+    dheap_entry entry = heap->entries[pos];
+    for(;;){
+        u32 child = pos * 2 + 1;
+        if(child >= heap->count){
+            break;
+        }
+        if(child + 1 < heap->count && heap->entries[child + 1].key < heap->entries[child].key){
+            child += 1;
+        }
+        if(heap->entries[child].key >= entry.key){
+            break;
+        }
+        heap->entries[pos] = heap->entries[child];
+        pos = child;
+    }
+    heap->entries[pos] = entry;
+}
+
+bool binary_pop(binary_heap* heap, u64* key){
+    if(heap->count == 0){
+        return false;
+    }
+    *key = heap->entries[0].key;
+    heap->count -= 1;
+    if(heap->count != 0){
+        heap->entries[0] = heap->entries[heap->count];
+        binary_sift_down(heap, 0);
+    }
+    return true;
+}
+
+void bench_check(u64 popped, u64 count, bool ordered, const char* what){
+    if(popped != count || !ordered){
+        printf("%s popped %llu of %llu, %s!\n", what, (unsigned long long)popped, (unsigned long long)count, ordered ? "in order" : "out of order");
+        exit(1);
+    }
+}
+
+typedef enum{ BENCH_PUSH_POP, BENCH_HEAPIFY_POP, BENCH_DECREASE_KEY, BENCH_KIND_COUNT } bench_kind;
+const char* bench_names[BENCH_KIND_COUNT] = { "push + pop", "heapify + pop", "decrease-key + pop" };
+
+///Runs one workload on the binary heap, or a d-ary heap when [arity] isn't 0, and returns ns per entry,
+///or 0 if the heap can't do it
+double bench_run(bench_kind kind, u32 arity, bool tracked, u64* keys, u32 count){
+    u64 start = bench_now_ns();
+    u64 popped = 0;
+    u64 previous = 0;
+    bool ordered = true;
+    u64 key = 0;
+    u64 value = 0;
+    if(kind == BENCH_DECREASE_KEY && (arity == 0 || !tracked)){
+        return 0;
+    }
+    if(arity == 0){
+        binary_heap heap = { malloc(sizeof(dheap_entry) * count), 0 };
+        start = bench_now_ns();
+        if(kind == BENCH_PUSH_POP){
+            for(u32 i = 0; i < count; i++){
+                binary_push(&heap, keys[i], i);
+            }
+        }else{
+            for(u32 i = 0; i < count; i++){
+                heap.entries[i] = (dheap_entry){ keys[i], i };
+            }
+            heap.count = count;
+            for(u32 pos = count / 2; pos-- > 0;){
+                binary_sift_down(&heap, pos);
+            }
+        }
+        while(binary_pop(&heap, &key)){
+            ordered &= key >= previous;
+            previous = key;
+            popped += 1;
+        }
+        double ns = (double)(bench_now_ns() - start) / count;
+        free(heap.entries);
+        bench_check(popped, count, ordered, "binary heap");
+        return ns;
+    }
+    dheap heap = create_dheap(NULL, arity, count, tracked);
+    start = bench_now_ns();
+    if(kind == BENCH_HEAPIFY_POP){
+        dheap_heapify(&heap, keys, NULL, count, NULL);
+    }else{
+        for(u32 i = 0; i < count; i++){
+            dheap_push(&heap, keys[i], i);
+        }
+    }
+    if(kind == BENCH_DECREASE_KEY){
+        ///Handles come out in push order, so handle i holds keys[i]. Halve the key of a random one, count times.
+        for(u32 i = 0; i < count; i++){
+            u32 handle = (u32)(bench_random() % count);
+            dheap_get(&heap, handle, &key, &value);
+            dheap_update_key(&heap, handle, key / 2);
+        }
+    }
+    while(dheap_pop(&heap, &key, &value)){
+        ordered &= key >= previous;
+        previous = key;
+        popped += 1;
+    }
+    double ns = (double)(bench_now_ns() - start) / count;
+    dheap_deinit(&heap);
+    bench_check(popped, count, ordered, "d-ary heap");
+    return ns;
+}
+
+int main(int argc, char** argv){
+    u32 max_count = argc > 1 ? (u32)atoi(argv[1]) : 10000000;
+    u64* keys = malloc(sizeof(u64) * max_count);
+    for(u32 count = 1000000; count <= max_count; count *= 10){
+        for(u32 i = 0; i < count; i++){
+            keys[i] = bench_random();
+        }
+        printf("\n%u entries, ns per entry, with handles | without\n", count);
+        printf("%-20s %-8s | %-8s %-8s %-8s | %-8s %-8s %-8s\n", "", "binary", "d=2", "d=4", "d=8", "d=2", "d=4", "d=8");
+        for(bench_kind kind = 0; kind < BENCH_KIND_COUNT; kind++){
+            printf("%-20s", bench_names[kind]);
+            for(u32 column = 0; column < 7; column++){
+                u32 arity = column == 0 ? 0 : 1u << ((column - 1) % 3 + 1);
+                double ns = bench_run(kind, arity, column <= 3, keys, count);
+                printf(column == 1 || column == 4 ? " | " : " ");
+                if(ns == 0){
+                    printf("%-8s", "-");
+                }else{
+                    printf("%-8.1f", ns);
+                }
+            }
+            printf("\n");
+        }
+        if(count > max_count / 10){
+            break;
+        }
+    }
+    free(keys);
+    return 0;
+}
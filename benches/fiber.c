@@ -0,0 +1,140 @@
+///Times fiber context switches against a round trip between two threads, then ping-pong throughput
+///between pairs of fibers over channels, with 100k fibers by default, from 1 worker thread up to one per cpu.
+///Build: gcc -O2 -pthread -I../includes/includes fiber.c -o fiber -lm
+///Run:   ./fiber [fibers] [round_trips_per_pair] [max_threads]
+#include "bench.h"
+#include "fiber.h"
+#include "channel.h"
+
+#define BENCH_YIELDS 1000000
+#define BENCH_THREAD_ROUND_TRIPS 100000
+///Ping-pong fibers get small stacks, since a hundred thousand of them at 64 KiB is a lot of address space
+#define BENCH_STACK_SIZE (16 * 1024)
+
+void bench_yielder(fiber* self, void* arg){
+    (void)arg;
+    for(u32 i = 0; i < BENCH_YIELDS; i++){
+        fiber_yield(self);
+    }
+}
+
+typedef struct{
+    fiber_chan* in;
+    fiber_chan* out;
+    u32 round_trips;
+    u64 sum;
+} bench_pair;
+
+void bench_ping(fiber* self, void* arg){
+    bench_pair* pair = (bench_pair*)arg;
+    u64 value = 0;
+    for(u32 i = 0; i < pair->round_trips; i++){
+        fiber_send(self, pair->out, &value);
+        fiber_recv(self, pair->in, &value);
+    }
+    pair->sum = value;
+    fiber_chan_close(pair->out);
+}
+
+void bench_pong(fiber* self, void* arg){
+    bench_pair* pair = (bench_pair*)arg;
+    u64 value;
+    while(fiber_recv(self, pair->in, &value)){
+        value += 1;
+        fiber_send(self, pair->out, &value);
+    }
+}
+
+///Moves [round_trips] messages each way between every pair of [fibers] / 2 pairs on [threads] workers,
+///and returns nanoseconds per message
+double bench_ping_pong(u32 fibers, u32 round_trips, u32 threads, u32 capacity){
+    u32 pairs = fibers / 2;
+    fiber_sched* sched = fiber_sched_init(threads, pairs * 2, BENCH_STACK_SIZE);
+    bench_pair* state = calloc((size_t)pairs * 2, sizeof(bench_pair));
+    fiber_chan** chans = calloc((size_t)pairs * 2, sizeof(fiber_chan*));
+    for(u32 i = 0; i < pairs; i++){
+        chans[i * 2] = fiber_chan_init(sched, sizeof(u64), capacity);
+        chans[i * 2 + 1] = fiber_chan_init(sched, sizeof(u64), capacity);
+        state[i * 2] = (bench_pair){ chans[i * 2 + 1], chans[i * 2], round_trips, 0 };
+        state[i * 2 + 1] = (bench_pair){ chans[i * 2], chans[i * 2 + 1], 0, 0 };
+        fiber_spawn(sched, bench_ping, &state[i * 2]);
+        fiber_spawn(sched, bench_pong, &state[i * 2 + 1]);
+    }
+    u64 start = bench_now_ns();
+    fiber_sched_run(sched);
+    u64 elapsed = bench_now_ns() - start;
+    for(u32 i = 0; i < pairs; i++){
+        if(state[i * 2].sum != round_trips){
+            printf("pair %u only made %llu of %u round trips!\n", i, (unsigned long long)state[i * 2].sum, round_trips);
+            exit(1);
+        }
+        fiber_chan_deinit(chans[i * 2]);
+        fiber_chan_deinit(chans[i * 2 + 1]);
+    }
+    free(chans);
+    free(state);
+    fiber_sched_deinit(sched);
+    return (double)elapsed / ((double)pairs * round_trips * 2);
+}
+
+channel* bench_thread_ping;
+channel* bench_thread_pong;
+
+void* bench_thread_echo(void* arg){
+    (void)arg;
+    u64 value;
+    while(channel_recv_wait(bench_thread_ping, &value)){
+        channel_send_wait(bench_thread_pong, &value);
+    }
+    return NULL;
+}
+
+channel* bench_thread_channel(){
+    deque_result created = deque_create_heap(sizeof(u64), 64, false);
+    return channel_init(created.data);
+}
+
+int main(int argc, char** argv){
+    u32 fibers = argc > 1 ? (u32)atoi(argv[1]) : 100000;
+    u32 round_trips = argc > 2 ? (u32)atoi(argv[2]) : 20;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_threads = argc > 3 ? (u32)atoi(argv[3]) : (cpus > 0 ? (u32)cpus : 1);
+
+    ///Two fibers yielding to each other on one thread, so every yield is a switch out to the scheduler and one into the other fiber
+    fiber_sched* sched = fiber_sched_init(1, 2, 0);
+    fiber_spawn(sched, bench_yielder, NULL);
+    fiber_spawn(sched, bench_yielder, NULL);
+    u64 start = bench_now_ns();
+    fiber_sched_run(sched);
+    double per_yield = (double)(bench_now_ns() - start) / (BENCH_YIELDS * 2.0);
+    fiber_sched_deinit(sched);
+
+    bench_thread_ping = bench_thread_channel();
+    bench_thread_pong = bench_thread_channel();
+    pthread_t echo;
+    pthread_create(&echo, NULL, bench_thread_echo, NULL);
+    start = bench_now_ns();
+    for(u64 i = 0; i < BENCH_THREAD_ROUND_TRIPS; i++){
+        u64 value = i;
+        channel_send_wait(bench_thread_ping, &value);
+        channel_recv_wait(bench_thread_pong, &value);
+    }
+    double per_thread_message = (double)(bench_now_ns() - start) / (BENCH_THREAD_ROUND_TRIPS * 2.0);
+    channel_close(bench_thread_ping);
+    pthread_join(echo, NULL);
+
+    printf("%-44s %10.1f ns\n", "fiber yield (switch out and back in)", per_yield);
+    printf("%-44s %10.1f ns\n", "message between two threads (channel.h)", per_thread_message);
+
+    printf("\n%u fibers ping-ponging %u round trips per pair\n", fibers, round_trips);
+    printf("%-8s %-22s %-22s %-12s\n", "threads", "unbuffered ns/msg", "buffered(1) ns/msg", "M msg/s");
+    for(u32 threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2){
+        double unbuffered = bench_ping_pong(fibers, round_trips, threads, 0);
+        double buffered = bench_ping_pong(fibers, round_trips, threads, 1);
+        printf("%-8u %-22.1f %-22.1f %-12.2f\n", threads, unbuffered, buffered, 1e3 / unbuffered);
+        if(threads == max_threads){
+            break;
+        }
+    }
+    return 0;
+}
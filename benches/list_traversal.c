@@ -0,0 +1,95 @@
+///Compares walking a list against walking an unrolled_list of the same elements, through bench.h,
+///with 8 and 64 byte elements. The size of a case is how many elements there are, and its time is per element.
+///Build: gcc -O2 -I../includes/includes list_traversal.c -o list_traversal -lm
+///Run:   ./list_traversal [--reps N] [--warmup N] [--filter text] [--json out.json] [--counters]
+///       ./list_traversal --compare old.json new.json [--threshold percent]
+#include "bench.h"
+#include "list.h"
+#include "unrolled_list.h"
+#include <stdlib.h>
+
+///The most elements a list is walked at, which is well past every cache
+#define BENCH_MAX_ELEMENTS (1024 * 1024)
+
+///Both lists hold the same elements, so walking either sums to the same
+typedef struct{
+    list* list;
+    unrolled_list* unrolled;
+    ///Written to by every walk, so the compiler can't throw them away
+    u64 sink;
+} bench_context;
+
+///Sums the first 8 bytes of every element so the walk can't be optimized away
+u64 bench_walk_list(list* _list){
+    u64 sum = 0;
+    list_iter iter = create_list_iter(_list);
+    list_entry* next = list_iter_next(&iter);
+    while(next != NULL){
+        sum += *(u64*)next->data;
+        next = list_iter_next(&iter);
+    }
+    return sum;
+}
+
+u64 bench_walk_unrolled(unrolled_list* _list){
+    u64 sum = 0;
+    unrolled_list_iter iter = create_unrolled_list_iter(_list);
+    unrolled_entry* next = unrolled_list_iter_next(&iter);
+    while(next != NULL){
+        sum += *(u64*)next->data;
+        next = unrolled_list_iter_next(&iter);
+    }
+    return sum;
+}
+
+void bench_list_walk(void* context, u32 size, u32 ops){
+    (void)size;
+    (void)ops;
+    bench_context* c = context;
+    c->sink += bench_walk_list(c->list);
+}
+
+void bench_unrolled_walk(void* context, u32 size, u32 ops){
+    (void)size;
+    (void)ops;
+    bench_context* c = context;
+    c->sink += bench_walk_unrolled(c->unrolled);
+}
+
+int main(int argc, char** argv){
+    bench_suite* suite = bench_init(argc, argv);
+    if(suite == NULL){
+        return 1;
+    }
+    ///Filling the lists takes longer than walking them, so it's done once for both and not per run
+    u32 element_sizes[] = { sizeof(u64), 64 };
+    for(u32 i = 0; i < sizeof(element_sizes) / sizeof(element_sizes[0]) && suite->compare_old == NULL; i++){
+        u32 element_size = element_sizes[i];
+        u8* element = calloc(1, element_size);
+        char list_name[64];
+        char unrolled_name[64];
+        snprintf(list_name, sizeof(list_name), "list_walk_%uB", element_size);
+        snprintf(unrolled_name, sizeof(unrolled_name), "unrolled_list_walk_%uB", element_size);
+        for(u32 count = 1000; count <= BENCH_MAX_ELEMENTS; count *= 4){
+            u32 arena_size = (u32)((u64)count * (element_size + 64) + (1u << 20));
+            arena_alloc* list_arena = arena_init(arena_size);
+            arena_alloc* unrolled_arena = arena_init(arena_size);
+            bench_context c = { create_list(list_arena), create_unrolled_list(unrolled_arena), 0 };
+            for(u64 value = 0; value < count; value++){
+                memcpy(element, &value, sizeof(u64));
+                list_add(c.list, element, element_size);
+                unrolled_list_add(c.unrolled, element, element_size);
+            }
+            if(bench_walk_list(c.list) != bench_walk_unrolled(c.unrolled)){
+                printf("list and unrolled list disagree!\n");
+                return 1;
+            }
+            bench_case(suite, list_name, count, count, NULL, bench_list_walk, NULL, &c);
+            bench_case(suite, unrolled_name, count, count, NULL, bench_unrolled_walk, NULL, &c);
+            arena_deinit(list_arena);
+            arena_deinit(unrolled_arena);
+        }
+        free(element);
+    }
+    return bench_finish(suite);
+}
@@ -0,0 +1,101 @@
+///Times recording into metrics.h's counters, gauges and histograms against one shared atomic counter,
+///from 1 thread and from several, in ns per record, then prints the histogram of the run's own record latencies.
+///Build: gcc -O2 -pthread -I../includes/includes metrics.c -o metrics -lm
+///Run:   ./metrics [records per thread] [threads]
+#include "bench.h"
+#include "metrics.h"
+
+typedef enum{
+    BENCH_SHARED_ATOMIC,
+    BENCH_COUNTER,
+    BENCH_GAUGE,
+    BENCH_HISTOGRAM,
+    BENCH_KINDS,
+} bench_kind;
+
+str bench_names[BENCH_KINDS] = { "shared atomic add", "metrics_counter_add", "metrics_gauge_add", "metrics_histogram_record" };
+
+_Atomic u64 bench_shared = 0;
+metrics_counter* bench_counter;
+metrics_gauge* bench_gauge;
+metrics_histogram* bench_histogram;
+u32 bench_records;
+bench_kind bench_running;
+
+void* bench_thread(void* arg){
+    (void)arg;
+    switch(bench_running){
+        case BENCH_SHARED_ATOMIC:
+            for(u32 i = 0; i < bench_records; i++){
+                atomic_fetch_add_explicit(&bench_shared, 1, memory_order_relaxed);
+            }
+            break;
+        case BENCH_COUNTER:
+            for(u32 i = 0; i < bench_records; i++){
+                metrics_counter_add(bench_counter, 1);
+            }
+            break;
+        case BENCH_GAUGE:
+            for(u32 i = 0; i < bench_records; i++){
+                metrics_gauge_add(bench_gauge, i & 1 ? 1 : -1);
+            }
+            break;
+        default:
+            for(u32 i = 0; i < bench_records; i++){
+                metrics_histogram_record(bench_histogram, i);
+            }
+            break;
+    }
+    return NULL;
+}
+
+///Runs [kind] on [threads] threads and gives back ns per record, counting every thread's records
+double bench_run(bench_kind kind, u32 threads){
+    bench_running = kind;
+    pthread_t ids[64];
+    u64 start = bench_now_ns();
+    for(u32 i = 0; i < threads; i++){
+        pthread_create(&ids[i], NULL, bench_thread, NULL);
+    }
+    for(u32 i = 0; i < threads; i++){
+        pthread_join(ids[i], NULL);
+    }
+    return (double)(bench_now_ns() - start) / ((double)bench_records * threads);
+}
+
+int main(int argc, char** argv){
+    bench_records = argc > 1 ? (u32)atoi(argv[1]) : 10000000;
+    u32 threads = argc > 2 ? (u32)atoi(argv[2]) : 4;
+    if(threads > 64){
+        threads = 64;
+    }
+    bench_counter = metrics_counter_create("bench.counter");
+    bench_gauge = metrics_gauge_create("bench.gauge");
+    bench_histogram = metrics_histogram_create("bench.histogram", 7);
+    metrics_histogram* latency = metrics_histogram_create("bench.record_ns", 7);
+
+    printf("%u records per thread, ns per record\n", bench_records);
+    printf("%-26s %-10s %-10s\n", "", "1 thread", "threads");
+    for(u32 kind = 0; kind < BENCH_KINDS; kind++){
+        double one = bench_run(kind, 1);
+        double many = bench_run(kind, threads);
+        printf("%-26s %-10.2f %-10.2f\n", bench_names[kind], one, many);
+    }
+    u64 expected = (u64)bench_records * (1 + threads);
+    metrics_snapshot snapshot = metrics_histogram_read(bench_histogram);
+    if(metrics_counter_read(bench_counter) != expected || metrics_gauge_read(bench_gauge) != 0 || snapshot.count != expected){
+        printf("metrics lost records!\n");
+        exit(1);
+    }
+    metrics_snapshot_free(&snapshot);
+
+    ///What a single histogram record costs, timed one by one, recorded into a histogram of its own
+    for(u32 i = 0; i < 1000000; i++){
+        u64 start = bench_now_ns();
+        metrics_histogram_record(bench_histogram, i);
+        metrics_histogram_record(latency, bench_now_ns() - start);
+    }
+    printf("\n");
+    metrics_export_text(stdout);
+    return 0;
+}
@@ -0,0 +1,189 @@
+///Times the MPMC queue against a mutex+condvar ring, from 1 producer and 1 consumer up to N of each.
+///Build: gcc -O2 -pthread -I../includes/includes mpmc.c -o mpmc -lm
+///Run:   ./mpmc [elements] [max_threads_per_side]
+#include "bench.h"
+#include "mpmc.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define BENCH_SLOTS 1024
+#define BENCH_BATCH 32
+
+///The baseline: a bounded ring behind one mutex, with a condvar for each of not full and not empty
+typedef struct{
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+    u64 slots[BENCH_SLOTS];
+    u32 head;
+    u32 tail;
+    bool closed;
+} locked_queue;
+
+void locked_push(locked_queue* queue, u64 value){
+    pthread_mutex_lock(&queue->lock);
+    while(queue->tail - queue->head == BENCH_SLOTS){
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->slots[queue->tail % BENCH_SLOTS] = value;
+    queue->tail += 1;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool locked_pop(locked_queue* queue, u64* value){
+    pthread_mutex_lock(&queue->lock);
+    while(queue->tail == queue->head && !queue->closed){
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    bool popped = queue->tail != queue->head;
+    if(popped){
+        *value = queue->slots[queue->head % BENCH_SLOTS];
+        queue->head += 1;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return popped;
+}
+
+void locked_close(locked_queue* queue){
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+typedef enum{ BENCH_LOCKED, BENCH_MPMC, BENCH_MPMC_BATCH } bench_kind;
+
+typedef struct{
+    bench_kind kind;
+    locked_queue* locked;
+    mpmc_queue* queue;
+    u64 first;
+    u64 count;
+    u64 sum;
+} bench_thread;
+
+void* bench_produce(void* arg){
+    bench_thread* thread = arg;
+    u64 end = thread->first + thread->count;
+    if(thread->kind == BENCH_LOCKED){
+        for(u64 i = thread->first; i < end; i++){
+            locked_push(thread->locked, i);
+        }
+    }else if(thread->kind == BENCH_MPMC){
+        for(u64 i = thread->first; i < end; i++){
+            mpmc_push_wait(thread->queue, &i);
+        }
+    }else{
+        u64 batch[BENCH_BATCH];
+        for(u64 i = thread->first; i < end;){
+            u32 count = 0;
+            while(count < BENCH_BATCH && i < end){
+                batch[count++] = i++;
+            }
+            mpmc_push_wait_n(thread->queue, batch, count);
+        }
+    }
+    return NULL;
+}
+
+void* bench_consume(void* arg){
+    bench_thread* thread = arg;
+    u64 sum = 0;
+    if(thread->kind == BENCH_LOCKED){
+        u64 value;
+        while(locked_pop(thread->locked, &value)){
+            sum += value;
+        }
+    }else if(thread->kind == BENCH_MPMC){
+        u64 value;
+        while(mpmc_pop_wait(thread->queue, &value)){
+            sum += value;
+        }
+    }else{
+        u64 batch[BENCH_BATCH];
+        u32 popped;
+        while((popped = mpmc_pop_wait_n(thread->queue, batch, BENCH_BATCH)) != 0){
+            for(u32 i = 0; i < popped; i++){
+                sum += batch[i];
+            }
+        }
+    }
+    thread->sum = sum;
+    return NULL;
+}
+
+///Runs [threads] producers and [threads] consumers moving [count] elements in total, and returns millions per second
+double bench_run(bench_kind kind, u32 threads, u64 count){
+    locked_queue* locked = NULL;
+    lazy_arena_alloc* arena = NULL;
+    mpmc_queue* queue = NULL;
+    if(kind == BENCH_LOCKED){
+        locked = calloc(1, sizeof(locked_queue));
+        pthread_mutex_init(&locked->lock, NULL);
+        pthread_cond_init(&locked->not_full, NULL);
+        pthread_cond_init(&locked->not_empty, NULL);
+    }else{
+        arena = lazy_arena_init(mpmc_arena_size(sizeof(u64), BENCH_SLOTS));
+        queue = mpmc_create(arena, sizeof(u64), BENCH_SLOTS);
+    }
+    pthread_t* handles = malloc(sizeof(pthread_t) * threads * 2);
+    bench_thread* state = calloc(threads * 2, sizeof(bench_thread));
+    u64 per_producer = count / threads;
+    u64 start = bench_now_ns();
+    for(u32 i = 0; i < threads; i++){
+        state[i] = (bench_thread){ kind, locked, queue, i * per_producer, per_producer, 0 };
+        state[threads + i] = (bench_thread){ kind, locked, queue, 0, 0, 0 };
+        pthread_create(&handles[i], NULL, bench_produce, &state[i]);
+        pthread_create(&handles[threads + i], NULL, bench_consume, &state[threads + i]);
+    }
+    for(u32 i = 0; i < threads; i++){
+        pthread_join(handles[i], NULL);
+    }
+    if(kind == BENCH_LOCKED){
+        locked_close(locked);
+    }else{
+        mpmc_close(queue);
+    }
+    u64 sum = 0;
+    for(u32 i = 0; i < threads; i++){
+        pthread_join(handles[threads + i], NULL);
+        sum += state[threads + i].sum;
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
+    u64 total = per_producer * threads;
+    if(sum != total * (total - 1) / 2){
+        printf("lost elements: sum %llu instead of %llu!\n", (unsigned long long)sum, (unsigned long long)(total * (total - 1) / 2));
+        exit(1);
+    }
+    if(kind == BENCH_LOCKED){
+        free(locked);
+    }else{
+        lazy_arena_deinit(arena);
+    }
+    free(handles);
+    free(state);
+    return total / seconds / 1e6;
+}
+
+int main(int argc, char** argv){
+    u64 count = argc > 1 ? (u64)atoll(argv[1]) : 10000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_threads = argc > 2 ? (u32)atoi(argv[2]) : (cpus > 1 ? (u32)cpus / 2 : 1);
+
+    printf("%llu u64 elements through %u slots\n", (unsigned long long)count, BENCH_SLOTS);
+    printf("%-10s %-16s %-16s %-16s %-8s\n", "P x C", "mutex M/s", "mpmc M/s", "mpmc x32 M/s", "speedup");
+    for(u32 threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2){
+        double locked = bench_run(BENCH_LOCKED, threads, count);
+        double single = bench_run(BENCH_MPMC, threads, count);
+        double batch = bench_run(BENCH_MPMC_BATCH, threads, count);
+        char sides[16];
+        snprintf(sides, sizeof(sides), "%u x %u", threads, threads);
+        printf("%-10s %-16.2f %-16.2f %-16.2f %6.2fx\n", sides, locked, single, batch, single / locked);
+        if(threads == max_threads){
+            break;
+        }
+    }
+    return 0;
+}
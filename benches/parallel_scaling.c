@@ -0,0 +1,118 @@
+///Times the parallel algorithms from 1 thread up to one per cpu on multi-million element inputs.
+///Build: gcc -O2 -pthread -I../includes/includes parallel_scaling.c -o parallel_scaling -lm
+///Run:   ./parallel_scaling [elements] [max_threads]
+#include "bench.h"
+#include "parallel.h"
+
+int bench_cmp_u64(const void* left, const void* right, void* ctx){
+    (void)ctx;
+    u64 a = *(const u64*)left;
+    u64 b = *(const u64*)right;
+    return (a > b) - (a < b);
+}
+
+void bench_square(void* in, void* out, void* ctx){
+    (void)ctx;
+    u64 value = *(u64*)in;
+    *(u64*)out = value * value;
+}
+
+void bench_sum(void* acc, void* element, void* ctx){
+    (void)ctx;
+    *(u64*)acc += *(u64*)element;
+}
+
+void bench_add(void* acc, void* other, void* ctx){
+    (void)ctx;
+    *(u64*)acc += *(u64*)other;
+}
+
+bool bench_is_even(void* element, void* ctx){
+    (void)ctx;
+    return (*(u64*)element & 1) == 0;
+}
+
+bool bench_is_needle(void* element, void* ctx){
+    return *(u64*)element == *(u64*)ctx;
+}
+
+int main(int argc, char** argv){
+    u32 count = argc > 1 ? (u32)atoi(argv[1]) : 8000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_threads = argc > 2 ? (u32)atoi(argv[2]) : (cpus > 0 ? (u32)cpus : 1);
+    u64* input = (u64*)malloc((size_t)count * sizeof(u64));
+    u64* work = (u64*)malloc((size_t)count * sizeof(u64));
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    for(u32 i = 0; i < count; i++){
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        input[i] = seed;
+    }
+    ///The needle is three quarters of the way in, so find_first has to search most of the input
+    u64 needle = input[count / 4 * 3];
+
+    printf("%u elements of %zu bytes\n", count, sizeof(u64));
+    printf("%-8s %-12s %-12s %-12s %-12s %-12s\n", "threads", "sort ms", "transform ms", "reduce ms", "filter ms", "find ms");
+    double base[5] = { 0 };
+    for(u32 threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2){
+        thread_pool* pool = thread_pool_init(threads);
+        double ms[5];
+
+        memcpy(work, input, (size_t)count * sizeof(u64));
+        u64 start = bench_now_ns();
+        parallel_sort(pool, work, count, sizeof(u64), bench_cmp_u64, NULL);
+        ms[0] = (bench_now_ns() - start) / 1e6;
+        for(u32 i = 1; i < count; i++){
+            if(work[i - 1] > work[i]){
+                printf("sort is out of order at %u!\n", i);
+                return 1;
+            }
+        }
+
+        start = bench_now_ns();
+        parallel_transform(pool, input, count, sizeof(u64), work, sizeof(u64), bench_square, NULL);
+        ms[1] = (bench_now_ns() - start) / 1e6;
+
+        u64 zero = 0;
+        u64 sum = 0;
+        start = bench_now_ns();
+        parallel_reduce(pool, input, count, sizeof(u64), &zero, sizeof(u64), bench_sum, bench_add, NULL, &sum);
+        ms[2] = (bench_now_ns() - start) / 1e6;
+
+        start = bench_now_ns();
+        i64 kept = parallel_filter(pool, input, count, sizeof(u64), bench_is_even, NULL, work);
+        ms[3] = (bench_now_ns() - start) / 1e6;
+
+        start = bench_now_ns();
+        i64 found = parallel_find_first(pool, input, count, sizeof(u64), bench_is_needle, &needle);
+        ms[4] = (bench_now_ns() - start) / 1e6;
+        if(found < 0 || input[found] != needle){
+            printf("find_first missed the needle!\n");
+            return 1;
+        }
+
+        if(threads == 1){
+            memcpy(base, ms, sizeof(ms));
+        }
+        printf("%-8u", threads);
+        for(u32 i = 0; i < 5; i++){
+            printf(" %7.2f %-4s", ms[i], "");
+        }
+        printf(" (kept %lld, sum %llu)\n", (long long)kept, (unsigned long long)sum);
+        if(threads != 1){
+            printf("%-8s", "speedup");
+            for(u32 i = 0; i < 5; i++){
+                printf(" %6.2fx %-4s", base[i] / ms[i], "");
+            }
+            printf("\n");
+        }
+        thread_pool_deinit(pool);
+        if(threads == max_threads){
+            break;
+        }
+    }
+    free(input);
+    free(work);
+    return 0;
+}
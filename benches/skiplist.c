@@ -0,0 +1,170 @@
+///Times the lock-free skip list against a mutex-guarded tsearch tree under mixed read/insert/remove workloads.
+///Build: gcc -O2 -pthread -I../includes/includes skiplist.c -o skiplist -lm
+///Run:   ./skiplist [ops_per_thread] [max_threads]
+#define _GNU_SOURCE
+#include "bench.h"
+#include "skiplist.h"
+#include <pthread.h>
+#include <search.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_KEY_RANGE (1u << 20)
+
+u64 bench_next(u64* seed){
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+///A workload is what percent of operations are lookups and inserts. The rest are removes.
+typedef struct{
+    const char* name;
+    u32 lookup_percent;
+    u32 insert_percent;
+} bench_workload;
+
+///The baseline: a glibc tsearch tree behind one mutex. Keys are stored as the tree's pointers.
+void* tree_root = NULL;
+pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int bench_cmp_key(const void* left, const void* right){
+    uintptr_t a = (uintptr_t)left;
+    uintptr_t b = (uintptr_t)right;
+    return (a > b) - (a < b);
+}
+
+typedef struct{
+    bool use_skiplist;
+    skiplist* _skiplist;
+    bench_workload workload;
+    u32 ops;
+    u64 seed;
+    u64 hits;
+    pthread_barrier_t* start;
+} bench_thread;
+
+void* bench_run_thread(void* arg){
+    bench_thread* thread = arg;
+    u64 seed = thread->seed;
+    u64 hits = 0;
+    pthread_barrier_wait(thread->start);
+    for(u32 i = 0; i < thread->ops; i++){
+        u64 r = bench_next(&seed);
+        u64 key = 1 + (r >> 32) % BENCH_KEY_RANGE;
+        u32 roll = (u32)(r % 100);
+        if(thread->use_skiplist){
+            if(roll < thread->workload.lookup_percent){
+                hits += skiplist_get(thread->_skiplist, key) != NULL;
+            }else if(roll < thread->workload.lookup_percent + thread->workload.insert_percent){
+                skiplist_put(thread->_skiplist, key, (void*)(uintptr_t)key);
+            }else{
+                hits += skiplist_remove(thread->_skiplist, key);
+            }
+        }else{
+            pthread_mutex_lock(&tree_lock);
+            if(roll < thread->workload.lookup_percent){
+                hits += tfind((void*)(uintptr_t)key, &tree_root, bench_cmp_key) != NULL;
+            }else if(roll < thread->workload.lookup_percent + thread->workload.insert_percent){
+                tsearch((void*)(uintptr_t)key, &tree_root, bench_cmp_key);
+            }else{
+                hits += tdelete((void*)(uintptr_t)key, &tree_root, bench_cmp_key) != NULL;
+            }
+            pthread_mutex_unlock(&tree_lock);
+        }
+    }
+    thread->hits = hits;
+    return NULL;
+}
+
+void bench_tree_free(void* node){
+    (void)node;
+}
+
+bool bench_scan_visit(u64 key, void* value, void* ctx){
+    (void)value;
+    u64* last = ctx;
+    if(key < *last){
+        printf("skip list scan went backwards at %llu!\n", (unsigned long long)key);
+        exit(1);
+    }
+    *last = key;
+    return true;
+}
+
+///Runs [threads] threads of [ops] operations each on a freshly preloaded structure and returns millions of ops per second
+double bench_run(bool use_skiplist, bench_workload workload, u32 threads, u32 ops){
+    ///Every insert can take a node that is never given back, so the pool is sized for all of them
+    u64 inserts = (u64)threads * ops * workload.insert_percent / 100 + BENCH_KEY_RANGE;
+    u64 pool_size = (inserts + 1024) * 48;
+    arena_alloc* arena = NULL;
+    skiplist* _skiplist = NULL;
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    if(use_skiplist){
+        arena = arena_init((u32)pool_size + 4096);
+        _skiplist = create_skiplist(arena, (u32)pool_size);
+        for(u32 i = 0; i < BENCH_KEY_RANGE / 2; i++){
+            u64 key = 1 + (bench_next(&seed) >> 32) % BENCH_KEY_RANGE;
+            skiplist_put(_skiplist, key, (void*)(uintptr_t)key);
+        }
+    }else{
+        for(u32 i = 0; i < BENCH_KEY_RANGE / 2; i++){
+            u64 key = 1 + (bench_next(&seed) >> 32) % BENCH_KEY_RANGE;
+            tsearch((void*)(uintptr_t)key, &tree_root, bench_cmp_key);
+        }
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+    pthread_t* handles = malloc(sizeof(pthread_t) * threads);
+    bench_thread* state = malloc(sizeof(bench_thread) * threads);
+    for(u32 i = 0; i < threads; i++){
+        state[i] = (bench_thread){ use_skiplist, _skiplist, workload, ops, 0x2545f4914f6cdd1dull * (i + 1), 0, &start };
+        pthread_create(&handles[i], NULL, bench_run_thread, &state[i]);
+    }
+    pthread_barrier_wait(&start);
+    u64 begin = bench_now_ns();
+    for(u32 i = 0; i < threads; i++){
+        pthread_join(handles[i], NULL);
+    }
+    double seconds = (bench_now_ns() - begin) / 1e9;
+
+    if(use_skiplist){
+        u64 last = 0;
+        skiplist_scan(_skiplist, 0, ~0ull, bench_scan_visit, &last);
+        arena_deinit(arena);
+    }else{
+        tdestroy(tree_root, bench_tree_free);
+        tree_root = NULL;
+    }
+    pthread_barrier_destroy(&start);
+    free(handles);
+    free(state);
+    return (double)threads * ops / seconds / 1e6;
+}
+
+int main(int argc, char** argv){
+    u32 ops = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_threads = argc > 2 ? (u32)atoi(argv[2]) : (cpus > 0 ? (u32)cpus : 1);
+    bench_workload workloads[] = {
+        { "read-heavy 90/9/1", 90, 9 },
+        { "mixed 50/25/25", 50, 25 },
+        { "write-heavy 10/45/45", 10, 45 },
+    };
+
+    printf("%u ops per thread over %u keys, preloaded half full\n", ops, BENCH_KEY_RANGE);
+    printf("%-22s %-8s %-14s %-14s %-8s\n", "workload", "threads", "mutex Mops/s", "skiplist Mops/s", "speedup");
+    for(u32 w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++){
+        for(u32 threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2){
+            double tree = bench_run(false, workloads[w], threads, ops);
+            double skip = bench_run(true, workloads[w], threads, ops);
+            printf("%-22s %-8u %-14.2f %-14.2f %6.2fx\n", workloads[w].name, threads, tree, skip, skip / tree);
+            if(threads == max_threads){
+                break;
+            }
+        }
+    }
+    return 0;
+}
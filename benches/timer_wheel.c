@@ -0,0 +1,224 @@
+///Times the timer wheel against the d-ary heap as a timer queue on a timeout-shaped workload:
+///add a lot of timers with deadlines up to 30 s out at 1 ms ticks, cancel 90% of them, then expire the rest tick by tick.
+///Before timing anything it checks the wheel on the manual clock, down every level, cancelling timers before
+///and while they fire, and exits 1 if a timer fires on the wrong tick, twice, or after it was cancelled.
+///Build: gcc -O2 -I../includes/includes timer_wheel.c -o timer_wheel -lm
+///Run:   ./timer_wheel [timers]
+#include "bench.h"
+#include "timer_wheel.h"
+#include "dheap.h"
+
+#define BENCH_TICK_NS 1000000
+#define BENCH_MAX_TICKS 30000
+///One in this many timers is left to fire
+#define BENCH_KEEP 10
+
+u64 bench_fired;
+u64 bench_late;
+
+void bench_timer_fired(timer_wheel* wheel, void* arg){
+    bench_fired += 1;
+    bench_late += (u64)(uintptr_t)arg != wheel->now;
+}
+
+///How many timers the check starts with. Every fifth one adds another when it fires.
+#define BENCH_CHECK_TIMERS 4096
+
+///Everything the check knows about its timers, indexed by the number each was given as its arg
+typedef struct{
+    timer_handle handles[BENCH_CHECK_TIMERS * 2];
+    u64 deadlines[BENCH_CHECK_TIMERS * 2];
+    u32 fired[BENCH_CHECK_TIMERS * 2];
+    bool cancelled[BENCH_CHECK_TIMERS * 2];
+    u32 count;
+    u64 wrong_tick;
+} bench_check;
+
+bench_check bench_checked;
+
+///Timers 2k and 2k+1 share a deadline, so they fire in the same batch, and for every third k
+///whichever runs first cancels the other. Every fifth of the first timers adds one more when it fires.
+void bench_check_fired(timer_wheel* wheel, void* arg){
+    bench_check* c = &bench_checked;
+    u32 i = (u32)(uintptr_t)arg;
+    c->fired[i] += 1;
+    c->wrong_tick += wheel->now != c->deadlines[i];
+    if(i < BENCH_CHECK_TIMERS && (i / 2) % 3 == 0 && timer_cancel(wheel, c->handles[i ^ 1])){
+        c->cancelled[i ^ 1] = true;
+    }
+    if(i < BENCH_CHECK_TIMERS && i % 5 == 0){
+        u32 added = c->count++;
+        c->deadlines[added] = wheel->now + 1 + bench_random() % 100000;
+        c->handles[added] = timer_add_at(wheel, c->deadlines[added], bench_check_fired, (void*)(uintptr_t)added);
+    }
+}
+
+///Runs timers on every level of the wheel on the manual clock, moving the clock by uneven jumps
+///and by what timer_wheel_next_deadline says, and exits if any timer did the wrong thing
+void bench_check_wheel(){
+    bench_check* c = &bench_checked;
+    memset(c, 0, sizeof(bench_check));
+    u64 clock = 0;
+    timer_wheel* wheel = timer_wheel_init(1, timer_clock_manual(&clock));
+    ///The edges of the first levels, then anything up to 2^24 ticks, then a few far enough out for the top level
+    u64 edges[] = { 1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 262143, 262144, 262145 };
+    for(u32 i = 0; i < BENCH_CHECK_TIMERS; i += 2){
+        u64 deadline = i / 2 < sizeof(edges) / sizeof(edges[0]) ? edges[i / 2] : 1 + bench_random() % (1ull << 24);
+        if(i >= BENCH_CHECK_TIMERS - 8){
+            deadline = (1ull << 60) + bench_random() % (1ull << 40);
+        }
+        for(u32 j = i; j < i + 2; j++){
+            c->deadlines[j] = deadline;
+            c->handles[j] = timer_add(wheel, deadline, bench_check_fired, (void*)(uintptr_t)j);
+        }
+    }
+    c->count = BENCH_CHECK_TIMERS;
+    ///A quarter are cancelled before anything fires, and cancelling them again does nothing
+    for(u32 i = 3; i < BENCH_CHECK_TIMERS; i += 4){
+        c->cancelled[i] = timer_cancel(wheel, c->handles[i]);
+        if(!c->cancelled[i] || timer_cancel(wheel, c->handles[i]) || timer_pending(wheel, c->handles[i])){
+            printf("timer %u could not be cancelled exactly once!\n", i);
+            exit(1);
+        }
+    }
+    ///Far more steps than it takes, so a wheel that loses timers stops instead of spinning forever
+    for(u32 step = 0; timer_wheel_count(wheel) > 0; step++){
+        if(step == 1u << 20){
+            printf("timer wheel check: %llu timers never fired!\n", (unsigned long long)timer_wheel_count(wheel));
+            exit(1);
+        }
+        u64 next = timer_wheel_next_deadline(wheel);
+        clock += step % 2 == 0 ? next : 1 + bench_random() % 5000;
+        timer_advance(wheel);
+    }
+    u64 wrong = 0;
+    for(u32 i = 0; i < c->count; i++){
+        wrong += c->fired[i] != (c->cancelled[i] ? 0 : 1) || timer_pending(wheel, c->handles[i]) || timer_cancel(wheel, c->handles[i]);
+    }
+    ///The pairs where one cancels the other in the same batch must have had exactly one fire
+    for(u32 i = 0; i < BENCH_CHECK_TIMERS; i += 6){
+        wrong += c->fired[i] + c->fired[i + 1] != 1;
+    }
+    if(wrong != 0 || c->wrong_tick != 0){
+        printf("timer wheel check: %llu timers fired the wrong number of times, %llu on the wrong tick!\n", (unsigned long long)wrong, (unsigned long long)c->wrong_tick);
+        exit(1);
+    }
+    timer_wheel_deinit(wheel);
+}
+
+typedef struct{
+    double add;
+    double cancel;
+    double expire;
+    u64 fired;
+} bench_timings;
+
+///[deadlines] are in ticks, and [order] is the order to cancel them in
+bench_timings bench_wheel(u64* deadlines, u32* order, u32 count){
+    bench_timings result;
+    u64 clock = 0;
+    timer_wheel* wheel = timer_wheel_init(BENCH_TICK_NS, timer_clock_manual(&clock));
+    timer_handle* handles = malloc(sizeof(timer_handle) * count);
+    bench_fired = 0;
+    bench_late = 0;
+
+    u64 start = bench_now_ns();
+    for(u32 i = 0; i < count; i++){
+        handles[i] = timer_add(wheel, deadlines[i] * BENCH_TICK_NS, bench_timer_fired, (void*)(uintptr_t)deadlines[i]);
+    }
+    result.add = (double)(bench_now_ns() - start) / count;
+
+    u32 cancels = count - count / BENCH_KEEP;
+    start = bench_now_ns();
+    for(u32 i = 0; i < cancels; i++){
+        timer_cancel(wheel, handles[order[i]]);
+    }
+    result.cancel = (double)(bench_now_ns() - start) / cancels;
+
+    start = bench_now_ns();
+    for(u32 tick = 1; tick <= BENCH_MAX_TICKS; tick++){
+        clock = (u64)tick * BENCH_TICK_NS;
+        timer_advance(wheel);
+    }
+    result.expire = (double)(bench_now_ns() - start) / BENCH_MAX_TICKS;
+    result.fired = bench_fired;
+    if(bench_late != 0 || timer_wheel_count(wheel) != 0){
+        printf("timer wheel fired %llu timers on the wrong tick and left %llu!\n", (unsigned long long)bench_late, (unsigned long long)timer_wheel_count(wheel));
+        exit(1);
+    }
+    free(handles);
+    timer_wheel_deinit(wheel);
+    return result;
+}
+
+bench_timings bench_heap(u64* deadlines, u32* order, u32 count){
+    bench_timings result;
+    dheap heap = create_dheap(NULL, 4, 0, true);
+    u32* handles = malloc(sizeof(u32) * count);
+
+    u64 start = bench_now_ns();
+    for(u32 i = 0; i < count; i++){
+        handles[i] = dheap_push(&heap, deadlines[i], i);
+    }
+    result.add = (double)(bench_now_ns() - start) / count;
+
+    u32 cancels = count - count / BENCH_KEEP;
+    start = bench_now_ns();
+    for(u32 i = 0; i < cancels; i++){
+        dheap_remove(&heap, handles[order[i]], NULL, NULL);
+    }
+    result.cancel = (double)(bench_now_ns() - start) / cancels;
+
+    u64 fired = 0;
+    u64 late = 0;
+    start = bench_now_ns();
+    for(u32 tick = 1; tick <= BENCH_MAX_TICKS; tick++){
+        u64 key, value;
+        while(dheap_peek(&heap, &key, &value) && key <= tick){
+            dheap_pop(&heap, &key, &value);
+            fired += 1;
+            late += key != tick;
+        }
+    }
+    result.expire = (double)(bench_now_ns() - start) / BENCH_MAX_TICKS;
+    result.fired = fired;
+    if(late != 0 || dheap_count(&heap) != 0){
+        printf("heap fired %llu timers on the wrong tick and left %u!\n", (unsigned long long)late, dheap_count(&heap));
+        exit(1);
+    }
+    free(handles);
+    dheap_deinit(&heap);
+    return result;
+}
+
+int main(int argc, char** argv){
+    bench_check_wheel();
+    u32 count = argc > 1 ? (u32)atoi(argv[1]) : 1000000;
+    u64* deadlines = malloc(sizeof(u64) * count);
+    u32* order = malloc(sizeof(u32) * count);
+    for(u32 i = 0; i < count; i++){
+        deadlines[i] = 1 + bench_random() % BENCH_MAX_TICKS;
+        order[i] = i;
+    }
+    for(u32 i = count; i > 1; i--){
+        u32 j = (u32)(bench_random() % i);
+        u32 swap = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = swap;
+    }
+
+    bench_timings wheel = bench_wheel(deadlines, order, count);
+    bench_timings heap = bench_heap(deadlines, order, count);
+    if(wheel.fired != heap.fired){
+        printf("timer wheel fired %llu timers but the heap fired %llu!\n", (unsigned long long)wheel.fired, (unsigned long long)heap.fired);
+        exit(1);
+    }
+
+    printf("%u timers up to %u ticks out, %u%% cancelled, %llu fired\n", count, BENCH_MAX_TICKS, 100 - 100 / BENCH_KEEP, (unsigned long long)wheel.fired);
+    printf("%-14s %-14s %-14s %-14s\n", "", "add ns", "cancel ns", "ns per tick");
+    printf("%-14s %-14.1f %-14.1f %-14.1f\n", "timer wheel", wheel.add, wheel.cancel, wheel.expire);
+    printf("%-14s %-14.1f %-14.1f %-14.1f\n", "4-ary heap", heap.add, heap.cancel, heap.expire);
+    free(order);
+    free(deadlines);
+    return 0;
+}
@@ -0,0 +1,139 @@
+///Times the instrumented containers and allocators with tracing compiled in and compiled out, and what one zone costs,
+///through bench.h. Build it both ways and compare the two runs with --compare. The traced build also dumps trace.json,
+///which Perfetto can open.
+///Build: gcc -O2 -DTRACING -pthread -I../includes/includes trace.c -o trace_on -lm
+///       gcc -O2 -pthread -I../includes/includes trace.c -o trace_off -lm
+///Run:   ./trace_off --json off.json && ./trace_on --json on.json && ./trace_off --compare off.json on.json
+#include "bench.h"
+#include "map.h"
+#include "list.h"
+#include "trace.h"
+
+///How many operations a case times per run
+#define BENCH_OPS 100000
+#define BENCH_MAP_KEYS 1000
+///How many elements list_get walks into
+#define BENCH_LIST_GETS 1000
+
+typedef struct{
+    arena_alloc* arena;
+    list* list;
+    map* map;
+} bench_context;
+
+///Keeps the results from being optimized out
+volatile u64 bench_sink;
+
+///A function with nothing in it but a zone, to see what the zone costs by itself
+__attribute__((noinline)) void bench_empty(u64 i){
+    TRACE_ZONE_ARG("empty", "i", i);
+    bench_sink = i;
+}
+
+void bench_empty_zone(void* context, u32 size, u32 ops){
+    (void)context;
+    (void)size;
+    for(u32 i = 0; i < ops; i++){
+        bench_empty(i);
+    }
+}
+
+void bench_teardown_all(void* context){
+    bench_context* c = context;
+    arena_deinit(c->arena);
+    c->arena = NULL;
+    c->list = NULL;
+    c->map = NULL;
+}
+
+void bench_list_setup(void* context, u32 size){
+    (void)size;
+    bench_context* c = context;
+    c->arena = arena_init(BENCH_OPS * 64 + (1u << 20));
+    c->list = create_list(c->arena);
+}
+
+void bench_list_add(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u64 i = 0; i < ops; i++){
+        list_add(c->list, &i, sizeof(i));
+    }
+}
+
+void bench_list_filled_setup(void* context, u32 size){
+    bench_list_setup(context, size);
+    bench_list_add(context, size, BENCH_LIST_GETS);
+}
+
+void bench_list_get(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    u64 sum = 0;
+    for(u32 i = 0; i < ops; i++){
+        sum += *(u64*)list_get(c->list, i);
+    }
+    if(sum != (u64)ops * (ops - 1) / 2){
+        printf("list_get summed to %llu!\n", (unsigned long long)sum);
+        exit(1);
+    }
+    bench_sink = sum;
+}
+
+void bench_map_setup(void* context, u32 size){
+    (void)size;
+    bench_context* c = context;
+    c->arena = arena_init(BENCH_MAP_KEYS * 256);
+    c->map = create_map(c->arena);
+}
+
+void bench_map_put(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        u32 value = i * 3;
+        map_put(c->map, &i, sizeof(i), U32, &value, sizeof(value), U32);
+    }
+}
+
+void bench_map_filled_setup(void* context, u32 size){
+    bench_map_setup(context, size);
+    bench_map_put(context, size, BENCH_MAP_KEYS);
+}
+
+void bench_map_get(void* context, u32 size, u32 ops){
+    (void)size;
+    bench_context* c = context;
+    for(u32 i = 0; i < ops; i++){
+        u32* value = map_get(c->map, &i, U32, sizeof(i), NULL);
+        if(value == NULL || *value != i * 3){
+            printf("map_get lost key %u!\n", i);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv){
+#ifdef TRACING
+    printf("tracing compiled in\n");
+#else
+    printf("tracing compiled out\n");
+#endif
+    bench_suite* suite = bench_init(argc, argv);
+    if(suite == NULL){
+        return 1;
+    }
+    bench_context c = { 0 };
+    bench_case(suite, "empty function", 0, BENCH_OPS, NULL, bench_empty_zone, NULL, &c);
+    bench_case(suite, "list_add", 0, BENCH_OPS, bench_list_setup, bench_list_add, bench_teardown_all, &c);
+    bench_case(suite, "list_get", BENCH_LIST_GETS, BENCH_LIST_GETS, bench_list_filled_setup, bench_list_get, bench_teardown_all, &c);
+    bench_case(suite, "map_put", BENCH_MAP_KEYS, BENCH_MAP_KEYS, bench_map_setup, bench_map_put, bench_teardown_all, &c);
+    bench_case(suite, "map_get", BENCH_MAP_KEYS, BENCH_MAP_KEYS, bench_map_filled_setup, bench_map_get, bench_teardown_all, &c);
+
+    if(suite->compare_old == NULL && !trace_dump("trace.json")){
+#ifdef TRACING
+        exit(1);
+#endif
+    }
+    return bench_finish(suite);
+}
@@ -0,0 +1,245 @@
+///Times the work-stealing pool from 1 worker up to one per cpu on three fork-join workloads:
+///recursive fib, a parallel-for sum over a big array, and a walk of a randomly unbalanced tree.
+///Prints a table, or with "csv" as the last argument, benchmark,workers,ms,speedup rows to plot scaling from.
+///Build: gcc -O2 -pthread -I../includes/includes work_stealing.c -o work_stealing -lm
+///Run:   ./work_stealing [max_workers] [csv]
+#include "bench.h"
+#include "work_stealing.h"
+
+#define BENCH_FIB_N 38
+///Below this fib is computed serially, so a task is worth more than its spawn
+#define BENCH_FIB_CUTOFF 16
+#define BENCH_SUM_ELEMENTS (64u * 1024 * 1024)
+///The tree: the root has BENCH_TREE_ROOT children, and every other node has BENCH_TREE_BRANCH children
+///with probability BENCH_TREE_Q and none otherwise. Branch times q is just under 1, so subtree sizes
+///vary wildly, which is what makes static partitioning fall over.
+#define BENCH_TREE_ROOT 2000
+#define BENCH_TREE_BRANCH 4
+#define BENCH_TREE_Q 0.2495
+///Hash rounds per node, standing in for real work done at each node
+#define BENCH_TREE_WORK 64
+#define BENCH_PAD 8
+
+u64 bench_mix(u64 x){
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+u64 bench_fib_serial(u32 n){
+    return n < 2 ? n : bench_fib_serial(n - 1) + bench_fib_serial(n - 2);
+}
+
+typedef struct{
+    u32 n;
+    u64 result;
+} bench_fib_args;
+
+void bench_fib_task(ws_worker* worker, void* args){
+    bench_fib_args* fib = (bench_fib_args*)args;
+    if(fib->n < BENCH_FIB_CUTOFF){
+        fib->result = bench_fib_serial(fib->n);
+        return;
+    }
+    bench_fib_args left = { fib->n - 1, 0 };
+    bench_fib_args right = { fib->n - 2, 0 };
+    ws_task* task = ws_spawn(worker, bench_fib_task, &left, sizeof(left));
+    bench_fib_task(worker, &right);
+    ws_join(worker, task, &left, sizeof(left));
+    fib->result = left.result + right.result;
+}
+
+///One running total per worker, each on its own cache line
+typedef struct{
+    u64* data;
+    u64* partials;
+} bench_sum_ctx;
+
+void bench_sum_range(ws_worker* worker, u64 first, u64 end, void* ctx){
+    bench_sum_ctx* sum = (bench_sum_ctx*)ctx;
+    u64 total = 0;
+    for(u64 i = first; i < end; i++){
+        total += sum->data[i];
+    }
+    sum->partials[ws_worker_index(worker) * BENCH_PAD] += total;
+}
+
+void bench_sum_task(ws_worker* worker, void* args){
+    bench_sum_ctx* sum = (bench_sum_ctx*)args;
+    ws_parallel_for(worker, 0, BENCH_SUM_ELEMENTS, 0, bench_sum_range, sum);
+}
+
+u32 bench_tree_children(u64 node){
+    return (double)(bench_mix(node) >> 11) / (double)(1ull << 53) < BENCH_TREE_Q ? BENCH_TREE_BRANCH : 0;
+}
+
+u64 bench_tree_work(u64 node){
+    for(u32 i = 0; i < BENCH_TREE_WORK; i++){
+        node = bench_mix(node);
+    }
+    return node;
+}
+
+u64 bench_tree_serial(u64 node, u64* checksum){
+    *checksum += bench_tree_work(node);
+    u64 count = 1;
+    u32 children = bench_tree_children(node);
+    for(u32 i = 0; i < children; i++){
+        count += bench_tree_serial(node * BENCH_TREE_BRANCH + i + 1, checksum);
+    }
+    return count;
+}
+
+typedef struct{
+    u64 node;
+    u64 count;
+    u64 checksum;
+} bench_tree_args;
+
+void bench_tree_task(ws_worker* worker, void* args){
+    bench_tree_args* tree = (bench_tree_args*)args;
+    tree->count = 1;
+    tree->checksum = bench_tree_work(tree->node);
+    u32 children = bench_tree_children(tree->node);
+    if(children == 0){
+        return;
+    }
+    ws_task* tasks[BENCH_TREE_BRANCH];
+    bench_tree_args child[BENCH_TREE_BRANCH];
+    ///Spawn all but the last child, which we walk ourselves
+    for(u32 i = 0; i + 1 < children; i++){
+        child[i] = (bench_tree_args){ tree->node * BENCH_TREE_BRANCH + i + 1, 0, 0 };
+        tasks[i] = ws_spawn(worker, bench_tree_task, &child[i], sizeof(bench_tree_args));
+    }
+    child[children - 1] = (bench_tree_args){ tree->node * BENCH_TREE_BRANCH + children, 0, 0 };
+    bench_tree_task(worker, &child[children - 1]);
+    for(u32 i = children - 1; i-- > 0;){
+        ws_join(worker, tasks[i], &child[i], sizeof(bench_tree_args));
+    }
+    for(u32 i = 0; i < children; i++){
+        tree->count += child[i].count;
+        tree->checksum += child[i].checksum;
+    }
+}
+
+typedef struct{
+    u64* counts;
+    u64* checksums;
+} bench_tree_root;
+
+void bench_tree_root_range(ws_worker* worker, u64 first, u64 end, void* ctx){
+    bench_tree_root* root = (bench_tree_root*)ctx;
+    for(u64 i = first; i < end; i++){
+        bench_tree_args tree = { (i + 1) * 0x9E3779B97F4A7C15ull, 0, 0 };
+        bench_tree_task(worker, &tree);
+        root->counts[ws_worker_index(worker) * BENCH_PAD] += tree.count;
+        root->checksums[ws_worker_index(worker) * BENCH_PAD] += tree.checksum;
+    }
+}
+
+void bench_tree_root_task(ws_worker* worker, void* args){
+    ws_parallel_for(worker, 0, BENCH_TREE_ROOT, 1, bench_tree_root_range, args);
+}
+
+typedef enum{ BENCH_FIB, BENCH_SUM, BENCH_TREE, BENCH_KIND_COUNT } bench_kind;
+const char* bench_names[BENCH_KIND_COUNT] = { "fib", "sum", "tree" };
+
+///The serial answers every parallel run is checked against
+u64 bench_expected[BENCH_KIND_COUNT];
+u64 bench_expected_checksum;
+u64* bench_data;
+
+///Runs one benchmark on [workers] workers, checks the answer and returns milliseconds, or the serial time if [workers] is 0
+double bench_run(bench_kind kind, u32 workers, u64* steals){
+    u64 start, result = 0, checksum = 0;
+    if(workers == 0){
+        start = bench_now_ns();
+        if(kind == BENCH_FIB){
+            result = bench_fib_serial(BENCH_FIB_N);
+        }else if(kind == BENCH_SUM){
+            for(u64 i = 0; i < BENCH_SUM_ELEMENTS; i++){
+                result += bench_data[i];
+            }
+        }else{
+            for(u64 i = 0; i < BENCH_TREE_ROOT; i++){
+                result += bench_tree_serial((i + 1) * 0x9E3779B97F4A7C15ull, &checksum);
+            }
+            bench_expected_checksum = checksum;
+        }
+        double ms = (bench_now_ns() - start) / 1e6;
+        bench_expected[kind] = result;
+        return ms;
+    }
+    ws_pool* pool = ws_pool_init(workers);
+    u64* partials = calloc((size_t)workers * BENCH_PAD * 2, sizeof(u64));
+    start = bench_now_ns();
+    if(kind == BENCH_FIB){
+        bench_fib_args fib = { BENCH_FIB_N, 0 };
+        ws_pool_run(pool, bench_fib_task, &fib);
+        result = fib.result;
+    }else if(kind == BENCH_SUM){
+        bench_sum_ctx sum = { bench_data, partials };
+        ws_pool_run(pool, bench_sum_task, &sum);
+        for(u32 i = 0; i < workers; i++){
+            result += partials[i * BENCH_PAD];
+        }
+    }else{
+        bench_tree_root root = { partials, partials + (size_t)workers * BENCH_PAD };
+        ws_pool_run(pool, bench_tree_root_task, &root);
+        for(u32 i = 0; i < workers; i++){
+            result += root.counts[i * BENCH_PAD];
+            checksum += root.checksums[i * BENCH_PAD];
+        }
+    }
+    double ms = (bench_now_ns() - start) / 1e6;
+    *steals = ws_pool_steals(pool);
+    if(result != bench_expected[kind] || (kind == BENCH_TREE && checksum != bench_expected_checksum)){
+        printf("%s on %u workers got %llu instead of %llu!\n", bench_names[kind], workers, (unsigned long long)result, (unsigned long long)bench_expected[kind]);
+        exit(1);
+    }
+    free(partials);
+    ws_pool_deinit(pool);
+    return ms;
+}
+
+int main(int argc, char** argv){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 max_workers = argc > 1 && strcmp(argv[1], "csv") != 0 ? (u32)atoi(argv[1]) : (cpus > 0 ? (u32)cpus : 1);
+    bool csv = argc > 1 && strcmp(argv[argc - 1], "csv") == 0;
+    if(cpus < 2 && !csv){
+        printf("NOTE: only %ld cpu online, so every worker shares it and there is no speedup to see\n", cpus);
+    }
+
+    bench_data = malloc(sizeof(u64) * BENCH_SUM_ELEMENTS);
+    for(u64 i = 0; i < BENCH_SUM_ELEMENTS; i++){
+        bench_data[i] = bench_mix(i);
+    }
+    if(csv){
+        printf("benchmark,workers,ms,speedup\n");
+    }
+    for(bench_kind kind = 0; kind < BENCH_KIND_COUNT; kind++){
+        double serial = bench_run(kind, 0, NULL);
+        if(csv){
+            printf("%s,0,%.3f,1.00\n", bench_names[kind], serial);
+        }else{
+            printf("\n%s: serial %.2f ms, answer %llu\n", bench_names[kind], serial, (unsigned long long)bench_expected[kind]);
+            printf("%-8s %-12s %-10s %-10s\n", "workers", "ms", "speedup", "steals");
+        }
+        for(u32 workers = 1; workers <= max_workers; workers = workers < max_workers && workers * 2 > max_workers ? max_workers : workers * 2){
+            u64 steals;
+            double ms = bench_run(kind, workers, &steals);
+            if(csv){
+                printf("%s,%u,%.3f,%.2f\n", bench_names[kind], workers, ms, serial / ms);
+            }else{
+                printf("%-8u %-12.2f %8.2fx  %-10llu\n", workers, ms, serial / ms, (unsigned long long)steals);
+            }
+            if(workers == max_workers){
+                break;
+            }
+        }
+    }
+    free(bench_data);
+    return 0;
+}
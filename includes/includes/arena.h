@@ -1,11 +1,14 @@
 #pragma once
 
 #include "commons.h"
+#include "trace.h"
 #include <string.h>
+#include <stdio.h>
 #include <malloc.h>
 
 
 //Named arena_alloc so that variables of this struct can be called `arena`
+typedef struct arena_alloc arena_alloc;
 struct arena_alloc{
     ///The size allocated for the arena
     u32 size;
@@ -15,17 +18,23 @@ struct arena_alloc{
     void* first;
     ///The next chunk of data allocated to the arena
     void* next;
+    ///The first arena that was handed over to this one via arena_adopt.
+    ///Adopted arenas are freed when this one is.
+    arena_alloc* adopted;
+    ///The next arena adopted by the same arena as this one
+    arena_alloc* sibling;
+    ///The arena that adopted this one, or NULL if none has
+    arena_alloc* adopted_by;
 };
-typedef struct arena_alloc arena_alloc;
 
 /*
     Initializes a new arena allocator with the given size
 
-    |-----------------------------------|---------------------------------------|
-    |        Header (32 + 8 + 8)        |                                       |
-    |-----------------------------------|            Payload (size)             |
-    | size (32) | first (8) | next (8)  |                                       |
-    |-----------------------------------|---------------------------------------|
+    |-------------------------------------------------------------------------------------|---------------------------------------|
+    |                          Header (4 + 4 + 8 + 8 + 8 + 8 + 8)                         |                                       |
+    |-------------------------------------------------------------------------------------|            Payload (size)             |
+    | size | capacity | first (8) | next (8) | adopted (8) | sibling (8) | adopted_by (8)   |                                       |
+    |-------------------------------------------------------------------------------------|---------------------------------------|
 */
 
 arena_alloc* arena_init(u32 size){
@@ -44,6 +53,9 @@ arena_alloc* arena_init(u32 size){
     arena->next = arena->first;
     arena->size = size;
     arena->capacity = 0;
+    arena->adopted = NULL;
+    arena->sibling = NULL;
+    arena->adopted_by = NULL;
     return arena;
 }
 
@@ -52,13 +64,69 @@ arena_alloc* arena_init(u32 size){
 /// MEM: Borrowed
 /// LIFETIME: Borrowed by free and then discarded by the system.
 /// NOTE: After calling this function, NEVER attempt to use this pointer to read/write memory. It will result in a use-after-free.
+/// NOTE: Every arena adopted by this one is deinitialized as well.
+/// NOTE: An arena that was adopted is refused, since the arena that adopted it frees it.
 void arena_deinit(arena_alloc* arena){
+    if(arena->adopted_by != NULL){
+        printf("Cannot deinitialize an arena that was adopted, it is freed with the arena that adopted it!\n");
+        return;
+    }
+    arena_alloc* adopted = arena->adopted;
+    while(adopted != NULL){
+        arena_alloc* sibling = adopted->sibling;
+        adopted->adopted_by = NULL;
+        arena_deinit(adopted);
+        adopted = sibling;
+    }
     arena->first = 0;
     arena->next = 0;
     free(arena);
 }
 
+///Empties the given arena so its whole size can be put into again, without giving its memory back.
+///This is O(1): nothing is cleared, the next put just starts from the beginning again.
+/// NOTE: Every pointer into this arena is invalid after this, and every arena it adopted is deinitialized.
+void arena_reset(arena_alloc* arena){
+    arena_alloc* adopted = arena->adopted;
+    while(adopted != NULL){
+        arena_alloc* sibling = adopted->sibling;
+        adopted->adopted_by = NULL;
+        arena_deinit(adopted);
+        adopted = sibling;
+    }
+    arena->adopted = NULL;
+    arena->next = arena->first;
+    arena->capacity = 0;
+}
+
+///Hands the whole of [adoptee] over to [arena] in O(1). Nothing is copied and no pointer into [adoptee] changes,
+///but [adoptee] now lives exactly as long as [arena]: it is freed by arena_deinit(arena) and must not
+///be passed to arena_deinit itself anymore.
+///Adopting an arena [arena] already adopted, like when a list and a map that share an arena are both transferred
+///to it, does nothing and succeeds. Returns false, having changed nothing, if another arena already adopted [adoptee],
+///or if [adoptee] adopted [arena], since either would free something twice.
+bool arena_adopt(arena_alloc* arena, arena_alloc* adoptee){
+    if(arena == adoptee || adoptee->adopted_by == arena){
+        return true;
+    }
+    if(adoptee->adopted_by != NULL){
+        printf("Cannot adopt an arena that another arena already adopted!\n");
+        return false;
+    }
+    for(arena_alloc* parent = arena->adopted_by; parent != NULL; parent = parent->adopted_by){
+        if(parent == adoptee){
+            printf("Cannot adopt an arena that adopted this one!\n");
+            return false;
+        }
+    }
+    adoptee->sibling = arena->adopted;
+    adoptee->adopted_by = arena;
+    arena->adopted = adoptee;
+    return true;
+}
+
 void* arena_put(arena_alloc* arena, void* data, u32 size){
+    TRACE_ZONE_ARG("arena_put", "size", size);
     if(arena->capacity + size > arena->size){
         printf("Exceeded allocator size! Cannot put data into arena!\n");
         return NULL;
@@ -86,6 +154,7 @@ void* arena_put(arena_alloc* arena, void* data, u32 size){
 ///This is for reading in files effectively without undefined behavior or weird glitches
 ///~alex, 12:01 AM PST, 11/22/2020
 void* arena_reserve(arena_alloc* arena, u32 size){
+    TRACE_ZONE_ARG("arena_reserve", "size", size);
     if(arena->capacity + size > arena->size){
         printf("Cannot reserve %i bytes of space as there is not enough room in arena!\n", size);
         return NULL;
@@ -98,11 +167,21 @@ void* arena_reserve(arena_alloc* arena, u32 size){
         ///Borrow the pointer to arena->next, which should be called `next`, to be used for initializing the pointer to the newly copied data in the arena
         ///MEM: Borrowed-always
         ///LIFETIME: The data copied into this address is persistent as long as the arena remains alive. This data's lifetime depends on the arena's.
-        void* ret = arena->first;    
+        ret = arena->first;
     }
     // printf("Current addr copied to %p\n", (u8*)arena->next);
     // printf("Next addr predicted: %p\n", ((u8*)arena->next) + size);
     arena->next = (void*)(((u8*)ret) + size);
     arena->capacity += size;
     return ret;
+}
+
+///Reserves [size] bytes aligned to [align], which must be a power of two.
+///arena_reserve only hands out byte aligned memory, so this over-reserves by up to [align] - 1 bytes.
+void* arena_reserve_aligned(arena_alloc* arena, u32 size, u32 align){
+    u8* reserved = arena_reserve(arena, size + align - 1);
+    if(reserved == NULL){
+        return NULL;
+    }
+    return (void*)(((uintptr_t)reserved + align - 1) & ~((uintptr_t)align - 1));
 }
\ No newline at end of file
@@ -0,0 +1,536 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include "bip_buffer.h"
+#include "clock.h"
+#include "debug.h"
+#include "log_format.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    A logger that keeps the call site cheap by doing nothing there but copying. Every thread that logs gets
+    its own spsc_bip_buffer ring, and a log call reads the TSC and log_captures its arguments straight
+    into a reservation in that ring. No lock, no formatting, no syscall.
+
+    thread 1 --> | ring | --\
+    thread 2 --> | ring | ---+--> background thread: merge by timestamp, log_format, writev --> fd
+    thread 3 --> | ring | --/
+
+    A background thread takes the records out of every ring, oldest first, formats them,
+    and writes them out in batches with one writev. Lines look like debug_log's:
+    [Mon Oct 19 12:00:01.123456 2026][from]: message
+    The date up to the seconds is only copied into a batch once per second, and every line in that second
+    points an iovec at that copy, followed by one for its own digits and the rest of the line.
+    The date comes from clock.h's cache, and the background thread recalibrates the TSC about once a second.
+
+    When a ring is full the call either drops the message, counting it so the background thread can say how many
+    were lost, or spins until there's room, depending on the async_log_overflow it was made with.
+    async_log_flush waits until everything logged before it has been written.
+
+    Records from one thread come out in the order they were logged. Between threads they are merged by timestamp,
+    but only across what is in the rings at that moment, so two lines logged at nearly the same time can swap.
+    A thread's ring goes back to be reused by a new thread once its thread has exited and everything in it is written.
+    LIFETIME: Format strings aren't copied, see log_format.h. The from string and every %s argument are.
+*/
+
+///How many threads can have a ring at once. Threads past this have everything they log dropped.
+#define ASYNC_LOG_MAX_THREADS 64
+///The size of every thread's ring
+#define ASYNC_LOG_RING_SIZE (256 * 1024)
+///The most a single record can take in a ring, header and all. Arguments past that print as (?).
+#define ASYNC_LOG_MAX_RECORD 2048
+///The longest a single formatted line can be
+#define ASYNC_LOG_MAX_LINE 4096
+///How many bytes of formatted lines are batched up before they're written
+#define ASYNC_LOG_BATCH (64 * 1024)
+///How many iovecs a batch can have, two per line. Linux takes at most 1024 in one writev.
+#define ASYNC_LOG_IOVECS 512
+///How long the background thread sleeps when every ring is empty
+#define ASYNC_LOG_IDLE_NS 1000000
+///How many sub-second digits the dates have
+#define ASYNC_LOG_DIGITS 6
+
+PUBLIC
+enum async_log_overflow{
+    ///Drop the message and count it
+    ASYNC_LOG_DROP,
+    ///Wait for the background thread to make room
+    ASYNC_LOG_BLOCK,
+};
+typedef enum async_log_overflow async_log_overflow;
+
+PUBLIC
+enum async_log_ring_state{
+    ASYNC_LOG_RING_FREE,
+    ASYNC_LOG_RING_ACTIVE,
+    ///Its thread has exited, and it goes back to free once it's been read empty
+    ASYNC_LOG_RING_RETIRED,
+};
+
+///What goes in front of the captured arguments of every record
+INTERNAL
+struct async_log_record{
+    ///The size of the whole record, rounded up to 8
+    u32 size;
+    ///The length of the from string, which follows this header
+    u32 from_length;
+    ///clock_tsc when it was logged, which also orders records between threads
+    u64 tsc;
+    str format;
+};
+typedef struct async_log_record async_log_record;
+
+INTERNAL
+struct async_log_ring{
+    spsc_bip_buffer* buffer;
+    _Atomic u32 state;
+    ///Messages the producer has dropped. Only the producer writes this.
+    _Atomic u64 dropped;
+    ///How many of those the background thread has already reported
+    u64 reported;
+    ///What the background thread is reading from this ring right now
+    u8* run;
+    u32 run_size;
+    u32 consumed;
+};
+typedef struct async_log_ring async_log_ring;
+
+PUBLIC
+struct async_log{
+    INTERNAL
+    int fd;
+    INTERNAL
+    async_log_overflow overflow;
+    INTERNAL
+    async_log_ring rings[ASYNC_LOG_MAX_THREADS];
+    ///How many rings have ever been handed out. The background thread only looks at these.
+    INTERNAL
+    _Atomic u32 ring_count;
+    ///Held while handing out a ring, since that reserves from [arena]
+    INTERNAL
+    pthread_mutex_t register_lock;
+    ///Where the rings live
+    INTERNAL
+    arena_alloc* arena;
+    ///The ring of every thread that has logged
+    INTERNAL
+    pthread_key_t thread_ring;
+    ///Messages dropped by threads that couldn't get a ring
+    INTERNAL
+    _Atomic u64 unregistered_dropped;
+    INTERNAL
+    u64 unregistered_reported;
+
+    INTERNAL
+    pthread_t thread;
+    INTERNAL
+    _Atomic bool running;
+    ///Wakes the background thread early, and tells flushers it's caught up
+    INTERNAL
+    pthread_mutex_t wake_lock;
+    INTERNAL
+    pthread_cond_t wake;
+    INTERNAL
+    pthread_cond_t flushed;
+    INTERNAL
+    u64 flush_requested;
+    INTERNAL
+    u64 flush_done;
+
+    ///The batch being built: formatted text, and the iovecs that point into it
+    INTERNAL
+    char batch[ASYNC_LOG_BATCH];
+    INTERNAL
+    u32 batch_used;
+    INTERNAL
+    struct iovec iovecs[ASYNC_LOG_IOVECS];
+    INTERNAL
+    u32 iovec_count;
+    ///The second the date text in the batch is for, and where it is
+    INTERNAL
+    u64 date_second;
+    INTERNAL
+    u32 date_start;
+    INTERNAL
+    u32 date_length;
+    ///CLOCK_MONOTONIC_COARSE when the background thread last recalibrated the TSC
+    INTERNAL
+    u64 calibrated_ns;
+};
+typedef struct async_log async_log;
+
+///Marks the ring of a thread that has exited, so the background thread can give it to a new one
+HELPER
+void async_log_retire_ring(void* ring){
+    atomic_store_explicit(&((async_log_ring*)ring)->state, ASYNC_LOG_RING_RETIRED, memory_order_release);
+}
+
+///Gets this thread's ring, handing it one if it doesn't have one yet. Returns NULL if every ring is taken.
+INTERNAL
+RECEIVER(log)
+async_log_ring* async_log_thread_ring(async_log* log){
+    async_log_ring* ring = pthread_getspecific(log->thread_ring);
+    if(ring != NULL){
+        return ring;
+    }
+    pthread_mutex_lock(&log->register_lock);
+    u32 count = atomic_load_explicit(&log->ring_count, memory_order_relaxed);
+    for(u32 i = 0; i < count; i++){
+        u32 expected = ASYNC_LOG_RING_FREE;
+        if(atomic_compare_exchange_strong_explicit(&log->rings[i].state, &expected, ASYNC_LOG_RING_ACTIVE, memory_order_acq_rel, memory_order_relaxed)){
+            ring = &log->rings[i];
+            break;
+        }
+    }
+    if(ring == NULL && count < ASYNC_LOG_MAX_THREADS){
+        spsc_bip_buffer* buffer = create_spsc_bip_buffer(log->arena, ASYNC_LOG_RING_SIZE);
+        if(buffer != NULL){
+            ring = &log->rings[count];
+            ring->buffer = buffer;
+            atomic_store_explicit(&ring->state, ASYNC_LOG_RING_ACTIVE, memory_order_relaxed);
+            ///Published last, so the background thread never sees a ring without its buffer
+            atomic_store_explicit(&log->ring_count, count + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&log->register_lock);
+    if(ring != NULL){
+        pthread_setspecific(log->thread_ring, ring);
+    }
+    return ring;
+}
+
+///Logs [fmt] with [args], as coming from [from]. Returns false if the message was dropped.
+PUBLIC
+RECEIVER(log)
+bool async_log_vwrite(async_log* log, str from, str fmt, va_list args){
+    async_log_ring* ring = async_log_thread_ring(log);
+    if(ring == NULL){
+        atomic_fetch_add_explicit(&log->unregistered_dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    u64 tsc = clock_tsc();
+    u8* record = spsc_bip_reserve(ring->buffer, ASYNC_LOG_MAX_RECORD);
+    while(record == NULL){
+        if(log->overflow == ASYNC_LOG_DROP){
+            ///Only this thread writes its count, so there's no need for a locked add
+            atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+            return false;
+        }
+        pthread_cond_signal(&log->wake);
+        sched_yield();
+        record = spsc_bip_reserve(ring->buffer, ASYNC_LOG_MAX_RECORD);
+    }
+    async_log_record* header = (async_log_record*)record;
+    u32 from_length = (u32)strlen(from);
+    if(from_length > ASYNC_LOG_MAX_RECORD / 4){
+        from_length = ASYNC_LOG_MAX_RECORD / 4;
+    }
+    memcpy(record + sizeof(async_log_record), from, from_length);
+    u32 used = sizeof(async_log_record) + from_length;
+    used += log_capture(fmt, args, record + used, ASYNC_LOG_MAX_RECORD - used);
+    header->size = (used + 7) & ~7u;
+    header->from_length = from_length;
+    header->tsc = tsc;
+    header->format = fmt;
+    spsc_bip_commit(ring->buffer, header->size);
+    return true;
+}
+
+///Logs [fmt] with everything after it, as coming from [from]. Returns false if the message was dropped.
+PUBLIC
+RECEIVER(log)
+bool async_log_write(async_log* log, str from, str fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    bool logged = async_log_vwrite(log, from, fmt, args);
+    va_end(args);
+    return logged;
+}
+
+///Sends every debug_log after this to [log], which does the formatting and writing on its own thread,
+///or goes back to printing on the calling thread if [log] is NULL.
+///It lives here and not in debug.h so that debug.h, and every container that includes it, doesn't need this header.
+///NOTE: Set this before other threads start logging, and set it back to NULL before [log] is deinitialized.
+PUBLIC
+void debug_log_set_backend(async_log* log){
+    debug_log_backend_write = async_log_vwrite;
+    debug_log_backend = log;
+}
+
+///Writes out the batch, carrying on after short writes, and empties it
+INTERNAL
+RECEIVER(log)
+void async_log_write_batch(async_log* log){
+    struct iovec* iovecs = log->iovecs;
+    u32 count = log->iovec_count;
+    while(count != 0){
+        ssize_t written = writev(log->fd, iovecs, (int)count);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            ///Nowhere to report it but stderr, and nothing to do but lose the batch
+            fprintf(stderr, "async_log could not write to fd %i: %s\n", log->fd, strerror(errno));
+            break;
+        }
+        while(count != 0 && (size_t)written >= iovecs->iov_len){
+            written -= (ssize_t)iovecs->iov_len;
+            iovecs += 1;
+            count -= 1;
+        }
+        if(count != 0){
+            iovecs->iov_base = (u8*)iovecs->iov_base + written;
+            iovecs->iov_len -= (size_t)written;
+        }
+    }
+    log->batch_used = 0;
+    log->iovec_count = 0;
+    ///The date text was in the batch, so it has to be made again
+    log->date_second = UINT64_MAX;
+}
+
+///Makes room in the batch for a line, writing it out first if it's full
+INTERNAL
+RECEIVER(log)
+void async_log_batch_room(async_log* log){
+    if(ASYNC_LOG_BATCH - log->batch_used < ASYNC_LOG_MAX_LINE + 64 || log->iovec_count + 2 > ASYNC_LOG_IOVECS){
+        async_log_write_batch(log);
+    }
+}
+
+///Adds a line to the batch: the shared date text of its second, then the rest, formatted straight into the batch
+INTERNAL
+RECEIVER(log)
+void async_log_batch_line(async_log* log, u64 tsc, str from, u32 from_length, str fmt, u8* args, u32 args_size){
+    async_log_batch_room(log);
+    clock_date_cache* date = clock_thread_date(clock_tsc_to_real_ns(tsc), ASYNC_LOG_DIGITS);
+    if(date->second != log->date_second){
+        log->date_start = log->batch_used;
+        log->date_length = (u32)snprintf(log->batch + log->batch_used, 64, "[%.*s", (int)date->fraction, date->text);
+        log->batch_used += log->date_length;
+        log->date_second = date->second;
+    }
+    log->iovecs[log->iovec_count++] = (struct iovec){ log->batch + log->date_start, log->date_length };
+    char* line = log->batch + log->batch_used;
+    u32 length = (u32)snprintf(line, ASYNC_LOG_MAX_LINE, "%s][%.*s]: ", date->text + date->fraction, (int)from_length, from);
+    length += log_format(fmt, args, args_size, line + length, ASYNC_LOG_MAX_LINE - length - 1);
+    line[length++] = '\n';
+    log->batch_used += length;
+    log->iovecs[log->iovec_count++] = (struct iovec){ line, length };
+}
+
+///Adds a line saying how many messages were dropped
+INTERNAL
+RECEIVER(log)
+void async_log_batch_dropped(async_log* log, u64 dropped, str whose){
+    async_log_batch_room(log);
+    char* line = log->batch + log->batch_used;
+    u32 length = (u32)snprintf(line, ASYNC_LOG_MAX_LINE, "[async_log]: dropped %llu messages from %s\n", (unsigned long long)dropped, whose);
+    log->batch_used += length;
+    log->iovecs[log->iovec_count++] = (struct iovec){ line, length };
+}
+
+///Gets the next record of [ring] without taking it, or NULL if the ring is empty
+INTERNAL
+RECEIVER(ring)
+async_log_record* async_log_ring_peek(async_log_ring* ring){
+    if(ring->consumed == ring->run_size){
+        if(ring->consumed != 0){
+            spsc_bip_release(ring->buffer, ring->consumed);
+        }
+        ring->consumed = 0;
+        ring->run = spsc_bip_read(ring->buffer, &ring->run_size);
+        if(ring->run == NULL){
+            ring->run_size = 0;
+            return NULL;
+        }
+    }
+    return (async_log_record*)(ring->run + ring->consumed);
+}
+
+///Formats everything in every ring into batches, oldest first, and writes it all out.
+///Returns how many records there were.
+INTERNAL
+RECEIVER(log)
+u64 async_log_drain(async_log* log){
+    u32 count = atomic_load_explicit(&log->ring_count, memory_order_acquire);
+    u64 drained = 0;
+    for(;;){
+        async_log_ring* oldest = NULL;
+        async_log_record* oldest_record = NULL;
+        for(u32 i = 0; i < count; i++){
+            async_log_record* record = async_log_ring_peek(&log->rings[i]);
+            if(record != NULL && (oldest == NULL || record->tsc < oldest_record->tsc)){
+                oldest = &log->rings[i];
+                oldest_record = record;
+            }
+        }
+        if(oldest == NULL){
+            break;
+        }
+        u8* from = (u8*)oldest_record + sizeof(async_log_record);
+        u8* args = from + oldest_record->from_length;
+        u32 args_size = oldest_record->size - sizeof(async_log_record) - oldest_record->from_length;
+        async_log_batch_line(log, oldest_record->tsc, (str)from, oldest_record->from_length, oldest_record->format, args, args_size);
+        oldest->consumed += oldest_record->size;
+        drained += 1;
+    }
+    for(u32 i = 0; i < count; i++){
+        async_log_ring* ring = &log->rings[i];
+        u64 dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if(dropped != ring->reported){
+            char whose[32];
+            snprintf(whose, sizeof(whose), "thread ring %u", i);
+            async_log_batch_dropped(log, dropped - ring->reported, whose);
+            ring->reported = dropped;
+        }
+        ///A retired ring that has been read empty can go to a new thread
+        if(atomic_load_explicit(&ring->state, memory_order_acquire) == ASYNC_LOG_RING_RETIRED && async_log_ring_peek(ring) == NULL){
+            atomic_store_explicit(&ring->state, ASYNC_LOG_RING_FREE, memory_order_release);
+        }
+    }
+    u64 unregistered = atomic_load_explicit(&log->unregistered_dropped, memory_order_relaxed);
+    if(unregistered != log->unregistered_reported){
+        async_log_batch_dropped(log, unregistered - log->unregistered_reported, "threads past ASYNC_LOG_MAX_THREADS");
+        log->unregistered_reported = unregistered;
+    }
+    if(log->iovec_count != 0){
+        async_log_write_batch(log);
+    }
+    return drained;
+}
+
+INTERNAL
+void* async_log_main(void* arg){
+    async_log* log = (async_log*)arg;
+    for(;;){
+        pthread_mutex_lock(&log->wake_lock);
+        u64 requested = log->flush_requested;
+        pthread_mutex_unlock(&log->wake_lock);
+        bool running = atomic_load_explicit(&log->running, memory_order_acquire);
+        u64 now = clock_coarse_mono_ns();
+        if(now - log->calibrated_ns >= 1000000000ull){
+            clock_recalibrate();
+            log->calibrated_ns = now;
+        }
+
+        u64 drained = async_log_drain(log);
+
+        pthread_mutex_lock(&log->wake_lock);
+        if(requested != log->flush_done){
+            log->flush_done = requested;
+            pthread_cond_broadcast(&log->flushed);
+        }
+        if(!running){
+            pthread_mutex_unlock(&log->wake_lock);
+            break;
+        }
+        if(drained == 0 && log->flush_requested == log->flush_done){
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += ASYNC_LOG_IDLE_NS;
+            if(until.tv_nsec >= 1000000000){
+                until.tv_sec += 1;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&log->wake, &log->wake_lock, &until);
+        }
+        pthread_mutex_unlock(&log->wake_lock);
+    }
+    return NULL;
+}
+
+///Starts a logger that writes to [fd], doing [overflow] when a thread's ring is full
+PUBLIC
+async_log* async_log_init(int fd, async_log_overflow overflow){
+    async_log* log = malloc(sizeof(async_log));
+    if(log == NULL){
+        return NULL;
+    }
+    memset(log, 0, sizeof(async_log));
+    ///Room for every ring, header and alignment included. The pages aren't touched until a ring is handed out.
+    log->arena = arena_init((sizeof(spsc_bip_buffer) + BIP_CACHE_LINE + ASYNC_LOG_RING_SIZE + BIP_ALIGN) * ASYNC_LOG_MAX_THREADS);
+    if(log->arena == NULL){
+        free(log);
+        return NULL;
+    }
+    ///Calibrated here rather than in whichever thread logs first
+    clock_init();
+    log->fd = fd;
+    log->overflow = overflow;
+    log->date_second = UINT64_MAX;
+    atomic_init(&log->ring_count, 0);
+    atomic_init(&log->unregistered_dropped, 0);
+    atomic_init(&log->running, true);
+    for(u32 i = 0; i < ASYNC_LOG_MAX_THREADS; i++){
+        atomic_init(&log->rings[i].state, ASYNC_LOG_RING_FREE);
+        atomic_init(&log->rings[i].dropped, 0);
+    }
+    pthread_key_create(&log->thread_ring, async_log_retire_ring);
+    pthread_mutex_init(&log->register_lock, NULL);
+    pthread_mutex_init(&log->wake_lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    pthread_cond_init(&log->flushed, NULL);
+    if(pthread_create(&log->thread, NULL, async_log_main, log) != 0){
+        printf("Could not start the async_log thread\n");
+        pthread_key_delete(log->thread_ring);
+        arena_deinit(log->arena);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+///Waits until everything logged before this call, from any thread, has been written
+PUBLIC
+RECEIVER(log)
+void async_log_flush(async_log* log){
+    pthread_mutex_lock(&log->wake_lock);
+    u64 ticket = ++log->flush_requested;
+    pthread_cond_signal(&log->wake);
+    while(log->flush_done < ticket){
+        pthread_cond_wait(&log->flushed, &log->wake_lock);
+    }
+    pthread_mutex_unlock(&log->wake_lock);
+}
+
+///How many messages have been dropped so far, from every thread
+PUBLIC
+RECEIVER(log)
+u64 async_log_dropped(async_log* log){
+    u64 dropped = atomic_load_explicit(&log->unregistered_dropped, memory_order_relaxed);
+    u32 count = atomic_load_explicit(&log->ring_count, memory_order_acquire);
+    for(u32 i = 0; i < count; i++){
+        dropped += atomic_load_explicit(&log->rings[i].dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+///Writes out everything that's been logged, stops the background thread and frees the logger.
+///NOTE: No thread may log to it once this has started.
+PUBLIC
+RECEIVER(log)
+void async_log_deinit(async_log* log){
+    pthread_mutex_lock(&log->wake_lock);
+    atomic_store_explicit(&log->running, false, memory_order_release);
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->wake_lock);
+    pthread_join(log->thread, NULL);
+    pthread_key_delete(log->thread_ring);
+    pthread_cond_destroy(&log->flushed);
+    pthread_cond_destroy(&log->wake);
+    pthread_mutex_destroy(&log->wake_lock);
+    pthread_mutex_destroy(&log->register_lock);
+    arena_deinit(log->arena);
+    free(log);
+}
@@ -0,0 +1,556 @@
+#pragma once
+
+#include "commons.h"
+#include "clock.h"
+#include "log_format.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+    A log that never formats anything. A log call writes which call site it came from, the TSC, and its arguments
+    as raw bytes into a memory mapped file, and tools/binlog_decode turns the file into text later, if anyone wants to read it.
+
+    Every call site has a static binlog_site holding its format string, file, line and level. The first time a site
+    is used it gets a process wide id, and every log it's written to gets one record with its text before any of
+    its own. After that a call only pays for the id.
+
+    |--------|-----------------------------------|-------------------------------|-----
+    | header | size | site 7 | tsc | args ...    | size | site 3 | tsc | args ... | ...
+    |--------|-----------------------------------|-------------------------------|-----
+
+    Arguments are encoded by their C type, picked with _Generic, not by the format string, so there's no parsing
+    at the call site. Every argument is a log_arg_type and its size in one byte, followed by its bytes as they are
+    in memory: 4 for an int, 8 for a double. Strings are copied, a u16 length and the bytes.
+
+    The file is mapped BINLOG_CHUNK_SIZE at a time and grows as it fills. Threads take room for a record with one
+    compare and swap, so records are in the order they took their room, which may not quite be the order of their
+    timestamps. A record never crosses into the next chunk: the one that would have goes at the start of the next one,
+    and what it skipped is padding.
+    The pages are the kernel's as soon as they're written, so what was logged is still in the file if the process crashes.
+
+    Levels below BINLOG_LEVEL compile to nothing, arguments and all, so BINLOG_TRACE can be left in hot code.
+    Define BINLOG_LEVEL before including this to pick the level. It's BINLOG_LEVEL_TRACE with DEBUG, and BINLOG_LEVEL_INFO otherwise.
+
+    BINLOG_INFO(log, "request %d took %.3f ms from %s", id, ms, address);
+    LIFETIME: Format strings have to be string literals, since the site holding them is static.
+*/
+
+#define BINLOG_LEVEL_TRACE 0
+#define BINLOG_LEVEL_DEBUG 1
+#define BINLOG_LEVEL_INFO 2
+#define BINLOG_LEVEL_WARN 3
+#define BINLOG_LEVEL_ERROR 4
+///Nothing is logged at all
+#define BINLOG_LEVEL_OFF 5
+
+#ifndef BINLOG_LEVEL
+#ifdef DEBUG
+#define BINLOG_LEVEL BINLOG_LEVEL_TRACE
+#else
+#define BINLOG_LEVEL BINLOG_LEVEL_INFO
+#endif
+#endif
+
+///How much of the file is mapped at once. The file grows by this much at a time.
+#define BINLOG_CHUNK_SIZE (16 * 1024 * 1024)
+///How many chunks the file can grow to. Records past that are dropped.
+#define BINLOG_MAX_CHUNKS 4096
+///The most the arguments of one call can take. Arguments past that decode as (?).
+#define BINLOG_MAX_ARGS 1024
+#define BINLOG_MAGIC "BINLOG\0\0"
+#define BINLOG_VERSION 1
+
+///Sites that aren't call sites. Real ones count up from 1.
+#define BINLOG_SITE_PADDING 0
+///The record of a call site's text
+#define BINLOG_SITE_TEXT 0xffffffffu
+///The record of the TSC's calibration, which the decoder uses for every record after it
+#define BINLOG_SITE_CLOCK 0xfffffffeu
+
+///At the start of the file
+PUBLIC
+struct binlog_header{
+    char magic[8];
+    u32 version;
+    u32 chunk_size;
+};
+typedef struct binlog_header binlog_header;
+
+///In front of every record
+PUBLIC
+struct binlog_record{
+    ///The size of the whole record, header and all. 0 means nothing was written here.
+    u32 size;
+    u32 site;
+    ///clock_tsc when it was logged
+    u64 tsc;
+};
+typedef struct binlog_record binlog_record;
+
+///What follows a BINLOG_SITE_TEXT record's header, followed by the file and the format string, both terminated
+PUBLIC
+struct binlog_site_text{
+    u32 id;
+    u32 line;
+    u32 level;
+};
+typedef struct binlog_site_text binlog_site_text;
+
+///What follows a BINLOG_SITE_CLOCK record's header, whose tsc is the calibration's
+PUBLIC
+struct binlog_clock{
+    u64 real_ns;
+    ///Nanoseconds per tick, as a 32.32 fixed point number
+    u64 mult;
+};
+typedef struct binlog_clock binlog_clock;
+
+///One call site, made static by the logging macros
+PUBLIC
+struct binlog_site{
+    str format;
+    str file;
+    u32 line;
+    u32 level;
+    ///0 until the site is first used
+    _Atomic u32 id;
+    ///The site registered after this one
+    INTERNAL
+    struct binlog_site* next;
+};
+typedef struct binlog_site binlog_site;
+
+///The encoded arguments of one call, built on the caller's stack
+PUBLIC
+struct binlog_args{
+    u32 used;
+    u8 bytes[BINLOG_MAX_ARGS];
+};
+typedef struct binlog_args binlog_args;
+
+PUBLIC
+struct binlog{
+    INTERNAL
+    int fd;
+    ///The offset in the file the next record goes at
+    INTERNAL
+    _Atomic u64 head;
+    INTERNAL
+    _Atomic(u8*) chunks[BINLOG_MAX_CHUNKS];
+    ///Held while mapping a chunk
+    INTERNAL
+    pthread_mutex_t map_lock;
+    INTERNAL
+    u64 file_size;
+    ///Set once a chunk couldn't be mapped, so that every call after doesn't try again
+    INTERNAL
+    bool full;
+    ///The highest site id whose text is in this log
+    INTERNAL
+    _Atomic u32 sites_written;
+    ///The last site whose text is in this log
+    INTERNAL
+    binlog_site* last_site;
+    INTERNAL
+    _Atomic u64 dropped;
+};
+typedef struct binlog binlog;
+
+///Every site that has been used, in the order of their ids
+INTERNAL
+binlog_site* binlog_first_site = NULL;
+INTERNAL
+binlog_site* binlog_last_site = NULL;
+INTERNAL
+u32 binlog_site_count = 0;
+///Held while registering a site, and while writing site texts into a log
+INTERNAL
+pthread_mutex_t binlog_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+///The name of [level], like INFO
+PUBLIC
+str binlog_level_name(u32 level){
+    static str names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+    return level < BINLOG_LEVEL_OFF ? names[level] : "?";
+}
+
+///Gets chunk [index] of the file, mapping it if no thread has yet. Returns NULL if it can't be mapped.
+INTERNAL
+RECEIVER(log)
+u8* binlog_chunk(binlog* log, u64 index){
+    if(index >= BINLOG_MAX_CHUNKS){
+        return NULL;
+    }
+    u8* chunk = atomic_load_explicit(&log->chunks[index], memory_order_acquire);
+    if(chunk != NULL){
+        return chunk;
+    }
+    pthread_mutex_lock(&log->map_lock);
+    chunk = atomic_load_explicit(&log->chunks[index], memory_order_relaxed);
+    if(chunk == NULL && !log->full){
+        u64 end = (index + 1) * (u64)BINLOG_CHUNK_SIZE;
+        ///A thread far ahead may have grown the file past this chunk already
+        if(end > log->file_size && ftruncate(log->fd, (off_t)end) != 0){
+            printf("binlog could not grow its file to %llu bytes: %s\n", (unsigned long long)end, strerror(errno));
+            log->full = true;
+        }else{
+            if(end > log->file_size){
+                log->file_size = end;
+            }
+            void* mapped = mmap(NULL, BINLOG_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, (off_t)(index * BINLOG_CHUNK_SIZE));
+            if(mapped == MAP_FAILED){
+                printf("binlog could not map chunk %llu: %s\n", (unsigned long long)index, strerror(errno));
+                log->full = true;
+            }else{
+                chunk = mapped;
+                atomic_store_explicit(&log->chunks[index], chunk, memory_order_release);
+            }
+        }
+    }
+    pthread_mutex_unlock(&log->map_lock);
+    return chunk;
+}
+
+///Takes [size] bytes of the file for a record. Returns NULL if the file can't hold any more.
+INTERNAL
+RECEIVER(log)
+u8* binlog_reserve(binlog* log, u32 size){
+    u64 at = atomic_load_explicit(&log->head, memory_order_relaxed);
+    u64 start;
+    do{
+        start = at;
+        ///A record that would run over the end of the chunk goes at the start of the next one instead
+        if(at % BINLOG_CHUNK_SIZE + size > BINLOG_CHUNK_SIZE){
+            start = at - at % BINLOG_CHUNK_SIZE + BINLOG_CHUNK_SIZE;
+        }
+    }while(!atomic_compare_exchange_weak_explicit(&log->head, &at, start + size, memory_order_relaxed, memory_order_relaxed));
+    ///What it skipped is marked as padding. When there isn't room for even that, the decoder knows to skip it.
+    if(start != at && BINLOG_CHUNK_SIZE - at % BINLOG_CHUNK_SIZE >= sizeof(binlog_record)){
+        u8* chunk = binlog_chunk(log, at / BINLOG_CHUNK_SIZE);
+        if(chunk != NULL){
+            binlog_record padding = { sizeof(binlog_record), BINLOG_SITE_PADDING, 0 };
+            memcpy(chunk + at % BINLOG_CHUNK_SIZE, &padding, sizeof(padding));
+        }
+    }
+    u8* chunk = binlog_chunk(log, start / BINLOG_CHUNK_SIZE);
+    return chunk == NULL ? NULL : chunk + start % BINLOG_CHUNK_SIZE;
+}
+
+///Writes the text of [site] into [log]
+INTERNAL
+RECEIVER(log)
+void binlog_write_site(binlog* log, binlog_site* site){
+    u32 file_length = (u32)strlen(site->file) + 1;
+    u32 format_length = (u32)strlen(site->format) + 1;
+    u32 size = sizeof(binlog_record) + sizeof(binlog_site_text) + file_length + format_length;
+    u8* at = binlog_reserve(log, size);
+    if(at == NULL){
+        return;
+    }
+    binlog_site_text text = { atomic_load_explicit(&site->id, memory_order_relaxed), site->line, site->level };
+    memcpy(at + sizeof(binlog_record), &text, sizeof(text));
+    memcpy(at + sizeof(binlog_record) + sizeof(text), site->file, file_length);
+    memcpy(at + sizeof(binlog_record) + sizeof(text) + file_length, site->format, format_length);
+    binlog_record record = { size, BINLOG_SITE_TEXT, clock_tsc() };
+    memcpy(at, &record, sizeof(record));
+}
+
+///Gives [site] an id if it doesn't have one, and makes sure its text, and every other site's before it, is in [log]
+INTERNAL
+RECEIVER(log)
+u32 binlog_register(binlog* log, binlog_site* site){
+    pthread_mutex_lock(&binlog_sites_lock);
+    if(atomic_load_explicit(&site->id, memory_order_relaxed) == 0){
+        site->next = NULL;
+        if(binlog_last_site == NULL){
+            binlog_first_site = site;
+        }else{
+            binlog_last_site->next = site;
+        }
+        binlog_last_site = site;
+        binlog_site_count += 1;
+        atomic_store_explicit(&site->id, binlog_site_count, memory_order_release);
+    }
+    binlog_site* next = log->last_site == NULL ? binlog_first_site : log->last_site->next;
+    while(next != NULL){
+        binlog_write_site(log, next);
+        log->last_site = next;
+        next = next->next;
+    }
+    ///Published after the texts are written, so no record of a site can be written before its text
+    atomic_store_explicit(&log->sites_written, binlog_site_count, memory_order_release);
+    pthread_mutex_unlock(&binlog_sites_lock);
+    return atomic_load_explicit(&site->id, memory_order_relaxed);
+}
+
+///Writes the current calibration of the TSC into [log], which the decoder uses for every record after it.
+///Call this after clock_recalibrate, if something calls it, so the dates in a long log don't drift.
+PUBLIC
+RECEIVER(log)
+void binlog_mark_clock(binlog* log){
+    clock_calibration calibration = clock_load();
+    u8* at = binlog_reserve(log, sizeof(binlog_record) + sizeof(binlog_clock));
+    if(at == NULL){
+        return;
+    }
+    binlog_clock clock = { calibration.real_ns, calibration.mult };
+    memcpy(at + sizeof(binlog_record), &clock, sizeof(clock));
+    binlog_record record = { sizeof(binlog_record) + sizeof(binlog_clock), BINLOG_SITE_CLOCK, calibration.tsc };
+    memcpy(at, &record, sizeof(record));
+}
+
+///Writes one call's record into [log]. The logging macros call this. Returns false if it was dropped.
+PUBLIC
+RECEIVER(log)
+bool binlog_commit(binlog* log, binlog_site* site, binlog_args* args){
+    u64 tsc = clock_tsc();
+    u32 id = atomic_load_explicit(&site->id, memory_order_acquire);
+    if(id == 0 || id > atomic_load_explicit(&log->sites_written, memory_order_acquire)){
+        id = binlog_register(log, site);
+    }
+    u32 size = sizeof(binlog_record) + args->used;
+    u8* at = binlog_reserve(log, size);
+    if(at == NULL){
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    memcpy(at + sizeof(binlog_record), args->bytes, args->used);
+    binlog_record record = { size, id, tsc };
+    memcpy(at, &record, sizeof(record));
+    return true;
+}
+
+///Writes the low [size] bytes of [bits] as an argument of [type]
+INTERNAL
+void binlog_put_bits(binlog_args* args, log_arg_type type, u64 bits, u32 size){
+    if(args->used + 1 + size > BINLOG_MAX_ARGS){
+        return;
+    }
+    args->bytes[args->used] = (u8)(type | size << 4);
+    memcpy(args->bytes + args->used + 1, &bits, size);
+    args->used += 1 + size;
+}
+
+HELPER
+void binlog_put_int(binlog_args* args, i64 value, u32 size){
+    binlog_put_bits(args, LOG_ARG_INT, (u64)value, size);
+}
+
+HELPER
+void binlog_put_uint(binlog_args* args, u64 value, u32 size){
+    binlog_put_bits(args, LOG_ARG_UINT, value, size);
+}
+
+///Plain char is signed or not depending on the platform
+HELPER
+void binlog_put_char(binlog_args* args, char value, u32 size){
+    binlog_put_bits(args, (char)-1 < 0 ? LOG_ARG_INT : LOG_ARG_UINT, (u64)(i64)value, size);
+}
+
+///Floats are kept as doubles, the same as printf gets them
+HELPER
+void binlog_put_double(binlog_args* args, double value, u32 size){
+    (void)size;
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    binlog_put_bits(args, LOG_ARG_DOUBLE, bits, sizeof(bits));
+}
+
+HELPER
+void binlog_put_long_double(binlog_args* args, long double value, u32 size){
+    binlog_put_double(args, (double)value, size);
+}
+
+HELPER
+void binlog_put_pointer(binlog_args* args, const void* value, u32 size){
+    (void)size;
+    binlog_put_bits(args, LOG_ARG_POINTER, (u64)(uintptr_t)value, sizeof(u64));
+}
+
+///Copies the string, cut to what's left rather than dropped, the same as log_capture
+HELPER
+void binlog_put_string(binlog_args* args, const char* value, u32 size){
+    (void)size;
+    if(value == NULL){
+        value = "(null)";
+    }
+    if(args->used + 1 + sizeof(u16) > BINLOG_MAX_ARGS){
+        return;
+    }
+    size_t length = strlen(value);
+    if(length > BINLOG_MAX_ARGS - args->used - 1 - sizeof(u16)){
+        length = BINLOG_MAX_ARGS - args->used - 1 - sizeof(u16);
+    }
+    u16 stored = (u16)length;
+    args->bytes[args->used] = LOG_ARG_STRING;
+    memcpy(args->bytes + args->used + 1, &stored, sizeof(stored));
+    memcpy(args->bytes + args->used + 1 + sizeof(stored), value, length);
+    args->used += 1 + sizeof(stored) + (u32)length;
+}
+
+///Encodes [value] by its C type. Anything that isn't a number or a string is kept as a pointer.
+#define binlog_put(args, value) _Generic((value), \
+    _Bool: binlog_put_uint, \
+    char: binlog_put_char, \
+    signed char: binlog_put_int, \
+    short: binlog_put_int, \
+    int: binlog_put_int, \
+    long: binlog_put_int, \
+    long long: binlog_put_int, \
+    unsigned char: binlog_put_uint, \
+    unsigned short: binlog_put_uint, \
+    unsigned int: binlog_put_uint, \
+    unsigned long: binlog_put_uint, \
+    unsigned long long: binlog_put_uint, \
+    float: binlog_put_double, \
+    double: binlog_put_double, \
+    long double: binlog_put_long_double, \
+    char*: binlog_put_string, \
+    const char*: binlog_put_string, \
+    default: binlog_put_pointer)(args, value, sizeof(value))
+
+///binlog_put on every argument, up to 16 of them
+#define BINLOG_COUNT(...) BINLOG_COUNT_AT(_, ##__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_COUNT_AT(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, count, ...) count
+#define BINLOG_JOIN(a, b) BINLOG_JOIN_AT(a, b)
+#define BINLOG_JOIN_AT(a, b) a##b
+#define BINLOG_PUT_ALL(args, ...) BINLOG_JOIN(BINLOG_PUT_, BINLOG_COUNT(__VA_ARGS__))(args, ##__VA_ARGS__)
+#define BINLOG_PUT_0(args)
+#define BINLOG_PUT_1(args, a) binlog_put(args, a);
+#define BINLOG_PUT_2(args, a, ...) binlog_put(args, a); BINLOG_PUT_1(args, __VA_ARGS__)
+#define BINLOG_PUT_3(args, a, ...) binlog_put(args, a); BINLOG_PUT_2(args, __VA_ARGS__)
+#define BINLOG_PUT_4(args, a, ...) binlog_put(args, a); BINLOG_PUT_3(args, __VA_ARGS__)
+#define BINLOG_PUT_5(args, a, ...) binlog_put(args, a); BINLOG_PUT_4(args, __VA_ARGS__)
+#define BINLOG_PUT_6(args, a, ...) binlog_put(args, a); BINLOG_PUT_5(args, __VA_ARGS__)
+#define BINLOG_PUT_7(args, a, ...) binlog_put(args, a); BINLOG_PUT_6(args, __VA_ARGS__)
+#define BINLOG_PUT_8(args, a, ...) binlog_put(args, a); BINLOG_PUT_7(args, __VA_ARGS__)
+#define BINLOG_PUT_9(args, a, ...) binlog_put(args, a); BINLOG_PUT_8(args, __VA_ARGS__)
+#define BINLOG_PUT_10(args, a, ...) binlog_put(args, a); BINLOG_PUT_9(args, __VA_ARGS__)
+#define BINLOG_PUT_11(args, a, ...) binlog_put(args, a); BINLOG_PUT_10(args, __VA_ARGS__)
+#define BINLOG_PUT_12(args, a, ...) binlog_put(args, a); BINLOG_PUT_11(args, __VA_ARGS__)
+#define BINLOG_PUT_13(args, a, ...) binlog_put(args, a); BINLOG_PUT_12(args, __VA_ARGS__)
+#define BINLOG_PUT_14(args, a, ...) binlog_put(args, a); BINLOG_PUT_13(args, __VA_ARGS__)
+#define BINLOG_PUT_15(args, a, ...) binlog_put(args, a); BINLOG_PUT_14(args, __VA_ARGS__)
+#define BINLOG_PUT_16(args, a, ...) binlog_put(args, a); BINLOG_PUT_15(args, __VA_ARGS__)
+
+///Logs [fmt] with everything after it into [log] at [level], whatever BINLOG_LEVEL is. Does nothing if [log] is NULL.
+#define BINLOG_WRITE(log, level, fmt, ...) do{ \
+    static binlog_site binlog_this_site = { fmt, __FILE__, __LINE__, level, 0, NULL }; \
+    binlog* binlog_target = (log); \
+    if(binlog_target != NULL){ \
+        binlog_args binlog_these_args; \
+        binlog_these_args.used = 0; \
+        BINLOG_PUT_ALL(&binlog_these_args, ##__VA_ARGS__) \
+        binlog_commit(binlog_target, &binlog_this_site, &binlog_these_args); \
+    } \
+}while(0)
+
+#if BINLOG_LEVEL <= BINLOG_LEVEL_TRACE
+#define BINLOG_TRACE(log, fmt, ...) BINLOG_WRITE(log, BINLOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define BINLOG_TRACE(log, fmt, ...) ((void)0)
+#endif
+#if BINLOG_LEVEL <= BINLOG_LEVEL_DEBUG
+#define BINLOG_DEBUG(log, fmt, ...) BINLOG_WRITE(log, BINLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define BINLOG_DEBUG(log, fmt, ...) ((void)0)
+#endif
+#if BINLOG_LEVEL <= BINLOG_LEVEL_INFO
+#define BINLOG_INFO(log, fmt, ...) BINLOG_WRITE(log, BINLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define BINLOG_INFO(log, fmt, ...) ((void)0)
+#endif
+#if BINLOG_LEVEL <= BINLOG_LEVEL_WARN
+#define BINLOG_WARN(log, fmt, ...) BINLOG_WRITE(log, BINLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define BINLOG_WARN(log, fmt, ...) ((void)0)
+#endif
+#if BINLOG_LEVEL <= BINLOG_LEVEL_ERROR
+#define BINLOG_ERROR(log, fmt, ...) BINLOG_WRITE(log, BINLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define BINLOG_ERROR(log, fmt, ...) ((void)0)
+#endif
+
+///Creates the file at [path], or empties it, and starts a log in it. Returns NULL if it can't.
+PUBLIC
+binlog* binlog_open(str path){
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("binlog could not open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    binlog* log = malloc(sizeof(binlog));
+    if(log == NULL){
+        close(fd);
+        return NULL;
+    }
+    memset(log, 0, sizeof(binlog));
+    log->fd = fd;
+    pthread_mutex_init(&log->map_lock, NULL);
+    atomic_init(&log->head, sizeof(binlog_header));
+    atomic_init(&log->sites_written, 0);
+    atomic_init(&log->dropped, 0);
+    u8* first = binlog_chunk(log, 0);
+    if(first == NULL){
+        pthread_mutex_destroy(&log->map_lock);
+        close(fd);
+        free(log);
+        return NULL;
+    }
+    binlog_header header = { BINLOG_MAGIC, BINLOG_VERSION, BINLOG_CHUNK_SIZE };
+    memcpy(first, &header, sizeof(header));
+    clock_init();
+    binlog_mark_clock(log);
+    return log;
+}
+
+///How many records have been dropped because the file couldn't grow
+PUBLIC
+RECEIVER(log)
+u64 binlog_dropped(binlog* log){
+    return atomic_load_explicit(&log->dropped, memory_order_relaxed);
+}
+
+///Waits until everything logged so far is on the disk, not just with the kernel
+PUBLIC
+RECEIVER(log)
+void binlog_sync(binlog* log){
+    for(u32 i = 0; i < BINLOG_MAX_CHUNKS; i++){
+        u8* chunk = atomic_load_explicit(&log->chunks[i], memory_order_acquire);
+        if(chunk == NULL){
+            break;
+        }
+        msync(chunk, BINLOG_CHUNK_SIZE, MS_SYNC);
+    }
+}
+
+///Unmaps the file, cuts it to what was written, and frees the log.
+///NOTE: No thread may log to it once this has started.
+PUBLIC
+RECEIVER(log)
+void binlog_close(binlog* log){
+    binlog_mark_clock(log);
+    u64 end = atomic_load_explicit(&log->head, memory_order_relaxed);
+    if(end > log->file_size){
+        end = log->file_size;
+    }
+    for(u32 i = 0; i < BINLOG_MAX_CHUNKS; i++){
+        u8* chunk = atomic_load_explicit(&log->chunks[i], memory_order_relaxed);
+        if(chunk != NULL){
+            munmap(chunk, BINLOG_CHUNK_SIZE);
+        }
+    }
+    if(ftruncate(log->fd, (off_t)end) != 0){
+        printf("binlog could not cut its file to %llu bytes: %s\n", (unsigned long long)end, strerror(errno));
+    }
+    close(log->fd);
+    pthread_mutex_destroy(&log->map_lock);
+    free(log);
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/*
+    A bip buffer is a ring buffer for variable-sized records that never splits a record across the wrap.
+    Instead of one region that wraps around, it keeps up to two regions that don't: A, which is read from,
+    and B, which starts at the beginning of the buffer once there's no room left after A.
+
+    |-----------------|=====================================|--------------|
+    |   B (written)   |          free          |  A (read)  |     free     |
+    |-----------------|=====================================|--------------|
+    0                 b_size                   a_start      a_start + a_size
+
+    A reservation is always contiguous, so a serializer can write a whole record in place, and the readable
+    data is at most two contiguous runs, so a reader can hand both straight to writev.
+    When A is fully released, B becomes the new A.
+
+    bip_buffer is for one thread, or for callers doing their own locking.
+    spsc_bip_buffer is the same idea for exactly one producer thread and one consumer thread without a lock,
+    using a read index, a write index and a watermark that marks where the data before a wrap ends.
+*/
+
+#define BIP_ALIGN 64
+
+PUBLIC
+EXTENSION(arena)
+struct bip_buffer{
+    INTERNAL
+    u8* data;
+    INTERNAL
+    u32 size;
+    ///Where region A starts and how much is in it
+    INTERNAL
+    u32 a_start;
+    INTERNAL
+    u32 a_size;
+    ///How much is in region B, which always starts at 0
+    INTERNAL
+    u32 b_size;
+    ///The reservation handed out by bip_reserve, if any
+    INTERNAL
+    u32 reserve_start;
+    INTERNAL
+    u32 reserve_size;
+};
+typedef struct bip_buffer bip_buffer;
+
+///Creates a new bip buffer of [size] bytes in the given greedy arena
+PUBLIC
+RECEIVER(arena)
+bip_buffer* create_bip_buffer(arena_alloc* arena, u32 size){
+    ///NOTE: arena_put doesn't align, so the header is reserved aligned and filled in place
+    bip_buffer* buffer = arena_reserve_aligned(arena, sizeof(bip_buffer), _Alignof(bip_buffer));
+    u8* data = arena_reserve_aligned(arena, size, BIP_ALIGN);
+    if(buffer == NULL || data == NULL){
+        return NULL;
+    }
+    *buffer = (bip_buffer){ .data = data, .size = size };
+    return buffer;
+}
+
+///Reserves [size] contiguous bytes to write a record into. Returns NULL if there isn't a run that long free.
+///Only one reservation can be open at a time, reserving again replaces it.
+PUBLIC
+RECEIVER(buffer)
+void* bip_reserve(bip_buffer* buffer, u32 size){
+    u32 start;
+    if(buffer->b_size != 0){
+        ///B is in use, so the only room is between the end of B and the start of A
+        if(size > buffer->a_start - buffer->b_size){
+            return NULL;
+        }
+        start = buffer->b_size;
+    }else{
+        if(buffer->a_size == 0){
+            ///Nothing to keep, so the whole buffer is free
+            buffer->a_start = 0;
+        }
+        u32 a_end = buffer->a_start + buffer->a_size;
+        if(size <= buffer->size - a_end){
+            start = a_end;
+        }else if(size <= buffer->a_start){
+            ///Not enough room after A, so start B at the beginning
+            start = 0;
+        }else{
+            return NULL;
+        }
+    }
+    buffer->reserve_start = start;
+    buffer->reserve_size = size;
+    return buffer->data + start;
+}
+
+///Makes the first [size] bytes of the open reservation readable and closes it.
+///[size] can be less than what was reserved, if the record came out smaller.
+PUBLIC
+RECEIVER(buffer)
+void bip_commit(bip_buffer* buffer, u32 size){
+    if(size > buffer->reserve_size){
+        printf("Cannot commit %i bytes of a %i byte reservation\n", size, buffer->reserve_size);
+        size = buffer->reserve_size;
+    }
+    if(size != 0){
+        if(buffer->a_size == 0 && buffer->b_size == 0){
+            buffer->a_start = buffer->reserve_start;
+            buffer->a_size = size;
+        }else if(buffer->reserve_start == buffer->a_start + buffer->a_size){
+            buffer->a_size += size;
+        }else{
+            buffer->b_size += size;
+        }
+    }
+    buffer->reserve_start = 0;
+    buffer->reserve_size = 0;
+}
+
+///Gets the first contiguous run of readable bytes and sets [size] to its length. Returns NULL if there's nothing to read.
+PUBLIC
+RECEIVER(buffer)
+void* bip_read(bip_buffer* buffer, OUT u32* size){
+    *size = buffer->a_size;
+    return buffer->a_size == 0 ? NULL : buffer->data + buffer->a_start;
+}
+
+///Fills [regions] with every readable byte in order, which is at most two runs, and returns how many there are.
+///EXAMPLE: writev(fd, regions, bip_read_regions(buffer, regions));
+PUBLIC
+RECEIVER(buffer)
+u32 bip_read_regions(bip_buffer* buffer, OUT struct iovec regions[2]){
+    u32 count = 0;
+    if(buffer->a_size != 0){
+        regions[count].iov_base = buffer->data + buffer->a_start;
+        regions[count].iov_len = buffer->a_size;
+        count += 1;
+    }
+    if(buffer->b_size != 0){
+        regions[count].iov_base = buffer->data;
+        regions[count].iov_len = buffer->b_size;
+        count += 1;
+    }
+    return count;
+}
+
+///Gives back the first [size] readable bytes. Releasing more than region A moves on into region B,
+///so the total from bip_read_regions can be released in one call.
+PUBLIC
+RECEIVER(buffer)
+void bip_release(bip_buffer* buffer, u32 size){
+    if(size < buffer->a_size){
+        buffer->a_start += size;
+        buffer->a_size -= size;
+        return;
+    }
+    size -= buffer->a_size;
+    ///A is used up, so B becomes the new A
+    buffer->a_start = 0;
+    buffer->a_size = buffer->b_size;
+    buffer->b_size = 0;
+    if(size != 0){
+        buffer->a_start = size < buffer->a_size ? size : buffer->a_size;
+        buffer->a_size -= buffer->a_start;
+    }
+}
+
+///Gets how many bytes are committed and not yet released
+PUBLIC
+RECEIVER(buffer)
+u32 bip_count(bip_buffer* buffer){
+    return buffer->a_size + buffer->b_size;
+}
+
+#define BIP_CACHE_LINE 64
+
+/*
+    The single-producer/single-consumer bip buffer. The producer owns [write] and [watermark],
+    the consumer owns [read], and each of them sits on its own cache line.
+
+    [watermark] is where the readable data stops before the producer wrapped back to 0. The consumer reads
+    from [read] up to [write], or, when [write] is behind [read], up to [watermark] and then from 0.
+    Keeping [write] from catching up to [read] from behind means write == read always means empty.
+*/
+PUBLIC
+EXTENSION(arena)
+struct spsc_bip_buffer{
+    ///One past the last committed byte. Only the producer writes this.
+    INTERNAL
+    _Alignas(BIP_CACHE_LINE) _Atomic u32 write;
+    ///Where the data ends before the wrap. Only the producer writes this.
+    INTERNAL
+    _Atomic u32 watermark;
+    ///Where the open reservation starts
+    INTERNAL
+    u32 reserve_start;
+
+    ///The first unreleased byte. Only the consumer writes this.
+    INTERNAL
+    _Alignas(BIP_CACHE_LINE) _Atomic u32 read;
+
+    INTERNAL
+    _Alignas(BIP_CACHE_LINE) u8* data;
+    INTERNAL
+    u32 size;
+};
+typedef struct spsc_bip_buffer spsc_bip_buffer;
+
+///Creates a new single-producer/single-consumer bip buffer of [size] bytes in the given greedy arena
+PUBLIC
+RECEIVER(arena)
+spsc_bip_buffer* create_spsc_bip_buffer(arena_alloc* arena, u32 size){
+    spsc_bip_buffer* buffer = arena_reserve_aligned(arena, sizeof(spsc_bip_buffer), BIP_CACHE_LINE);
+    u8* data = arena_reserve_aligned(arena, size, BIP_ALIGN);
+    if(buffer == NULL || data == NULL){
+        return NULL;
+    }
+    atomic_init(&buffer->write, 0);
+    atomic_init(&buffer->watermark, 0);
+    buffer->reserve_start = 0;
+    atomic_init(&buffer->read, 0);
+    buffer->data = data;
+    buffer->size = size;
+    return buffer;
+}
+
+///Reserves [size] contiguous bytes to write a record into. Producer only.
+///Returns NULL if there isn't a run that long free.
+PUBLIC
+RECEIVER(buffer)
+void* spsc_bip_reserve(spsc_bip_buffer* buffer, u32 size){
+    u32 write = atomic_load_explicit(&buffer->write, memory_order_relaxed);
+    u32 read = atomic_load_explicit(&buffer->read, memory_order_acquire);
+    u32 start;
+    if(write < read){
+        ///Already wrapped, so the room is up to just before the reader
+        if(size >= read - write){
+            return NULL;
+        }
+        start = write;
+    }else if(size <= buffer->size - write){
+        start = write;
+    }else if(size < read){
+        ///Not enough room before the end, so wrap back to 0
+        start = 0;
+    }else{
+        return NULL;
+    }
+    buffer->reserve_start = start;
+    return buffer->data + start;
+}
+
+///Makes the first [size] bytes of the open reservation readable. Producer only.
+PUBLIC
+RECEIVER(buffer)
+void spsc_bip_commit(spsc_bip_buffer* buffer, u32 size){
+    u32 write = atomic_load_explicit(&buffer->write, memory_order_relaxed);
+    u32 new_write = buffer->reserve_start + size;
+    if(new_write < write){
+        ///We wrapped, so the data before the wrap ends where [write] was
+        atomic_store_explicit(&buffer->watermark, write, memory_order_release);
+    }else if(new_write > atomic_load_explicit(&buffer->watermark, memory_order_relaxed)){
+        ///Past the old watermark, so it no longer means anything until the next wrap
+        atomic_store_explicit(&buffer->watermark, buffer->size, memory_order_release);
+    }
+    atomic_store_explicit(&buffer->write, new_write, memory_order_release);
+    buffer->reserve_start = new_write;
+}
+
+///Gets the next contiguous run of readable bytes and sets [size] to its length. Consumer only.
+///Returns NULL if there's nothing to read.
+PUBLIC
+RECEIVER(buffer)
+void* spsc_bip_read(spsc_bip_buffer* buffer, OUT u32* size){
+    u32 write = atomic_load_explicit(&buffer->write, memory_order_acquire);
+    u32 watermark = atomic_load_explicit(&buffer->watermark, memory_order_acquire);
+    u32 read = atomic_load_explicit(&buffer->read, memory_order_relaxed);
+    if(read == watermark && write < read){
+        ///Everything before the wrap has been read, so follow the producer back to 0
+        read = 0;
+        atomic_store_explicit(&buffer->read, 0, memory_order_release);
+    }
+    *size = write < read ? watermark - read : write - read;
+    return *size == 0 ? NULL : buffer->data + read;
+}
+
+///Gives back the first [size] bytes of what spsc_bip_read handed out. Consumer only.
+PUBLIC
+RECEIVER(buffer)
+void spsc_bip_release(spsc_bip_buffer* buffer, u32 size){
+    u32 read = atomic_load_explicit(&buffer->read, memory_order_relaxed);
+    atomic_store_explicit(&buffer->read, read + size, memory_order_release);
+}
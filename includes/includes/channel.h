@@ -0,0 +1,386 @@
+#pragma once
+
+#include "commons.h"
+#include "deque.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+    A bounded single-producer/single-consumer channel on top of a deque's ring of slots.
+    Exactly one thread sends and exactly one thread receives, and neither ever takes a lock.
+
+    The producer owns [tail] and the consumer owns [head]. Each sits on its own cache line, along with a
+    cached copy of the other side's index, so a thread only reads the other's line when its cached copy
+    says the channel looks full (or empty). Slots are published with a release store of [tail] and handed
+    back with a release store of [head], and each side reads the other's index with an acquire load.
+
+    |----------------------------|----------------------------|----------------------------|
+    | tail | cached_head | parked | head | cached_tail | parked | slots | mask | slot_size  |
+    |----------------------------|----------------------------|----------------------------|
+      producer's cache line        consumer's cache line        read-only after init
+
+    Zero copy: channel_reserve hands the producer the free slots themselves to write into and
+    channel_commit publishes however many it filled. channel_peek and channel_consume are the same for
+    the consumer. The batch send and receive are built on them, with at most two memcpys per batch.
+
+    The waiting sends and receives spin for [spin_limit] tries first, then park on a futex until the
+    other side moves its index. The other side only makes the wake syscall when someone is parked.
+    Each side parks on a wake counter of its own rather than on an index, so channel_close can wake it too.
+*/
+
+#define CHANNEL_CACHE_LINE 64
+///How many times a waiting send or receive tries again before it parks
+#define CHANNEL_DEFAULT_SPIN 1024
+
+PUBLIC
+EXTENSION(deque)
+struct channel{
+    ///Counter one past the last published slot. Only the producer writes this.
+    INTERNAL
+    _Alignas(CHANNEL_CACHE_LINE) _Atomic u32 tail;
+    ///The producer's last look at [head]
+    INTERNAL
+    u32 cached_head;
+    ///Set while the producer is parked waiting for room
+    INTERNAL
+    _Atomic u32 producer_parked;
+    ///The futex the producer parks on. Bumped by whoever wakes it.
+    INTERNAL
+    _Atomic u32 producer_wake;
+
+    ///Counter of the first unconsumed slot. Only the consumer writes this.
+    INTERNAL
+    _Alignas(CHANNEL_CACHE_LINE) _Atomic u32 head;
+    ///The consumer's last look at [tail]
+    INTERNAL
+    u32 cached_tail;
+    ///Set while the consumer is parked waiting for slots
+    INTERNAL
+    _Atomic u32 consumer_parked;
+    ///The futex the consumer parks on. Bumped by whoever wakes it.
+    INTERNAL
+    _Atomic u32 consumer_wake;
+
+    ///The deque whose slots this channel uses
+    INTERNAL
+    _Alignas(CHANNEL_CACHE_LINE) deque_alloc* deque;
+    INTERNAL
+    u8* slots;
+    INTERNAL
+    u32 mask;
+    INTERNAL
+    u32 slot_size;
+    ///How many times a waiting send or receive tries again before it parks.
+    ///0 parks straight away and UINT_MAX never parks.
+    INTERNAL
+    u32 spin_limit;
+    ///Set by channel_close
+    INTERNAL
+    _Atomic u32 closed;
+};
+typedef struct channel channel;
+
+INTERNAL
+void channel_futex_wait(_Atomic u32* addr, u32 expected){
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+///Bumps a wake counter and wakes whoever is parked on it. Bumping first means a thread that read the counter
+///before this and hasn't made it into the futex yet won't sleep, since the value it expects is gone.
+INTERNAL
+void channel_futex_wake(_Atomic u32* addr){
+    atomic_fetch_add(addr, 1);
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+INTERNAL
+void channel_cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+///Initializes a new channel that uses the slots of [deque], which has to be empty and can't be growable,
+///since a growing deque moves its slots. The channel takes over the slots, so don't push or pop the deque directly anymore.
+///MEM: Borrowed-always
+///LIFETIME: Until passed into channel_deinit. The deque has to outlive the channel.
+RECEIVER(deque)
+channel* channel_init(deque_alloc* deque){
+    if(deque == NULL){
+        printf("Expected a deque_alloc* for the channel's slots, but instead got NULL!\n");
+        return NULL;
+    }
+    if(deque->growable || deque_count(deque) != 0){
+        printf("A channel needs an empty deque that can't grow\n");
+        return NULL;
+    }
+    channel* chan = aligned_alloc(CHANNEL_CACHE_LINE, sizeof(channel));
+    if(chan == NULL){
+        return NULL;
+    }
+    atomic_init(&chan->tail, 0);
+    chan->cached_head = 0;
+    atomic_init(&chan->producer_parked, 0);
+    atomic_init(&chan->producer_wake, 0);
+    atomic_init(&chan->head, 0);
+    chan->cached_tail = 0;
+    atomic_init(&chan->consumer_parked, 0);
+    atomic_init(&chan->consumer_wake, 0);
+    chan->deque = deque;
+    chan->slots = deque->slots;
+    chan->mask = deque->mask;
+    chan->slot_size = deque->slot_size;
+    chan->spin_limit = CHANNEL_DEFAULT_SPIN;
+    atomic_init(&chan->closed, 0);
+    return chan;
+}
+
+///Frees the channel. The deque it used is left alone.
+RECEIVER(chan)
+void channel_deinit(channel* chan){
+    free(chan);
+}
+
+///Sets how many times a waiting send or receive tries again before it parks on a futex.
+///0 always parks straight away, and UINT_MAX spins forever, which is only worth it with a core each.
+RECEIVER(chan)
+void channel_set_spin(channel* chan, u32 spin_limit){
+    chan->spin_limit = spin_limit;
+}
+
+///Closes the channel. Waiting sends fail, and waiting receives fail once the channel is drained.
+RECEIVER(chan)
+void channel_close(channel* chan){
+    atomic_store(&chan->closed, 1);
+    channel_futex_wake(&chan->consumer_wake);
+    channel_futex_wake(&chan->producer_wake);
+}
+
+///channel_reserve, but for the free slots after the first [skip] of them, which are already reserved
+INTERNAL
+RECEIVER(chan)
+void* channel_reserve_after(channel* chan, u32 skip, u32 count, OUT u32* reserved){
+    u32 tail = atomic_load_explicit(&chan->tail, memory_order_relaxed) + skip;
+    u32 capacity = chan->mask + 1;
+    u32 free_slots = capacity - (tail - chan->cached_head);
+    if(free_slots < count){
+        ///Only look at the consumer's line when the cached head says there isn't room
+        chan->cached_head = atomic_load_explicit(&chan->head, memory_order_acquire);
+        free_slots = capacity - (tail - chan->cached_head);
+    }
+    u32 idx = tail & chan->mask;
+    u32 contiguous = capacity - idx;
+    if(count > free_slots){
+        count = free_slots;
+    }
+    if(count > contiguous){
+        count = contiguous;
+    }
+    *reserved = count;
+    return count == 0 ? NULL : chan->slots + (size_t)idx * chan->slot_size;
+}
+
+///Gets up to [count] free slots to write into, without copying anything. Producer only.
+///The slots are contiguous, so fewer than [count] come back if the ring wraps, even if more are free.
+///[reserved] is set to how many slots there are. Returns NULL with [reserved] 0 if the channel is full.
+RECEIVER(chan)
+void* channel_reserve(channel* chan, u32 count, OUT u32* reserved){
+    return channel_reserve_after(chan, 0, count, reserved);
+}
+
+///Publishes the first [count] reserved slots to the consumer. Producer only.
+RECEIVER(chan)
+void channel_commit(channel* chan, u32 count){
+    u32 tail = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+    atomic_store_explicit(&chan->tail, tail + count, memory_order_release);
+    ///Pairs with the fence in channel_wait_readable, so either the consumer sees the new tail or we see it parked
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&chan->consumer_parked, memory_order_relaxed)){
+        channel_futex_wake(&chan->consumer_wake);
+    }
+}
+
+///channel_peek, but for the published slots after the first [skip] of them, which are already peeked
+INTERNAL
+RECEIVER(chan)
+void* channel_peek_after(channel* chan, u32 skip, u32 count, OUT u32* available){
+    u32 head = atomic_load_explicit(&chan->head, memory_order_relaxed) + skip;
+    u32 ready = chan->cached_tail - head;
+    if(ready < count){
+        chan->cached_tail = atomic_load_explicit(&chan->tail, memory_order_acquire);
+        ready = chan->cached_tail - head;
+    }
+    u32 idx = head & chan->mask;
+    u32 contiguous = chan->mask + 1 - idx;
+    if(count > ready){
+        count = ready;
+    }
+    if(count > contiguous){
+        count = contiguous;
+    }
+    *available = count;
+    return count == 0 ? NULL : chan->slots + (size_t)idx * chan->slot_size;
+}
+
+///Gets up to [count] published slots to read, without copying anything. Consumer only.
+///The slots are contiguous, so fewer than [count] come back if the ring wraps.
+///[available] is set to how many slots there are. Returns NULL with [available] 0 if the channel is empty.
+RECEIVER(chan)
+void* channel_peek(channel* chan, u32 count, OUT u32* available){
+    return channel_peek_after(chan, 0, count, available);
+}
+
+///Hands the first [count] peeked slots back to the producer. Consumer only.
+RECEIVER(chan)
+void channel_consume(channel* chan, u32 count){
+    u32 head = atomic_load_explicit(&chan->head, memory_order_relaxed);
+    atomic_store_explicit(&chan->head, head + count, memory_order_release);
+    ///Pairs with the fence in channel_wait_writable
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&chan->producer_parked, memory_order_relaxed)){
+        channel_futex_wake(&chan->producer_wake);
+    }
+}
+
+///Copies up to [count] contiguous elements from [data] into the channel and publishes them all at once.
+///Returns how many were sent, which is less than [count] if the channel filled up.
+RECEIVER(chan)
+u32 channel_send_n(channel* chan, void* data, u32 count){
+    u32 sent = 0;
+    ///At most two goes: up to the end of the ring, then from its start
+    for(u32 run = 0; run < 2 && sent < count; run++){
+        u32 reserved;
+        void* slots = channel_reserve_after(chan, sent, count - sent, &reserved);
+        if(slots == NULL){
+            break;
+        }
+        memcpy(slots, (u8*)data + (size_t)sent * chan->slot_size, (size_t)reserved * chan->slot_size);
+        sent += reserved;
+    }
+    if(sent != 0){
+        channel_commit(chan, sent);
+    }
+    return sent;
+}
+
+///Copies up to [count] elements out of the channel into [data] and consumes them all at once.
+///Returns how many were received, which is less than [count] if the channel ran dry.
+RECEIVER(chan)
+u32 channel_recv_n(channel* chan, OUT void* data, u32 count){
+    u32 received = 0;
+    for(u32 run = 0; run < 2 && received < count; run++){
+        u32 available;
+        void* slots = channel_peek_after(chan, received, count - received, &available);
+        if(slots == NULL){
+            break;
+        }
+        memcpy((u8*)data + (size_t)received * chan->slot_size, slots, (size_t)available * chan->slot_size);
+        received += available;
+    }
+    if(received != 0){
+        channel_consume(chan, received);
+    }
+    return received;
+}
+
+///Sends one element if there's room. Returns false if the channel is full.
+RECEIVER(chan)
+bool channel_try_send(channel* chan, void* data){
+    return channel_send_n(chan, data, 1) == 1;
+}
+
+///Receives one element into [data] if there is one. Returns false if the channel is empty.
+RECEIVER(chan)
+bool channel_try_recv(channel* chan, OUT void* data){
+    return channel_recv_n(chan, data, 1) == 1;
+}
+
+///Spins and then parks until there's at least one free slot. Producer only.
+///Use this with channel_reserve to wait for room without copying. Returns false if the channel was closed first.
+RECEIVER(chan)
+bool channel_wait_writable(channel* chan){
+    u32 spins = 0;
+    for(;;){
+        u32 tail = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+        if(tail - atomic_load_explicit(&chan->head, memory_order_acquire) <= chan->mask){
+            return true;
+        }
+        if(atomic_load_explicit(&chan->closed, memory_order_relaxed)){
+            return false;
+        }
+        if(spins < chan->spin_limit){
+            spins += 1;
+            channel_cpu_relax();
+            continue;
+        }
+        u32 wake = atomic_load(&chan->producer_wake);
+        atomic_store_explicit(&chan->producer_parked, 1, memory_order_relaxed);
+        ///Pairs with the fence in channel_consume, so either we see the new head or it sees us parked
+        atomic_thread_fence(memory_order_seq_cst);
+        if(tail - atomic_load_explicit(&chan->head, memory_order_acquire) > chan->mask && !atomic_load(&chan->closed)){
+            channel_futex_wait(&chan->producer_wake, wake);
+        }
+        atomic_store_explicit(&chan->producer_parked, 0, memory_order_relaxed);
+    }
+}
+
+///Spins and then parks until there's at least one published slot. Consumer only.
+///Use this with channel_peek to wait for elements without copying.
+///Returns false if the channel was closed and there's nothing left in it.
+RECEIVER(chan)
+bool channel_wait_readable(channel* chan){
+    u32 spins = 0;
+    for(;;){
+        u32 head = atomic_load_explicit(&chan->head, memory_order_relaxed);
+        if(atomic_load_explicit(&chan->tail, memory_order_acquire) != head){
+            return true;
+        }
+        if(atomic_load_explicit(&chan->closed, memory_order_acquire)){
+            ///Everything sent before the close is still there to drain
+            return atomic_load_explicit(&chan->tail, memory_order_acquire) != head;
+        }
+        if(spins < chan->spin_limit){
+            spins += 1;
+            channel_cpu_relax();
+            continue;
+        }
+        u32 wake = atomic_load(&chan->consumer_wake);
+        atomic_store_explicit(&chan->consumer_parked, 1, memory_order_relaxed);
+        ///Pairs with the fence in channel_commit, so either we see the new tail or it sees us parked
+        atomic_thread_fence(memory_order_seq_cst);
+        if(atomic_load_explicit(&chan->tail, memory_order_acquire) == head && !atomic_load(&chan->closed)){
+            channel_futex_wait(&chan->consumer_wake, wake);
+        }
+        atomic_store_explicit(&chan->consumer_parked, 0, memory_order_relaxed);
+    }
+}
+
+///Sends one element, spinning and then parking until there's room.
+///Returns false if the channel was closed first.
+RECEIVER(chan)
+bool channel_send_wait(channel* chan, void* data){
+    while(!channel_try_send(chan, data)){
+        if(!channel_wait_writable(chan)){
+            return false;
+        }
+    }
+    return true;
+}
+
+///Receives one element into [data], spinning and then parking until there is one.
+///Returns false if the channel was closed and there's nothing left in it.
+RECEIVER(chan)
+bool channel_recv_wait(channel* chan, OUT void* data){
+    while(!channel_try_recv(chan, data)){
+        if(!channel_wait_readable(chan)){
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "commons.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+/*
+    Timestamps that cost a few ns to take, and dates that cost a few ns to print.
+
+    clock_tsc reads the cpu's timestamp counter, which is one instruction. clock_init measures how fast it
+    ticks against CLOCK_MONOTONIC and CLOCK_REALTIME, and from then on a tick count turns into either clock's
+    nanoseconds with a multiply and a shift. Where there is no invariant TSC, clock_tsc is CLOCK_MONOTONIC
+    in nanoseconds instead, and everything else works the same, only slower.
+
+    calibration:    tsc ----- mult -----> ns since [mono_ns] / [real_ns]
+                     ^ [tsc]
+
+    The first calibration only watches the counter for CLOCK_CALIBRATE_NS, so the rate is only roughly right.
+    clock_recalibrate measures the rate again over everything since clock_init, which gets more exact the
+    longer the process runs, and moves the base up to now so CLOCK_REALTIME steps are picked up.
+    Something long-running, like async_log's background thread, calls it every so often.
+    Readers never lock, the calibration is published under a sequence number.
+
+    clock_coarse_* read the kernel's coarse clocks, which are as cheap as the TSC but only move every tick.
+
+    A date is printed through a per-thread cache of the text for the current second, so within a second only
+    the sub-second digits are written, and localtime_r only runs once a second:
+    Mon Oct 19 12:00:01.123456 2026
+*/
+
+///How long clock_init watches the counter for
+#define CLOCK_CALIBRATE_NS 2000000
+///The most sub-second digits a date can have
+#define CLOCK_MAX_DIGITS 9
+
+PUBLIC
+struct clock_calibration{
+    ///The counter and both clocks, read at the same moment
+    u64 tsc;
+    u64 mono_ns;
+    u64 real_ns;
+    ///Nanoseconds per tick, as a 32.32 fixed point number
+    u64 mult;
+};
+typedef struct clock_calibration clock_calibration;
+
+///Even while the calibration is being written, odd when it's in the middle of it
+INTERNAL
+_Atomic u32 clock_sequence = 0;
+INTERNAL
+clock_calibration clock_current;
+///The very first calibration, which clock_recalibrate measures the rate from
+INTERNAL
+clock_calibration clock_origin;
+///Whether clock_tsc really reads the TSC
+INTERNAL
+bool clock_has_tsc = false;
+INTERNAL
+_Atomic bool clock_ready = false;
+INTERNAL
+pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+
+HELPER
+u64 clock_read(clockid_t id){
+    struct timespec now;
+    clock_gettime(id, &now);
+    return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+///CLOCK_MONOTONIC in nanoseconds, exact, through the vDSO
+PUBLIC
+u64 clock_mono_ns(){
+    return clock_read(CLOCK_MONOTONIC);
+}
+
+///CLOCK_REALTIME in nanoseconds since the epoch, exact, through the vDSO
+PUBLIC
+u64 clock_real_ns(){
+    return clock_read(CLOCK_REALTIME);
+}
+
+///CLOCK_MONOTONIC_COARSE in nanoseconds. Only moves once per kernel tick, a few ms.
+PUBLIC
+u64 clock_coarse_mono_ns(){
+    return clock_read(CLOCK_MONOTONIC_COARSE);
+}
+
+///CLOCK_REALTIME_COARSE in nanoseconds since the epoch. Only moves once per kernel tick, a few ms.
+PUBLIC
+u64 clock_coarse_real_ns(){
+    return clock_read(CLOCK_REALTIME_COARSE);
+}
+
+///Reads the counter without making sure it's calibrated, for the calibration itself
+INTERNAL
+u64 clock_tsc_raw(){
+#if defined(__x86_64__) || defined(__i386__)
+    if(clock_has_tsc){
+        return __rdtsc();
+    }
+#endif
+    return clock_mono_ns();
+}
+
+///Reads the counter and both clocks as close to the same moment as it can, by keeping the try where reading
+///the clocks took the fewest ticks, and taking the counter halfway through it
+INTERNAL
+clock_calibration clock_sample(){
+    clock_calibration best = { 0 };
+    u64 best_span = UINT64_MAX;
+    for(u32 i = 0; i < 16; i++){
+        u64 before = clock_tsc_raw();
+        u64 mono = clock_mono_ns();
+        u64 real = clock_real_ns();
+        u64 after = clock_tsc_raw();
+        if(after - before < best_span){
+            best_span = after - before;
+            best = (clock_calibration){ before + (after - before) / 2, mono, real, 0 };
+        }
+    }
+    return best;
+}
+
+///Publishes [calibration] so that readers never see half of it
+INTERNAL
+void clock_publish(clock_calibration calibration){
+    u32 sequence = atomic_load_explicit(&clock_sequence, memory_order_relaxed);
+    atomic_store_explicit(&clock_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    clock_current = calibration;
+    atomic_store_explicit(&clock_sequence, sequence + 2, memory_order_release);
+}
+
+///Whether the cpu has a TSC that ticks at a constant rate through frequency changes and sleep states
+INTERNAL
+bool clock_tsc_invariant(){
+#if defined(__x86_64__) || defined(__i386__)
+    u32 eax, ebx, ecx, edx;
+    if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)){
+        return (edx & (1u << 8)) != 0;
+    }
+#endif
+    return false;
+}
+
+INTERNAL
+void clock_calibrate(){
+    clock_has_tsc = clock_tsc_invariant();
+    clock_calibration start = clock_sample();
+    if(!clock_has_tsc){
+        ///The "ticks" are CLOCK_MONOTONIC ns already
+        start.mult = 1ull << 32;
+        clock_origin = start;
+        clock_publish(start);
+        return;
+    }
+    u64 until = start.mono_ns + CLOCK_CALIBRATE_NS;
+    while(clock_mono_ns() < until){
+    }
+    clock_calibration end = clock_sample();
+    end.mult = (u64)(((unsigned __int128)(end.mono_ns - start.mono_ns) << 32) / (end.tsc - start.tsc));
+    start.mult = end.mult;
+    clock_origin = start;
+    clock_publish(end);
+}
+
+///Calibrates the counter, once per process, waiting for it if another thread is already doing it.
+///Everything that turns ticks into ns calls this itself, so calling it first only moves the wait to a better time.
+PUBLIC
+void clock_init(){
+    if(!atomic_load_explicit(&clock_ready, memory_order_acquire)){
+        pthread_once(&clock_once, clock_calibrate);
+        atomic_store_explicit(&clock_ready, true, memory_order_release);
+    }
+}
+
+///Reads the timestamp counter, or CLOCK_MONOTONIC in nanoseconds if there's no invariant one.
+///Only means something turned into ns by clock_tsc_to_mono_ns or clock_tsc_to_real_ns.
+PUBLIC
+u64 clock_tsc(){
+    clock_init();
+    return clock_tsc_raw();
+}
+
+///Measures the counter's rate again over everything since clock_init, and moves the base to now.
+///Call this from one thread every second or so. Calling it more often doesn't make it more exact.
+PUBLIC
+void clock_recalibrate(){
+    clock_init();
+    clock_calibration now = clock_sample();
+    if(clock_has_tsc){
+        now.mult = (u64)(((unsigned __int128)(now.mono_ns - clock_origin.mono_ns) << 32) / (now.tsc - clock_origin.tsc));
+    }else{
+        now.mult = 1ull << 32;
+    }
+    clock_publish(now);
+}
+
+///Gets the calibration, waiting out a clock_recalibrate that's writing it
+INTERNAL
+clock_calibration clock_load(){
+    clock_init();
+    for(;;){
+        u32 sequence = atomic_load_explicit(&clock_sequence, memory_order_acquire);
+        clock_calibration calibration = clock_current;
+        atomic_thread_fence(memory_order_acquire);
+        if((sequence & 1) == 0 && atomic_load_explicit(&clock_sequence, memory_order_relaxed) == sequence){
+            return calibration;
+        }
+    }
+}
+
+///How many ns [tsc] is after the calibration's base, or before it if negative
+INTERNAL
+i64 clock_tsc_offset_ns(clock_calibration* calibration, u64 tsc){
+    i64 ticks = (i64)(tsc - calibration->tsc);
+    return (i64)(((__int128)ticks * calibration->mult) >> 32);
+}
+
+///Turns a clock_tsc reading into CLOCK_MONOTONIC ns
+PUBLIC
+u64 clock_tsc_to_mono_ns(u64 tsc){
+    clock_calibration calibration = clock_load();
+    return calibration.mono_ns + clock_tsc_offset_ns(&calibration, tsc);
+}
+
+///Turns a clock_tsc reading into CLOCK_REALTIME ns since the epoch
+PUBLIC
+u64 clock_tsc_to_real_ns(u64 tsc){
+    clock_calibration calibration = clock_load();
+    return calibration.real_ns + clock_tsc_offset_ns(&calibration, tsc);
+}
+
+///CLOCK_REALTIME in ns since the epoch, off the counter
+PUBLIC
+u64 clock_now_real_ns(){
+    return clock_tsc_to_real_ns(clock_tsc());
+}
+
+///The text of a date, and where in it the sub-second digits go
+PUBLIC
+struct clock_date_cache{
+    ///The second the text is for, or UINT64_MAX if there is none yet
+    u64 second;
+    ///How many sub-second digits the text has room for
+    u32 digits;
+    ///Where the . before the sub-second digits is, which is also the length of everything up to the seconds
+    u32 fraction;
+    u32 length;
+    char text[48];
+};
+typedef struct clock_date_cache clock_date_cache;
+
+INTERNAL
+_Thread_local clock_date_cache clock_thread_date_cache = { UINT64_MAX, 0, 0, 0, { 0 } };
+
+///Gets this thread's date text for [real_ns], with [digits] sub-second digits, like
+///Mon Oct 19 12:00:01.123456 2026
+///Only the digits are written unless the second or the number of digits has changed since this thread's last call.
+///LIFETIME: The cache is this thread's, and the text changes on its next call.
+PUBLIC
+clock_date_cache* clock_thread_date(u64 real_ns, u32 digits){
+    clock_date_cache* cache = &clock_thread_date_cache;
+    if(digits > CLOCK_MAX_DIGITS){
+        digits = CLOCK_MAX_DIGITS;
+    }
+    u64 second = real_ns / 1000000000ull;
+    if(second != cache->second || digits != cache->digits){
+        time_t raw = (time_t)second;
+        struct tm local;
+        localtime_r(&raw, &local);
+        ///asctime's layout, which is what get_now_time_string always printed, with room for the digits after the seconds
+        cache->fraction = (u32)strftime(cache->text, sizeof(cache->text), "%a %b %e %H:%M:%S", &local);
+        u32 at = cache->fraction;
+        if(digits != 0){
+            cache->text[at] = '.';
+            at += 1 + digits;
+        }
+        at += (u32)strftime(cache->text + at, sizeof(cache->text) - at, " %Y", &local);
+        cache->length = at;
+        cache->second = second;
+        cache->digits = digits;
+    }
+    u32 fraction = (u32)(real_ns % 1000000000ull);
+    for(u32 i = 9; i > digits; i--){
+        fraction /= 10;
+    }
+    for(u32 i = digits; i > 0; i--){
+        cache->text[cache->fraction + i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return cache;
+}
+
+///Gets this thread's date text for [real_ns] with [digits] sub-second digits, see clock_thread_date.
+///LIFETIME: The text is this thread's, and changes on its next call.
+PUBLIC
+str clock_date_string(u64 real_ns, u32 digits){
+    return clock_thread_date(real_ns, digits)->text;
+}
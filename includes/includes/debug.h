@@ -1,11 +1,11 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdio.h>
 
 #include "commons.h"
 #include "timestr.h"
-#include "stack.h"
-#include "string_store.h"
+#include "clock.h"
 
 #ifndef DEBUG
 #define ASSERT(expr)
@@ -13,21 +13,34 @@
 #define ASSERT(expr) if(!expr){ (*(int*)0 = 0); }
 #endif
 
+///The longest message debug_log prints when it's printing on the calling thread. Longer ones are cut off.
+#define DEBUG_LOG_MAX_MESSAGE 1024
+
+///Only declared here, so that just the code that sets a backend pulls in async_log.h and its thread and rings
+typedef struct async_log async_log;
+
+///The async_log that debug_log hands its messages to, or NULL to print them on the calling thread.
+///SEE: debug_log_set_backend in async_log.h
+INTERNAL
+async_log* debug_log_backend = NULL;
+///How debug_log hands a message to debug_log_backend, which is async_log_vwrite once a backend is set
+INTERNAL
+bool (*debug_log_backend_write)(async_log* log, str from, str fmt, va_list args) = NULL;
+
+///Logs [msg], formatted printf style with everything after it, as coming from [from]:
+///[Mon Oct 19 12:00:01.123456 2026][from]: msg
+///With a backend set, this only copies the arguments into the calling thread's ring, see async_log.h.
+PUBLIC
 void debug_log(str from, str msg, ...){
     va_list args;
     va_start(args, msg);
-
-    stack_alloc stack = create_stack_alloc();
-    string_store str_store = string_store_create(&stack);
-    string* output = string_store_put(&str_store, "[");
-    str time_str = get_now_time_string();
-    varg_string_store_concat_str(output, time_str, args);
-    varg_string_store_concat_str(output, "]", args);
-    varg_string_store_concat_str(output, "[", args);
-    varg_string_store_concat_str(output, from, args);
-    varg_string_store_concat_str(output, "]: ", args);
-    varg_string_store_concat_str(output, msg, args);
-    printf("%s\n", output->data);
-
+    if(debug_log_backend != NULL){
+        debug_log_backend_write(debug_log_backend, from, msg, args);
+        va_end(args);
+        return;
+    }
+    char message[DEBUG_LOG_MAX_MESSAGE];
+    vsnprintf(message, sizeof(message), msg, args);
     va_end(args);
-}
\ No newline at end of file
+    printf("[%s][%s]: %s\n", clock_date_string(clock_now_real_ns(), 6), from, message);
+}
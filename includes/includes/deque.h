@@ -2,29 +2,48 @@
 
 #include "commons.h"
 #include "lazy_arena.h"
-#include "stdio.h"
-
-typedef enum deque_state deque_state;
-typedef struct deque_entry deque_entry;
-
-///A dequeue_alloc is a queue implementation that uses a dynamic array and circular buffer.
-///A circular buffer is a buffer that wraps back around to tbe beginning of the buffer.
-///The [arena] is the arena that this deque is a part of, which allows for instant monotonicity
-/// and great locality.
-///The [size] is how many bytes total are in the queue before it becomes "full".
-///The [capacity] is the current number of items in the queue.
-///The [start] is the start of the queue, which will be used for looping back around the buffer
-///The [head] is the next address that will be pushed if queue_push_head is used,
-/// and also the place where the head will be popped if queue_pop_head is used.
-///The [end] is the end of the buffer that will indicate to the tail or head that it has reached
-/// the end of the buffer and to loop back around to the [start]. 
-///The [tail] is the last item pushed onto the queue via deque_push_tail is used, and also the
-/// place where deque_pop_tail will pop and return the item popped.
-///The [state] is the current state of the deque.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    A deque is a double-ended queue on a ring buffer of fixed-size slots.
+    The number of slots is always a power of two, so wrapping around is a mask instead of a branch or a modulo.
+
+    |--------|--------|--------|--------|--------|--------|--------|--------|
+    |        |        |  head  |        |        |        |  tail  |        |
+    |--------|--------|--------|--------|--------|--------|--------|--------|
+                       ^ head & mask                       ^ tail & mask
+
+    [head] and [tail] are counters that only ever move by one slot per element and are masked when used,
+    so the deque is empty when they're equal and full when they're [mask] + 1 apart.
+    Pushing to the tail writes at [tail] and moves it up, pushing to the head moves [head] down and writes there.
+
+    Batch pushes and pops move N elements in one call. The slots they cover are contiguous in the ring,
+    which is at most two runs in memory, so that's at most two memcpys.
+
+    A deque either lives in a lazy arena, with its header at offset 0 and its slots right after it,
+    or on the heap. A deque on the heap can be made growable, in which case a push to a full deque
+    doubles the number of slots instead of failing.
+*/
+
+///The slots start on a cache line
+#define DEQUE_ALIGN 64
+///The most slots a deque can have, the largest power of two a u32 holds
+#define DEQUE_MAX_CAPACITY 0x80000000u
+
+///A deque_alloc is a double-ended queue of fixed-size slots on a power-of-two ring buffer.
+///The [arena] is the lazy arena this deque is a part of, or NULL if it is on the heap.
+///The [slot_size] is how many bytes every element takes.
+///The [mask] is the number of slots minus one. Masking a counter with it gives a slot index.
+///The [head] is the counter of the first element. deque_pop_head pops here and deque_push_head pushes just before it.
+///The [tail] is the counter one past the last element. deque_push_tail pushes here and deque_pop_tail pops just before it.
+///The [slots] is the start of the ring buffer.
+///The [growable] is whether a push to a full deque grows it instead of failing. Only heap deques can grow.
 ///
-///SEE: arena_alloc
-///SEE: deque_state
-///SEE: drque_entry
+///SEE: lazy_arena_alloc
+///SEE: deque_result
 PUBLIC
 EXTENSION(arena)
 struct deque_alloc{
@@ -32,65 +51,41 @@ struct deque_alloc{
     lazy_arena_alloc* arena;
 
     INTERNAL
-    u32 size;
-    
-    INTERNAL
-    u32 capacity;
-    
-    INTERNAL
-    void* start;
-    
-    INTERNAL
-    deque_entry* head;
-    
-    INTERNAL
-    void* end;
-    
+    u32 slot_size;
+
     INTERNAL
-    deque_entry* tail;
+    u32 mask;
 
     INTERNAL
-    deque_state state;
-};
-typedef struct deque_alloc deque_alloc;
+    u32 head;
 
-///This is an entry in the deque, which makes this deque a linked list.
-///The [size] is the size of the entry as a sanity check.
-///The [data] is the data that proceeds this structure in memory, and acts as a convenience field
-///The [next] is the next entry in the deque after this entry.
-PUBLIC
-struct deque_entry{
     INTERNAL
-    u32 size;
+    u32 tail;
 
-    PUBLIC
-    HELPER
-    void* data;
-};
+    INTERNAL
+    u8* slots;
 
-///This represents a state of the deque.
-///EMPTY is used for knowing that there is currently no entries in the queue and to be cautious
-/// with adding a new entry, because [head] will be NULL.
-///FULL is used for rejecting a push due to insufficient space.
-enum deque_state{
-    EMPTY,
-    FULL
+    INTERNAL
+    bool growable;
 };
+typedef struct deque_alloc deque_alloc;
 
 ///A result kind, which is used for tagging the internal union of deque_result
-///SUCCESS: We succeeded with pushing or popping. This will be accompanied by [data] in deque_result
-///CREATE_FAILED_TOO_LARGE: deque_create was called with a size argument too large for the given arena
+///SUCCESS: We succeeded with pushing or popping. This will be accompanied by [data] or [size] in deque_result
+///CREATE_FAILED_TOO_LARGE: deque_create was called with a capacity too large for the given arena, or over DEQUE_MAX_CAPACITY
 ///CREATE_FAILED_ARENA_NULL: deque_create was called with a NULL arena argument.
+///CREATE_FAILED_SLOT_SIZE: deque_create was called with a slot size of 0
 ///DEQUE_NULL: deque_alloc* deque is null
 ///INSUFFICIENT_SPACE: We failed to push because there's not enough space to push the data to the deque
-///DATA_TOO_LARGE: The data size being pushed exceed the capacity of the deque
+///DATA_TOO_LARGE: More elements were pushed at once than the deque could ever hold
 ///NULL_DATA_RECEIVED: A deque_push_* operation was called and it was given NULL for [data] param.
-///POP_FAIL_TAIL_NULL: A pop tail operation failed due to the tail being NULL
-///POP_FAIL_HEAD_NULL: A pop head operation failed due to the head being NULL
+///POP_FAIL_TAIL_NULL: A pop tail operation failed due to the deque being empty
+///POP_FAIL_HEAD_NULL: A pop head operation failed due to the deque being empty
 enum deque_result_kind{
     SUCCESS,
     CREATE_FAILED_TOO_LARGE,
     CREATE_FAILED_ARENA_NULL,
+    CREATE_FAILED_SLOT_SIZE,
     DEQUE_NULL,
     INSUFFICIENT_SPACE,
     DATA_TOO_LARGE,
@@ -103,7 +98,8 @@ typedef enum deque_result_kind deque_result_kind;
 ///This represents a result of some deque operation. This uses a tagged union to indicate what happened
 ///and what data it comes with.
 ///The [tag] is a result kind of deque_result_kind, this is used for tagging the union.
-///The [message] is used for logging if something goes wrong, then one can create a stacktrace if necessary.
+///On SUCCESS, single pushes give the slot the data was copied to in [data],
+///and batch operations give how many elements they moved in [size].
 ///
 ///SEE: deque_result_kind
 struct deque_result{
@@ -115,129 +111,403 @@ struct deque_result{
 };
 typedef struct deque_result deque_result;
 
-///Creates a new deque with the given arena and given size. This will check if size is within
-///The capacity of the given arena. If not, then the result tag will become CREATE_FAILED_TOO_LARGE.
-///If the arena is NULL, the result tag will be CREATE_FAILED_ARENA_NULL
-///Otherwise, the arena will be used to put a new instance of the deque_alloc in the arena
-///It will then be initialized to default state of EMPTY and pointers set to NULL
-///It will then return with result tag of SUCCESS and the result data field in the union set to the
-///Pointer in the arena that the deque_alloc was put to.
-///~alex, 9:39 AM PST, 11/15/2020
-deque_result deque_create(lazy_arena_alloc* arena,  u32 size){
+///Rounds [capacity] up to a power of two, with at least 2 slots.
+///[capacity] must be at most DEQUE_MAX_CAPACITY, there's no larger power of two in a u32.
+INTERNAL
+u32 deque_round_capacity(u32 capacity){
+    if(capacity <= 2){
+        return 2;
+    }
+    return 1u << (32 - __builtin_clz(capacity - 1));
+}
+
+///Creates a new deque in the given lazy arena, with room for at least [capacity] elements of [slot_size] bytes.
+///The deque_alloc is put at offset 0 of the arena and the slots start on the next cache line after it,
+///so the arena has to be big enough for both. If not, then the result tag will become CREATE_FAILED_TOO_LARGE.
+///If the arena is NULL, the result tag will be CREATE_FAILED_ARENA_NULL.
+///Only the header is written, the slots aren't touched until something is pushed into them.
+///On SUCCESS the result data field in the union is set to the pointer in the arena that the deque_alloc was put to.
+deque_result deque_create(lazy_arena_alloc* arena, u32 slot_size, u32 capacity){
     deque_result result;
     if(arena == NULL){
         result.tag = CREATE_FAILED_ARENA_NULL;
-        result.size = size;
+        result.size = capacity;
+        return result;
+    }
+    if(slot_size == 0){
+        result.tag = CREATE_FAILED_SLOT_SIZE;
+        result.size = slot_size;
         return result;
     }
-    if(size > arena->size){
+    if(capacity > DEQUE_MAX_CAPACITY){
         result.tag = CREATE_FAILED_TOO_LARGE;
-        result.size = size;
+        result.size = capacity;
+        return result;
+    }
+    capacity = deque_round_capacity(capacity);
+    uintptr_t start = (uintptr_t)arena->start;
+    uintptr_t slots = (start + sizeof(deque_alloc) + DEQUE_ALIGN - 1) & ~(uintptr_t)(DEQUE_ALIGN - 1);
+    u64 needed = (u64)(slots - start) + (u64)capacity * slot_size;
+    if(needed > arena->size){
+        result.tag = CREATE_FAILED_TOO_LARGE;
+        result.size = capacity;
         return result;
     }
     deque_alloc deque;
     deque.arena = arena;
-    deque.size = size;
-    deque.capacity = 0;
-    deque.start = NULL;
-    deque.head = NULL;
-    deque.end = NULL;
-    deque.tail = NULL;
-    deque.state = EMPTY;
-
-    deque_alloc* pdeque = lazy_arena_put(arena, 0, &deque, sizeof(deque_alloc) + size);
-    pdeque->start = (char*)pdeque + sizeof(deque_alloc);
-    pdeque->end = (char*)pdeque + sizeof(deque_alloc) + size;
-    pdeque->head = (deque_entry*)((str)pdeque->start + size / 2);
-    pdeque->tail = pdeque->head;
-
-    result.data = pdeque;
+    deque.slot_size = slot_size;
+    deque.mask = capacity - 1;
+    deque.head = 0;
+    deque.tail = 0;
+    deque.slots = (u8*)slots;
+    deque.growable = false;
+
+    result.data = lazy_arena_put(arena, 0, &deque, sizeof(deque_alloc));
     result.tag = SUCCESS;
     return result;
 }
 
-///Pushes at the head. If the current state is FULL, then return with an error result.
-///If the current pointer - the size is too large for the remaining head space, it will be
-///wrapped around to the end, as long as the tail is nowhere near the end.
-///~alex, 12:41 PM PST, 11/15/2020
-deque_result deque_push_head(deque_alloc* deque, void* data, u32 size){
+///Creates a new deque on the heap, with room for at least [capacity] elements of [slot_size] bytes.
+///If [growable], a push to a full deque doubles the slots instead of failing with INSUFFICIENT_SPACE.
+///MEM: Borrowed-always
+///LIFETIME: Until passed into deque_destroy
+deque_result deque_create_heap(u32 slot_size, u32 capacity, bool growable){
+    deque_result result;
+    if(slot_size == 0){
+        result.tag = CREATE_FAILED_SLOT_SIZE;
+        result.size = slot_size;
+        return result;
+    }
+    if(capacity > DEQUE_MAX_CAPACITY){
+        result.tag = CREATE_FAILED_TOO_LARGE;
+        result.size = capacity;
+        return result;
+    }
+    capacity = deque_round_capacity(capacity);
+    if((u64)capacity * slot_size > 0xffffffffu){
+        result.tag = CREATE_FAILED_TOO_LARGE;
+        result.size = capacity;
+        return result;
+    }
+    deque_alloc* deque = (deque_alloc*)malloc(sizeof(deque_alloc));
+    u8* slots = aligned_alloc(DEQUE_ALIGN, ((size_t)capacity * slot_size + DEQUE_ALIGN - 1) & ~(size_t)(DEQUE_ALIGN - 1));
+    if(deque == NULL || slots == NULL){
+        free(deque);
+        free(slots);
+        result.tag = CREATE_FAILED_TOO_LARGE;
+        result.size = capacity;
+        return result;
+    }
+    deque->arena = NULL;
+    deque->slot_size = slot_size;
+    deque->mask = capacity - 1;
+    deque->head = 0;
+    deque->tail = 0;
+    deque->slots = slots;
+    deque->growable = growable;
+
+    result.data = deque;
+    result.tag = SUCCESS;
+    return result;
+}
+
+///Frees a deque made by deque_create_heap. A deque in a lazy arena goes away with the arena instead.
+RECEIVER(deque)
+void deque_destroy(deque_alloc* deque){
+    if(deque == NULL || deque->arena != NULL){
+        return;
+    }
+    free(deque->slots);
+    free(deque);
+}
+
+///Gets the number of elements in the deque
+RECEIVER(deque)
+u32 deque_count(deque_alloc* deque){
+    return deque->tail - deque->head;
+}
+
+///Gets the number of elements the deque can hold before it is full, or has to grow
+RECEIVER(deque)
+u32 deque_capacity(deque_alloc* deque){
+    return deque->mask + 1;
+}
+
+///Removes every element but keeps the slots
+RECEIVER(deque)
+void deque_clear(deque_alloc* deque){
+    deque->head = 0;
+    deque->tail = 0;
+}
+
+///Copies [count] elements from [src] into the ring, starting at counter [at]. That's one memcpy, or two if it wraps.
+INTERNAL
+RECEIVER(deque)
+void deque_copy_in(deque_alloc* deque, u32 at, void* src, u32 count){
+    u32 idx = at & deque->mask;
+    u32 first = deque->mask + 1 - idx;
+    if(first > count){
+        first = count;
+    }
+    memcpy(deque->slots + (size_t)idx * deque->slot_size, src, (size_t)first * deque->slot_size);
+    if(first < count){
+        memcpy(deque->slots, (u8*)src + (size_t)first * deque->slot_size, (size_t)(count - first) * deque->slot_size);
+    }
+}
+
+///Copies [count] elements out of the ring into [dest], starting at counter [at]. That's one memcpy, or two if it wraps.
+INTERNAL
+RECEIVER(deque)
+void deque_copy_out(deque_alloc* deque, u32 at, void* dest, u32 count){
+    u32 idx = at & deque->mask;
+    u32 first = deque->mask + 1 - idx;
+    if(first > count){
+        first = count;
+    }
+    memcpy(dest, deque->slots + (size_t)idx * deque->slot_size, (size_t)first * deque->slot_size);
+    if(first < count){
+        memcpy((u8*)dest + (size_t)first * deque->slot_size, deque->slots, (size_t)(count - first) * deque->slot_size);
+    }
+}
+
+///Makes room for [extra] more elements. A full growable deque gets at least twice the slots, with the
+///elements moved to the start of the new ones, otherwise this fails with INSUFFICIENT_SPACE.
+INTERNAL
+RECEIVER(deque)
+deque_result_kind deque_reserve(deque_alloc* deque, u32 extra){
+    u32 count = deque_count(deque);
+    u32 capacity = deque->mask + 1;
+    if(extra <= capacity - count){
+        return SUCCESS;
+    }
+    if(!deque->growable){
+        return extra > capacity ? DATA_TOO_LARGE : INSUFFICIENT_SPACE;
+    }
+    u64 wanted = (u64)count + extra;
+    if(wanted > DEQUE_MAX_CAPACITY || wanted * deque->slot_size > 0xffffffffu){
+        return DATA_TOO_LARGE;
+    }
+    u32 new_capacity = deque_round_capacity((u32)wanted);
+    if(new_capacity < capacity * 2){
+        new_capacity = capacity * 2;
+    }
+    u8* slots = aligned_alloc(DEQUE_ALIGN, ((size_t)new_capacity * deque->slot_size + DEQUE_ALIGN - 1) & ~(size_t)(DEQUE_ALIGN - 1));
+    if(slots == NULL){
+        return INSUFFICIENT_SPACE;
+    }
+    deque_copy_out(deque, deque->head, slots, count);
+    free(deque->slots);
+    deque->slots = slots;
+    deque->mask = new_capacity - 1;
+    deque->head = 0;
+    deque->tail = count;
+    return SUCCESS;
+}
+
+///Pushes one element onto the tail. This is the back of the queue when used as a fifo.
+///On SUCCESS the result data is the slot [data] was copied to.
+RECEIVER(deque)
+deque_result deque_push_tail(deque_alloc* deque, void* data){
     deque_result result;
     if(deque == NULL){
         result.tag = DEQUE_NULL;
         return result;
     }
-    if(size > deque->size){
-        result.tag = DATA_TOO_LARGE;
-        result.size = size;
-        return result;
-    }
-    u32 remaining = deque->size - deque->capacity;
-    if(size > remaining){
-        result.tag = INSUFFICIENT_SPACE;
-        result.size = size;
-        return result;
-    }
-    ///The space needed to push the head is past the start of the deque
-    if(deque->start > deque->head - size){
-        char* after_tail = (char*)deque->tail + deque->tail->size;
-        
-        ///If the tail plus its size plus our size is greater than the size of the deque
-        ///then there's no enough space to push the entry
-        if(after_tail + size > deque->end){
-            result.tag = INSUFFICIENT_SPACE;
-            result.size = size;
-            return result;
-        }
-
-        ///Go to the end of the buffer and push there
-        deque->head = (str)deque->end - (sizeof(deque_entry) + size);
-        deque->head->size = size;
-        u32 offset = (deque->head + sizeof(deque_entry) - (str)deque->start);
-        deque->head->data = lazy_arena_put(deque->arena, offset, data, size);
-        
-        result.tag = SUCCESS;
-        result.data = deque->head;
-        return result;
-    }else{
-        deque->head = (str)deque->head - sizeof(deque_entry) + size;
-        deque->head->size = size;
-        u32 offset = (deque->head + sizeof(deque_entry)) - (str)deque->start;
-        deque->head->data = lazy_arena_put(deque->arena, offset, data, size);
-        
-        result.tag = SUCCESS;
-        result.data = deque->head->data;
-        return result;
-    }
-}
-///Push to the current tail if its NULL, otherwise, set the next address after the current tail
-///As long as we are in bounds of the deque and the deque is not null, and the size of the data
-///is within sufficient space.
-///
-deque_result deque_push_tail(deque_alloc* deque, void* data, u32 size){
+    if(data == NULL){
+        result.tag = NULL_DATA_RECEIVED;
+        return result;
+    }
+    result.tag = deque_reserve(deque, 1);
+    if(result.tag != SUCCESS){
+        result.size = 1;
+        return result;
+    }
+    u8* slot = deque->slots + (size_t)(deque->tail & deque->mask) * deque->slot_size;
+    memcpy(slot, data, deque->slot_size);
+    deque->tail += 1;
+    result.data = slot;
+    return result;
+}
+
+///Pushes one element onto the head, in front of every element already in the deque.
+///On SUCCESS the result data is the slot [data] was copied to.
+RECEIVER(deque)
+deque_result deque_push_head(deque_alloc* deque, void* data){
     deque_result result;
     if(deque == NULL){
         result.tag = DEQUE_NULL;
         return result;
     }
-    if(size > deque->size){
-        result.tag = DATA_TOO_LARGE;
-        result.size = size;
+    if(data == NULL){
+        result.tag = NULL_DATA_RECEIVED;
         return result;
     }
-    u32 remaining = deque->size - deque->capacity;
-    if(size > remaining){
-        result.tag = INSUFFICIENT_SPACE;
-        result.size = size;
+    result.tag = deque_reserve(deque, 1);
+    if(result.tag != SUCCESS){
+        result.size = 1;
         return result;
     }
+    deque->head -= 1;
+    u8* slot = deque->slots + (size_t)(deque->head & deque->mask) * deque->slot_size;
+    memcpy(slot, data, deque->slot_size);
+    result.data = slot;
+    return result;
+}
 
-    ///If the size of the tail plus our 
-    str after_tail = deque->tail + sizeof(deque_entry) + deque->size;
-    if(deque->end < after_tail + size){
-    
+///Pops the element at the head and copies it into [data]. This is the front of the queue when used as a fifo.
+///If the deque is empty, the result tag is POP_FAIL_HEAD_NULL.
+RECEIVER(deque)
+deque_result deque_pop_head(deque_alloc* deque, OUT void* data){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
+    }
+    if(deque->head == deque->tail){
+        result.tag = POP_FAIL_HEAD_NULL;
+        result.size = 0;
+        return result;
+    }
+    memcpy(data, deque->slots + (size_t)(deque->head & deque->mask) * deque->slot_size, deque->slot_size);
+    deque->head += 1;
+    result.tag = SUCCESS;
+    result.data = data;
+    return result;
+}
+
+///Pops the element at the tail and copies it into [data], so the deque can also be used as a stack.
+///If the deque is empty, the result tag is POP_FAIL_TAIL_NULL.
+RECEIVER(deque)
+deque_result deque_pop_tail(deque_alloc* deque, OUT void* data){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
     }
+    if(deque->head == deque->tail){
+        result.tag = POP_FAIL_TAIL_NULL;
+        result.size = 0;
+        return result;
+    }
+    deque->tail -= 1;
+    memcpy(data, deque->slots + (size_t)(deque->tail & deque->mask) * deque->slot_size, deque->slot_size);
+    result.tag = SUCCESS;
+    result.data = data;
+    return result;
+}
 
+///Pushes [count] contiguous elements onto the tail in one go, in the order they are in [data].
+///Either all of them are pushed or none are. On SUCCESS the result size is [count].
+RECEIVER(deque)
+deque_result deque_push_tail_n(deque_alloc* deque, void* data, u32 count){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
+    }
+    if(data == NULL){
+        result.tag = NULL_DATA_RECEIVED;
+        return result;
+    }
+    result.tag = deque_reserve(deque, count);
+    result.size = count;
+    if(result.tag != SUCCESS){
+        return result;
+    }
+    deque_copy_in(deque, deque->tail, data, count);
+    deque->tail += count;
     return result;
 }
-deque_result deque_pop_head(deque_alloc* deque, void* data, u32 size);
-deque_result deque_pop_tail(deque_alloc* deque, void* data, u32 size);
\ No newline at end of file
+
+///Pushes [count] contiguous elements onto the head in one go. They keep their order, so the first
+///element of [data] becomes the new head. Either all of them are pushed or none are.
+RECEIVER(deque)
+deque_result deque_push_head_n(deque_alloc* deque, void* data, u32 count){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
+    }
+    if(data == NULL){
+        result.tag = NULL_DATA_RECEIVED;
+        return result;
+    }
+    result.tag = deque_reserve(deque, count);
+    result.size = count;
+    if(result.tag != SUCCESS){
+        return result;
+    }
+    deque->head -= count;
+    deque_copy_in(deque, deque->head, data, count);
+    return result;
+}
+
+///Pops up to [count] elements off the head into [data], in queue order.
+///On SUCCESS the result size is how many were popped, which is less than [count] if the deque ran out.
+///If the deque is empty, the result tag is POP_FAIL_HEAD_NULL.
+RECEIVER(deque)
+deque_result deque_pop_head_n(deque_alloc* deque, OUT void* data, u32 count){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
+    }
+    u32 available = deque->tail - deque->head;
+    if(available == 0){
+        result.tag = POP_FAIL_HEAD_NULL;
+        result.size = 0;
+        return result;
+    }
+    if(count > available){
+        count = available;
+    }
+    deque_copy_out(deque, deque->head, data, count);
+    deque->head += count;
+    result.tag = SUCCESS;
+    result.size = count;
+    return result;
+}
+
+///Pops up to [count] elements off the tail into [data]. They keep their order, so the last element
+///of [data] is what was the tail. On SUCCESS the result size is how many were popped.
+///If the deque is empty, the result tag is POP_FAIL_TAIL_NULL.
+RECEIVER(deque)
+deque_result deque_pop_tail_n(deque_alloc* deque, OUT void* data, u32 count){
+    deque_result result;
+    if(deque == NULL){
+        result.tag = DEQUE_NULL;
+        return result;
+    }
+    u32 available = deque->tail - deque->head;
+    if(available == 0){
+        result.tag = POP_FAIL_TAIL_NULL;
+        result.size = 0;
+        return result;
+    }
+    if(count > available){
+        count = available;
+    }
+    deque->tail -= count;
+    deque_copy_out(deque, deque->tail, data, count);
+    result.tag = SUCCESS;
+    result.size = count;
+    return result;
+}
+
+///Gets the element at the head without popping it, or NULL if the deque is empty
+RECEIVER(deque)
+void* deque_peek_head(deque_alloc* deque){
+    if(deque->head == deque->tail){
+        return NULL;
+    }
+    return deque->slots + (size_t)(deque->head & deque->mask) * deque->slot_size;
+}
+
+///Gets the element at the tail without popping it, or NULL if the deque is empty
+RECEIVER(deque)
+void* deque_peek_tail(deque_alloc* deque){
+    if(deque->head == deque->tail){
+        return NULL;
+    }
+    return deque->slots + (size_t)((deque->tail - 1) & deque->mask) * deque->slot_size;
+}
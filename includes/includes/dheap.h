@@ -0,0 +1,453 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    A d-ary min-heap of u64 keys, each carrying a u64 value, on contiguous memory.
+    Every node has [arity] children instead of two, so the heap is half as deep at arity 4,
+    and the children of a node are next to each other, so finding the smallest is one cache line.
+
+    The entries are shifted by [arity] - 1 slots so that every group of siblings starts on a
+    multiple of [arity]. At 16 bytes an entry and an arity of 4 that is exactly one cache line per group.
+
+    |-------------|--------|------------------------------|------------------------------|-----
+    | arity-1 pad |  root  | children of root (arity)     | children of entry 1 (arity)  | ...
+    |-------------|--------|------------------------------|------------------------------|-----
+
+    Every push hands back a handle that stays valid, wherever the entry moves to, until the entry is popped
+    or removed. Handles index [positions], which says where in the heap the entry is now, and [handles] says
+    which handle the entry at a position has, so an entry's key can be changed or the entry removed in O(log n).
+    Freed handles are reused.
+    Keeping handles up to date is a random write into [positions] for every entry that moves, which on a big heap
+    costs about as much as the sift itself. A heap that never needs them can be made without them, see create_dheap.
+
+    Like vector, the heap lives on the heap or in an arena_alloc, and doubles when it's full.
+*/
+
+#define DHEAP_DEFAULT_ARITY 4
+#define DHEAP_ALIGN 64
+///Returned instead of a handle when a push fails
+#define DHEAP_NO_HANDLE 0xffffffffu
+///Marks a handle in [positions] as free. The rest of the bits are the next free handle.
+#define DHEAP_FREE_HANDLE 0x80000000u
+
+PUBLIC
+struct dheap_entry{
+    u64 key;
+    u64 value;
+};
+typedef struct dheap_entry dheap_entry;
+
+///NOTE: This is returned on the stack by create_dheap, like vector.
+///      Keep it wherever it needs to live, and pass it around by pointer.
+PUBLIC
+EXTENSION(arena)
+struct dheap{
+    ///The arena everything is reserved in, or NULL if it is on the heap
+    INTERNAL
+    arena_alloc* arena;
+    ///The number of children every node has, a power of two
+    INTERNAL
+    u32 arity;
+    ///log2 of [arity], so finding a parent or child is a shift
+    INTERNAL
+    u32 shift;
+    ///Whether every entry has a handle. If not, [handles] and [positions] are NULL.
+    INTERNAL
+    bool tracked;
+    INTERNAL
+    u32 count;
+    INTERNAL
+    u32 capacity;
+    ///The entries, already offset past the padding, so the root is entries[0]
+    INTERNAL
+    dheap_entry* entries;
+    ///The handle of the entry at every position
+    INTERNAL
+    u32* handles;
+    ///The position of the entry every handle refers to, or DHEAP_FREE_HANDLE and the next free handle
+    INTERNAL
+    u32* positions;
+    ///How many handles have ever been handed out. All of them are either live or on the free list.
+    INTERNAL
+    u32 handle_count;
+    INTERNAL
+    u32 free_handle;
+    ///The memory the entries and both handle arrays live in
+    INTERNAL
+    u8* block;
+};
+typedef struct dheap dheap;
+
+///Makes sure there is room for at least [capacity] entries, moving everything if it has to.
+///Returns false if the memory could not be had, in which case the heap is left as it was.
+PUBLIC
+RECEIVER(heap)
+bool dheap_reserve(dheap* heap, u32 capacity){
+    if(capacity <= heap->capacity){
+        return true;
+    }
+    u64 entry_bytes = ((u64)capacity + heap->arity - 1) * sizeof(dheap_entry);
+    u64 bytes = entry_bytes + (heap->tracked ? (u64)capacity * sizeof(u32) * 2 : 0);
+    if(bytes > 0xffffffffu - DHEAP_ALIGN){
+        printf("Cannot reserve %i entries in a heap\n", capacity);
+        return false;
+    }
+    u8* block;
+    if(heap->arena == NULL){
+        block = aligned_alloc(DHEAP_ALIGN, (size_t)((bytes + DHEAP_ALIGN - 1) & ~(u64)(DHEAP_ALIGN - 1)));
+    }else{
+        block = arena_reserve_aligned(heap->arena, (u32)bytes, DHEAP_ALIGN);
+    }
+    if(block == NULL){
+        printf("Could not grow heap to %i entries\n", capacity);
+        return false;
+    }
+    dheap_entry* entries = (dheap_entry*)block + heap->arity - 1;
+    u32* handles = heap->tracked ? (u32*)(block + entry_bytes) : NULL;
+    u32* positions = heap->tracked ? handles + capacity : NULL;
+    if(heap->block != NULL){
+        memcpy(entries, heap->entries, (size_t)heap->count * sizeof(dheap_entry));
+        if(heap->tracked){
+            memcpy(handles, heap->handles, (size_t)heap->count * sizeof(u32));
+            memcpy(positions, heap->positions, (size_t)heap->handle_count * sizeof(u32));
+        }
+        if(heap->arena == NULL){
+            free(heap->block);
+        }
+    }
+    heap->block = block;
+    heap->entries = entries;
+    heap->handles = handles;
+    heap->positions = positions;
+    heap->capacity = capacity;
+    return true;
+}
+
+///Creates a new heap where every node has [arity] children, with room for [capacity] entries.
+///[arity] must be a power of two from 2 to 64, and is DHEAP_DEFAULT_ARITY if it's 0.
+///If [track_handles] is false, pushes don't hand out handles, so entries can only be popped, and everything else is faster.
+///If [arena] is NULL, everything is kept on the heap and dheap_deinit must be called.
+PUBLIC
+RECEIVER(arena)
+dheap create_dheap(arena_alloc* arena, u32 arity, u32 capacity, bool track_handles){
+    dheap heap = { 0 };
+    heap.arena = arena;
+    heap.tracked = track_handles;
+    heap.free_handle = DHEAP_NO_HANDLE;
+    if(arity == 0){
+        arity = DHEAP_DEFAULT_ARITY;
+    }
+    if(arity < 2 || arity > 64 || (arity & (arity - 1)) != 0){
+        printf("A heap's arity must be a power of two from 2 to 64, not %i\n", arity);
+        return heap;
+    }
+    heap.arity = arity;
+    heap.shift = __builtin_ctz(arity);
+    if(capacity != 0){
+        dheap_reserve(&heap, capacity);
+    }
+    return heap;
+}
+
+///Frees everything if it is on the heap. A heap in an arena goes away with the arena.
+PUBLIC
+RECEIVER(heap)
+void dheap_deinit(dheap* heap){
+    if(heap->arena == NULL){
+        free(heap->block);
+    }
+    heap->block = NULL;
+    heap->entries = NULL;
+    heap->handles = NULL;
+    heap->positions = NULL;
+    heap->count = 0;
+    heap->capacity = 0;
+    heap->handle_count = 0;
+    heap->free_handle = DHEAP_NO_HANDLE;
+}
+
+PUBLIC
+RECEIVER(heap)
+u32 dheap_count(dheap* heap){
+    return heap->count;
+}
+
+///Puts [entry] with [handle] at [pos] and points the handle at it
+INTERNAL
+RECEIVER(heap)
+void dheap_place(dheap* heap, u32 pos, dheap_entry entry, u32 handle){
+    heap->entries[pos] = entry;
+    if(heap->tracked){
+        heap->handles[pos] = handle;
+        heap->positions[handle] = pos;
+    }
+}
+
+///The handle of the entry at [pos], or DHEAP_NO_HANDLE if the heap doesn't keep them
+INTERNAL
+RECEIVER(heap)
+u32 dheap_handle_at(dheap* heap, u32 pos){
+    return heap->tracked ? heap->handles[pos] : DHEAP_NO_HANDLE;
+}
+
+///Moves the entry at [pos] up until its parent is no bigger. The entry is held aside while its ancestors
+///move down into the hole, so each level is one move instead of a swap.
+INTERNAL
+RECEIVER(heap)
+void dheap_sift_up(dheap* heap, u32 pos){
+    dheap_entry entry = heap->entries[pos];
+    u32 handle = dheap_handle_at(heap, pos);
+    while(pos != 0){
+        u32 parent = (pos - 1) >> heap->shift;
+        if(heap->entries[parent].key <= entry.key){
+            break;
+        }
+        dheap_place(heap, pos, heap->entries[parent], dheap_handle_at(heap, parent));
+        pos = parent;
+    }
+    dheap_place(heap, pos, entry, handle);
+}
+
+///Gets the smallest of the children [first, last). The siblings share a cache line, so this is cheap.
+///NOTE: This is left as a branch on purpose. Conditional moves make the next level's address wait on the compares,
+///      which is slower once the heap is out of cache, since the branch at least lets the cpu load ahead.
+INTERNAL
+RECEIVER(heap)
+u32 dheap_smallest_child(dheap* heap, u32 first, u32 last){
+    u32 smallest = first;
+    u64 smallest_key = heap->entries[first].key;
+    for(u32 child = first + 1; child < last; child++){
+        if(heap->entries[child].key < smallest_key){
+            smallest = child;
+            smallest_key = heap->entries[child].key;
+        }
+    }
+    return smallest;
+}
+
+///Moves the entry at [pos] down until none of its children are smaller, the same way
+INTERNAL
+RECEIVER(heap)
+void dheap_sift_down(dheap* heap, u32 pos){
+    dheap_entry entry = heap->entries[pos];
+    u32 handle = dheap_handle_at(heap, pos);
+    u32 count = heap->count;
+    for(;;){
+        ///In 64 bits, since at arity 64 a position past 2^26 has children past what a u32 holds
+        u64 first = ((u64)pos << heap->shift) + 1;
+        if(first >= count){
+            break;
+        }
+        u32 last = first + heap->arity < count ? (u32)(first + heap->arity) : count;
+        u32 smallest = dheap_smallest_child(heap, (u32)first, last);
+        if(heap->entries[smallest].key >= entry.key){
+            break;
+        }
+        dheap_place(heap, pos, heap->entries[smallest], dheap_handle_at(heap, smallest));
+        pos = smallest;
+    }
+    dheap_place(heap, pos, entry, handle);
+}
+
+///Takes a handle off the free list, or a fresh one
+INTERNAL
+RECEIVER(heap)
+u32 dheap_take_handle(dheap* heap){
+    if(heap->free_handle != DHEAP_NO_HANDLE){
+        u32 handle = heap->free_handle;
+        u32 next = heap->positions[handle] & ~DHEAP_FREE_HANDLE;
+        heap->free_handle = next == (DHEAP_NO_HANDLE & ~DHEAP_FREE_HANDLE) ? DHEAP_NO_HANDLE : next;
+        return handle;
+    }
+    return heap->handle_count++;
+}
+
+INTERNAL
+RECEIVER(heap)
+void dheap_give_handle(dheap* heap, u32 handle){
+    heap->positions[handle] = DHEAP_FREE_HANDLE | (heap->free_handle & ~DHEAP_FREE_HANDLE);
+    heap->free_handle = handle;
+}
+
+///Makes room for [extra] more entries, at least doubling the capacity when it has to grow
+INTERNAL
+RECEIVER(heap)
+bool dheap_grow(dheap* heap, u32 extra){
+    ///In 64 bits, so a large [extra] can't wrap around and look like it fits
+    u64 needed = (u64)heap->count + extra;
+    if(needed <= heap->capacity){
+        return true;
+    }
+    u64 wanted = (u64)heap->capacity * 2;
+    if(wanted < 16){
+        wanted = 16;
+    }
+    if(wanted < needed){
+        wanted = needed;
+    }
+    if(wanted >= DHEAP_FREE_HANDLE){
+        wanted = DHEAP_FREE_HANDLE - 1;
+    }
+    return needed <= wanted && dheap_reserve(heap, (u32)wanted);
+}
+
+///Pushes [key] with [value] and returns the entry's handle, or DHEAP_NO_HANDLE if there was no room for it.
+///A heap made without handles returns 0 for every entry it pushes.
+PUBLIC
+RECEIVER(heap)
+u32 dheap_push(dheap* heap, u64 key, u64 value){
+    if(heap->arity == 0 || !dheap_grow(heap, 1)){
+        return DHEAP_NO_HANDLE;
+    }
+    u32 handle = heap->tracked ? dheap_take_handle(heap) : 0;
+    u32 pos = heap->count++;
+    dheap_place(heap, pos, (dheap_entry){ key, value }, handle);
+    dheap_sift_up(heap, pos);
+    return handle;
+}
+
+///Gets the smallest entry without removing it. Returns false if the heap is empty.
+PUBLIC
+RECEIVER(heap)
+bool dheap_peek(dheap* heap, OUT u64* key, OUT u64* value){
+    if(heap->count == 0){
+        return false;
+    }
+    *key = heap->entries[0].key;
+    *value = heap->entries[0].value;
+    return true;
+}
+
+///Removes the entry at [pos] by moving the last entry into its place and sifting that whichever way it needs to go
+INTERNAL
+RECEIVER(heap)
+void dheap_remove_at(dheap* heap, u32 pos){
+    if(heap->tracked){
+        dheap_give_handle(heap, heap->handles[pos]);
+    }
+    heap->count -= 1;
+    if(pos == heap->count){
+        return;
+    }
+    u64 removed = heap->entries[pos].key;
+    dheap_place(heap, pos, heap->entries[heap->count], dheap_handle_at(heap, heap->count));
+    if(heap->entries[pos].key < removed){
+        dheap_sift_up(heap, pos);
+    }else{
+        dheap_sift_down(heap, pos);
+    }
+}
+
+///Removes the smallest entry into [key] and [value]. Returns false if the heap is empty.
+///Entries with equal keys come out in no particular order.
+PUBLIC
+RECEIVER(heap)
+bool dheap_pop(dheap* heap, OUT u64* key, OUT u64* value){
+    if(heap->count == 0){
+        return false;
+    }
+    *key = heap->entries[0].key;
+    *value = heap->entries[0].value;
+    dheap_remove_at(heap, 0);
+    return true;
+}
+
+///Whether [handle] refers to an entry that's still in the heap. Always false in a heap made without handles.
+PUBLIC
+RECEIVER(heap)
+bool dheap_contains(dheap* heap, u32 handle){
+    return handle < heap->handle_count && (heap->positions[handle] & DHEAP_FREE_HANDLE) == 0;
+}
+
+///Gets the key and value of the entry [handle] refers to. Returns false if it's no longer in the heap.
+PUBLIC
+RECEIVER(heap)
+bool dheap_get(dheap* heap, u32 handle, OUT u64* key, OUT u64* value){
+    if(!dheap_contains(heap, handle)){
+        return false;
+    }
+    dheap_entry* entry = &heap->entries[heap->positions[handle]];
+    *key = entry->key;
+    *value = entry->value;
+    return true;
+}
+
+///Changes the key of the entry [handle] refers to and moves it to where it now belongs.
+///This is decrease-key, but raising a key works too. Returns false if the handle is no longer in the heap.
+PUBLIC
+RECEIVER(heap)
+bool dheap_update_key(dheap* heap, u32 handle, u64 key){
+    if(!dheap_contains(heap, handle)){
+        return false;
+    }
+    u32 pos = heap->positions[handle];
+    u64 old = heap->entries[pos].key;
+    heap->entries[pos].key = key;
+    if(key < old){
+        dheap_sift_up(heap, pos);
+    }else if(key > old){
+        dheap_sift_down(heap, pos);
+    }
+    return true;
+}
+
+///Removes the entry [handle] refers to, wherever it is in the heap, into [key] and [value] unless they're NULL.
+///Returns false if the handle is no longer in the heap.
+PUBLIC
+RECEIVER(heap)
+bool dheap_remove(dheap* heap, u32 handle, OUT u64* key, OUT u64* value){
+    if(!dheap_contains(heap, handle)){
+        return false;
+    }
+    u32 pos = heap->positions[handle];
+    if(key != NULL){
+        *key = heap->entries[pos].key;
+    }
+    if(value != NULL){
+        *value = heap->entries[pos].value;
+    }
+    dheap_remove_at(heap, pos);
+    return true;
+}
+
+///Adds [count] entries at once and restores the heap bottom up, which is O(n) for the whole heap
+///instead of O(n log n) for pushing them one at a time. [values] may be NULL, which makes every value 0.
+///If [handles] isn't NULL, it gets the handle of every entry, in the order they were given,
+///or 0 for every one in a heap made without handles, like dheap_push.
+///Returns false if there was no room for them, in which case nothing was added.
+PUBLIC
+RECEIVER(heap)
+bool dheap_heapify(dheap* heap, u64* keys, u64* values, u32 count, OUT u32* handles){
+    if(heap->arity == 0 || !dheap_grow(heap, count)){
+        return false;
+    }
+    for(u32 i = 0; i < count; i++){
+        u32 handle = heap->tracked ? dheap_take_handle(heap) : 0;
+        dheap_place(heap, heap->count++, (dheap_entry){ keys[i], values == NULL ? 0 : values[i] }, handle);
+        if(handles != NULL){
+            handles[i] = handle;
+        }
+    }
+    if(heap->count < 2){
+        return true;
+    }
+    ///Sift down every entry that has children, from the last of them back to the root
+    for(u32 pos = ((heap->count - 2) >> heap->shift) + 1; pos-- > 0;){
+        dheap_sift_down(heap, pos);
+    }
+    return true;
+}
+
+///Empties the heap and frees every handle, keeping its memory
+PUBLIC
+RECEIVER(heap)
+void dheap_clear(dheap* heap){
+    heap->count = 0;
+    heap->handle_count = 0;
+    heap->free_handle = DHEAP_NO_HANDLE;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/*
+    An epoch arena is a ring of N arenas, one per epoch. A producer puts everything for epoch k
+    into arena k % N, then advances to epoch k + 1. Advancing publishes epoch k to readers and
+    resets the arena of epoch k + 1 - N, the oldest one, in O(1) with arena_reset.
+    So data lives for exactly N - 1 advances after the epoch it was put in, with no per-object frees.
+
+    epoch:       k-2         k-1          k
+    |-----------|-----------|-----------|-----------|
+    |  arena 0  |  arena 1  |  arena 2  |  arena 3  |    N = 4
+    |-----------|-----------|-----------|-----------|
+     (oldest,    (readers)   (producer)  (reset when
+      readers)                            k+1 starts)
+
+    One producer thread allocates into the current epoch while any number of reader threads read
+    published ones. A reader pins the latest published epoch with epoch_arena_read, and the producer
+    will not reset a pinned arena until every reader pinned on it has called epoch_arena_release.
+
+    The handoff is two counters. The reader bumps the pin count of the arena and then checks the
+    producer hasn't moved on far enough to reuse it. The producer moves [epoch] on and then checks
+    the pin count. Both are sequentially consistent, so at least one of the two sees the other.
+*/
+
+///The most arenas an epoch arena can have
+#define EPOCH_ARENA_MAX 16
+///What epoch_reader.epoch is when nothing has been published yet
+#define EPOCH_NONE (~0ull)
+
+PUBLIC
+EXTENSION(arena)
+struct epoch_arena{
+    ///How many arenas there are, N
+    INTERNAL
+    u32 count;
+    INTERNAL
+    arena_alloc* arenas[EPOCH_ARENA_MAX];
+    ///What the producer handed over with each epoch when it published it
+    INTERNAL
+    _Atomic(void*) roots[EPOCH_ARENA_MAX];
+    ///How many readers have each arena pinned
+    INTERNAL
+    _Atomic u32 pins[EPOCH_ARENA_MAX];
+    ///The epoch the producer is putting into
+    INTERNAL
+    _Atomic u64 epoch;
+    ///The latest epoch the producer is done with, or EPOCH_NONE
+    INTERNAL
+    _Atomic u64 published;
+};
+typedef struct epoch_arena epoch_arena;
+
+///A reader's pin on one published epoch. [root] is whatever the producer published it with.
+///NOTE: This is returned on the stack by epoch_arena_read
+PUBLIC
+struct epoch_reader{
+    u64 epoch;
+    arena_alloc* arena;
+    void* root;
+};
+typedef struct epoch_reader epoch_reader;
+
+///Initializes a new epoch arena with [count] arenas of [size] bytes each. [count] has to be at least 2,
+///so the producer always has an arena of its own while readers hold the one before it.
+///MEM: Borrowed-always
+///LIFETIME: Until passed into epoch_arena_deinit
+epoch_arena* epoch_arena_init(u32 count, u32 size){
+    if(count < 2 || count > EPOCH_ARENA_MAX){
+        printf("Expected between 2 and %i arenas in an epoch arena but got %i\n", EPOCH_ARENA_MAX, count);
+        return NULL;
+    }
+    epoch_arena* epochs = (epoch_arena*)malloc(sizeof(epoch_arena));
+    if(epochs == NULL){
+        return NULL;
+    }
+    epochs->count = count;
+    for(u32 i = 0; i < count; i++){
+        epochs->arenas[i] = arena_init(size);
+        atomic_init(&epochs->roots[i], NULL);
+        atomic_init(&epochs->pins[i], 0);
+    }
+    atomic_init(&epochs->epoch, 0);
+    atomic_init(&epochs->published, EPOCH_NONE);
+    return epochs;
+}
+
+///Deinitializes every arena in the ring. No reader may still have an epoch pinned.
+RECEIVER(epochs)
+void epoch_arena_deinit(epoch_arena* epochs){
+    for(u32 i = 0; i < epochs->count; i++){
+        arena_deinit(epochs->arenas[i]);
+    }
+    free(epochs);
+}
+
+///Gets the arena of the epoch the producer is putting into. Only the producer may call this.
+RECEIVER(epochs)
+arena_alloc* epoch_arena_current(epoch_arena* epochs){
+    u64 epoch = atomic_load_explicit(&epochs->epoch, memory_order_relaxed);
+    return epochs->arenas[epoch % epochs->count];
+}
+
+///Gets the epoch the producer is putting into
+RECEIVER(epochs)
+u64 epoch_arena_epoch(epoch_arena* epochs){
+    return atomic_load(&epochs->epoch);
+}
+
+///Publishes the current epoch with [root] and moves the producer onto the next one, resetting its arena,
+///but only if no reader still has that arena pinned. Returns false, having changed nothing, if one does.
+RECEIVER(epochs)
+bool epoch_arena_try_advance(epoch_arena* epochs, void* root){
+    u64 epoch = atomic_load_explicit(&epochs->epoch, memory_order_relaxed);
+    u32 current = epoch % epochs->count;
+    u32 next = (epoch + 1) % epochs->count;
+    ///Move on first, so a reader pinning the next arena from here on backs off, then check for ones that got there first.
+    ///Nothing is published until the move can't fail, so readers never see the epoch the producer is still putting into.
+    atomic_store(&epochs->epoch, epoch + 1);
+    if(atomic_load(&epochs->pins[next]) != 0){
+        ///A reader got there first. Step back so readers can keep pinning it, it hasn't been touched.
+        atomic_store(&epochs->epoch, epoch);
+        return false;
+    }
+    atomic_store_explicit(&epochs->roots[current], root, memory_order_relaxed);
+    ///Release, so a reader that sees this epoch published also sees everything put into it
+    atomic_store_explicit(&epochs->published, epoch, memory_order_release);
+    arena_reset(epochs->arenas[next]);
+    atomic_store_explicit(&epochs->roots[next], NULL, memory_order_relaxed);
+    return true;
+}
+
+///Publishes the current epoch with [root] and moves the producer onto the next one, resetting its arena.
+///If a reader still has that arena pinned, this yields until it's released.
+RECEIVER(epochs)
+void epoch_arena_advance(epoch_arena* epochs, void* root){
+    while(!epoch_arena_try_advance(epochs, root)){
+        sched_yield();
+    }
+}
+
+///Pins the latest published epoch so the producer can't reset it, and returns it.
+///[epoch] is EPOCH_NONE, and nothing is pinned, if the producer hasn't published anything yet.
+///Every pinned reader must be passed to epoch_arena_release once it's done reading.
+RECEIVER(epochs)
+epoch_reader epoch_arena_read(epoch_arena* epochs){
+    epoch_reader reader = { EPOCH_NONE, NULL, NULL };
+    for(;;){
+        u64 published = atomic_load_explicit(&epochs->published, memory_order_acquire);
+        if(published == EPOCH_NONE){
+            return reader;
+        }
+        u32 slot = published % epochs->count;
+        atomic_fetch_add(&epochs->pins[slot], 1);
+        ///The arena is ours unless the producer has already moved far enough on to reuse it
+        if(atomic_load(&epochs->epoch) < published + epochs->count){
+            reader.epoch = published;
+            reader.arena = epochs->arenas[slot];
+            reader.root = atomic_load_explicit(&epochs->roots[slot], memory_order_relaxed);
+            return reader;
+        }
+        atomic_fetch_sub(&epochs->pins[slot], 1);
+    }
+}
+
+///Releases a reader's pin so the producer can reset that arena again
+RECEIVER(epochs)
+void epoch_arena_release(epoch_arena* epochs, epoch_reader* reader){
+    if(reader->epoch == EPOCH_NONE){
+        return;
+    }
+    atomic_fetch_sub_explicit(&epochs->pins[reader->epoch % epochs->count], 1, memory_order_release);
+    reader->epoch = EPOCH_NONE;
+    reader->arena = NULL;
+    reader->root = NULL;
+}
@@ -0,0 +1,718 @@
+#pragma once
+
+#include "commons.h"
+#include "deque.h"
+#include "ilist.h"
+#include "mpmc.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "fiber.h only has a context switch for x86-64 Linux"
+#endif
+
+/*
+    Cooperative fibers, run M:N on a few worker threads, with channels that park the fiber instead of the thread.
+
+    A fiber is a function with its own stack. It runs until it yields, blocks on a channel, or returns,
+    and then its worker thread switches back to the scheduler loop and picks up the next ready fiber.
+    Ready fibers wait in one mpmc_queue that every worker pops from, so a fiber can resume on any worker.
+    A worker with nothing to run parks in mpmc_pop_wait.
+    A fiber woken by a channel handoff goes into its waker's worker's [next] slot instead, so a pair of fibers
+    talking to each other stay on one worker with warm caches and skip the shared queue. So that nothing waits
+    forever behind them, every FIBER_FAIRNESS switches a worker looks at the shared queue first.
+
+    A switch saves the callee-saved registers on the old stack, swaps stack pointers and restores them off
+    the new one, which is all the SysV ABI requires a call to keep. It's a few nanoseconds, against the
+    microseconds a thread handoff through the kernel costs.
+
+    Every fiber's stack comes out of a pool of mmap'd blocks, with the fiber itself at the top of its block
+    and a guard page at the bottom, so running off the end of the stack faults instead of corrupting the next one.
+
+    |-------------|------------------------------------------------|---------|
+    | guard page  |            stack, growing down  <--            |  fiber  |
+    |-------------|------------------------------------------------|---------|
+
+    Blocks are mapped FIBER_STACK_BATCH at a time and never unmapped before fiber_sched_deinit,
+    a finished fiber's block just goes back onto the pool's free list.
+
+    NOTE: Every guard page splits its mapping in two, and Linux caps a process at vm.max_map_count mappings,
+    65530 by default, which thread stacks, malloc and everything else need too. So guard pages only go on
+    stacks until they would take up half of that, and past that the pool says so once and leaves them off.
+
+    Everything a fiber does goes through the fiber* it was started with, rather than thread-local state,
+    since a fiber can move to another thread every time it blocks.
+*/
+
+///How big each fiber's stack is, not counting its guard page or the fiber itself
+#define FIBER_STACK_SIZE (64 * 1024)
+///How many stacks the pool maps at once
+#define FIBER_STACK_BATCH 64
+#define FIBER_CACHE_LINE 64
+///How many switches a worker makes between looking at the shared queue ahead of its [next] fiber
+#define FIBER_FAIRNESS 61
+
+typedef struct fiber fiber;
+typedef struct fiber_worker fiber_worker;
+typedef struct fiber_sched fiber_sched;
+
+typedef void (*fiber_fn)(fiber* self, void* arg);
+
+///What a worker does once the fiber it was running has switched back to it
+INTERNAL
+enum fiber_action{
+    FIBER_RESUMED,
+    ///Put the fiber back on the ready queue
+    FIBER_YIELDED,
+    ///Leave the fiber alone, whoever wakes it readies it. Release [unlock] now that it's off its stack.
+    FIBER_PARKED,
+    ///Give the fiber's stack back
+    FIBER_EXITED
+};
+typedef enum fiber_action fiber_action;
+
+///A spinlock for the short critical sections around channels, which a parked fiber's worker releases for it
+INTERNAL
+struct fiber_lock{
+    atomic_flag flag;
+};
+typedef struct fiber_lock fiber_lock;
+
+PUBLIC
+struct fiber{
+    ///The saved stack pointer while the fiber isn't running
+    INTERNAL
+    void* sp;
+    INTERNAL
+    fiber_fn fn;
+    INTERNAL
+    void* arg;
+    ///The worker currently running this fiber
+    INTERNAL
+    fiber_worker* worker;
+    INTERNAL
+    fiber_sched* sched;
+    ///The start of this fiber's block, guard page included
+    INTERNAL
+    u8* block;
+    ///The next free block, while this one is free
+    INTERNAL
+    fiber* next_free;
+    ///Links the fiber into a channel's list of waiting senders or receivers
+    INTERNAL
+    ilist_node link;
+    ///What a parked sender sends or where a parked receiver receives into
+    INTERNAL
+    void* transfer;
+    ///Whether the handoff a fiber parked for happened, or it was woken by the channel closing
+    INTERNAL
+    bool transfer_ok;
+};
+
+PUBLIC
+struct fiber_worker{
+    ///The scheduler loop's saved stack pointer while a fiber runs
+    INTERNAL
+    void* sp;
+    INTERNAL
+    fiber* current;
+    ///A fiber the running one just woke up, which this worker runs next
+    INTERNAL
+    fiber* next;
+    INTERNAL
+    fiber_action action;
+    INTERNAL
+    fiber_lock* unlock;
+    INTERNAL
+    fiber_sched* sched;
+    INTERNAL
+    pthread_t thread;
+    ///How many times this worker switched into a fiber
+    INTERNAL
+    u64 switches;
+};
+
+PUBLIC
+struct fiber_sched{
+    INTERNAL
+    lazy_arena_alloc* arena;
+    ///Fibers ready to run. It has room for every fiber there can be, so readying one never waits.
+    INTERNAL
+    mpmc_queue* ready;
+    INTERNAL
+    u32 max_fibers;
+    ///Fibers spawned and not yet returned. The last one to return closes [ready], which stops the workers.
+    INTERNAL
+    _Atomic u32 live;
+    INTERNAL
+    u32 thread_count;
+    INTERNAL
+    fiber_worker* workers;
+
+    INTERNAL
+    pthread_mutex_t pool_lock;
+    INTERNAL
+    fiber* free_blocks;
+    INTERNAL
+    u32 stack_size;
+    ///The size of a block: guard page, stack and fiber, in whole pages
+    INTERNAL
+    u32 block_size;
+    INTERNAL
+    u32 page_size;
+    ///How many more stacks get a guard page, out of the process' share of vm.max_map_count
+    INTERNAL
+    u32 guard_budget;
+    ///Every batch mapping, to unmap them all in fiber_sched_deinit
+    INTERNAL
+    void** mappings;
+    INTERNAL
+    u32 mapping_count;
+    INTERNAL
+    u32 mapping_capacity;
+};
+
+///Saves the callee-saved registers and the fp control words on the current stack, stores the stack pointer
+///into [save_sp], and restores everything from [load_sp]. Returns when something switches back to [save_sp].
+INTERNAL
+void fiber_switch(void** save_sp, void* load_sp);
+
+///Where a new fiber's first switch returns to. fiber_prepare left the fiber in r12, so pass it on to fiber_start.
+INTERNAL
+void fiber_trampoline(void);
+
+__asm__(
+    ".pushsection .text\n"
+    ".globl fiber_switch\n"
+    ".type fiber_switch, @function\n"
+    "fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size fiber_switch, .-fiber_switch\n"
+    ".globl fiber_trampoline\n"
+    ".type fiber_trampoline, @function\n"
+    "fiber_trampoline:\n"
+    "    movq %r12, %rdi\n"
+    "    call fiber_start\n"
+    "    ud2\n"
+    ".size fiber_trampoline, .-fiber_trampoline\n"
+    ".popsection\n"
+);
+
+INTERNAL
+RECEIVER(lock)
+void fiber_lock_acquire(fiber_lock* lock){
+    u32 spins = 0;
+    while(atomic_flag_test_and_set_explicit(&lock->flag, memory_order_acquire)){
+        mpmc_backoff(spins++);
+    }
+}
+
+INTERNAL
+RECEIVER(lock)
+void fiber_lock_release(fiber_lock* lock){
+    atomic_flag_clear_explicit(&lock->flag, memory_order_release);
+}
+
+///Switches from the running fiber back to its worker's scheduler loop, which does [action] with it
+INTERNAL
+RECEIVER(self)
+void fiber_suspend(fiber* self, fiber_action action, fiber_lock* unlock){
+    fiber_worker* worker = self->worker;
+    worker->action = action;
+    worker->unlock = unlock;
+    fiber_switch(&self->sp, worker->sp);
+}
+
+///Where every fiber starts, on its own stack. It never returns, the worker drops the stack instead.
+///Only fiber_trampoline calls this, so it's marked used to keep it from being dropped.
+INTERNAL
+__attribute__((used))
+void fiber_start(fiber* self){
+    self->fn(self, self->arg);
+    fiber_suspend(self, FIBER_EXITED, NULL);
+}
+
+///Lays out a fresh stack so the first switch to it "returns" into fiber_trampoline with the fiber in r12
+INTERNAL
+RECEIVER(self)
+void fiber_prepare(fiber* self){
+    ///The stack tops out just under the fiber, 16 byte aligned
+    u64* top = (u64*)((uintptr_t)self & ~(uintptr_t)15);
+    ///fiber_trampoline runs with the stack 16 byte aligned, so its call lands in fiber_start as a normal call would
+    top[-2] = 0;
+    top[-3] = (u64)(uintptr_t)fiber_trampoline;
+    ///rbp, rbx, r12, r13, r14, r15, as fiber_switch pops them back off in reverse
+    top[-4] = 0;
+    top[-5] = 0;
+    top[-6] = (u64)(uintptr_t)self;
+    top[-7] = 0;
+    top[-8] = 0;
+    top[-9] = 0;
+    ///The default mxcsr, and the default x87 control word right above it
+    top[-10] = 0x1F80ull | (0x037Full << 32);
+    self->sp = &top[-10];
+}
+
+///Maps another FIBER_STACK_BATCH blocks and puts them on the free list. The pool lock must be held.
+INTERNAL
+RECEIVER(sched)
+bool fiber_pool_grow(fiber_sched* sched){
+    size_t length = (size_t)sched->block_size * FIBER_STACK_BATCH;
+    u8* mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mapping == MAP_FAILED){
+        printf("Could not map %zu bytes of fiber stacks\n", length);
+        return false;
+    }
+    if(sched->mapping_count == sched->mapping_capacity){
+        u32 capacity = sched->mapping_capacity == 0 ? 16 : sched->mapping_capacity * 2;
+        void** mappings = realloc(sched->mappings, sizeof(void*) * capacity);
+        if(mappings == NULL){
+            munmap(mapping, length);
+            return false;
+        }
+        sched->mappings = mappings;
+        sched->mapping_capacity = capacity;
+    }
+    sched->mappings[sched->mapping_count++] = mapping;
+    for(u32 i = FIBER_STACK_BATCH; i-- > 0;){
+        u8* block = mapping + (size_t)i * sched->block_size;
+        if(sched->guard_budget != 0){
+            if(mprotect(block, sched->page_size, PROT_NONE) != 0){
+                printf("Could not add a guard page to a fiber stack (%s), so stacks from here on have none\n", strerror(errno));
+                sched->guard_budget = 0;
+            }else if(--sched->guard_budget == 0){
+                printf("Out of mappings for guard pages, so fiber stacks from here on have none. Raising vm.max_map_count fixes this.\n");
+            }
+        }
+        fiber* f = (fiber*)(block + sched->block_size - ((sizeof(fiber) + FIBER_CACHE_LINE - 1) & ~(size_t)(FIBER_CACHE_LINE - 1)));
+        f->block = block;
+        f->next_free = sched->free_blocks;
+        sched->free_blocks = f;
+    }
+    return true;
+}
+
+INTERNAL
+RECEIVER(sched)
+fiber* fiber_pool_take(fiber_sched* sched){
+    pthread_mutex_lock(&sched->pool_lock);
+    if(sched->free_blocks == NULL && !fiber_pool_grow(sched)){
+        pthread_mutex_unlock(&sched->pool_lock);
+        return NULL;
+    }
+    fiber* f = sched->free_blocks;
+    sched->free_blocks = f->next_free;
+    pthread_mutex_unlock(&sched->pool_lock);
+    return f;
+}
+
+INTERNAL
+RECEIVER(sched)
+void fiber_pool_give(fiber_sched* sched, fiber* f){
+    pthread_mutex_lock(&sched->pool_lock);
+    f->next_free = sched->free_blocks;
+    sched->free_blocks = f;
+    pthread_mutex_unlock(&sched->pool_lock);
+}
+
+///Puts [f] on the ready queue. There's always room, since there's a cell for every fiber there can be.
+INTERNAL
+RECEIVER(sched)
+void fiber_ready(fiber_sched* sched, fiber* f){
+    mpmc_push_wait(sched->ready, &f);
+}
+
+///Readies [f] from the running fiber [self], putting it in its worker's [next] slot.
+///Whatever was there already goes onto the shared queue.
+INTERNAL
+RECEIVER(self)
+void fiber_ready_next(fiber* self, fiber* f){
+    fiber_worker* worker = self->worker;
+    fiber* bumped = worker->next;
+    worker->next = f;
+    if(bumped != NULL){
+        fiber_ready(self->sched, bumped);
+    }
+}
+
+///Picks the fiber a worker runs next: its [next] slot, or the shared queue when that's empty or it's time to be fair.
+///Returns NULL once the queue is closed, which is when every fiber is done.
+INTERNAL
+RECEIVER(worker)
+fiber* fiber_worker_pick(fiber_worker* worker){
+    fiber* f = worker->next;
+    if(f == NULL){
+        return mpmc_pop_wait(worker->sched->ready, &f) ? f : NULL;
+    }
+    fiber* queued;
+    if(worker->switches % FIBER_FAIRNESS == 0 && mpmc_try_pop(worker->sched->ready, &queued)){
+        return queued;
+    }
+    worker->next = NULL;
+    return f;
+}
+
+///The scheduler loop every worker runs: pick a ready fiber, run it until it switches back, deal with why it did
+INTERNAL
+void* fiber_worker_main(void* arg){
+    fiber_worker* worker = (fiber_worker*)arg;
+    fiber_sched* sched = worker->sched;
+    fiber* f;
+    while((f = fiber_worker_pick(worker)) != NULL){
+        worker->current = f;
+        worker->action = FIBER_RESUMED;
+        f->worker = worker;
+        worker->switches += 1;
+        fiber_switch(&worker->sp, f->sp);
+        worker->current = NULL;
+        switch(worker->action){
+            case FIBER_YIELDED:
+                fiber_ready(sched, f);
+                break;
+            case FIBER_PARKED:
+                ///Only now that the fiber is off its stack can whoever wakes it be let in
+                fiber_lock_release(worker->unlock);
+                break;
+            case FIBER_EXITED:
+                fiber_pool_give(sched, f);
+                if(atomic_fetch_sub(&sched->live, 1) == 1){
+                    mpmc_close(sched->ready);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
+///Creates a scheduler that runs up to [max_fibers] fibers at once on [thread_count] threads, including the
+///caller of fiber_sched_run. If [thread_count] is 0, one thread per online cpu is used.
+///If [stack_size] is 0, every fiber gets FIBER_STACK_SIZE bytes of stack.
+///MEM: Borrowed-always
+///LIFETIME: This persists until it's passed into fiber_sched_deinit
+PUBLIC
+fiber_sched* fiber_sched_init(u32 thread_count, u32 max_fibers, u32 stack_size){
+    if(thread_count == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (u32)cpus : 1;
+    }
+    if(max_fibers == 0){
+        printf("A scheduler needs room for at least one fiber\n");
+        return NULL;
+    }
+    fiber_sched* sched = (fiber_sched*)calloc(1, sizeof(fiber_sched));
+    if(sched == NULL){
+        return NULL;
+    }
+    sched->page_size = (u32)sysconf(_SC_PAGESIZE);
+    sched->stack_size = stack_size == 0 ? FIBER_STACK_SIZE : stack_size;
+    u64 block_size = (u64)sched->page_size + sched->stack_size + sizeof(fiber) + FIBER_CACHE_LINE;
+    sched->block_size = (u32)((block_size + sched->page_size - 1) & ~(u64)(sched->page_size - 1));
+    ///Each guarded stack costs two mappings, and they get half of what the process is allowed
+    u32 max_map_count = 65530;
+    FILE* limit = fopen("/proc/sys/vm/max_map_count", "r");
+    if(limit != NULL){
+        if(fscanf(limit, "%u", &max_map_count) != 1){
+            max_map_count = 65530;
+        }
+        fclose(limit);
+    }
+    sched->guard_budget = max_map_count / 4;
+    pthread_mutex_init(&sched->pool_lock, NULL);
+    sched->max_fibers = max_fibers;
+    atomic_init(&sched->live, 0);
+    sched->arena = lazy_arena_init(mpmc_arena_size(sizeof(fiber*), max_fibers));
+    sched->ready = mpmc_create(sched->arena, sizeof(fiber*), max_fibers);
+    sched->thread_count = thread_count;
+    sched->workers = (fiber_worker*)calloc(thread_count, sizeof(fiber_worker));
+    if(sched->ready == NULL || sched->workers == NULL){
+        printf("Could not allocate a scheduler for %i fibers on %i threads\n", max_fibers, thread_count);
+        if(sched->arena != NULL){
+            lazy_arena_deinit(sched->arena);
+        }
+        free(sched->workers);
+        free(sched);
+        return NULL;
+    }
+    for(u32 i = 0; i < thread_count; i++){
+        sched->workers[i].sched = sched;
+    }
+    return sched;
+}
+
+///Frees the scheduler and unmaps every fiber stack. Any fiber that never finished is gone with it.
+PUBLIC
+RECEIVER(sched)
+void fiber_sched_deinit(fiber_sched* sched){
+    if(sched == NULL){
+        return;
+    }
+    for(u32 i = 0; i < sched->mapping_count; i++){
+        munmap(sched->mappings[i], (size_t)sched->block_size * FIBER_STACK_BATCH);
+    }
+    free(sched->mappings);
+    pthread_mutex_destroy(&sched->pool_lock);
+    lazy_arena_deinit(sched->arena);
+    free(sched->workers);
+    free(sched);
+}
+
+///Gets how many times any worker switched into a fiber
+PUBLIC
+RECEIVER(sched)
+u64 fiber_sched_switches(fiber_sched* sched){
+    u64 switches = 0;
+    for(u32 i = 0; i < sched->thread_count; i++){
+        switches += sched->workers[i].switches;
+    }
+    return switches;
+}
+
+///Starts a fiber that runs [fn] with [arg]. This can be called from any thread or fiber, before or during
+///fiber_sched_run. Returns NULL if [max_fibers] are already alive or there was no stack for it.
+PUBLIC
+RECEIVER(sched)
+fiber* fiber_spawn(fiber_sched* sched, fiber_fn fn, void* arg){
+    u32 live = atomic_fetch_add(&sched->live, 1);
+    if(live >= sched->max_fibers){
+        atomic_fetch_sub(&sched->live, 1);
+        printf("Cannot spawn more than %i fibers at once\n", sched->max_fibers);
+        return NULL;
+    }
+    fiber* f = fiber_pool_take(sched);
+    if(f == NULL){
+        atomic_fetch_sub(&sched->live, 1);
+        return NULL;
+    }
+    u8* block = f->block;
+    memset(f, 0, sizeof(fiber));
+    f->block = block;
+    f->fn = fn;
+    f->arg = arg;
+    f->sched = sched;
+    ilist_node_init(&f->link);
+    fiber_prepare(f);
+    fiber_ready(sched, f);
+    return f;
+}
+
+///Runs fibers on the calling thread and [thread_count] - 1 more until every fiber has returned.
+///A scheduler runs once: spawn the first fibers, run it, then pass it to fiber_sched_deinit.
+///NOTE: If a fiber is left waiting on a channel nobody will send to or close, this never returns.
+PUBLIC
+RECEIVER(sched)
+void fiber_sched_run(fiber_sched* sched){
+    if(atomic_load(&sched->live) == 0){
+        return;
+    }
+    u32 started = 1;
+    for(; started < sched->thread_count; started++){
+        if(pthread_create(&sched->workers[started].thread, NULL, fiber_worker_main, &sched->workers[started]) != 0){
+            printf("Could only start %i of %i fiber threads\n", started, sched->thread_count);
+            break;
+        }
+    }
+    fiber_worker_main(&sched->workers[0]);
+    for(u32 i = 1; i < started; i++){
+        pthread_join(sched->workers[i].thread, NULL);
+    }
+}
+
+///Lets every other ready fiber run before this one carries on
+PUBLIC
+RECEIVER(self)
+void fiber_yield(fiber* self){
+    fiber_suspend(self, FIBER_YIELDED, NULL);
+}
+
+///Parks the fiber until someone readies it. [lock] is held on the way in and released once the fiber is off its stack.
+INTERNAL
+RECEIVER(self)
+void fiber_park(fiber* self, fiber_lock* lock){
+    fiber_suspend(self, FIBER_PARKED, lock);
+}
+
+/*
+    A channel between fibers. Buffered channels keep their elements in a deque, unbuffered ones hand every
+    element straight from sender to receiver. A fiber that has to wait links itself into the channel's list
+    of senders or receivers and parks, and whoever completes its send or receive readies it again.
+*/
+PUBLIC
+struct fiber_chan{
+    INTERNAL
+    fiber_lock lock;
+    ///The scheduler whose fibers use this channel, which is where woken fibers are readied
+    INTERNAL
+    fiber_sched* sched;
+    ///The buffered elements, or NULL for an unbuffered channel
+    INTERNAL
+    deque_alloc* buffer;
+    ///How many elements can be buffered. The deque rounds its slots up to a power of two, so this is kept apart.
+    INTERNAL
+    u32 capacity;
+    INTERNAL
+    u32 slot_size;
+    INTERNAL
+    ilist senders;
+    INTERNAL
+    ilist receivers;
+    INTERNAL
+    bool closed;
+};
+typedef struct fiber_chan fiber_chan;
+
+///Creates a channel of [slot_size] byte elements between fibers of [sched] that buffers up to [capacity] of them,
+///or hands each one straight over if [capacity] is 0.
+///MEM: Borrowed-always
+///LIFETIME: Until passed into fiber_chan_deinit, after every fiber is done with it
+PUBLIC
+RECEIVER(sched)
+fiber_chan* fiber_chan_init(fiber_sched* sched, u32 slot_size, u32 capacity){
+    fiber_chan* chan = (fiber_chan*)calloc(1, sizeof(fiber_chan));
+    if(chan == NULL){
+        return NULL;
+    }
+    if(capacity != 0){
+        deque_result created = deque_create_heap(slot_size, capacity, false);
+        if(created.tag != SUCCESS){
+            printf("Could not create a buffer of %i elements of %i bytes for a channel\n", capacity, slot_size);
+            free(chan);
+            return NULL;
+        }
+        chan->buffer = created.data;
+    }
+    atomic_flag_clear(&chan->lock.flag);
+    chan->sched = sched;
+    chan->capacity = capacity;
+    chan->slot_size = slot_size;
+    ilist_init(&chan->senders);
+    ilist_init(&chan->receivers);
+    return chan;
+}
+
+PUBLIC
+RECEIVER(chan)
+void fiber_chan_deinit(fiber_chan* chan){
+    if(chan == NULL){
+        return;
+    }
+    deque_destroy(chan->buffer);
+    free(chan);
+}
+
+///Sends the element at [data], parking [self] until there is room or a receiver takes it.
+///Returns false if the channel is closed, in which case nothing was sent.
+PUBLIC
+RECEIVER(chan)
+bool fiber_send(fiber* self, fiber_chan* chan, void* data){
+    fiber_lock_acquire(&chan->lock);
+    if(chan->closed){
+        fiber_lock_release(&chan->lock);
+        return false;
+    }
+    ilist_node* waiting = ilist_pop_front(&chan->receivers);
+    if(waiting != NULL){
+        ///A receiver is already parked, so hand it over directly
+        fiber* receiver = ILIST_CONTAINER(waiting, fiber, link);
+        memcpy(receiver->transfer, data, chan->slot_size);
+        receiver->transfer_ok = true;
+        fiber_lock_release(&chan->lock);
+        fiber_ready_next(self, receiver);
+        return true;
+    }
+    if(chan->buffer != NULL && deque_count(chan->buffer) < chan->capacity){
+        deque_push_tail(chan->buffer, data);
+        fiber_lock_release(&chan->lock);
+        return true;
+    }
+    self->transfer = data;
+    self->transfer_ok = false;
+    ilist_push_back(&chan->senders, &self->link);
+    fiber_park(self, &chan->lock);
+    return self->transfer_ok;
+}
+
+///Receives the next element into [data], parking [self] until there is one.
+///Returns false once the channel is closed and has nothing left in it.
+PUBLIC
+RECEIVER(chan)
+bool fiber_recv(fiber* self, fiber_chan* chan, OUT void* data){
+    fiber_lock_acquire(&chan->lock);
+    fiber* sender = NULL;
+    ilist_node* waiting = ilist_pop_front(&chan->senders);
+    if(waiting != NULL){
+        sender = ILIST_CONTAINER(waiting, fiber, link);
+    }
+    if(chan->buffer != NULL && deque_count(chan->buffer) != 0){
+        deque_pop_head(chan->buffer, data);
+        ///That made room, so the first parked sender's element moves into the buffer
+        if(sender != NULL){
+            deque_push_tail(chan->buffer, sender->transfer);
+        }
+    }else if(sender != NULL){
+        memcpy(data, sender->transfer, chan->slot_size);
+    }else if(chan->closed){
+        fiber_lock_release(&chan->lock);
+        return false;
+    }else{
+        self->transfer = data;
+        self->transfer_ok = false;
+        ilist_push_back(&chan->receivers, &self->link);
+        fiber_park(self, &chan->lock);
+        return self->transfer_ok;
+    }
+    fiber_lock_release(&chan->lock);
+    if(sender != NULL){
+        sender->transfer_ok = true;
+        fiber_ready_next(self, sender);
+    }
+    return true;
+}
+
+///Closes the channel. Parked senders and receivers wake up with false, and receivers can still drain the buffer.
+///This can be called from a fiber or from outside any fiber.
+PUBLIC
+RECEIVER(chan)
+void fiber_chan_close(fiber_chan* chan){
+    ilist woken;
+    ilist_init(&woken);
+    fiber_lock_acquire(&chan->lock);
+    chan->closed = true;
+    ilist_splice_back(&woken, &chan->senders);
+    ilist_splice_back(&woken, &chan->receivers);
+    fiber_lock_release(&chan->lock);
+    ILIST_FOR_EACH_SAFE(&woken, node){
+        fiber* f = ILIST_CONTAINER(node, fiber, link);
+        ilist_unlink(node);
+        f->transfer_ok = false;
+        fiber_ready(chan->sched, f);
+    }
+}
@@ -0,0 +1,437 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+    Approximate membership filters. Both of these answer "is this hash definitely not in the set?"
+    so a lookup that is going to miss can be turned away before walking a whole map.
+    They never give a false negative, but can give a false positive.
+
+    A bloom_filter is a blocked bloom filter. Every key lands in exactly one 32 byte block, and sets
+    one bit in each of the 8 words of that block. Blocks are aligned so one never straddles a cache line,
+    so a lookup costs a single cache line no matter how many bits are tested.
+    |---------------------------------------------------------------|
+    |                     bloom_block (32 bytes)                    |
+    |---------------------------------------------------------------|
+    |  u32  |  u32  |  u32  |  u32  |  u32  |  u32  |  u32  |  u32  |
+    |---------------------------------------------------------------|
+
+    A cuckoo_filter stores a 16 bit fingerprint of each key in one of two buckets of 4 fingerprints.
+    Unlike the bloom filter, keys can be removed again.
+    |-------------------------------------------|
+    |          cuckoo bucket (8 bytes)          |
+    |-------------------------------------------|
+    |  u16 fp  |  u16 fp  |  u16 fp  |  u16 fp  |
+    |-------------------------------------------|
+
+    Both are put into an arena_alloc and live as long as it does. Neither is thread safe.
+*/
+
+#define BLOOM_BLOCK_WORDS 8
+#define CUCKOO_BUCKET_SLOTS 4
+#define CUCKOO_MAX_KICKS 500
+
+///One block of a bloom_filter
+INTERNAL
+struct bloom_block{
+    u32 words[BLOOM_BLOCK_WORDS];
+};
+typedef struct bloom_block bloom_block;
+
+PUBLIC
+EXTENSION(arena)
+struct bloom_filter{
+    INTERNAL
+    u32 block_count;
+    INTERNAL
+    bloom_block* blocks;
+};
+typedef struct bloom_filter bloom_filter;
+
+PUBLIC
+EXTENSION(arena)
+struct cuckoo_filter{
+    ///The number of buckets. Always a power of two so the alternate bucket can be found with a xor.
+    INTERNAL
+    u32 bucket_count;
+    ///The number of fingerprints currently stored, including the victim
+    INTERNAL
+    u32 count;
+    ///State for picking which fingerprint to kick out of a full bucket
+    INTERNAL
+    u32 rng;
+    ///A fingerprint that was kicked out and could not be placed. It is still checked by lookups,
+    ///so a failed insert never causes a false negative.
+    INTERNAL
+    u16 victim;
+    INTERNAL
+    u32 victim_bucket;
+    INTERNAL
+    u64* buckets;
+};
+typedef struct cuckoo_filter cuckoo_filter;
+
+///Which filter a membership_filter holds. NO_FILTER means every lookup is let through.
+PUBLIC
+enum membership_filter_kind{
+    NO_FILTER,
+    BLOOM_FILTER,
+    CUCKOO_FILTER
+};
+typedef enum membership_filter_kind membership_filter_kind;
+
+///Either filter behind one tag, so a container can hold whichever one it was given.
+///SEE: map_attach_filter
+PUBLIC
+struct membership_filter{
+    membership_filter_kind kind;
+    union{
+        bloom_filter* bloom;
+        cuckoo_filter* cuckoo;
+    };
+};
+typedef struct membership_filter membership_filter;
+
+///The murmur3 finalizer. Spreads every input bit over the whole output.
+INTERNAL
+u64 filter_mix(u64 value){
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+///Hashes [size] bytes of [data] eight at a time. Filters need every bit of the result to be
+///well mixed, since the block, bucket and fingerprint are all taken from different bits.
+PUBLIC
+u64 filter_hash(void* data, u32 size){
+    u8* bytes = (u8*)data;
+    u64 hash = 0x9e3779b97f4a7c15ull ^ size;
+    while(size >= sizeof(u64)){
+        u64 word;
+        memcpy(&word, bytes, sizeof(u64));
+        hash = (hash ^ filter_mix(word)) * 0x9e3779b97f4a7c15ull;
+        bytes += sizeof(u64);
+        size -= sizeof(u64);
+    }
+    if(size != 0){
+        u64 tail = 0;
+        memcpy(&tail, bytes, size);
+        hash = (hash ^ filter_mix(tail)) * 0x9e3779b97f4a7c15ull;
+    }
+    return filter_mix(hash);
+}
+
+///Reserves zeroed, aligned memory from the arena
+INTERNAL
+RECEIVER(arena)
+void* filter_reserve_aligned(arena_alloc* arena, u32 size, u32 align){
+    void* aligned = arena_reserve_aligned(arena, size, align);
+    if(aligned != NULL){
+        memset(aligned, 0, size);
+    }
+    return aligned;
+}
+
+///Creates a bloom filter sized for [expected_items] keys at [bits_per_item] bits each.
+///10 bits per item gives roughly a 1% false positive rate.
+PUBLIC
+RECEIVER(arena)
+bloom_filter* create_bloom_filter(arena_alloc* arena, u32 expected_items, u32 bits_per_item){
+    u64 bits = (u64)expected_items * bits_per_item;
+    u64 block_count = (bits + sizeof(bloom_block) * 8 - 1) / (sizeof(bloom_block) * 8);
+    if(block_count == 0){
+        block_count = 1;
+    }
+    if(block_count * sizeof(bloom_block) > arena->size){
+        printf("A bloom filter of %i items at %i bits each does not fit in the arena\n", expected_items, bits_per_item);
+        return NULL;
+    }
+    bloom_filter filter;
+    filter.block_count = (u32)block_count;
+    filter.blocks = filter_reserve_aligned(arena, filter.block_count * sizeof(bloom_block), sizeof(bloom_block));
+    if(filter.blocks == NULL){
+        return NULL;
+    }
+    return arena_put(arena, &filter, sizeof(bloom_filter));
+}
+
+///The odd constants used to pick one bit out of each word of a block
+INTERNAL
+static const u32 bloom_salts[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+///The upper half of the hash picks the block without needing a power of two block count
+INTERNAL
+RECEIVER(filter)
+bloom_block* bloom_filter_block(bloom_filter* filter, u64 hash){
+    u64 index = ((hash >> 32) * filter->block_count) >> 32;
+    return &filter->blocks[index];
+}
+
+///The lower half of the hash picks one bit in each word
+INTERNAL
+void bloom_filter_mask(u32 hash, OUT u32* mask){
+    for(u32 i = 0; i < BLOOM_BLOCK_WORDS; i++){
+        mask[i] = 1u << ((hash * bloom_salts[i]) >> 27);
+    }
+}
+
+PUBLIC
+RECEIVER(filter)
+void bloom_filter_insert(bloom_filter* filter, u64 hash){
+    bloom_block* block = bloom_filter_block(filter, hash);
+#if defined(__AVX2__)
+    __m256i salts = _mm256_loadu_si256((__m256i*)bloom_salts);
+    __m256i shifts = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((u32)hash), salts), 27);
+    __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+    __m256i words = _mm256_load_si256((__m256i*)block->words);
+    _mm256_store_si256((__m256i*)block->words, _mm256_or_si256(words, mask));
+#else
+    u32 mask[BLOOM_BLOCK_WORDS];
+    bloom_filter_mask((u32)hash, mask);
+    for(u32 i = 0; i < BLOOM_BLOCK_WORDS; i++){
+        block->words[i] |= mask[i];
+    }
+#endif
+}
+
+///Returns false if the hash was definitely never inserted.
+///This only ever touches the one block the hash lands in, and tests all 8 words at once.
+PUBLIC
+RECEIVER(filter)
+bool bloom_filter_contains(bloom_filter* filter, u64 hash){
+    bloom_block* block = bloom_filter_block(filter, hash);
+#if defined(__AVX2__)
+    __m256i salts = _mm256_loadu_si256((__m256i*)bloom_salts);
+    __m256i shifts = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((u32)hash), salts), 27);
+    __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+    __m256i words = _mm256_load_si256((__m256i*)block->words);
+    ///testc is set when every bit of mask is also set in words
+    return _mm256_testc_si256(words, mask);
+#elif defined(__SSE2__)
+    ///SSE2 has no per-lane shift, so the mask is built in scalar and only the test is vectorized
+    u32 mask[BLOOM_BLOCK_WORDS] __attribute__((aligned(16)));
+    bloom_filter_mask((u32)hash, mask);
+    __m128i low_mask = _mm_load_si128((__m128i*)mask);
+    __m128i high_mask = _mm_load_si128((__m128i*)(mask + 4));
+    __m128i low = _mm_and_si128(_mm_load_si128((__m128i*)block->words), low_mask);
+    __m128i high = _mm_and_si128(_mm_load_si128((__m128i*)(block->words + 4)), high_mask);
+    __m128i equal = _mm_and_si128(_mm_cmpeq_epi32(low, low_mask), _mm_cmpeq_epi32(high, high_mask));
+    return _mm_movemask_epi8(equal) == 0xffff;
+#else
+    u32 mask[BLOOM_BLOCK_WORDS];
+    bloom_filter_mask((u32)hash, mask);
+    for(u32 i = 0; i < BLOOM_BLOCK_WORDS; i++){
+        if((block->words[i] & mask[i]) != mask[i]){
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+///Forgets everything that was inserted
+PUBLIC
+RECEIVER(filter)
+void bloom_filter_clear(bloom_filter* filter){
+    memset(filter->blocks, 0, filter->block_count * sizeof(bloom_block));
+}
+
+///Creates a cuckoo filter that can hold at least [expected_items] keys.
+///The bucket count is rounded up to a power of two, and sized so the table is at most ~95% full,
+///which is about as full as 4 slot buckets get before inserts start failing.
+PUBLIC
+RECEIVER(arena)
+cuckoo_filter* create_cuckoo_filter(arena_alloc* arena, u32 expected_items){
+    u64 wanted = ((u64)expected_items * 100 / 95 + CUCKOO_BUCKET_SLOTS - 1) / CUCKOO_BUCKET_SLOTS;
+    u64 bucket_count = 1;
+    while(bucket_count < wanted){
+        bucket_count <<= 1;
+    }
+    if(bucket_count * sizeof(u64) > arena->size){
+        printf("A cuckoo filter of %i items does not fit in the arena\n", expected_items);
+        return NULL;
+    }
+    cuckoo_filter filter;
+    filter.bucket_count = (u32)bucket_count;
+    filter.count = 0;
+    filter.rng = 0x9e3779b9u;
+    filter.victim = 0;
+    filter.victim_bucket = 0;
+    filter.buckets = filter_reserve_aligned(arena, filter.bucket_count * sizeof(u64), 64);
+    if(filter.buckets == NULL){
+        return NULL;
+    }
+    return arena_put(arena, &filter, sizeof(cuckoo_filter));
+}
+
+///The fingerprint is taken from the top 16 bits. 0 marks an empty slot so it's never used.
+INTERNAL
+u16 cuckoo_fingerprint(u64 hash){
+    u16 fingerprint = (u16)(hash >> 48);
+    return fingerprint == 0 ? 1 : fingerprint;
+}
+
+///The other bucket a fingerprint can live in. Applying this twice gives back the first bucket.
+INTERNAL
+RECEIVER(filter)
+u32 cuckoo_alt_bucket(cuckoo_filter* filter, u32 bucket, u16 fingerprint){
+    return (bucket ^ (fingerprint * 0x5bd1e995u)) & (filter->bucket_count - 1);
+}
+
+///Finds the slot holding [fingerprint] in a bucket, or -1.
+///The 4 fingerprints are compared at once by looking for a zero 16 bit lane in bucket ^ fingerprint.
+INTERNAL
+i32 cuckoo_bucket_find(u64 bucket, u16 fingerprint){
+    u64 lanes = bucket ^ (fingerprint * 0x0001000100010001ull);
+    u64 zero = (lanes - 0x0001000100010001ull) & ~lanes & 0x8000800080008000ull;
+    if(zero == 0){
+        return -1;
+    }
+    return __builtin_ctzll(zero) / 16;
+}
+
+///Tries to put the fingerprint in an empty slot of the bucket
+INTERNAL
+RECEIVER(filter)
+bool cuckoo_bucket_put(cuckoo_filter* filter, u32 bucket, u16 fingerprint){
+    i32 slot = cuckoo_bucket_find(filter->buckets[bucket], 0);
+    if(slot < 0){
+        return false;
+    }
+    filter->buckets[bucket] |= (u64)fingerprint << (slot * 16);
+    return true;
+}
+
+///Inserts a hash. Returns false if the filter is too full to take it, in which case the hash
+///was not inserted and the caller should stop trusting misses from this filter.
+PUBLIC
+RECEIVER(filter)
+bool cuckoo_filter_insert(cuckoo_filter* filter, u64 hash){
+    if(filter->victim != 0){
+        return false;
+    }
+    u16 fingerprint = cuckoo_fingerprint(hash);
+    u32 bucket = (u32)hash & (filter->bucket_count - 1);
+    u32 alt = cuckoo_alt_bucket(filter, bucket, fingerprint);
+    if(cuckoo_bucket_put(filter, bucket, fingerprint) || cuckoo_bucket_put(filter, alt, fingerprint)){
+        filter->count += 1;
+        return true;
+    }
+    ///Both buckets are full, so keep kicking a random fingerprint to its alternate bucket
+    ///until one lands in an empty slot
+    bucket = (filter->rng & 1) ? alt : bucket;
+    for(u32 kick = 0; kick < CUCKOO_MAX_KICKS; kick++){
+        filter->rng ^= filter->rng << 13;
+        filter->rng ^= filter->rng >> 17;
+        filter->rng ^= filter->rng << 5;
+        u32 slot = filter->rng % CUCKOO_BUCKET_SLOTS;
+        u64 lane = 0xffffull << (slot * 16);
+        u16 kicked = (u16)((filter->buckets[bucket] & lane) >> (slot * 16));
+        filter->buckets[bucket] = (filter->buckets[bucket] & ~lane) | ((u64)fingerprint << (slot * 16));
+        fingerprint = kicked;
+        bucket = cuckoo_alt_bucket(filter, bucket, fingerprint);
+        if(cuckoo_bucket_put(filter, bucket, fingerprint)){
+            filter->count += 1;
+            return true;
+        }
+    }
+    ///The hash itself did go in, but something else got kicked out, so hold onto it
+    filter->victim = fingerprint;
+    filter->victim_bucket = bucket;
+    filter->count += 1;
+    return true;
+}
+
+///Returns false if the hash is definitely not in the filter. This checks at most 2 buckets.
+PUBLIC
+RECEIVER(filter)
+bool cuckoo_filter_contains(cuckoo_filter* filter, u64 hash){
+    u16 fingerprint = cuckoo_fingerprint(hash);
+    u32 bucket = (u32)hash & (filter->bucket_count - 1);
+    if(cuckoo_bucket_find(filter->buckets[bucket], fingerprint) >= 0){
+        return true;
+    }
+    u32 alt = cuckoo_alt_bucket(filter, bucket, fingerprint);
+    if(cuckoo_bucket_find(filter->buckets[alt], fingerprint) >= 0){
+        return true;
+    }
+    return filter->victim == fingerprint && (filter->victim_bucket == bucket || filter->victim_bucket == alt);
+}
+
+///Removes one copy of a hash that was inserted before. Removing a hash that was never inserted
+///can remove a different key that shares its fingerprint, so only remove what you've inserted.
+///Returns whether a fingerprint was found and removed.
+PUBLIC
+RECEIVER(filter)
+bool cuckoo_filter_remove(cuckoo_filter* filter, u64 hash){
+    u16 fingerprint = cuckoo_fingerprint(hash);
+    u32 bucket = (u32)hash & (filter->bucket_count - 1);
+    u32 alt = cuckoo_alt_bucket(filter, bucket, fingerprint);
+    bool removed = false;
+    if(filter->victim == fingerprint && (filter->victim_bucket == bucket || filter->victim_bucket == alt)){
+        filter->victim = 0;
+        filter->count -= 1;
+        return true;
+    }
+    u32 buckets[2] = { bucket, alt };
+    for(u32 i = 0; i < 2 && !removed; i++){
+        i32 slot = cuckoo_bucket_find(filter->buckets[buckets[i]], fingerprint);
+        if(slot >= 0){
+            filter->buckets[buckets[i]] &= ~(0xffffull << (slot * 16));
+            filter->count -= 1;
+            removed = true;
+        }
+    }
+    ///A slot just opened up, so the victim might fit now
+    if(removed && filter->victim != 0){
+        u16 victim = filter->victim;
+        u32 victim_bucket = filter->victim_bucket;
+        if(
+            cuckoo_bucket_put(filter, victim_bucket, victim) ||
+            cuckoo_bucket_put(filter, cuckoo_alt_bucket(filter, victim_bucket, victim), victim)
+        ){
+            filter->victim = 0;
+        }
+    }
+    return removed;
+}
+
+///Inserts a hash into whichever filter this is. Returns false if the filter could not take it.
+PUBLIC
+RECEIVER(filter)
+bool membership_filter_insert(membership_filter* filter, u64 hash){
+    switch(filter->kind){
+    case BLOOM_FILTER:
+        bloom_filter_insert(filter->bloom, hash);
+        return true;
+    case CUCKOO_FILTER:
+        return cuckoo_filter_insert(filter->cuckoo, hash);
+    default:
+        return true;
+    }
+}
+
+///Returns false only if the hash is definitely not in the filter
+PUBLIC
+RECEIVER(filter)
+bool membership_filter_contains(membership_filter* filter, u64 hash){
+    switch(filter->kind){
+    case BLOOM_FILTER:
+        return bloom_filter_contains(filter->bloom, hash);
+    case CUCKOO_FILTER:
+        return cuckoo_filter_contains(filter->cuckoo, hash);
+    default:
+        return true;
+    }
+}
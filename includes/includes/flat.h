@@ -0,0 +1,434 @@
+#pragma once
+
+#include "commons.h"
+#include "list.h"
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+    A flat file is a snapshot of a list or a map that can be mapped straight into memory and read
+    without deserializing anything. Every link is an offset from the start of the file instead of a pointer,
+    and every payload starts on a FLAT_ALIGN boundary so it can be read in place.
+
+    |------------------|------------------------------------------|------------------------------|
+    |   flat_header    |  payloads (each padded to FLAT_ALIGN)    |  slot table                  |
+    |   (32 bytes)     |                                          |  (count * slot size)         |
+    |------------------|------------------------------------------|------------------------------|
+
+    The slot table is written last so the writer can stream payloads out as it walks the container.
+    The header is rewritten once the table is done, so the FILE* given to the writer must be seekable.
+
+    A list slot is a flat_list_slot and a map slot is a flat_map_slot.
+    Only the bytes of each payload are written. If a payload holds pointers (like a string struct), those
+    pointers will be meaningless once loaded.
+*/
+
+///"CMNF" in little endian
+#define FLAT_MAGIC 0x464e4d43
+#define FLAT_VERSION 1
+#define FLAT_ALIGN 8
+
+///What kind of container a flat file holds
+PUBLIC
+enum flat_kind{
+    FLAT_LIST = 1,
+    FLAT_MAP = 2
+};
+typedef enum flat_kind flat_kind;
+
+///The header at offset 0 of every flat file.
+///The [table_offset] is where the slot table starts, and [file_size] is the total size of the file
+///which is used to check that the file has not been truncated.
+PUBLIC
+struct flat_header{
+    u32 magic;
+    u32 version;
+    u32 kind;
+    u32 count;
+    u64 table_offset;
+    u64 file_size;
+};
+typedef struct flat_header flat_header;
+
+///A list element. [offset] is from the start of the file.
+PUBLIC
+struct flat_list_slot{
+    u64 offset;
+    u32 size;
+    u32 reserved;
+};
+typedef struct flat_list_slot flat_list_slot;
+
+///A key-value pair. The [key_hash] is used to skip keys without touching their payload.
+///It is only meaningful for keys that are not OTHER.
+PUBLIC
+struct flat_map_slot{
+    u64 key_offset;
+    u64 value_offset;
+    u32 key_size;
+    u32 value_size;
+    u32 key_hash;
+    u16 key_type;
+    u16 value_type;
+};
+typedef struct flat_map_slot flat_map_slot;
+
+///A streaming writer. Payloads are written as they are pushed, while the slots are kept on the heap
+///until flat_writer_end writes them out as the slot table.
+///NOTE: This returns on the stack, like list_iter.
+PUBLIC
+struct flat_writer{
+    INTERNAL
+    FILE* file;
+    INTERNAL
+    flat_kind kind;
+    INTERNAL
+    u32 count;
+    ///The offset the next payload will be written to
+    INTERNAL
+    u64 offset;
+    INTERNAL
+    void* slots;
+    INTERNAL
+    u32 slot_capacity;
+    ///Set when any write fails, after which every push is ignored and flat_writer_end returns false
+    INTERNAL
+    bool failed;
+};
+typedef struct flat_writer flat_writer;
+
+///A read-only view of a mapped flat file. [header] is NULL if the file could not be opened.
+PUBLIC
+struct flat_view{
+    INTERNAL
+    u8* base;
+    INTERNAL
+    u64 size;
+    PUBLIC
+    flat_header* header;
+};
+typedef struct flat_view flat_view;
+
+///FNV-1a over the given bytes. Used for the map slot [key_hash].
+INTERNAL
+u32 flat_hash(void* data, u32 size){
+    u8* bytes = (u8*)data;
+    u32 hash = 2166136261u;
+    for(u32 i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+INTERNAL
+u32 flat_slot_size(flat_kind kind){
+    return kind == FLAT_LIST ? sizeof(flat_list_slot) : sizeof(flat_map_slot);
+}
+
+///Writes [size] bytes of [data] at the writer's current offset and then pads to FLAT_ALIGN.
+///Returns the offset the data was written to.
+INTERNAL
+RECEIVER(writer)
+u64 flat_writer_put(flat_writer* writer, void* data, u32 size){
+    static const u8 zeroes[FLAT_ALIGN] = { 0 };
+    u64 offset = writer->offset;
+    if(size != 0 && fwrite(data, 1, size, writer->file) != size){
+        writer->failed = true;
+        return offset;
+    }
+    u32 padding = (FLAT_ALIGN - (size % FLAT_ALIGN)) % FLAT_ALIGN;
+    if(padding != 0 && fwrite(zeroes, 1, padding, writer->file) != padding){
+        writer->failed = true;
+    }
+    writer->offset += size + padding;
+    return offset;
+}
+
+///Makes room for one more slot, doubling the slot buffer when it is full.
+///Returns a pointer to the new slot or NULL if the writer has failed.
+INTERNAL
+RECEIVER(writer)
+void* flat_writer_next_slot(flat_writer* writer){
+    if(writer->failed){
+        return NULL;
+    }
+    u32 slot_size = flat_slot_size(writer->kind);
+    if(writer->count == writer->slot_capacity){
+        u32 capacity = writer->slot_capacity == 0 ? 64 : writer->slot_capacity * 2;
+        void* slots = realloc(writer->slots, (size_t)capacity * slot_size);
+        if(slots == NULL){
+            printf("Could not grow flat writer slot table to %i slots\n", capacity);
+            writer->failed = true;
+            return NULL;
+        }
+        writer->slots = slots;
+        writer->slot_capacity = capacity;
+    }
+    void* slot = (u8*)writer->slots + (size_t)writer->count * slot_size;
+    writer->count += 1;
+    return slot;
+}
+
+///Starts a new flat file of the given [kind] in [file]. A placeholder header is written right away
+///and replaced by flat_writer_end.
+///NOTE: [file] must be opened for binary writing and must be seekable.
+PUBLIC
+flat_writer flat_writer_begin(FILE* file, flat_kind kind){
+    flat_writer writer = { file, kind, 0, 0, NULL, 0, false };
+    if(file == NULL){
+        printf("Expected a FILE* to write a flat file to but instead got NULL!\n");
+        writer.failed = true;
+        return writer;
+    }
+    flat_header header = { 0 };
+    flat_writer_put(&writer, &header, sizeof(flat_header));
+    return writer;
+}
+
+///Streams one list element out to the file.
+PUBLIC
+RECEIVER(writer)
+bool flat_writer_push(flat_writer* writer, void* data, u32 size){
+    if(writer->kind != FLAT_LIST){
+        printf("flat_writer_push can only be used on a FLAT_LIST writer\n");
+        return false;
+    }
+    flat_list_slot* slot = flat_writer_next_slot(writer);
+    if(slot == NULL){
+        return false;
+    }
+    slot->offset = flat_writer_put(writer, data, size);
+    slot->size = size;
+    slot->reserved = 0;
+    return !writer->failed;
+}
+
+///Streams one key-value pair out to the file.
+PUBLIC
+RECEIVER(writer)
+bool flat_writer_push_pair(
+    flat_writer* writer,
+    void* key, u32 key_size, map_entry_type key_type,
+    void* value, u32 value_size, map_entry_type value_type
+){
+    if(writer->kind != FLAT_MAP){
+        printf("flat_writer_push_pair can only be used on a FLAT_MAP writer\n");
+        return false;
+    }
+    flat_map_slot* slot = flat_writer_next_slot(writer);
+    if(slot == NULL){
+        return false;
+    }
+    slot->key_offset = flat_writer_put(writer, key, key_size);
+    slot->value_offset = flat_writer_put(writer, value, value_size);
+    slot->key_size = key_size;
+    slot->value_size = value_size;
+    slot->key_hash = key_type == OTHER ? 0 : flat_hash(key, map_key_width(key, key_type, key_size));
+    slot->key_type = (u16)key_type;
+    slot->value_type = (u16)value_type;
+    return !writer->failed;
+}
+
+///Writes the slot table, then goes back and writes the real header.
+///The slot buffer is always freed, even if the writer failed.
+///Returns whether the whole file was written.
+PUBLIC
+RECEIVER(writer)
+bool flat_writer_end(flat_writer* writer){
+    if(!writer->failed){
+        flat_header header;
+        header.magic = FLAT_MAGIC;
+        header.version = FLAT_VERSION;
+        header.kind = writer->kind;
+        header.count = writer->count;
+        header.table_offset = flat_writer_put(writer, writer->slots, writer->count * flat_slot_size(writer->kind));
+        header.file_size = writer->offset;
+        if(!writer->failed){
+            if(fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(flat_header), 1, writer->file) != 1){
+                printf("Could not rewrite the flat header. Is the file seekable?\n");
+                writer->failed = true;
+            }else{
+                fseek(writer->file, 0, SEEK_END);
+                fflush(writer->file);
+            }
+        }
+    }
+    free(writer->slots);
+    writer->slots = NULL;
+    writer->slot_capacity = 0;
+    return !writer->failed;
+}
+
+///Writes every element that the list iterator can see out to [file]
+PUBLIC
+RECEIVER(_list)
+bool flat_write_list(list* _list, FILE* file){
+    flat_writer writer = flat_writer_begin(file, FLAT_LIST);
+    list_iter iter = create_list_iter(_list);
+    list_entry* next = list_iter_next(&iter);
+    while(next != NULL && !writer.failed){
+        flat_writer_push(&writer, next->data, next->size);
+        next = list_iter_next(&iter);
+    }
+    return flat_writer_end(&writer);
+}
+
+///Writes every key-value pair in the map out to [file]
+PUBLIC
+RECEIVER(_map)
+bool flat_write_map(map* _map, FILE* file){
+    flat_writer writer = flat_writer_begin(file, FLAT_MAP);
+    map_iter iter = create_map_iter(_map);
+    map_entry* next = next_entry(&iter);
+    while(next != NULL && !writer.failed){
+        map_entry* value = next->value;
+        flat_writer_push_pair(
+            &writer,
+            next->data, next->size, next->data_type,
+            value->data, value->size, value->data_type
+        );
+        next = next_entry(&iter);
+    }
+    return flat_writer_end(&writer);
+}
+
+///Maps the flat file at [path] read-only and checks its header and slot table.
+///Nothing is read past the header and slot table until it's asked for, so opening costs
+///only the page faults of the pages actually touched.
+///If anything is wrong, the returned view has a NULL [header].
+PUBLIC
+flat_view flat_open(str path){
+    flat_view view = { NULL, 0, NULL };
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("Could not open flat file %s\n", path);
+        return view;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (u64)info.st_size < sizeof(flat_header)){
+        printf("Flat file %s is too small to hold a header\n", path);
+        close(fd);
+        return view;
+    }
+    void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ///The mapping keeps its own reference to the file, so the descriptor isn't needed anymore
+    close(fd);
+    if(base == MAP_FAILED){
+        printf("Could not map flat file %s\n", path);
+        return view;
+    }
+    view.base = (u8*)base;
+    view.size = (u64)info.st_size;
+    flat_header* header = (flat_header*)base;
+    if(header->magic != FLAT_MAGIC || header->version != FLAT_VERSION){
+        printf("%s is not a version %i flat file\n", path, FLAT_VERSION);
+    }else if(header->kind != FLAT_LIST && header->kind != FLAT_MAP){
+        printf("Flat file %s has unknown kind %i\n", path, header->kind);
+    }else if(
+        header->file_size != view.size ||
+        header->table_offset % FLAT_ALIGN != 0 ||
+        header->table_offset > view.size ||
+        (view.size - header->table_offset) / flat_slot_size(header->kind) < header->count
+    ){
+        printf("Flat file %s is truncated or corrupt\n", path);
+    }else{
+        view.header = header;
+        return view;
+    }
+    munmap(base, (size_t)info.st_size);
+    view.base = NULL;
+    view.size = 0;
+    return view;
+}
+
+///Unmaps the view. Any pointer handed out by flat_list_get or flat_map_get is invalid afterwards.
+PUBLIC
+RECEIVER(view)
+void flat_close(flat_view* view){
+    if(view->base != NULL){
+        munmap(view->base, (size_t)view->size);
+    }
+    view->base = NULL;
+    view->size = 0;
+    view->header = NULL;
+}
+
+///Gets the number of elements or key-value pairs in the view
+PUBLIC
+RECEIVER(view)
+u32 flat_count(flat_view* view){
+    return view->header == NULL ? 0 : view->header->count;
+}
+
+///Checks that [size] bytes at [offset] lie inside the mapping, so a corrupt slot can't read past it
+INTERNAL
+RECEIVER(view)
+bool flat_in_bounds(flat_view* view, u64 offset, u32 size){
+    return offset <= view->size && size <= view->size - offset;
+}
+
+///Gets the data at the given index straight out of the mapping, or NULL if it's out of range.
+///[size] is optional and will be set to the size of the element.
+PUBLIC
+RECEIVER(view)
+void* flat_list_get(flat_view* view, u32 idx, OUT u32* size){
+    if(view->header == NULL || view->header->kind != FLAT_LIST || idx >= view->header->count){
+        return NULL;
+    }
+    flat_list_slot* slot = (flat_list_slot*)(view->base + view->header->table_offset) + idx;
+    if(!flat_in_bounds(view, slot->offset, slot->size)){
+        return NULL;
+    }
+    if(size != NULL){
+        *size = slot->size;
+    }
+    return view->base + slot->offset;
+}
+
+///Gets the value for the given key straight out of the mapping. This takes the same arguments as map_get.
+///Keys that aren't OTHER are compared by hash and then by their bytes. OTHER keys are given to [eq_check].
+PUBLIC
+RECEIVER(view)
+void* flat_map_get(
+    flat_view* view,
+    void* key, map_entry_type key_type, u32 size,
+    bool (*eq_check)(void*, void*)
+){
+    if(view->header == NULL || view->header->kind != FLAT_MAP){
+        return NULL;
+    }
+    if(key_type == OTHER && eq_check == NULL){
+        printf("flat_map_get needs an eq_check for OTHER keys\n");
+        return NULL;
+    }
+    u32 width = map_key_width(key, key_type, key_type == STRING ? (u32)-1 : size);
+    u32 hash = key_type == OTHER ? 0 : flat_hash(key, width);
+    flat_map_slot* slots = (flat_map_slot*)(view->base + view->header->table_offset);
+    for(u32 i = 0; i < view->header->count; i++){
+        flat_map_slot* slot = &slots[i];
+        if(slot->key_type != key_type || slot->key_hash != hash){
+            continue;
+        }
+        if(!flat_in_bounds(view, slot->key_offset, slot->key_size) || !flat_in_bounds(view, slot->value_offset, slot->value_size)){
+            continue;
+        }
+        void* entry_key = view->base + slot->key_offset;
+        bool found;
+        if(key_type == OTHER){
+            found = eq_check(entry_key, key);
+        }else{
+            found = map_key_width(entry_key, key_type, slot->key_size) == width && memcmp(entry_key, key, width) == 0;
+        }
+        if(found){
+            return view->base + slot->value_offset;
+        }
+    }
+    return NULL;
+}
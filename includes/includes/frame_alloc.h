@@ -0,0 +1,206 @@
+#pragma once
+
+#include "lazy_arena.h"
+#include <stdint.h>
+
+/*
+    A double-ended stack allocator on a lazy arena. Persistent data is reserved from the bottom and
+    grows up, transient data is reserved from the top and grows down, and the two share whatever is
+    left in the middle.
+
+    |------------------------------|-------------------|--------------------|-------------------|
+    |  frame header (16 bytes)     |  bottom (persist) ->       free       <-  top (transient) |
+    |------------------------------|-------------------|--------------------|-------------------|
+                                                       ^ bottom             ^ top
+
+    Reserving is a pointer bump on either end. A frame is a marker of where one end was, and popping
+    the frame moves that end straight back to the marker in O(1), releasing everything reserved since.
+
+    frame_marker scratch = frame_push(frames, FRAME_TOP);
+    u8* buffer = frame_reserve_top(frames, 4096, 16);
+    ...
+    frame_pop(frames, scratch);
+
+    Popped memory is only cleared when FRAME_CLEAR_ON_POP is set, which is by default only under DEBUG.
+    Clearing is one memset over the popped range, so that stale pointers read zeros instead of data that looks valid.
+*/
+
+///Whether frame_pop zeroes what it releases. Define this before including to change it.
+#ifndef FRAME_CLEAR_ON_POP
+#ifdef DEBUG
+#define FRAME_CLEAR_ON_POP 1
+#else
+#define FRAME_CLEAR_ON_POP 0
+#endif
+#endif
+
+///The alignment the put functions use
+#define FRAME_ALIGN 8
+
+PUBLIC
+enum frame_end{
+    FRAME_BOTTOM,
+    FRAME_TOP,
+};
+typedef enum frame_end frame_end;
+
+PUBLIC
+EXTENSION(arena)
+struct frame_alloc{
+    ///The lazy arena both ends live in. This header sits at offset 0 of it.
+    lazy_arena_alloc*   arena;
+    ///Offset of the next free byte at the bottom, counting up
+    u32                 bottom;
+    ///Offset one past the next free byte at the top, counting down
+    u32                 top;
+};
+typedef struct frame_alloc frame_alloc;
+
+///Where one end of a frame_alloc was when a frame was pushed
+PUBLIC
+struct frame_marker{
+    u32         offset;
+    frame_end   end;
+};
+typedef struct frame_marker frame_marker;
+
+///Initialize a new frame allocator in the given lazy arena, with its header at offset 0
+///and the whole rest of the arena shared between the bottom and the top.
+RECEIVER(arena)
+frame_alloc* frame_init(lazy_arena_alloc* arena){
+    if(arena == NULL){
+        printf("Expected an initialized lazy_arena_alloc*, but instead got NULL!\n");
+        return NULL;
+    }
+    if(arena->size < sizeof(frame_alloc)){
+        printf("Cannot create frame allocator in a lazy arena smaller than its header: %i\n", arena->size);
+        return NULL;
+    }
+    frame_alloc frames;
+    frames.arena = arena;
+    frames.bottom = sizeof(frame_alloc);
+    frames.top = arena->size;
+    return lazy_arena_put(arena, 0, &frames, sizeof(frame_alloc));
+}
+
+///Initialize a new frame allocator with its own lazy arena that has room for [size] bytes after the header
+frame_alloc* frame_init_full(u32 size){
+    lazy_arena_alloc* lazy_arena = lazy_arena_init(sizeof(frame_alloc) + size);
+    if(lazy_arena == NULL){
+        return NULL;
+    }
+    return frame_init(lazy_arena);
+}
+
+///Deinitialize the frame allocator and the lazy arena it lives in
+RECEIVER(frames)
+void frame_deinit(frame_alloc* frames){
+    if(frames == NULL){
+        return;
+    }
+    lazy_arena_deinit(frames->arena);
+}
+
+///Reserves [size] bytes aligned to [align] from the bottom. This is persistent data, and lives until
+///a bottom frame pushed before it is popped. [align] must be a power of two.
+///Returns NULL if the bottom would run into the top.
+RECEIVER(frames)
+void* frame_reserve_bottom(frame_alloc* frames, u32 size, u32 align){
+    uintptr_t start = (uintptr_t)frames->arena->start;
+    uintptr_t at = (start + frames->bottom + align - 1) & ~(uintptr_t)(align - 1);
+    if(at + size > start + frames->top){
+        printf("Cannot reserve %i bytes from the bottom, only %i are left\n", size, frames->top - frames->bottom);
+        return NULL;
+    }
+    frames->bottom = (u32)(at + size - start);
+    return (void*)at;
+}
+
+///Reserves [size] bytes aligned to [align] from the top. This is transient data, and lives until
+///a top frame pushed before it is popped. [align] must be a power of two.
+///Returns NULL if the top would run into the bottom.
+RECEIVER(frames)
+void* frame_reserve_top(frame_alloc* frames, u32 size, u32 align){
+    uintptr_t start = (uintptr_t)frames->arena->start;
+    uintptr_t end = start + frames->top;
+    if(size > end - (start + frames->bottom)){
+        printf("Cannot reserve %i bytes from the top, only %i are left\n", size, frames->top - frames->bottom);
+        return NULL;
+    }
+    uintptr_t at = (end - size) & ~(uintptr_t)(align - 1);
+    if(at < start + frames->bottom){
+        printf("Cannot reserve %i bytes from the top, only %i are left\n", size, frames->top - frames->bottom);
+        return NULL;
+    }
+    frames->top = (u32)(at - start);
+    return (void*)at;
+}
+
+///Copies [data] of [size] onto the bottom and returns where it was copied to
+RECEIVER(frames)
+void* frame_put_bottom(frame_alloc* frames, void* data, u32 size){
+    void* dest = frame_reserve_bottom(frames, size, FRAME_ALIGN);
+    if(dest != NULL){
+        memcpy(dest, data, size);
+    }
+    return dest;
+}
+
+///Copies [data] of [size] onto the top and returns where it was copied to
+RECEIVER(frames)
+void* frame_put_top(frame_alloc* frames, void* data, u32 size){
+    void* dest = frame_reserve_top(frames, size, FRAME_ALIGN);
+    if(dest != NULL){
+        memcpy(dest, data, size);
+    }
+    return dest;
+}
+
+///Starts a frame on the given end. Everything reserved from that end after this is released by
+///passing the returned marker to frame_pop.
+///NOTE: This returns a frame_marker on the stack
+RECEIVER(frames)
+frame_marker frame_push(frame_alloc* frames, frame_end end){
+    frame_marker marker;
+    marker.end = end;
+    marker.offset = end == FRAME_BOTTOM ? frames->bottom : frames->top;
+    return marker;
+}
+
+///Moves the marker's end straight back to where it was when the frame was pushed.
+///Any frames pushed on that end after this one are popped along with it.
+RECEIVER(frames)
+void frame_pop(frame_alloc* frames, frame_marker marker){
+    if(marker.end == FRAME_BOTTOM){
+        if(marker.offset > frames->bottom){
+            printf("Cannot pop a bottom frame at %i that is above the bottom at %i\n", marker.offset, frames->bottom);
+            return;
+        }
+#if FRAME_CLEAR_ON_POP
+        memset((u8*)frames->arena->start + marker.offset, 0, frames->bottom - marker.offset);
+#endif
+        frames->bottom = marker.offset;
+    }else{
+        if(marker.offset < frames->top){
+            printf("Cannot pop a top frame at %i that is below the top at %i\n", marker.offset, frames->top);
+            return;
+        }
+#if FRAME_CLEAR_ON_POP
+        memset((u8*)frames->arena->start + frames->top, 0, marker.offset - frames->top);
+#endif
+        frames->top = marker.offset;
+    }
+}
+
+///Releases everything on the top at once. This is the end of a frame's worth of scratch data.
+RECEIVER(frames)
+void frame_reset_top(frame_alloc* frames){
+    frame_marker marker = { frames->arena->size, FRAME_TOP };
+    frame_pop(frames, marker);
+}
+
+///Gets the number of free bytes between the bottom and the top
+RECEIVER(frames)
+u32 frame_remaining(frame_alloc* frames){
+    return frames->top - frames->bottom;
+}
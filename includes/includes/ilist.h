@@ -0,0 +1,220 @@
+#pragma once
+
+#include "commons.h"
+#include <stddef.h>
+
+/*
+    An intrusive doubly linked list. Instead of the list allocating an entry for each element,
+    the element embeds an ilist_node, and the list links those nodes together.
+    Linking and unlinking never allocate, and a node can be unlinked in O(1) knowing only the node itself.
+
+    struct timer{
+        u64 deadline;
+        ilist_node link;
+    };
+    ilist timers;
+    ilist_init(&timers);
+    ilist_push_back(&timers, &my_timer.link);
+    ILIST_FOR_EACH(&timers, node){
+        struct timer* t = ILIST_CONTAINER(node, struct timer, link);
+    }
+
+    The list is circular around a sentinel node embedded in the ilist itself,
+    so there is no NULL check on any insert or unlink.
+
+    |--------|     |--------|     |--------|     |--------|
+    |  head  | --> |  node  | --> |  node  | --> |  head  |
+    |--------| <-- |--------| <-- |--------| <-- |--------|
+
+    An element can be in as many lists at once as it has ilist_nodes.
+    Nothing is ever freed by the list, the elements belong to whoever put them there.
+*/
+
+typedef struct ilist_node ilist_node;
+PUBLIC
+struct ilist_node{
+    ilist_node* next;
+    ilist_node* prev;
+};
+
+PUBLIC
+struct ilist{
+    ///The sentinel. [head.next] is the first node and [head.prev] is the last.
+    INTERNAL
+    ilist_node head;
+};
+typedef struct ilist ilist;
+
+///Gets the struct that [node] is embedded in as [member]
+///EXAMPLE: struct timer* t = ILIST_CONTAINER(node, struct timer, link);
+#define ILIST_CONTAINER(node, type, member) ((type*)((u8*)(node) - offsetof(type, member)))
+
+///Loops over every node from first to last. The loop body must not unlink [node].
+#define ILIST_FOR_EACH(list, node) \
+    for(ilist_node* node = (list)->head.next; node != &(list)->head; node = node->next)
+
+///Loops over every node from last to first. The loop body must not unlink [node].
+#define ILIST_FOR_EACH_REVERSE(list, node) \
+    for(ilist_node* node = (list)->head.prev; node != &(list)->head; node = node->prev)
+
+///Loops over every node from first to last. The loop body may unlink [node], since the next node is read beforehand.
+#define ILIST_FOR_EACH_SAFE(list, node) \
+    for(ilist_node* node = (list)->head.next, *node##_next = node->next; node != &(list)->head; node = node##_next, node##_next = node->next)
+
+///Initializes an empty list
+PUBLIC
+RECEIVER(_list)
+void ilist_init(ilist* _list){
+    _list->head.next = &_list->head;
+    _list->head.prev = &_list->head;
+}
+
+///Initializes a node as not being in any list. This is only needed to use ilist_node_linked on it.
+PUBLIC
+RECEIVER(node)
+void ilist_node_init(ilist_node* node){
+    node->next = node;
+    node->prev = node;
+}
+
+///Whether the node is currently in a list. Only meaningful after ilist_node_init.
+PUBLIC
+RECEIVER(node)
+bool ilist_node_linked(ilist_node* node){
+    return node->next != node;
+}
+
+PUBLIC
+RECEIVER(_list)
+bool ilist_empty(ilist* _list){
+    return _list->head.next == &_list->head;
+}
+
+///Links [node] in right after [pos]. [pos] may be another node or the list's head.
+PUBLIC
+RECEIVER(pos)
+void ilist_insert_after(ilist_node* pos, ilist_node* node){
+    node->prev = pos;
+    node->next = pos->next;
+    pos->next->prev = node;
+    pos->next = node;
+}
+
+///Links [node] in right before [pos]. [pos] may be another node or the list's head.
+PUBLIC
+RECEIVER(pos)
+void ilist_insert_before(ilist_node* pos, ilist_node* node){
+    ilist_insert_after(pos->prev, node);
+}
+
+PUBLIC
+RECEIVER(_list)
+void ilist_push_front(ilist* _list, ilist_node* node){
+    ilist_insert_after(&_list->head, node);
+}
+
+PUBLIC
+RECEIVER(_list)
+void ilist_push_back(ilist* _list, ilist_node* node){
+    ilist_insert_after(_list->head.prev, node);
+}
+
+///Unlinks [node] from whatever list it is in, in O(1).
+///The node is left pointing at itself, so ilist_node_linked is false and unlinking it again is harmless.
+PUBLIC
+RECEIVER(node)
+void ilist_unlink(ilist_node* node){
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node;
+    node->prev = node;
+}
+
+///Gets the first node, or NULL if the list is empty
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_first(ilist* _list){
+    return ilist_empty(_list) ? NULL : _list->head.next;
+}
+
+///Gets the last node, or NULL if the list is empty
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_last(ilist* _list){
+    return ilist_empty(_list) ? NULL : _list->head.prev;
+}
+
+///Gets the node after [node], or NULL if [node] is the last one
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_next(ilist* _list, ilist_node* node){
+    return node->next == &_list->head ? NULL : node->next;
+}
+
+///Gets the node before [node], or NULL if [node] is the first one
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_prev(ilist* _list, ilist_node* node){
+    return node->prev == &_list->head ? NULL : node->prev;
+}
+
+///Unlinks and returns the first node, or NULL if the list is empty
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_pop_front(ilist* _list){
+    ilist_node* node = ilist_first(_list);
+    if(node != NULL){
+        ilist_unlink(node);
+    }
+    return node;
+}
+
+///Unlinks and returns the last node, or NULL if the list is empty
+PUBLIC
+RECEIVER(_list)
+ilist_node* ilist_pop_back(ilist* _list){
+    ilist_node* node = ilist_last(_list);
+    if(node != NULL){
+        ilist_unlink(node);
+    }
+    return node;
+}
+
+///Moves every node of [src] in between [pos] and the node after it, in O(1). [src] is left empty.
+PUBLIC
+RECEIVER(pos)
+void ilist_splice_after(ilist_node* pos, ilist* src){
+    if(ilist_empty(src)){
+        return;
+    }
+    ilist_node* first = src->head.next;
+    ilist_node* last = src->head.prev;
+    last->next = pos->next;
+    pos->next->prev = last;
+    pos->next = first;
+    first->prev = pos;
+    ilist_init(src);
+}
+
+///Moves every node of [src] onto the end of [dest], in O(1). [src] is left empty.
+PUBLIC
+RECEIVER(dest)
+void ilist_splice_back(ilist* dest, ilist* src){
+    ilist_splice_after(dest->head.prev, src);
+}
+
+///Moves every node of [src] onto the front of [dest], in O(1). [src] is left empty.
+PUBLIC
+RECEIVER(dest)
+void ilist_splice_front(ilist* dest, ilist* src){
+    ilist_splice_after(&dest->head, src);
+}
+
+///Moves [node] to the end of its list, or onto the end of another one. This is the O(1) "touch" of an LRU.
+PUBLIC
+RECEIVER(_list)
+void ilist_move_back(ilist* _list, ilist_node* node){
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    ilist_push_back(_list, node);
+}
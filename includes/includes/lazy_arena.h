@@ -2,6 +2,8 @@
 
 #include "commons.h"
 #include <malloc.h>
+#include <stdio.h>
+#include <string.h>
 
 ///A lazy arena is an arena that does not care about where you allocate things.
 ///It only cares about whether you're allocating within a given size
@@ -19,7 +21,9 @@ lazy_arena_alloc* lazy_arena_init(u32 size){
     ///LIFETIME: This will always be borrowed until either the pointer is somehow lost or until it's passed into lazy_arena_deinit
     lazy_arena_alloc* arena = (lazy_arena_alloc*)malloc(sizeof(lazy_arena_alloc) + size);
     arena->size = size;
-    arena->start = arena + sizeof(lazy_arena_alloc);
+    ///The data starts right after the header. [arena + 1] steps over one lazy_arena_alloc,
+    ///where [arena + sizeof(lazy_arena_alloc)] would step over that many of them.
+    arena->start = (void*)(arena + 1);
     return arena;
 }
 
@@ -34,7 +38,7 @@ void* lazy_arena_put(lazy_arena_alloc* arena, u32 offset, void* data, u32 size){
     }
     ///Check that the size of data being put into the arena is within the given arena size so ensure we dont overflow the arena
     ///We also check that the size plus the offset dont overflow the arena
-    if(size > arena->size && size + offset < arena->size){
+    if(size > arena->size - offset){
         printf("Expected data size within size %i but instead got %i with offset %i", arena->size, size, offset);
         return NULL;
     }
@@ -44,7 +48,6 @@ void* lazy_arena_put(lazy_arena_alloc* arena, u32 offset, void* data, u32 size){
     ///MEM: Borrowed
     ///LIFETIME: Borrowed by memcpy, Borrowed by return/caller
     u8* dest = ((u8*)arena->start) + offset;
-    printf("Putting data into addr %p\n", dest);
     memcpy(dest, data, size);
     return (void*)dest;
 }
@@ -137,16 +137,16 @@ void* queue_push(lifo_alloc* stack, void* data, u32 size){
 }
 
 ///Pop off the top of the stack by decrementing the stack->queue_ptr with an offset of [size]
-///This will check if queue_ptr is already sizeof(lifo_alloc), and if so, 
-///don't do anything and just early return
+///This will check if [size] is more than what has been pushed, and if so,
+///don't do anything and just early return false
 ///~alex, 3:48 AM PST, 11/10/2020
 ///TODO: Replace null-checks with null-asserts
 ///TODO: Replace weak printing with debug asserts/logging
 RECEIVER(stack)
-void queue_pop(lifo_alloc* stack, u32 size){
+bool queue_pop(lifo_alloc* stack, u32 size){
     if(stack == NULL){
         printf("stack* cannot be null!\n");
-        return;
+        return false;
     }
     ///This is the current size of data that's already been pushed onto the stack.
     ///It is just the current queue_ptr minus the size of the lifo_alloc
@@ -155,17 +155,22 @@ void queue_pop(lifo_alloc* stack, u32 size){
     ///MEM: Moved/Owned
     ///LIFETIME: This is used for checking pop size validity, then discarded at the end of scope
     u32 pushed_size = stack->queue_ptr - sizeof(lifo_alloc);
-    if(size > stack->queue_ptr - sizeof(lifo_alloc)){
+    if(size > pushed_size){
         printf("Cannot pop size greater than what is already on the stack: %i", pushed_size);
-        return;
+        return false;
     }
+    ///Decrement the current stack pointer, so the next push lands where the popped data was
+    stack->queue_ptr -= size;
+    return true;
 }
 
 ///This is a secondary procedure that will first pop off the stack and then clear the popped data
-///This is inefficient so if you absolutely need to clear the popped data, this is your goto.
+///Only reach for this if you absolutely need the popped data cleared, queue_pop alone is just a subtraction.
 ///~alex, 6:18 AM PST, 11/10/2020
 void queue_pop_and_clear(lifo_alloc* stack, u32 size){
-    queue_pop(stack, size);
+    if(!queue_pop(stack, size)){
+        return;
+    }
     /*
         The following code paragraph is simply going through a popped data and zeroing it out
         A lot of stack allocators will just decrement the stack pointer but just for brevity
@@ -178,22 +183,7 @@ void queue_pop_and_clear(lifo_alloc* stack, u32 size){
 
         ~alex, 4:19 AM PST, 11/10/2020
     */
-    ///Decrement the current stack pointer
-    stack->queue_ptr -= size;
-    ///Get the number of bytes to clear in the data that was popped
-    ///This will be iterated over via a ranged-for loop to set all the bytes
-    ///That was popped to 0
-    u32 num_chunks = size / sizeof(u8);
-    for(
-        u32 i = 0;
-        i < num_chunks;
-        i++
-    ){
-        ///The null data being copied into the current offset to clear out the memory on the stack
-        u8 zero = 0;
-        ///This value is ignored. Capturing in local variable for documentation/clarity
-        ///Clear the memory on the stack at the stack->queue_ptr + i
-        ///This makes the memory virtually unusable, if a pointer to it is kept around
-        void* ignored = lazy_arena_put(stack->arena, stack->queue_ptr + i, &zero, sizeof(u8));
-    }
+    ///queue_pop already moved the stack pointer down, so the popped data starts right at it.
+    ///Clear it all in one memset. This makes the memory virtually unusable, if a pointer to it is kept around
+    memset((u8*)stack->arena->start + stack->queue_ptr, 0, size);
 }
\ No newline at end of file
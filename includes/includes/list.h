@@ -2,7 +2,9 @@
 
 #include "arena.h"
 #include "string.h"
+#ifdef DEBUG
 #include "debug.h"
+#endif
 #include <stdio.h>
 
 ///An entry in the list.
@@ -41,10 +43,11 @@ struct list_entry{
 ///better implementation.
 ///This is meant to act as a simple, easy to use list for cases where remove and insert aren't as
 ///prevalent, or demanded.
-///This list's remove is also only intended so that the list may be transferred from one arena
+///This list's remove is also only intended so that the list may be compacted from one arena
 ///to another, where any "removed" elements will be deinitialized/free with the rest of this list's
-///arena. Any entries that have stuck around will be transferred to another arena.
-///If you'd like to transfer this list to another arena, use list_transfer with a new arena pointer.
+///arena. Any entries that have stuck around will be copied to another arena.
+///If you'd like to compact this list into another arena, use list_compact with a new arena pointer.
+///If you'd like to hand this list over to another arena's lifetime without copying, use list_transfer.
 PUBLIC
 EXTENSION(arena_alloc*)
 struct list{
@@ -88,6 +91,7 @@ list* create_list(arena_alloc* arena){
 PUBLIC
 RECEIVER(_list)
 void* list_add(list* _list, void* data, u32 size){
+    TRACE_ZONE_ARG("list_add", "size", size);
     if(size > _list->arena->size){
         ///TODO: Need to make an assertion/debug library and replace this with a debug/assert call. ~alex, 11/8/2020, 11:19 PM PST
         printf("Expected a list data size within the size of the arena but instead found %i", size);
@@ -116,6 +120,7 @@ void* list_add(list* _list, void* data, u32 size){
         _list->first_element = entry_ptr;
         _list->last_element = _list->first_element;
     }else{
+        _list->last_element->next = entry_ptr;
         _list->last_element = entry_ptr;
     }
     _list->element_count += 1;
@@ -167,7 +172,7 @@ list_entry* list_iter_next(list_iter* iter){
 PUBLIC
 RECEIVER(_list)
 void* list_remove(list* _list, u32 idx){
-    if(idx > _list->element_count){
+    if(idx >= _list->element_count){
         ///TODO: Replace with a debug/assert with a debug/assert library. ~alex, 11/8/2020, 11:23 PM PST
         printf("Index %i given is not within list indices %i", idx, _list->element_count);
         return NULL;
@@ -222,6 +227,10 @@ void* list_remove(list* _list, u32 idx){
         ///next's next field is set NULL
         next->next = NULL;
     }
+    ///Removing the last entry makes the one before it the last, so the next list_add links onto something that's still in the list
+    if(next == _list->last_element){
+        _list->last_element = prev_entry;
+    }
     _list->element_count -= 1;
     ///Return the data at next
     return next->data;
@@ -238,11 +247,10 @@ void* list_remove(list* _list, u32 idx){
 PUBLIC
 RECEIVER(_list)
 void* list_get(list* _list, u32 idx){
-    if(idx > _list->element_count){
+    TRACE_ZONE_ARG("list_get", "index", idx);
+    if(idx >= _list->element_count){
         #ifdef DEBUG
-            string message = create_string("Index %i given is not within list indices %i", idx, _list->element_count);
-            string from = create_string("list_get");
-            debug_log(&from, &message);
+            debug_log("list_get", "Index %i given is not within list indices %i", idx, _list->element_count);
         #endif
         return NULL;
     }
@@ -333,51 +341,59 @@ i32 list_index_of(list* _list, void* data, bool (*eq_check)(void*, void*)){
     return -1;
 }
 
-///This will transfer all the persistent entries in _list to a new list, with the new_arena
-///and will be returned
-///Step1: Create a new list via create_list by passing in new_arena
-///Step2: Iterate over _list
-///Step3: Take every `next` entry in _list and add it to the newly created list via list_add
-///Step4: After iteration is complete, call arena_deinit on the old _list->arena
-///NOTE: Step4 is deinit'ing the _list->arena which will also deinit the list itself.
-///TEST: This hasn't been tested yet but will be tested in the future
-///TODO: Test this procedure
+///This will relocate all the persistent entries in _list into a new, dense list in new_arena,
+///which will be returned. Entries that were removed via list_remove are left behind, and every
+///entry is followed immediately by its data, so a list that has been added to and removed from
+///for a long time shrinks down and walks through contiguous memory again.
+///The old list is left as it was. Deinit its arena when you're done with it.
+///Returns NULL without touching new_arena if the live entries don't fit in it.
+///Step1: Add up the space the live entries need and check it against new_arena
+///Step2: Create a new list via create_list by passing in new_arena
+///Step3: Take the data of every `next` entry in _list and add it to the newly created list via list_add
 PUBLIC
 RECEIVER(_list)
-list* list_transfer(list* _list, arena_alloc* new_arena){
-    ///The new list we are transferring to in which will be returned
-    ///MEM: Borrowed-always
-    ///LIFETIME: This will persist as long as the user needs it, and will persist until it's pass into arena_deinit
-    ///LIFETIME: This is used to transfer the old list, whatever is iterable, into this list, and then returned
-    ///~alex, 11/9/2020, 12:11 AM PST
-    list* new_list = create_list(new_arena);
-    ///The iterator object over the given list object
-    ///This is used for getting the next element in the list
-    ///MEM: Borrowed
-    ///LIFETIME: This pointer will persist until the end of the procedure
-    ///LIFETIME: This will always be borrowed by list_iter_next 
-    ///SEE: next, list_iter_next, create_list_iter
-    ///~alex, 11/9/2020, 12:11 AM PST
+list* list_compact(list* _list, arena_alloc* new_arena){
+    ///The number of bytes the new list will take up in new_arena
+    ///MEM: Move-mut
+    ///LIFETIME: This is used to check that new_arena is big enough before anything is put into it
+    u64 needed = sizeof(list);
     list_iter iter = create_list_iter(_list);
-    ///The next element in the list. The first time this is set, it will be set to the first element in the list, aka, _list->first_element
-    ///MEM: Borrowed, Borrowed-mut
-    ///LIFETIME: This variable will persist either until the end of the current procedure, or until the end of any iteration.
-    ///LIFETIME: This variable is reassigned when its index is not equal to the given idx parameter
-    ///LIFETIME: If this variable's index matches the given idx, then it will be used to set prev_entry's next field to this variable's next field.
-    ///~alex, 11/9/2020, 12:11 AM PST
     list_entry* next = list_iter_next(&iter);
-    ///This loops until either next is NULL or until index == idx
-    ///Ever iteration, list_iter_next will be called, while index is incremented, and prev_entry is set to next
     while(next != NULL){
-        ///The return value is ignored
-        ///MEM: Ignored
-        ///LIFETIME: Ignored
-        ///~alex, 11/9/2020, 12:14 AM PST
-        void* ignored_value = list_add(new_list, next, next->size);
+        needed += sizeof(list_entry) + next->size;
+        next = list_iter_next(&iter);
+    }
+    if(new_arena->capacity + needed > new_arena->size){
+        printf("Cannot compact a list of %llu bytes into an arena with %i bytes left\n", (unsigned long long)needed, new_arena->size - new_arena->capacity);
+        return NULL;
+    }
+    ///The new list we are compacting into, which will be returned
+    ///MEM: Borrowed-always
+    ///LIFETIME: This will persist until new_arena is passed into arena_deinit
+    list* new_list = create_list(new_arena);
+    iter = create_list_iter(_list);
+    next = list_iter_next(&iter);
+    while(next != NULL){
+        list_add(new_list, next->data, next->size);
         next = list_iter_next(&iter);
     }
-    ///TODO: Is this really necessary tho? Should we keep it alive until the user decides to free it?
-    ///     although, the whole point of transferring iterable elements of one list to another is to get rid of the old one.
-    arena_deinit(_list->arena);
     return new_list;
+}
+
+///This will hand _list over to new_arena in O(1), so that the list now lives as long as new_arena.
+///Nothing is copied. The whole arena the list was in is adopted by new_arena via arena_adopt,
+///and later list_add calls put their entries into new_arena.
+///The returned list is the same pointer as _list, or NULL, having changed nothing, if arena_adopt refuses
+///because the old arena was already adopted by some other arena.
+///NOTE: Everything else that was in the old arena moves along with it, since the old arena
+///      is now freed by arena_deinit(new_arena). Never call arena_deinit on the old arena after this.
+///SEE: list_compact if you'd rather copy just the live entries into new_arena
+PUBLIC
+RECEIVER(_list)
+list* list_transfer(list* _list, arena_alloc* new_arena){
+    if(!arena_adopt(new_arena, _list->arena)){
+        return NULL;
+    }
+    _list->arena = new_arena;
+    return _list;
 }
\ No newline at end of file
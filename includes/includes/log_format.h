@@ -0,0 +1,407 @@
+#pragma once
+
+#include "commons.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+    printf formatting split in two halves, so that a log call can copy its arguments somewhere cheaply
+    and have the slow part, turning them into text, done later on another thread.
+
+    log_capture walks a printf format string and copies every argument it names out of a va_list into
+    a packed run of typed arguments. Strings are copied, since the pointer may not be good by the time
+    the text is made. log_format walks the same format string again and prints every argument from the run.
+
+    |------|---------|------|-----------------|------|---------|-----
+    | type | 8 bytes | type | u16 len | bytes | type | 8 bytes | ...
+    |------|---------|------|-----------------|------|---------|-----
+      int             string                   double
+
+    Every conversion of C99 printf is understood, with its flags, width, precision and length.
+    Integers are kept as 64 bits, cut to the width the length says when captured, and long doubles as doubles.
+    %n writes nothing, since whoever passed the pointer has long since moved on.
+    LIFETIME: The format string itself isn't copied, so it has to outlive the captured arguments. String literals always do.
+*/
+
+///The longest string argument that is captured whole. Anything longer is cut off.
+#define LOG_MAX_STRING 0xffff
+
+PUBLIC
+enum log_arg_type{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+};
+typedef enum log_arg_type log_arg_type;
+
+///One conversion of a format string, like %-08.3lld
+PUBLIC
+struct log_spec{
+    ///Where the % is
+    str start;
+    ///One past the conversion character
+    str end;
+    ///The flags, as they were written
+    char flags[8];
+    u32 flag_count;
+    ///Where the width, or the * standing in for it, starts
+    str width;
+    ///Whether the width or precision is * and so is an argument of its own
+    bool star_width;
+    bool star_precision;
+    ///The length modifier, like "ll", or empty
+    char length[3];
+    char conversion;
+};
+typedef struct log_spec log_spec;
+
+///Finds the next conversion in the format string at [cursor] and moves [cursor] past it.
+///Returns false when there are no more. %% is not a conversion and is skipped.
+INTERNAL
+bool log_next_spec(str* cursor, OUT log_spec* spec){
+    str at = *cursor;
+    for(;;){
+        at = strchr(at, '%');
+        if(at == NULL){
+            *cursor = NULL;
+            return false;
+        }
+        if(at[1] == '%'){
+            at += 2;
+            continue;
+        }
+        break;
+    }
+    spec->start = at;
+    at += 1;
+    spec->flag_count = 0;
+    while(*at == '-' || *at == '+' || *at == ' ' || *at == '#' || *at == '0'){
+        if(spec->flag_count < sizeof(spec->flags) - 1){
+            spec->flags[spec->flag_count++] = *at;
+        }
+        at += 1;
+    }
+    spec->flags[spec->flag_count] = 0;
+    spec->width = at;
+    spec->star_width = *at == '*';
+    if(spec->star_width){
+        at += 1;
+    }
+    while(*at >= '0' && *at <= '9'){
+        at += 1;
+    }
+    spec->star_precision = false;
+    if(*at == '.'){
+        at += 1;
+        spec->star_precision = *at == '*';
+        if(spec->star_precision){
+            at += 1;
+        }
+        while(*at >= '0' && *at <= '9'){
+            at += 1;
+        }
+    }
+    u32 length = 0;
+    while(length < 2 && (*at == 'h' || *at == 'l' || *at == 'L' || *at == 'q' || *at == 'j' || *at == 'z' || *at == 't')){
+        spec->length[length++] = *at;
+        at += 1;
+    }
+    spec->length[length] = 0;
+    spec->conversion = *at;
+    if(*at != 0){
+        at += 1;
+    }
+    spec->end = at;
+    *cursor = at;
+    return true;
+}
+
+///Whether [conversion] is one printf knows. Anything else is printed as it was written and takes no argument.
+INTERNAL
+bool log_known_conversion(char conversion){
+    return conversion != 0 && strchr("diuoxXceEfFgGaAspn%", conversion) != NULL;
+}
+
+///Writes one argument of [type] with [size] bytes of payload at [dest], if there's room. Returns the bytes it took, or 0.
+INTERNAL
+u32 log_put_arg(u8* dest, u32 capacity, log_arg_type type, void* payload, u32 size){
+    if(capacity < 1 + size){
+        return 0;
+    }
+    dest[0] = (u8)type;
+    memcpy(dest + 1, payload, size);
+    return 1 + size;
+}
+
+///Captures a signed integer of the width [length] says out of [args]
+INTERNAL
+i64 log_take_int(str length, va_list* args){
+    if(strcmp(length, "hh") == 0){
+        return (signed char)va_arg(*args, int);
+    }else if(strcmp(length, "h") == 0){
+        return (short)va_arg(*args, int);
+    }else if(strcmp(length, "l") == 0){
+        return va_arg(*args, long);
+    }else if(strcmp(length, "ll") == 0 || strcmp(length, "q") == 0){
+        return va_arg(*args, long long);
+    }else if(strcmp(length, "j") == 0){
+        return va_arg(*args, intmax_t);
+    }else if(strcmp(length, "z") == 0){
+        return va_arg(*args, ssize_t);
+    }else if(strcmp(length, "t") == 0){
+        return va_arg(*args, ptrdiff_t);
+    }
+    return va_arg(*args, int);
+}
+
+///Captures an unsigned integer of the width [length] says out of [args]
+INTERNAL
+u64 log_take_uint(str length, va_list* args){
+    if(strcmp(length, "hh") == 0){
+        return (unsigned char)va_arg(*args, unsigned int);
+    }else if(strcmp(length, "h") == 0){
+        return (unsigned short)va_arg(*args, unsigned int);
+    }else if(strcmp(length, "l") == 0){
+        return va_arg(*args, unsigned long);
+    }else if(strcmp(length, "ll") == 0 || strcmp(length, "q") == 0){
+        return va_arg(*args, unsigned long long);
+    }else if(strcmp(length, "j") == 0){
+        return va_arg(*args, uintmax_t);
+    }else if(strcmp(length, "z") == 0){
+        return va_arg(*args, size_t);
+    }else if(strcmp(length, "t") == 0){
+        return (u64)va_arg(*args, ptrdiff_t);
+    }
+    return va_arg(*args, unsigned int);
+}
+
+///Copies every argument [fmt] names out of [args] into [dest], and returns how many bytes that took.
+///Arguments that don't fit in [capacity] are left off, and print as (?) when formatted.
+///NOTE: [args] is used up, the same as by vprintf.
+PUBLIC
+u32 log_capture(str fmt, va_list args, OUT u8* dest, u32 capacity){
+    va_list taken;
+    va_copy(taken, args);
+    u32 used = 0;
+    str cursor = fmt;
+    log_spec spec;
+    while(log_next_spec(&cursor, &spec)){
+        if(!log_known_conversion(spec.conversion)){
+            continue;
+        }
+        if(spec.conversion == '%'){
+            continue;
+        }
+        if(spec.star_width){
+            i64 width = va_arg(taken, int);
+            used += log_put_arg(dest + used, capacity - used, LOG_ARG_INT, &width, sizeof(width));
+        }
+        if(spec.star_precision){
+            i64 precision = va_arg(taken, int);
+            used += log_put_arg(dest + used, capacity - used, LOG_ARG_INT, &precision, sizeof(precision));
+        }
+        switch(spec.conversion){
+            case 'd': case 'i':{
+                i64 value = log_take_int(spec.length, &taken);
+                used += log_put_arg(dest + used, capacity - used, LOG_ARG_INT, &value, sizeof(value));
+                break;
+            }
+            case 'u': case 'o': case 'x': case 'X':{
+                u64 value = log_take_uint(spec.length, &taken);
+                used += log_put_arg(dest + used, capacity - used, LOG_ARG_UINT, &value, sizeof(value));
+                break;
+            }
+            case 'c':{
+                i64 value = va_arg(taken, int);
+                used += log_put_arg(dest + used, capacity - used, LOG_ARG_INT, &value, sizeof(value));
+                break;
+            }
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':{
+                double value = spec.length[0] == 'L' ? (double)va_arg(taken, long double) : va_arg(taken, double);
+                used += log_put_arg(dest + used, capacity - used, LOG_ARG_DOUBLE, &value, sizeof(value));
+                break;
+            }
+            case 's':{
+                str value = va_arg(taken, str);
+                if(value == NULL){
+                    value = "(null)";
+                }
+                size_t length = strlen(value);
+                if(length > LOG_MAX_STRING){
+                    length = LOG_MAX_STRING;
+                }
+                ///Cut the string to what's left rather than dropping it, since a log line with half a string still says something
+                if(capacity - used < 1 + sizeof(u16)){
+                    break;
+                }
+                if(length > capacity - used - 1 - sizeof(u16)){
+                    length = capacity - used - 1 - sizeof(u16);
+                }
+                u16 stored = (u16)length;
+                dest[used] = LOG_ARG_STRING;
+                memcpy(dest + used + 1, &stored, sizeof(stored));
+                memcpy(dest + used + 1 + sizeof(stored), value, length);
+                used += 1 + sizeof(stored) + (u32)length;
+                break;
+            }
+            case 'p':{
+                void* value = va_arg(taken, void*);
+                used += log_put_arg(dest + used, capacity - used, LOG_ARG_POINTER, &value, sizeof(value));
+                break;
+            }
+            case 'n':{
+                (void)va_arg(taken, void*);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    va_end(taken);
+    return used;
+}
+
+///Reads the next captured argument at [*args], moving it past it. Returns false if there are none left.
+INTERNAL
+bool log_take_arg(u8** args, u8* end, OUT log_arg_type* type, OUT u64* bits, OUT str* string, OUT u32* length){
+    if(*args >= end){
+        return false;
+    }
+    *type = (log_arg_type)(*args)[0];
+    if(*type == LOG_ARG_STRING){
+        u16 stored;
+        memcpy(&stored, *args + 1, sizeof(stored));
+        *string = (str)(*args + 1 + sizeof(stored));
+        *length = stored;
+        *args += 1 + sizeof(stored) + stored;
+    }else{
+        memcpy(bits, *args + 1, sizeof(*bits));
+        *args += 1 + sizeof(*bits);
+    }
+    return true;
+}
+
+///Prints the arguments log_capture copied into [args] with the format string they were captured with,
+///into [dest], cut off to fit in [capacity] with its terminator. Returns the length of the text.
+PUBLIC
+u32 log_format(str fmt, u8* args, u32 args_size, OUT char* dest, u32 capacity){
+    if(capacity == 0){
+        return 0;
+    }
+    u8* end = args + args_size;
+    u32 written = 0;
+    str cursor = fmt;
+    str copied = fmt;
+    log_spec spec;
+    while(written < capacity - 1){
+        bool found = log_next_spec(&cursor, &spec);
+        ///The literal text up to the conversion, with every %% turned into %
+        str literal_end = found ? spec.start : copied + strlen(copied);
+        while(copied < literal_end && written < capacity - 1){
+            dest[written++] = *copied;
+            copied += copied[0] == '%' && copied[1] == '%' ? 2 : 1;
+        }
+        if(!found || written >= capacity - 1){
+            break;
+        }
+        if(!log_known_conversion(spec.conversion)){
+            continue;
+        }
+        copied = spec.end;
+        if(spec.conversion == 'n'){
+            continue;
+        }
+        if(spec.conversion == '%'){
+            ///Something like %5%, which is still just a %
+            dest[written++] = '%';
+            continue;
+        }
+        log_arg_type type = LOG_ARG_INT;
+        u64 bits = 0;
+        str string = NULL;
+        u32 length = 0;
+        int width = 0;
+        int precision = 0;
+        bool missing = false;
+        if(spec.star_width){
+            missing |= !log_take_arg(&args, end, &type, &bits, &string, &length);
+            width = (int)(i64)bits;
+        }
+        if(spec.star_precision){
+            missing |= !log_take_arg(&args, end, &type, &bits, &string, &length);
+            precision = (int)(i64)bits;
+        }
+        missing |= !log_take_arg(&args, end, &type, &bits, &string, &length);
+
+        ///Rebuild the conversion with * filled in and every integer as long long, since that's how it was kept
+        str digits = spec.width;
+        if(spec.star_width){
+            digits += 1;
+        }else{
+            width = (int)strtol(digits, NULL, 10);
+        }
+        while(*digits >= '0' && *digits <= '9'){
+            digits += 1;
+        }
+        bool has_precision = *digits == '.';
+        if(has_precision && !spec.star_precision){
+            precision = (int)strtol(digits + 1, NULL, 10);
+        }
+        ///A negative * width means left-justified
+        char one[48];
+        u32 at = (u32)snprintf(one, sizeof(one), "%%%s%s", width < 0 ? "-" : "", spec.flags);
+        if(width != 0){
+            at += (u32)snprintf(one + at, sizeof(one) - at, "%d", width < 0 ? -width : width);
+        }
+        if(type == LOG_ARG_STRING){
+            memcpy(one + at, ".*s", 4);
+        }else{
+            if(has_precision && precision >= 0){
+                at += (u32)snprintf(one + at, sizeof(one) - at, ".%d", precision);
+            }
+            if((type == LOG_ARG_INT || type == LOG_ARG_UINT) && spec.conversion != 'c'){
+                one[at++] = 'l';
+                one[at++] = 'l';
+            }
+            one[at++] = spec.conversion;
+            one[at] = 0;
+        }
+
+        u32 room = capacity - written;
+        int printed;
+        if(missing){
+            printed = snprintf(dest + written, room, "(?)");
+        }else if(type == LOG_ARG_STRING){
+            ///The captured string isn't terminated, so its length is the precision unless a smaller one was given
+            int shown = (int)length;
+            if(has_precision && precision >= 0 && precision < shown){
+                shown = precision;
+            }
+            printed = snprintf(dest + written, room, one, shown, string);
+        }else if(type == LOG_ARG_DOUBLE){
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            printed = snprintf(dest + written, room, one, value);
+        }else if(type == LOG_ARG_POINTER){
+            printed = snprintf(dest + written, room, one, (void*)(uintptr_t)bits);
+        }else if(spec.conversion == 'c'){
+            printed = snprintf(dest + written, room, one, (int)(i64)bits);
+        }else if(type == LOG_ARG_INT){
+            printed = snprintf(dest + written, room, one, (long long)(i64)bits);
+        }else{
+            printed = snprintf(dest + written, room, one, (unsigned long long)bits);
+        }
+        if(printed > 0){
+            written += (u32)printed < room ? (u32)printed : room - 1;
+        }
+    }
+    dest[written] = 0;
+    return written;
+}
@@ -2,6 +2,7 @@
 
 #include "string_store.h"
 #include "arena.h"
+#include "filter.h"
 
 /*
     A map is the use of an arena such that entries can be a key followed by a value.
@@ -19,7 +20,7 @@ enum map_entry_kind{
     KEY,
     VALUE,
 };
-typedef enum map_entry_type map_entry_kind;
+typedef enum map_entry_kind map_entry_kind;
 
 ///What type of data an entry contains. This is a marker for the data
 PUBLIC
@@ -33,6 +34,20 @@ enum map_entry_type{
 };
 typedef enum map_entry_type map_entry_type;
 
+///Gets the number of bytes of a key that are significant for equality, which is also what gets hashed.
+///STRING keys compare up to their terminator, the integer types compare their own width.
+INTERNAL
+u32 map_key_width(void* key, map_entry_type key_type, u32 size){
+    switch(key_type){
+    case U8: return sizeof(u8);
+    case U16: return sizeof(u16);
+    case U32: return sizeof(u32);
+    case U64: return sizeof(u64);
+    case STRING: return (u32)strnlen((str)key, size);
+    default: return size;
+    }
+}
+
 
 //A map entry. 
 //This has the data map for easily knowing how to treat the entry.
@@ -70,6 +85,15 @@ struct map{
     
     INTERNAL HELPER
     map_entry* last_entry;
+
+    ///An optional filter that turns away lookups for keys that were never put.
+    ///SEE: map_attach_filter
+    INTERNAL
+    membership_filter filter;
+
+    ///How to hash OTHER keys for the filter. If this is NULL, OTHER keys skip the filter.
+    INTERNAL
+    u64 (*hash_other)(void*, u32);
 };
 typedef struct map map;
 
@@ -87,6 +111,9 @@ map* create_map(arena_alloc* arena){
     _map.first_entry = NULL;
     ///Set the last_entry to first_entry which is set to NULL
     _map.last_entry = _map.first_entry;
+    ///No filter until one is attached
+    _map.filter.kind = NO_FILTER;
+    _map.hash_other = NULL;
     //printf("Putting new map header into arena\n");
     ///Give 
     return arena_put(arena, &_map, sizeof(map));
@@ -117,7 +144,7 @@ map_entry* create_map_entry(
     ///Put `entry` into the arena via arena_put. It will be copied into the arena, and the following uses of the entry will be from here.
     ///MEM: (Borrow or Borrow, Borrow), Borrow
     ///LIFETIME: This is borrowed by _map->first_entry or by _map->last_entry->next and _map->last_entry respectively
-    map_entry* entry_ptr = (map_entry*)arena_put(_map->arena, &entry, sizeof(map_entry) + data_size);
+    map_entry* entry_ptr = (map_entry*)arena_put(_map->arena, &entry, sizeof(map_entry));
     if(entry_ptr == NULL){
         //printf("entry_ptr came back null while putting entry into arena\n");
         return NULL;
@@ -177,6 +204,48 @@ map_entry* next_entry(map_iter* iter){
     return curr;
 }
 
+///Hashes a key for the map's filter. Returns false if this key can't go through the filter,
+///which is the case for OTHER keys when the map has no [hash_other].
+///NOTE: STRING keys are hashed up to their terminator no matter what [size] says, so a lookup
+///      with a different size than the put still finds the key.
+INTERNAL
+RECEIVER(_map)
+bool map_key_hash(map* _map, void* key, map_entry_type key_type, u32 size, OUT u64* hash){
+    if(key_type == OTHER){
+        if(_map->hash_other == NULL){
+            return false;
+        }
+        *hash = _map->hash_other(key, size);
+        return true;
+    }
+    u32 width = map_key_width(key, key_type, key_type == STRING ? (u32)-1 : size);
+    *hash = filter_hash(key, width);
+    return true;
+}
+
+///Attaches a bloom or cuckoo filter to the map. Every key already in the map is inserted into it,
+///and from then on map_put inserts into it and map_get checks it before walking the entries,
+///so a lookup for a key that isn't there is usually answered without touching a single entry.
+///[hash_other] is used to hash OTHER keys. It must give equal hashes for keys that [eq_check] finds equal.
+///If it is NULL, OTHER keys are never filtered.
+///If the filter fills up, it is detached again and the map goes back to walking every entry.
+PUBLIC
+RECEIVER(_map)
+void map_attach_filter(map* _map, membership_filter filter, u64 (*hash_other)(void*, u32)){
+    _map->filter = filter;
+    _map->hash_other = hash_other;
+    map_iter iter = create_map_iter(_map);
+    map_entry* next = next_entry(&iter);
+    while(next != NULL && _map->filter.kind != NO_FILTER){
+        u64 hash;
+        if(map_key_hash(_map, next->data, next->data_type, next->size, &hash) && !membership_filter_insert(&_map->filter, hash)){
+            printf("Map filter is full, detaching it\n");
+            _map->filter.kind = NO_FILTER;
+        }
+        next = next_entry(&iter);
+    }
+}
+
 PUBLIC
 RECEIVER(_map)
 void* map_get(
@@ -188,6 +257,14 @@ void* map_get(
     ///If you pass NULL to this, and key_type is not OTHER, it will be ignored.
     bool (*eq_check)(void*, void*)
 ){
+    TRACE_ZONE("map_get");
+    ///Ask the filter first. A miss here means the key was never put, so there's no need to walk the map.
+    if(_map->filter.kind != NO_FILTER){
+        u64 hash;
+        if(map_key_hash(_map, key, key_type, size, &hash) && !membership_filter_contains(&_map->filter, hash)){
+            return NULL;
+        }
+    }
     map_iter iter = create_map_iter(_map);
     map_entry* next = next_entry(&iter);
     while(next != NULL){
@@ -196,14 +273,14 @@ void* map_get(
             case U8: {
                 u8* entry_data = (u8*)next->data;
                 u8* key_data = (u8*)key;
-                if(entry_data == key_data){
+                if(*entry_data == *key_data){
                     return next->value->data;
                 }
             } break;
             case U16: {
                 u16* entry_data = (u16*)next->data;
                 u16* key_data = (u16*)key;
-                if(entry_data == key_data){
+                if(*entry_data == *key_data){
                     return next->value->data;
                 }
             } break;
@@ -224,7 +301,7 @@ void* map_get(
             case STRING:{
                 str entry_data = (str)next->data;
                 str key_data = (str)key;
-                if(strcmp(entry_data, key_data)){
+                if(strcmp(entry_data, key_data) == 0){
                     return next->value->data;
                 }
             } break;
@@ -249,8 +326,9 @@ void* map_put(
     ///Key data, size, and type of data
     void* key, u32 key_size, map_entry_type key_type,
     ///Value data, size, and type of data
-    void* value, u32 val_size, map_entry_kind val_type
+    void* value, u32 val_size, map_entry_type val_type
 ){
+    TRACE_ZONE("map_put");
     map_entry* key_entry = create_map_entry(_map, KEY, key_type, key_size, key);
     if(key_entry == NULL){
         printf("Couldn't create map entry...see console!\n");
@@ -260,6 +338,59 @@ void* map_put(
     map_entry* value_entry = create_map_entry(_map, VALUE, val_type, val_size, value);
     //printf("Created map entry value\n");
     key_entry->value = value_entry;
+    if(_map->filter.kind != NO_FILTER){
+        u64 hash;
+        if(map_key_hash(_map, key, key_type, key_size, &hash) && !membership_filter_insert(&_map->filter, hash)){
+            printf("Map filter is full, detaching it\n");
+            _map->filter.kind = NO_FILTER;
+        }
+    }
     return key_entry->data;
 }
 
+
+
+///Relocates every key-value pair of _map into a new, dense map in new_arena, which is returned.
+///Each key is followed by its value, so walking the new map touches contiguous memory.
+///The old map is left as it was. Deinit its arena when you're done with it.
+///Returns NULL without touching new_arena if the entries don't fit in it.
+///NOTE: An attached filter lives in the old arena, so it is not carried over. Attach a new one if you need it.
+PUBLIC
+RECEIVER(_map)
+map* map_compact(map* _map, arena_alloc* new_arena){
+    u64 needed = sizeof(map);
+    map_iter iter = create_map_iter(_map);
+    map_entry* next = next_entry(&iter);
+    while(next != NULL){
+        needed += 2 * sizeof(map_entry) + next->size + next->value->size;
+        next = next_entry(&iter);
+    }
+    if(new_arena->capacity + needed > new_arena->size){
+        printf("Cannot compact a map of %llu bytes into an arena with %i bytes left\n", (unsigned long long)needed, new_arena->size - new_arena->capacity);
+        return NULL;
+    }
+    map* new_map = create_map(new_arena);
+    iter = create_map_iter(_map);
+    next = next_entry(&iter);
+    while(next != NULL){
+        map_entry* value = next->value;
+        map_put(new_map, next->data, next->size, next->data_type, value->data, value->size, value->data_type);
+        next = next_entry(&iter);
+    }
+    return new_map;
+}
+
+///Hands _map over to new_arena in O(1), so that the map now lives as long as new_arena.
+///Nothing is copied, the old arena is adopted by new_arena and later map_put calls go into new_arena.
+///Returns _map, or NULL, having changed nothing, if the old arena was already adopted by some other arena.
+///NOTE: Never call arena_deinit on the old arena after this.
+///SEE: list_transfer
+PUBLIC
+RECEIVER(_map)
+map* map_transfer(map* _map, arena_alloc* new_arena){
+    if(!arena_adopt(new_arena, _map->arena)){
+        return NULL;
+    }
+    _map->arena = new_arena;
+    return _map;
+}
\ No newline at end of file
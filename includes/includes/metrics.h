@@ -0,0 +1,567 @@
+#pragma once
+
+#include "commons.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Counters, gauges and latency histograms cheap enough to leave on hot paths for good.
+
+    Every thread that records gets its own block of values, and only that thread writes it, so recording is a plain
+    load and store to memory no other thread writes: wait-free, no locked instruction, no shared cache line.
+    Reading a metric merges every thread's block. Blocks of threads that have exited are handed to new threads,
+    which carry on adding to them, so nothing recorded is lost.
+
+    thread 1 --> | block: counters, gauges, histograms | --\
+    thread 2 --> | block: counters, gauges, histograms | ----> metrics_*_read merges them
+    thread 3 --> | block: counters, gauges, histograms | --/
+
+    Histograms are log-linear, like HdrHistogram: every power of two is split into 2^precision buckets of equal width,
+    so a value is kept to within 1 / 2^precision of itself whatever its size, from 0 to 2^64 - 1.
+
+    bucket: | 0 | 1 | ... | 2^p - 1 | 2^p ... 2^(p+1) - 1, width 1 | ... width 2 | ... width 4 | ...
+
+    Resetting doesn't touch the threads' blocks. It remembers what had been recorded so far, and every read after
+    takes that off. Snapshots of histograms can be merged, queried for percentiles, and every metric can be
+    exported as text or JSON.
+    NOTE: Names aren't copied, so they have to outlive the metric. String literals always do.
+*/
+
+///How many counters and gauges there can be, together
+#define METRICS_MAX_VALUES 256
+#define METRICS_MAX_HISTOGRAMS 64
+///The finest a histogram can be. 14 bits is within 0.006%, in 6.4 MB for every thread that records into it.
+#define METRICS_MAX_PRECISION 14
+
+PUBLIC
+enum metrics_kind{
+    ///Only goes up
+    METRICS_COUNTER,
+    ///Goes up and down
+    METRICS_GAUGE,
+};
+typedef enum metrics_kind metrics_kind;
+
+PUBLIC
+enum metrics_block_state{
+    METRICS_BLOCK_FREE,
+    METRICS_BLOCK_ACTIVE,
+};
+
+///One thread's part of a histogram
+INTERNAL
+struct metrics_thread_histogram{
+    _Atomic u64 sum;
+    _Atomic u64 buckets[];
+};
+typedef struct metrics_thread_histogram metrics_thread_histogram;
+
+///Everything one thread has recorded
+INTERNAL
+struct metrics_block{
+    _Atomic u64 values[METRICS_MAX_VALUES];
+    ///Made the first time the thread records into the histogram
+    _Atomic(metrics_thread_histogram*) histograms[METRICS_MAX_HISTOGRAMS];
+    _Atomic u32 state;
+    struct metrics_block* next;
+};
+typedef struct metrics_block metrics_block;
+
+///A counter or a gauge
+PUBLIC
+struct metrics_value{
+    str name;
+    metrics_kind kind;
+    ///Where it is in every thread's block
+    INTERNAL
+    u32 slot;
+    ///What it had when it was last reset, taken off every read
+    INTERNAL
+    _Atomic u64 baseline;
+};
+typedef struct metrics_value metrics_value;
+typedef metrics_value metrics_counter;
+typedef metrics_value metrics_gauge;
+
+///A histogram's buckets merged from every thread at one moment, which can be queried without any more merging
+PUBLIC
+struct metrics_snapshot{
+    u32 precision;
+    u32 bucket_count;
+    u64 count;
+    u64 sum;
+    u64* buckets;
+};
+typedef struct metrics_snapshot metrics_snapshot;
+
+PUBLIC
+struct metrics_histogram{
+    str name;
+    u32 precision;
+    u32 bucket_count;
+    ///Where it is in every thread's block
+    INTERNAL
+    u32 id;
+    ///What it had when it was last reset, taken off every read. Held under the registry's lock.
+    INTERNAL
+    metrics_snapshot baseline;
+};
+typedef struct metrics_histogram metrics_histogram;
+
+///Every thread's block, newest first. Blocks are never freed, only handed to new threads.
+INTERNAL
+_Atomic(metrics_block*) metrics_blocks = NULL;
+INTERNAL
+_Thread_local metrics_block* metrics_this_block = NULL;
+///Every metric, for exporting
+INTERNAL
+metrics_value* metrics_values[METRICS_MAX_VALUES];
+INTERNAL
+_Atomic u32 metrics_value_count = 0;
+INTERNAL
+metrics_histogram* metrics_histograms[METRICS_MAX_HISTOGRAMS];
+INTERNAL
+_Atomic u32 metrics_histogram_count = 0;
+///Held while making a metric, handing out a block, and resetting or reading a histogram's baseline
+INTERNAL
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+INTERNAL
+pthread_key_t metrics_block_key;
+INTERNAL
+pthread_once_t metrics_key_once = PTHREAD_ONCE_INIT;
+
+///Gives the block of an exiting thread back, so a new thread can carry on with it
+HELPER
+void metrics_release_block(void* block){
+    atomic_store_explicit(&((metrics_block*)block)->state, METRICS_BLOCK_FREE, memory_order_release);
+}
+
+HELPER
+void metrics_make_key(){
+    pthread_key_create(&metrics_block_key, metrics_release_block);
+}
+
+///Gets this thread's block, handing it one the first time. Returns NULL if there's no memory for one.
+INTERNAL
+metrics_block* metrics_block_get(){
+    metrics_block* block = metrics_this_block;
+    if(block != NULL){
+        return block;
+    }
+    pthread_once(&metrics_key_once, metrics_make_key);
+    pthread_mutex_lock(&metrics_lock);
+    for(metrics_block* free_block = atomic_load_explicit(&metrics_blocks, memory_order_acquire); free_block != NULL; free_block = free_block->next){
+        u32 expected = METRICS_BLOCK_FREE;
+        if(atomic_compare_exchange_strong_explicit(&free_block->state, &expected, METRICS_BLOCK_ACTIVE, memory_order_acq_rel, memory_order_relaxed)){
+            block = free_block;
+            break;
+        }
+    }
+    if(block == NULL){
+        block = calloc(1, sizeof(metrics_block));
+        if(block != NULL){
+            atomic_init(&block->state, METRICS_BLOCK_ACTIVE);
+            block->next = atomic_load_explicit(&metrics_blocks, memory_order_relaxed);
+            atomic_store_explicit(&metrics_blocks, block, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    if(block != NULL){
+        pthread_setspecific(metrics_block_key, block);
+        metrics_this_block = block;
+    }
+    return block;
+}
+
+///How many buckets a histogram of [precision] has: 2^p for everything under 2^p, and 2^p for every power of two after
+HELPER
+u32 metrics_bucket_count(u32 precision){
+    return (65 - precision) << precision;
+}
+
+///The bucket [value] goes in
+HELPER
+u32 metrics_bucket_index(u64 value, u32 precision){
+    u32 top = 63 - (u32)__builtin_clzll(value | 1);
+    u32 shift = top > precision ? top - precision : 0;
+    return (shift << precision) + (u32)(value >> shift);
+}
+
+///The lowest value that goes in bucket [index]
+HELPER
+u64 metrics_bucket_lowest(u32 index, u32 precision){
+    if(index < (2u << precision)){
+        return index;
+    }
+    u32 shift = (index >> precision) - 1;
+    return (u64)(index - (shift << precision)) << shift;
+}
+
+///The highest value that goes in bucket [index]
+HELPER
+u64 metrics_bucket_highest(u32 index, u32 precision){
+    u32 shift = index < (2u << precision) ? 0 : (index >> precision) - 1;
+    return metrics_bucket_lowest(index, precision) + ((1ull << shift) - 1);
+}
+
+///Makes a counter or a gauge called [name]. Returns NULL if there are already METRICS_MAX_VALUES.
+INTERNAL
+metrics_value* metrics_value_create(str name, metrics_kind kind){
+    metrics_value* value = malloc(sizeof(metrics_value));
+    if(value == NULL){
+        return NULL;
+    }
+    pthread_mutex_lock(&metrics_lock);
+    u32 slot = atomic_load_explicit(&metrics_value_count, memory_order_relaxed);
+    if(slot == METRICS_MAX_VALUES){
+        pthread_mutex_unlock(&metrics_lock);
+        printf("Cannot make metric %s, there are already %i counters and gauges\n", name, METRICS_MAX_VALUES);
+        free(value);
+        return NULL;
+    }
+    value->name = name;
+    value->kind = kind;
+    value->slot = slot;
+    atomic_init(&value->baseline, 0);
+    metrics_values[slot] = value;
+    atomic_store_explicit(&metrics_value_count, slot + 1, memory_order_release);
+    pthread_mutex_unlock(&metrics_lock);
+    return value;
+}
+
+PUBLIC
+metrics_counter* metrics_counter_create(str name){
+    return metrics_value_create(name, METRICS_COUNTER);
+}
+
+PUBLIC
+metrics_gauge* metrics_gauge_create(str name){
+    return metrics_value_create(name, METRICS_GAUGE);
+}
+
+///Adds [amount] to [value] in this thread's block
+HELPER
+void metrics_value_add(metrics_value* value, u64 amount){
+    metrics_block* block = metrics_block_get();
+    if(block == NULL){
+        return;
+    }
+    ///Only this thread writes it, so there's no need for a locked add
+    _Atomic u64* slot = &block->values[value->slot];
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+PUBLIC
+RECEIVER(counter)
+void metrics_counter_add(metrics_counter* counter, u64 amount){
+    metrics_value_add(counter, amount);
+}
+
+///Moves [gauge] up or down by [amount]. A gauge is the sum of what every thread has added.
+PUBLIC
+RECEIVER(gauge)
+void metrics_gauge_add(metrics_gauge* gauge, i64 amount){
+    metrics_value_add(gauge, (u64)amount);
+}
+
+///Sums [value] over every thread, less what it had when it was last reset
+HELPER
+u64 metrics_value_read(metrics_value* value){
+    u64 sum = 0;
+    for(metrics_block* block = atomic_load_explicit(&metrics_blocks, memory_order_acquire); block != NULL; block = block->next){
+        sum += atomic_load_explicit(&block->values[value->slot], memory_order_relaxed);
+    }
+    return sum - atomic_load_explicit(&value->baseline, memory_order_relaxed);
+}
+
+PUBLIC
+RECEIVER(counter)
+u64 metrics_counter_read(metrics_counter* counter){
+    return metrics_value_read(counter);
+}
+
+PUBLIC
+RECEIVER(gauge)
+i64 metrics_gauge_read(metrics_gauge* gauge){
+    return (i64)metrics_value_read(gauge);
+}
+
+///Starts [counter] over from 0, without stopping threads from adding to it
+PUBLIC
+RECEIVER(counter)
+void metrics_counter_reset(metrics_counter* counter){
+    atomic_store_explicit(&counter->baseline, metrics_value_read(counter) + atomic_load_explicit(&counter->baseline, memory_order_relaxed), memory_order_relaxed);
+}
+
+///Makes a histogram called [name] whose values are kept to within 1 / 2^[precision] of themselves.
+///7 is within 1%, in 58 KB for every thread that records into it. Returns NULL if there are already METRICS_MAX_HISTOGRAMS.
+PUBLIC
+metrics_histogram* metrics_histogram_create(str name, u32 precision){
+    if(precision < 1 || precision > METRICS_MAX_PRECISION){
+        printf("Cannot make histogram %s with a precision of %u bits, it has to be 1 to %i\n", name, precision, METRICS_MAX_PRECISION);
+        return NULL;
+    }
+    metrics_histogram* histogram = calloc(1, sizeof(metrics_histogram));
+    if(histogram == NULL){
+        return NULL;
+    }
+    pthread_mutex_lock(&metrics_lock);
+    u32 id = atomic_load_explicit(&metrics_histogram_count, memory_order_relaxed);
+    if(id == METRICS_MAX_HISTOGRAMS){
+        pthread_mutex_unlock(&metrics_lock);
+        printf("Cannot make histogram %s, there are already %i\n", name, METRICS_MAX_HISTOGRAMS);
+        free(histogram);
+        return NULL;
+    }
+    histogram->name = name;
+    histogram->precision = precision;
+    histogram->bucket_count = metrics_bucket_count(precision);
+    histogram->id = id;
+    histogram->baseline.precision = precision;
+    histogram->baseline.bucket_count = histogram->bucket_count;
+    metrics_histograms[id] = histogram;
+    atomic_store_explicit(&metrics_histogram_count, id + 1, memory_order_release);
+    pthread_mutex_unlock(&metrics_lock);
+    return histogram;
+}
+
+///Makes this thread's part of [histogram]
+INTERNAL
+metrics_thread_histogram* metrics_thread_histogram_create(metrics_block* block, metrics_histogram* histogram){
+    metrics_thread_histogram* mine = calloc(1, sizeof(metrics_thread_histogram) + sizeof(u64) * histogram->bucket_count);
+    if(mine != NULL){
+        atomic_store_explicit(&block->histograms[histogram->id], mine, memory_order_release);
+    }
+    return mine;
+}
+
+///Records [value] into [histogram]
+PUBLIC
+RECEIVER(histogram)
+void metrics_histogram_record(metrics_histogram* histogram, u64 value){
+    metrics_block* block = metrics_block_get();
+    if(block == NULL){
+        return;
+    }
+    metrics_thread_histogram* mine = atomic_load_explicit(&block->histograms[histogram->id], memory_order_relaxed);
+    if(mine == NULL){
+        mine = metrics_thread_histogram_create(block, histogram);
+        if(mine == NULL){
+            return;
+        }
+    }
+    ///Only this thread writes these, so there's no need for locked adds
+    _Atomic u64* bucket = &mine->buckets[metrics_bucket_index(value, histogram->precision)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&mine->sum, atomic_load_explicit(&mine->sum, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+///Makes an empty snapshot for histograms of [precision]. Returns one with no buckets if there's no memory.
+PUBLIC
+metrics_snapshot metrics_snapshot_create(u32 precision){
+    metrics_snapshot snapshot = { precision, metrics_bucket_count(precision), 0, 0, NULL };
+    snapshot.buckets = calloc(snapshot.bucket_count, sizeof(u64));
+    if(snapshot.buckets == NULL){
+        snapshot.bucket_count = 0;
+    }
+    return snapshot;
+}
+
+PUBLIC
+RECEIVER(snapshot)
+void metrics_snapshot_free(metrics_snapshot* snapshot){
+    free(snapshot->buckets);
+    snapshot->buckets = NULL;
+    snapshot->bucket_count = 0;
+}
+
+///Adds everything in [from] to [snapshot]. Returns false if they're of different precisions.
+PUBLIC
+RECEIVER(snapshot)
+bool metrics_snapshot_merge(metrics_snapshot* snapshot, metrics_snapshot* from){
+    if(snapshot->precision != from->precision || snapshot->bucket_count != from->bucket_count){
+        return false;
+    }
+    for(u32 i = 0; i < snapshot->bucket_count; i++){
+        snapshot->buckets[i] += from->buckets[i];
+    }
+    snapshot->count += from->count;
+    snapshot->sum += from->sum;
+    return true;
+}
+
+///Merges every thread's part of [histogram] into [snapshot], less what it had when it was last reset.
+///The count is the buckets added up, not kept apart from them, so it always agrees with them even while threads record.
+INTERNAL
+RECEIVER(histogram)
+void metrics_histogram_gather(metrics_histogram* histogram, metrics_snapshot* snapshot){
+    for(metrics_block* block = atomic_load_explicit(&metrics_blocks, memory_order_acquire); block != NULL; block = block->next){
+        metrics_thread_histogram* theirs = atomic_load_explicit(&block->histograms[histogram->id], memory_order_acquire);
+        if(theirs == NULL){
+            continue;
+        }
+        for(u32 i = 0; i < histogram->bucket_count; i++){
+            snapshot->buckets[i] += atomic_load_explicit(&theirs->buckets[i], memory_order_relaxed);
+        }
+        snapshot->sum += atomic_load_explicit(&theirs->sum, memory_order_relaxed);
+    }
+    if(histogram->baseline.buckets != NULL){
+        for(u32 i = 0; i < histogram->bucket_count; i++){
+            snapshot->buckets[i] -= histogram->baseline.buckets[i];
+        }
+        snapshot->sum -= histogram->baseline.sum;
+    }
+    snapshot->count = 0;
+    for(u32 i = 0; i < histogram->bucket_count; i++){
+        snapshot->count += snapshot->buckets[i];
+    }
+}
+
+///Merges every thread's part of [histogram] as it is now.
+///LIFETIME: The snapshot is the caller's, and has to be passed to metrics_snapshot_free.
+PUBLIC
+RECEIVER(histogram)
+metrics_snapshot metrics_histogram_read(metrics_histogram* histogram){
+    metrics_snapshot snapshot = metrics_snapshot_create(histogram->precision);
+    if(snapshot.buckets == NULL){
+        return snapshot;
+    }
+    pthread_mutex_lock(&metrics_lock);
+    metrics_histogram_gather(histogram, &snapshot);
+    pthread_mutex_unlock(&metrics_lock);
+    return snapshot;
+}
+
+///Starts [histogram] over from empty, without stopping threads from recording into it
+PUBLIC
+RECEIVER(histogram)
+void metrics_histogram_reset(metrics_histogram* histogram){
+    metrics_snapshot now = metrics_snapshot_create(histogram->precision);
+    if(now.buckets == NULL){
+        return;
+    }
+    pthread_mutex_lock(&metrics_lock);
+    metrics_histogram_gather(histogram, &now);
+    if(histogram->baseline.buckets != NULL){
+        metrics_snapshot_merge(&now, &histogram->baseline);
+        metrics_snapshot_free(&histogram->baseline);
+    }
+    histogram->baseline = now;
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+///The value [percentile] percent of the values are at or under, to within the snapshot's precision, or 0 if it's empty
+PUBLIC
+RECEIVER(snapshot)
+u64 metrics_snapshot_percentile(metrics_snapshot* snapshot, double percentile){
+    if(snapshot->count == 0){
+        return 0;
+    }
+    if(percentile > 100){
+        percentile = 100;
+    }
+    u64 rank = (u64)(percentile / 100 * (double)snapshot->count + 0.5);
+    if(rank == 0){
+        rank = 1;
+    }
+    u64 seen = 0;
+    for(u32 i = 0; i < snapshot->bucket_count; i++){
+        seen += snapshot->buckets[i];
+        if(seen >= rank){
+            return metrics_bucket_highest(i, snapshot->precision);
+        }
+    }
+    return metrics_bucket_highest(snapshot->bucket_count - 1, snapshot->precision);
+}
+
+///The smallest value in the snapshot, to within its precision
+PUBLIC
+RECEIVER(snapshot)
+u64 metrics_snapshot_min(metrics_snapshot* snapshot){
+    for(u32 i = 0; i < snapshot->bucket_count; i++){
+        if(snapshot->buckets[i] != 0){
+            return metrics_bucket_lowest(i, snapshot->precision);
+        }
+    }
+    return 0;
+}
+
+PUBLIC
+RECEIVER(snapshot)
+double metrics_snapshot_mean(metrics_snapshot* snapshot){
+    return snapshot->count == 0 ? 0 : (double)snapshot->sum / (double)snapshot->count;
+}
+
+///The percentiles every export shows
+INTERNAL
+double metrics_export_percentiles[] = { 50, 90, 99, 99.9, 100 };
+INTERNAL
+str metrics_export_names[] = { "p50", "p90", "p99", "p99.9", "max" };
+
+///Writes every metric to [out], one per line:
+///counter map.get.calls 1234
+///histogram map.get.ns count=1234 mean=52.1 min=20 p50=48 p90=80 p99=130 p99.9=400 max=2100
+PUBLIC
+void metrics_export_text(FILE* out){
+    u32 count = atomic_load_explicit(&metrics_value_count, memory_order_acquire);
+    for(u32 i = 0; i < count; i++){
+        metrics_value* value = metrics_values[i];
+        if(value->kind == METRICS_COUNTER){
+            fprintf(out, "counter %s %llu\n", value->name, (unsigned long long)metrics_counter_read(value));
+        }else{
+            fprintf(out, "gauge %s %lld\n", value->name, (long long)metrics_gauge_read(value));
+        }
+    }
+    count = atomic_load_explicit(&metrics_histogram_count, memory_order_acquire);
+    for(u32 i = 0; i < count; i++){
+        metrics_snapshot snapshot = metrics_histogram_read(metrics_histograms[i]);
+        fprintf(out, "histogram %s count=%llu mean=%.1f min=%llu", metrics_histograms[i]->name,
+            (unsigned long long)snapshot.count, metrics_snapshot_mean(&snapshot), (unsigned long long)metrics_snapshot_min(&snapshot));
+        for(u32 j = 0; j < sizeof(metrics_export_percentiles) / sizeof(double); j++){
+            fprintf(out, " %s=%llu", metrics_export_names[j], (unsigned long long)metrics_snapshot_percentile(&snapshot, metrics_export_percentiles[j]));
+        }
+        fputc('\n', out);
+        metrics_snapshot_free(&snapshot);
+    }
+}
+
+///Writes every metric to [out] as one JSON object:
+///{"counters":{"map.get.calls":1234},"gauges":{},"histograms":{"map.get.ns":{"count":1234,"mean":52.1,...}}}
+///NOTE: Names are written as they are, so they shouldn't have quotes or backslashes in them.
+PUBLIC
+void metrics_export_json(FILE* out){
+    u32 count = atomic_load_explicit(&metrics_value_count, memory_order_acquire);
+    for(u32 kind = METRICS_COUNTER; kind <= METRICS_GAUGE; kind++){
+        fprintf(out, kind == METRICS_COUNTER ? "{\"counters\":{" : ",\"gauges\":{");
+        bool first = true;
+        for(u32 i = 0; i < count; i++){
+            metrics_value* value = metrics_values[i];
+            if(value->kind != kind){
+                continue;
+            }
+            if(kind == METRICS_COUNTER){
+                fprintf(out, "%s\"%s\":%llu", first ? "" : ",", value->name, (unsigned long long)metrics_counter_read(value));
+            }else{
+                fprintf(out, "%s\"%s\":%lld", first ? "" : ",", value->name, (long long)metrics_gauge_read(value));
+            }
+            first = false;
+        }
+        fputc('}', out);
+    }
+    fprintf(out, ",\"histograms\":{");
+    count = atomic_load_explicit(&metrics_histogram_count, memory_order_acquire);
+    for(u32 i = 0; i < count; i++){
+        metrics_snapshot snapshot = metrics_histogram_read(metrics_histograms[i]);
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"min\":%llu", i == 0 ? "" : ",", metrics_histograms[i]->name,
+            (unsigned long long)snapshot.count, metrics_snapshot_mean(&snapshot), (unsigned long long)metrics_snapshot_min(&snapshot));
+        for(u32 j = 0; j < sizeof(metrics_export_percentiles) / sizeof(double); j++){
+            fprintf(out, ",\"%s\":%llu", metrics_export_names[j], (unsigned long long)metrics_snapshot_percentile(&snapshot, metrics_export_percentiles[j]));
+        }
+        fputc('}', out);
+        metrics_snapshot_free(&snapshot);
+    }
+    fprintf(out, "}}\n");
+}
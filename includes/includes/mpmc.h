@@ -0,0 +1,396 @@
+#pragma once
+
+#include "commons.h"
+#include "lazy_arena.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+    A bounded multi-producer/multi-consumer queue, after Dmitry Vyukov's. Any number of threads can push
+    and pop at the same time, and each push or pop is one compare-and-swap when there is no contention.
+
+    Every cell has a sequence number next to its data that says whose turn it is:
+    a cell at position p is free for the producer claiming p when its sequence is p, and it's ready for
+    the consumer claiming p once its sequence is p + 1. Popping sets it to p + capacity, which is the
+    position the next producer to land on that cell will claim.
+
+    |-----------------------|-----------------------|-----------------------|-----------------------|
+    | enqueue_pos (padded)  | dequeue_pos (padded)  | cells, mask, wakes    | cell | cell | ...      |
+    |-----------------------|-----------------------|-----------------------|-----------------------|
+                                                                            | sequence (8) | data    |
+
+    Producers only touch [enqueue_pos] and consumers only touch [dequeue_pos], and each is on its own cache line.
+    Batch pushes and pops claim as many consecutive cells as are ready with a single compare-and-swap.
+
+    The whole queue lives in a lazy arena, like deque_create, with the header on a cache line at the start.
+    The waiting push and pop spin, then yield, then park on a futex, and only wake anyone when someone is parked.
+*/
+
+#define MPMC_CACHE_LINE 64
+///How many times a waiting push or pop tries again before it parks
+#define MPMC_DEFAULT_SPIN 256
+///How many of those tries just pause the cpu. The rest yield it, in case whoever we're waiting on needs it.
+#define MPMC_PAUSE_SPIN 16
+
+typedef struct mpmc_cell mpmc_cell;
+INTERNAL
+struct mpmc_cell{
+    _Atomic u32 sequence;
+    u32 reserved;
+    u8 data[];
+};
+
+PUBLIC
+EXTENSION(arena)
+struct mpmc_queue{
+    ///The position the next push claims
+    INTERNAL
+    _Alignas(MPMC_CACHE_LINE) _Atomic u32 enqueue_pos;
+    ///The position the next pop claims
+    INTERNAL
+    _Alignas(MPMC_CACHE_LINE) _Atomic u32 dequeue_pos;
+
+    INTERNAL
+    _Alignas(MPMC_CACHE_LINE) lazy_arena_alloc* arena;
+    INTERNAL
+    u8* cells;
+    ///Number of cells minus one
+    INTERNAL
+    u32 mask;
+    INTERNAL
+    u32 slot_size;
+    ///The size of a cell, its sequence plus its data rounded up to 8 bytes
+    INTERNAL
+    u32 cell_size;
+    INTERNAL
+    u32 spin_limit;
+    ///How many pops are parked, and the futex they park on
+    INTERNAL
+    _Atomic u32 pop_waiters;
+    INTERNAL
+    _Atomic u32 pop_wake;
+    ///How many pushes are parked, and the futex they park on
+    INTERNAL
+    _Atomic u32 push_waiters;
+    INTERNAL
+    _Atomic u32 push_wake;
+    ///Set by mpmc_close
+    INTERNAL
+    _Atomic u32 closed;
+};
+typedef struct mpmc_queue mpmc_queue;
+
+INTERNAL
+RECEIVER(queue)
+mpmc_cell* mpmc_cell_at(mpmc_queue* queue, u32 pos){
+    return (mpmc_cell*)(queue->cells + (size_t)(pos & queue->mask) * queue->cell_size);
+}
+
+INTERNAL
+void mpmc_futex_wait(_Atomic u32* addr, u32 expected){
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+///Bumps a wake counter and wakes up to [count] threads parked on it
+INTERNAL
+void mpmc_futex_wake(_Atomic u32* addr, u32 count){
+    atomic_fetch_add(addr, 1);
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : (int)count, NULL, NULL, 0);
+}
+
+///Waits a little before trying again. The first tries only pause, and after that the cpu is given up,
+///since when there are more threads than cpus the other side can't make progress while we spin.
+INTERNAL
+void mpmc_backoff(u32 spins){
+    if(spins >= MPMC_PAUSE_SPIN){
+        sched_yield();
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+///Creates a new queue in the given lazy arena with room for at least [capacity] elements of [slot_size] bytes.
+///The number of cells is rounded up to a power of two. The header goes on the first cache line of the arena
+///and the cells right after it, so the arena has to be big enough for both.
+///Returns NULL if it isn't.
+RECEIVER(arena)
+mpmc_queue* mpmc_create(lazy_arena_alloc* arena, u32 slot_size, u32 capacity){
+    if(arena == NULL){
+        printf("Expected an initialized lazy_arena_alloc*, but instead got NULL!\n");
+        return NULL;
+    }
+    if(slot_size == 0){
+        printf("Cannot create an mpmc queue of 0 sized elements\n");
+        return NULL;
+    }
+    if(capacity < 2){
+        capacity = 2;
+    }
+    if(capacity > 0x40000000u){
+        printf("Cannot create an mpmc queue of %i elements\n", capacity);
+        return NULL;
+    }
+    capacity = 1u << (32 - __builtin_clz(capacity - 1));
+    u32 cell_size = (sizeof(mpmc_cell) + slot_size + 7) & ~7u;
+    uintptr_t start = (uintptr_t)arena->start;
+    uintptr_t header = (start + MPMC_CACHE_LINE - 1) & ~(uintptr_t)(MPMC_CACHE_LINE - 1);
+    uintptr_t cells = header + sizeof(mpmc_queue);
+    u64 needed = (u64)(cells - start) + (u64)capacity * cell_size;
+    if(needed > arena->size){
+        printf("Cannot create an mpmc queue of %i elements of size %i in a lazy arena of %i bytes\n", capacity, slot_size, arena->size);
+        return NULL;
+    }
+    mpmc_queue* queue = (mpmc_queue*)header;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    queue->arena = arena;
+    queue->cells = (u8*)cells;
+    queue->mask = capacity - 1;
+    queue->slot_size = slot_size;
+    queue->cell_size = cell_size;
+    queue->spin_limit = MPMC_DEFAULT_SPIN;
+    atomic_init(&queue->pop_waiters, 0);
+    atomic_init(&queue->pop_wake, 0);
+    atomic_init(&queue->push_waiters, 0);
+    atomic_init(&queue->push_wake, 0);
+    atomic_init(&queue->closed, 0);
+    ///Every cell starts out free for the producer that will claim its position on the first lap
+    for(u32 i = 0; i < capacity; i++){
+        atomic_init(&mpmc_cell_at(queue, i)->sequence, i);
+    }
+    return queue;
+}
+
+///Gets the number of bytes of lazy arena a queue of [capacity] elements of [slot_size] bytes needs
+u32 mpmc_arena_size(u32 slot_size, u32 capacity){
+    if(capacity < 2){
+        capacity = 2;
+    }
+    capacity = 1u << (32 - __builtin_clz(capacity - 1));
+    return MPMC_CACHE_LINE + sizeof(mpmc_queue) + capacity * ((sizeof(mpmc_cell) + slot_size + 7) & ~7u);
+}
+
+///Sets how many times a waiting push or pop tries again before it parks on a futex
+RECEIVER(queue)
+void mpmc_set_spin(mpmc_queue* queue, u32 spin_limit){
+    queue->spin_limit = spin_limit;
+}
+
+///Gets roughly how many elements are in the queue. It can be stale by the time it returns.
+RECEIVER(queue)
+u32 mpmc_count(mpmc_queue* queue){
+    u32 tail = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    u32 head = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    i32 count = (i32)(tail - head);
+    return count < 0 ? 0 : (u32)count;
+}
+
+///Wakes up to [count] parked pops, if there are any. Pushes call this once their cells are ready.
+INTERNAL
+RECEIVER(queue)
+void mpmc_wake_pops(mpmc_queue* queue, u32 count){
+    ///Pairs with the fence in mpmc_pop_wait_n, so either it sees our cells or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&queue->pop_waiters, memory_order_relaxed) != 0){
+        mpmc_futex_wake(&queue->pop_wake, count);
+    }
+}
+
+///Wakes up to [count] parked pushes, if there are any. Pops call this once their cells are free.
+INTERNAL
+RECEIVER(queue)
+void mpmc_wake_pushes(mpmc_queue* queue, u32 count){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&queue->push_waiters, memory_order_relaxed) != 0){
+        mpmc_futex_wake(&queue->push_wake, count);
+    }
+}
+
+///Pushes up to [count] contiguous elements from [data], claiming as many consecutive free cells as there are
+///with one compare-and-swap. Returns how many were pushed, which is 0 if the queue is full.
+RECEIVER(queue)
+u32 mpmc_try_push_n(mpmc_queue* queue, void* data, u32 count){
+    u32 pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    u32 claimed;
+    for(;;){
+        ///Count how many cells from [pos] on are free for this lap
+        claimed = 0;
+        while(claimed < count){
+            u32 sequence = atomic_load_explicit(&mpmc_cell_at(queue, pos + claimed)->sequence, memory_order_acquire);
+            if(sequence != pos + claimed){
+                break;
+            }
+            claimed += 1;
+        }
+        if(claimed == 0){
+            u32 sequence = atomic_load_explicit(&mpmc_cell_at(queue, pos)->sequence, memory_order_acquire);
+            if((i32)(sequence - pos) < 0){
+                ///The cell still holds an element from the last lap, so the queue is full
+                return 0;
+            }
+            ///Another push claimed it first
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+            continue;
+        }
+        if(atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + claimed, memory_order_relaxed, memory_order_relaxed)){
+            break;
+        }
+    }
+    for(u32 i = 0; i < claimed; i++){
+        mpmc_cell* cell = mpmc_cell_at(queue, pos + i);
+        memcpy(cell->data, (u8*)data + (size_t)i * queue->slot_size, queue->slot_size);
+        atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release);
+    }
+    mpmc_wake_pops(queue, claimed);
+    return claimed;
+}
+
+///Pops up to [count] elements into [data], claiming as many consecutive ready cells as there are
+///with one compare-and-swap. Returns how many were popped, which is 0 if the queue is empty.
+RECEIVER(queue)
+u32 mpmc_try_pop_n(mpmc_queue* queue, OUT void* data, u32 count){
+    u32 pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    u32 claimed;
+    for(;;){
+        claimed = 0;
+        while(claimed < count){
+            u32 sequence = atomic_load_explicit(&mpmc_cell_at(queue, pos + claimed)->sequence, memory_order_acquire);
+            if(sequence != pos + claimed + 1){
+                break;
+            }
+            claimed += 1;
+        }
+        if(claimed == 0){
+            u32 sequence = atomic_load_explicit(&mpmc_cell_at(queue, pos)->sequence, memory_order_acquire);
+            if((i32)(sequence - (pos + 1)) < 0){
+                ///Nothing has been pushed into this cell yet on this lap, so the queue is empty
+                return 0;
+            }
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+            continue;
+        }
+        if(atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + claimed, memory_order_relaxed, memory_order_relaxed)){
+            break;
+        }
+    }
+    for(u32 i = 0; i < claimed; i++){
+        mpmc_cell* cell = mpmc_cell_at(queue, pos + i);
+        memcpy((u8*)data + (size_t)i * queue->slot_size, cell->data, queue->slot_size);
+        ///Hand the cell to the push that will claim it on the next lap
+        atomic_store_explicit(&cell->sequence, pos + i + queue->mask + 1, memory_order_release);
+    }
+    mpmc_wake_pushes(queue, claimed);
+    return claimed;
+}
+
+///Pushes one element if there's room. Returns false if the queue is full.
+RECEIVER(queue)
+bool mpmc_try_push(mpmc_queue* queue, void* data){
+    return mpmc_try_push_n(queue, data, 1) == 1;
+}
+
+///Pops one element into [data] if there is one. Returns false if the queue is empty.
+RECEIVER(queue)
+bool mpmc_try_pop(mpmc_queue* queue, OUT void* data){
+    return mpmc_try_pop_n(queue, data, 1) == 1;
+}
+
+///Closes the queue. Waiting pushes fail, and waiting pops fail once the queue is drained.
+RECEIVER(queue)
+void mpmc_close(mpmc_queue* queue){
+    atomic_store(&queue->closed, 1);
+    mpmc_futex_wake(&queue->pop_wake, INT_MAX);
+    mpmc_futex_wake(&queue->push_wake, INT_MAX);
+}
+
+///Pushes all [count] elements from [data], spinning and then parking whenever the queue is full.
+///Returns how many were pushed, which is only less than [count] if the queue was closed.
+RECEIVER(queue)
+u32 mpmc_push_wait_n(mpmc_queue* queue, void* data, u32 count){
+    u32 pushed = 0;
+    u32 spins = 0;
+    while(pushed < count){
+        if(atomic_load_explicit(&queue->closed, memory_order_relaxed)){
+            break;
+        }
+        u32 done = mpmc_try_push_n(queue, (u8*)data + (size_t)pushed * queue->slot_size, count - pushed);
+        if(done != 0){
+            pushed += done;
+            spins = 0;
+            continue;
+        }
+        if(spins < queue->spin_limit){
+            mpmc_backoff(spins);
+            spins += 1;
+            continue;
+        }
+        u32 wake = atomic_load(&queue->push_wake);
+        atomic_fetch_add(&queue->push_waiters, 1);
+        ///Pairs with the fence in mpmc_wake_pushes, so either we see the freed cell or it sees us waiting
+        atomic_thread_fence(memory_order_seq_cst);
+        done = mpmc_try_push_n(queue, (u8*)data + (size_t)pushed * queue->slot_size, count - pushed);
+        if(done == 0 && !atomic_load(&queue->closed)){
+            mpmc_futex_wait(&queue->push_wake, wake);
+        }
+        atomic_fetch_sub(&queue->push_waiters, 1);
+        pushed += done;
+    }
+    return pushed;
+}
+
+///Pops at least one and up to [count] elements into [data], spinning and then parking while the queue is empty.
+///Returns how many were popped, which is 0 only if the queue was closed and drained.
+RECEIVER(queue)
+u32 mpmc_pop_wait_n(mpmc_queue* queue, OUT void* data, u32 count){
+    u32 spins = 0;
+    for(;;){
+        u32 done = mpmc_try_pop_n(queue, data, count);
+        if(done != 0){
+            return done;
+        }
+        if(atomic_load_explicit(&queue->closed, memory_order_acquire)){
+            ///Everything pushed before the close is still there to drain
+            return mpmc_try_pop_n(queue, data, count);
+        }
+        if(spins < queue->spin_limit){
+            mpmc_backoff(spins);
+            spins += 1;
+            continue;
+        }
+        u32 wake = atomic_load(&queue->pop_wake);
+        atomic_fetch_add(&queue->pop_waiters, 1);
+        ///Pairs with the fence in mpmc_wake_pops
+        atomic_thread_fence(memory_order_seq_cst);
+        done = mpmc_try_pop_n(queue, data, count);
+        if(done == 0 && !atomic_load(&queue->closed)){
+            mpmc_futex_wait(&queue->pop_wake, wake);
+        }
+        atomic_fetch_sub(&queue->pop_waiters, 1);
+        if(done != 0){
+            return done;
+        }
+    }
+}
+
+///Pushes one element, spinning and then parking while the queue is full.
+///Returns false if the queue was closed first.
+RECEIVER(queue)
+bool mpmc_push_wait(mpmc_queue* queue, void* data){
+    return mpmc_push_wait_n(queue, data, 1) == 1;
+}
+
+///Pops one element into [data], spinning and then parking while the queue is empty.
+///Returns false if the queue was closed and drained.
+RECEIVER(queue)
+bool mpmc_pop_wait(mpmc_queue* queue, OUT void* data){
+    return mpmc_pop_wait_n(queue, data, 1) == 1;
+}
@@ -0,0 +1,642 @@
+#pragma once
+
+#include "commons.h"
+#include "list.h"
+#include "vector.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+    Parallel algorithms over contiguous buffers and lists, run on a fixed thread_pool.
+
+    Every algorithm splits its input into chunks of about PARALLEL_CHUNK_BYTES, which is sized so
+    a chunk sits comfortably in a core's L2 cache. Workers grab chunks in order off a shared counter,
+    so faster workers just end up doing more chunks. The calling thread works on chunks too, so a pool
+    of 1 thread runs everything on the caller with no worker threads at all.
+
+    A buffer is described by a pointer, a count, and the size of every element, like a vector.
+    Lists are handled by gathering pointers to their entries into a vector first, which is one O(n)
+    walk, after which the work itself is done over dense memory.
+
+    Callbacks may run on any thread at the same time as each other, so they must not touch shared state
+    without synchronizing it.
+*/
+
+///The number of bytes of input each chunk covers. Define this before including to change it.
+#ifndef PARALLEL_CHUNK_BYTES
+#define PARALLEL_CHUNK_BYTES (256 * 1024)
+#endif
+
+///A job run by thread_pool_run. It is called once for each chunk in [0, chunk_count)
+typedef void (*thread_pool_job)(void* ctx, u32 chunk);
+
+///A fixed pool of worker threads that run one fork-join job at a time.
+///SEE: thread_pool_run
+PUBLIC
+struct thread_pool{
+    ///Number of threads that work on a job, including the caller of thread_pool_run
+    INTERNAL
+    u32 thread_count;
+    INTERNAL
+    pthread_t* workers;
+    INTERNAL
+    pthread_mutex_t lock;
+    ///Signalled when a new job is posted or the pool is shutting down
+    INTERNAL
+    pthread_cond_t job_posted;
+    ///Signalled when the last worker finishes with a job
+    INTERNAL
+    pthread_cond_t job_done;
+    ///Bumped every time a job is posted, so workers can tell a new job from one they've finished
+    INTERNAL
+    u64 generation;
+    ///Number of workers that haven't finished with the current job yet
+    INTERNAL
+    u32 busy;
+    INTERNAL
+    bool stopping;
+    INTERNAL
+    thread_pool_job job;
+    INTERNAL
+    void* ctx;
+    INTERNAL
+    u32 chunk_count;
+    ///The next chunk to be handed out
+    INTERNAL
+    _Atomic u32 next_chunk;
+};
+typedef struct thread_pool thread_pool;
+
+///Grabs chunks of the current job until there are none left
+INTERNAL
+RECEIVER(pool)
+void thread_pool_drain(thread_pool* pool, thread_pool_job job, void* ctx, u32 chunk_count){
+    for(;;){
+        u32 chunk = atomic_fetch_add_explicit(&pool->next_chunk, 1, memory_order_relaxed);
+        if(chunk >= chunk_count){
+            return;
+        }
+        job(ctx, chunk);
+    }
+}
+
+INTERNAL
+void* thread_pool_worker(void* arg){
+    thread_pool* pool = (thread_pool*)arg;
+    u64 seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for(;;){
+        while(!pool->stopping && pool->generation == seen){
+            pthread_cond_wait(&pool->job_posted, &pool->lock);
+        }
+        if(pool->stopping){
+            break;
+        }
+        seen = pool->generation;
+        thread_pool_job job = pool->job;
+        void* ctx = pool->ctx;
+        u32 chunk_count = pool->chunk_count;
+        pthread_mutex_unlock(&pool->lock);
+
+        thread_pool_drain(pool, job, ctx, chunk_count);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy -= 1;
+        if(pool->busy == 0){
+            pthread_cond_signal(&pool->job_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+///Creates a pool that runs jobs on [thread_count] threads, including the caller.
+///If [thread_count] is 0, one thread per online cpu is used.
+///MEM: Borrowed-always
+///LIFETIME: This persists until it's passed into thread_pool_deinit
+PUBLIC
+thread_pool* thread_pool_init(u32 thread_count){
+    if(thread_count == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (u32)cpus : 1;
+    }
+    thread_pool* pool = (thread_pool*)calloc(1, sizeof(thread_pool));
+    if(pool == NULL){
+        return NULL;
+    }
+    pool->thread_count = thread_count;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_posted, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    atomic_init(&pool->next_chunk, 0);
+    pool->workers = (pthread_t*)calloc(thread_count, sizeof(pthread_t));
+    for(u32 i = 0; i + 1 < thread_count; i++){
+        if(pthread_create(&pool->workers[i], NULL, thread_pool_worker, pool) != 0){
+            printf("Could only start %i of %i pool threads\n", i + 1, thread_count);
+            pool->thread_count = i + 1;
+            break;
+        }
+    }
+    return pool;
+}
+
+///Stops and joins every worker and frees the pool
+PUBLIC
+RECEIVER(pool)
+void thread_pool_deinit(thread_pool* pool){
+    if(pool == NULL){
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_posted);
+    pthread_mutex_unlock(&pool->lock);
+    for(u32 i = 0; i + 1 < pool->thread_count; i++){
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_cond_destroy(&pool->job_posted);
+    pthread_cond_destroy(&pool->job_done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+///Runs [job] once for every chunk in [0, chunk_count) across the pool and returns once all of them are done.
+///The caller works on chunks as well. Only one thread may call this on a pool at a time.
+PUBLIC
+RECEIVER(pool)
+void thread_pool_run(thread_pool* pool, thread_pool_job job, void* ctx, u32 chunk_count){
+    if(chunk_count == 0){
+        return;
+    }
+    ///Not worth waking anyone up for
+    if(pool->thread_count == 1 || chunk_count == 1){
+        for(u32 chunk = 0; chunk < chunk_count; chunk++){
+            job(ctx, chunk);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->ctx = ctx;
+    pool->chunk_count = chunk_count;
+    atomic_store_explicit(&pool->next_chunk, 0, memory_order_relaxed);
+    pool->busy = pool->thread_count - 1;
+    pool->generation += 1;
+    pthread_cond_broadcast(&pool->job_posted);
+    pthread_mutex_unlock(&pool->lock);
+
+    thread_pool_drain(pool, job, ctx, chunk_count);
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->busy != 0){
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+///Gets the number of elements of [element_size] that make up one chunk
+INTERNAL
+u32 parallel_chunk_elements(u32 element_size){
+    u32 elements = PARALLEL_CHUNK_BYTES / (element_size == 0 ? 1 : element_size);
+    return elements == 0 ? 1 : elements;
+}
+
+///Everything an algorithm's chunk job needs. Not every algorithm uses every field.
+INTERNAL
+struct parallel_task{
+    u8* data;
+    u8* dest;
+    u32 count;
+    u32 element_size;
+    u32 dest_size;
+    u32 chunk_elements;
+    void* ctx;
+    int (*cmp)(const void*, const void*, void*);
+    bool (*pred)(void*, void*);
+    void (*transform)(void*, void*, void*);
+    void (*fold)(void*, void*, void*);
+    ///Per chunk results: counts for filter, accumulators for reduce
+    u8* results;
+    u32 result_size;
+    ///Which elements passed the filter predicate
+    u8* keep;
+    ///Merge sort: the width of the runs being merged in this pass
+    u32 run;
+    _Atomic i64 found;
+};
+typedef struct parallel_task parallel_task;
+
+///Gets the [first, end) elements of a chunk
+INTERNAL
+void parallel_chunk_range(parallel_task* task, u32 chunk, OUT u32* first, OUT u32* end){
+    u64 start = (u64)chunk * task->chunk_elements;
+    u64 stop = start + task->chunk_elements;
+    *first = (u32)start;
+    *end = stop > task->count ? task->count : (u32)stop;
+}
+
+///Merges the sorted runs [first, mid) and [mid, end) of src into the same place in dest.
+///Ties are taken from the left run so the merge is stable.
+INTERNAL
+void parallel_merge(parallel_task* task, u8* src, u8* dest, u64 first, u64 mid, u64 end){
+    u32 size = task->element_size;
+    u8* left = src + first * size;
+    u8* left_end = src + mid * size;
+    u8* right = left_end;
+    u8* right_end = src + end * size;
+    u8* out = dest + first * size;
+    while(left < left_end && right < right_end){
+        if(task->cmp(right, left, task->ctx) < 0){
+            vector_copy_element(out, right, size);
+            right += size;
+        }else{
+            vector_copy_element(out, left, size);
+            left += size;
+        }
+        out += size;
+    }
+    memcpy(out, left, left_end - left);
+    out += left_end - left;
+    memcpy(out, right, right_end - right);
+}
+
+///The length of the runs each chunk insertion sorts before merging them
+#define PARALLEL_SORT_RUN 16
+
+///Sorts one chunk in place with a bottom up merge sort, using the same range of the scratch buffer
+INTERNAL
+void parallel_sort_chunk(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    u32 size = task->element_size;
+    u32 count = end - first;
+    u8* base = task->data + (size_t)first * size;
+    u8* scratch = task->dest + (size_t)first * size;
+    ///Insertion sort short runs, holding the element being inserted in the scratch space
+    for(u32 run = 0; run < count; run += PARALLEL_SORT_RUN){
+        u32 run_end = run + PARALLEL_SORT_RUN < count ? run + PARALLEL_SORT_RUN : count;
+        for(u32 i = run + 1; i < run_end; i++){
+            u32 j = i;
+            vector_copy_element(scratch, base + (size_t)i * size, size);
+            while(j > run && task->cmp(scratch, base + (size_t)(j - 1) * size, task->ctx) < 0){
+                j -= 1;
+            }
+            if(j != i){
+                memmove(base + (size_t)(j + 1) * size, base + (size_t)j * size, (size_t)(i - j) * size);
+                vector_copy_element(base + (size_t)j * size, scratch, size);
+            }
+        }
+    }
+    u8* src = base;
+    u8* dest = scratch;
+    for(u64 run = PARALLEL_SORT_RUN; run < count; run *= 2){
+        for(u64 lo = 0; lo < count; lo += run * 2){
+            u64 mid = lo + run < count ? lo + run : count;
+            u64 hi = lo + run * 2 < count ? lo + run * 2 : count;
+            parallel_merge(task, src, dest, lo, mid, hi);
+        }
+        u8* swap = src;
+        src = dest;
+        dest = swap;
+    }
+    if(src != base){
+        memcpy(base, src, (size_t)count * size);
+    }
+}
+
+///Merges one pair of neighbouring runs of width [task->run] from data into dest
+INTERNAL
+void parallel_merge_pair(void* ctx, u32 pair){
+    parallel_task* task = (parallel_task*)ctx;
+    u64 first = (u64)pair * task->run * 2;
+    u64 mid = first + task->run < task->count ? first + task->run : task->count;
+    u64 end = mid + task->run < task->count ? mid + task->run : task->count;
+    parallel_merge(task, task->data, task->dest, first, mid, end);
+}
+
+///Sorts [count] elements of [element_size] in place, ordered by [cmp], which is given [ctx] as its last argument.
+///This is a stable merge sort: chunks are sorted in parallel, then merged pairwise in parallel passes.
+///Returns false if the scratch buffer could not be allocated, in which case nothing was sorted.
+PUBLIC
+RECEIVER(pool)
+bool parallel_sort(
+    thread_pool* pool,
+    void* data, u32 count, u32 element_size,
+    int (*cmp)(const void* left, const void* right, void* ctx), void* ctx
+){
+    if(count < 2){
+        return true;
+    }
+    parallel_task task = { 0 };
+    task.data = (u8*)data;
+    task.count = count;
+    task.element_size = element_size;
+    task.cmp = cmp;
+    task.ctx = ctx;
+    task.chunk_elements = parallel_chunk_elements(element_size);
+    u32 chunks = (count + task.chunk_elements - 1) / task.chunk_elements;
+    u8* scratch = (u8*)malloc((size_t)count * element_size);
+    if(scratch == NULL){
+        printf("Could not allocate scratch space to sort %i elements\n", count);
+        return false;
+    }
+    task.dest = scratch;
+    thread_pool_run(pool, parallel_sort_chunk, &task, chunks);
+    for(u64 run = task.chunk_elements; run < count; run *= 2){
+        task.run = (u32)run;
+        u32 pairs = (u32)((count + run * 2 - 1) / (run * 2));
+        thread_pool_run(pool, parallel_merge_pair, &task, pairs);
+        u8* swap = task.data;
+        task.data = task.dest;
+        task.dest = swap;
+    }
+    ///An odd number of passes leaves the result in the scratch buffer
+    if(task.data != (u8*)data){
+        memcpy(data, task.data, (size_t)count * element_size);
+    }
+    free(scratch);
+    return true;
+}
+
+INTERNAL
+void parallel_transform_chunk(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    u8* in = task->data + (size_t)first * task->element_size;
+    u8* out = task->dest + (size_t)first * task->dest_size;
+    for(u32 i = first; i < end; i++){
+        task->transform(in, out, task->ctx);
+        in += task->element_size;
+        out += task->dest_size;
+    }
+}
+
+///Calls [transform] with every element of [data] and the matching element of [dest], in parallel.
+///[dest] holds [count] elements of [dest_size], and may be the same buffer as [data] when the sizes match.
+PUBLIC
+RECEIVER(pool)
+void parallel_transform(
+    thread_pool* pool,
+    void* data, u32 count, u32 element_size,
+    void* dest, u32 dest_size,
+    void (*transform)(void* in, void* out, void* ctx), void* ctx
+){
+    parallel_task task = { 0 };
+    task.data = (u8*)data;
+    task.dest = (u8*)dest;
+    task.count = count;
+    task.element_size = element_size;
+    task.dest_size = dest_size;
+    task.transform = transform;
+    task.ctx = ctx;
+    u32 larger = element_size > dest_size ? element_size : dest_size;
+    task.chunk_elements = parallel_chunk_elements(larger);
+    thread_pool_run(pool, parallel_transform_chunk, &task, (count + task.chunk_elements - 1) / task.chunk_elements);
+}
+
+INTERNAL
+void parallel_reduce_chunk(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    void* acc = task->results + (size_t)chunk * task->result_size;
+    u8* element = task->data + (size_t)first * task->element_size;
+    for(u32 i = first; i < end; i++){
+        task->fold(acc, element, task->ctx);
+        element += task->element_size;
+    }
+}
+
+///Folds every element into an accumulator of [acc_size] bytes.
+///Every chunk starts its own accumulator as a copy of [identity] and folds its elements in with [fold].
+///The chunk accumulators are then merged into [result], in chunk order, with [combine].
+///Returns false if the accumulators could not be allocated.
+PUBLIC
+RECEIVER(pool)
+bool parallel_reduce(
+    thread_pool* pool,
+    void* data, u32 count, u32 element_size,
+    void* identity, u32 acc_size,
+    void (*fold)(void* acc, void* element, void* ctx),
+    void (*combine)(void* acc, void* other, void* ctx),
+    void* ctx, OUT void* result
+){
+    parallel_task task = { 0 };
+    task.data = (u8*)data;
+    task.count = count;
+    task.element_size = element_size;
+    task.fold = fold;
+    task.ctx = ctx;
+    task.result_size = acc_size;
+    task.chunk_elements = parallel_chunk_elements(element_size);
+    u32 chunks = (count + task.chunk_elements - 1) / task.chunk_elements;
+    memcpy(result, identity, acc_size);
+    if(chunks == 0){
+        return true;
+    }
+    task.results = (u8*)malloc((size_t)chunks * acc_size);
+    if(task.results == NULL){
+        printf("Could not allocate %i reduce accumulators\n", chunks);
+        return false;
+    }
+    for(u32 i = 0; i < chunks; i++){
+        memcpy(task.results + (size_t)i * acc_size, identity, acc_size);
+    }
+    thread_pool_run(pool, parallel_reduce_chunk, &task, chunks);
+    for(u32 i = 0; i < chunks; i++){
+        combine(result, task.results + (size_t)i * acc_size, ctx);
+    }
+    free(task.results);
+    return true;
+}
+
+INTERNAL
+void parallel_filter_mark(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    u32 kept = 0;
+    u8* element = task->data + (size_t)first * task->element_size;
+    for(u32 i = first; i < end; i++){
+        bool keep = task->pred(element, task->ctx);
+        task->keep[i] = keep;
+        kept += keep;
+        element += task->element_size;
+    }
+    ((u32*)task->results)[chunk] = kept;
+}
+
+INTERNAL
+void parallel_filter_copy(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    ///By now results holds where each chunk starts writing
+    u8* out = task->dest + (size_t)((u32*)task->results)[chunk] * task->element_size;
+    u8* element = task->data + (size_t)first * task->element_size;
+    for(u32 i = first; i < end; i++){
+        if(task->keep[i]){
+            vector_copy_element(out, element, task->element_size);
+            out += task->element_size;
+        }
+        element += task->element_size;
+    }
+}
+
+///Copies every element that [pred] returns true for into [dest], keeping their order.
+///[dest] must have room for [count] elements and must not overlap [data].
+///[pred] is called exactly once per element.
+///Returns the number of elements copied, or -1 if scratch space could not be allocated.
+PUBLIC
+RECEIVER(pool)
+i64 parallel_filter(
+    thread_pool* pool,
+    void* data, u32 count, u32 element_size,
+    bool (*pred)(void* element, void* ctx), void* ctx,
+    OUT void* dest
+){
+    parallel_task task = { 0 };
+    task.data = (u8*)data;
+    task.dest = (u8*)dest;
+    task.count = count;
+    task.element_size = element_size;
+    task.pred = pred;
+    task.ctx = ctx;
+    task.chunk_elements = parallel_chunk_elements(element_size);
+    u32 chunks = (count + task.chunk_elements - 1) / task.chunk_elements;
+    if(chunks == 0){
+        return 0;
+    }
+    task.keep = (u8*)malloc(count);
+    task.results = (u8*)malloc((size_t)chunks * sizeof(u32));
+    if(task.keep == NULL || task.results == NULL){
+        printf("Could not allocate scratch space to filter %i elements\n", count);
+        free(task.keep);
+        free(task.results);
+        return -1;
+    }
+    thread_pool_run(pool, parallel_filter_mark, &task, chunks);
+    ///Turn the per chunk counts into the offset each chunk writes to
+    u32* offsets = (u32*)task.results;
+    u32 total = 0;
+    for(u32 i = 0; i < chunks; i++){
+        u32 kept = offsets[i];
+        offsets[i] = total;
+        total += kept;
+    }
+    thread_pool_run(pool, parallel_filter_copy, &task, chunks);
+    free(task.keep);
+    free(task.results);
+    return total;
+}
+
+INTERNAL
+void parallel_find_chunk(void* ctx, u32 chunk){
+    parallel_task* task = (parallel_task*)ctx;
+    u32 first, end;
+    parallel_chunk_range(task, chunk, &first, &end);
+    ///Chunks are handed out in order, so once something is found before this chunk there's nothing to do
+    i64 found = atomic_load_explicit(&task->found, memory_order_relaxed);
+    if(found >= 0 && found < first){
+        return;
+    }
+    u8* element = task->data + (size_t)first * task->element_size;
+    for(u32 i = first; i < end; i++){
+        if(task->pred(element, task->ctx)){
+            found = atomic_load_explicit(&task->found, memory_order_relaxed);
+            while((found < 0 || i < found) && !atomic_compare_exchange_weak_explicit(&task->found, &found, i, memory_order_relaxed, memory_order_relaxed)){
+            }
+            return;
+        }
+        element += task->element_size;
+    }
+}
+
+///Gets the index of the first element that [pred] returns true for, or -1 if there is none.
+///Chunks after one that already found a match are skipped.
+PUBLIC
+RECEIVER(pool)
+i64 parallel_find_first(
+    thread_pool* pool,
+    void* data, u32 count, u32 element_size,
+    bool (*pred)(void* element, void* ctx), void* ctx
+){
+    parallel_task task = { 0 };
+    task.data = (u8*)data;
+    task.count = count;
+    task.element_size = element_size;
+    task.pred = pred;
+    task.ctx = ctx;
+    atomic_init(&task.found, -1);
+    ///Smaller chunks so that an early match stops the search sooner
+    task.chunk_elements = parallel_chunk_elements(element_size) / 4;
+    if(task.chunk_elements == 0){
+        task.chunk_elements = 1;
+    }
+    thread_pool_run(pool, parallel_find_chunk, &task, (count + task.chunk_elements - 1) / task.chunk_elements);
+    return atomic_load(&task.found);
+}
+
+///Gathers a pointer to every entry the list iterator can see into a heap vector of list_entry*.
+///The vector must be passed into vector_deinit when you're done with it.
+PUBLIC
+RECEIVER(_list)
+vector parallel_gather_list(list* _list){
+    vector entries = create_vector(NULL, sizeof(list_entry*), _list->element_count);
+    list_iter iter = create_list_iter(_list);
+    list_entry* next = list_iter_next(&iter);
+    while(next != NULL){
+        vector_push(&entries, &next);
+        next = list_iter_next(&iter);
+    }
+    return entries;
+}
+
+///The user's comparison for parallel_list_sort, which is given entry data rather than the entry pointers being sorted
+INTERNAL
+struct parallel_list_order{
+    int (*cmp)(const void*, const void*, void*);
+    void* ctx;
+};
+typedef struct parallel_list_order parallel_list_order;
+
+INTERNAL
+int parallel_list_entry_cmp(const void* left, const void* right, void* ctx){
+    parallel_list_order* order = (parallel_list_order*)ctx;
+    return order->cmp((*(list_entry* const*)left)->data, (*(list_entry* const*)right)->data, order->ctx);
+}
+
+///Sorts the list in place by relinking its entries in the order [cmp] gives their data.
+///No element is copied, only pointers to the entries are sorted.
+PUBLIC
+RECEIVER(_list)
+bool parallel_list_sort(
+    thread_pool* pool, list* _list,
+    int (*cmp)(const void* left, const void* right, void* ctx), void* ctx
+){
+    vector entries = parallel_gather_list(_list);
+    if(entries.count < 2){
+        vector_deinit(&entries);
+        return true;
+    }
+    parallel_list_order order = { cmp, ctx };
+    bool sorted = parallel_sort(pool, entries.data, entries.count, sizeof(list_entry*), parallel_list_entry_cmp, &order);
+    if(sorted){
+        list_entry** sorted_entries = (list_entry**)entries.data;
+        for(u32 i = 0; i + 1 < entries.count; i++){
+            sorted_entries[i]->next = sorted_entries[i + 1];
+        }
+        sorted_entries[entries.count - 1]->next = NULL;
+        _list->first_element = sorted_entries[0];
+        _list->last_element = sorted_entries[entries.count - 1];
+    }
+    vector_deinit(&entries);
+    return sorted;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "commons.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+    The cpu's own counts of what a piece of code did, to tell why it's slow and not just that it is.
+
+    perf_counters_open asks the kernel, through perf_event_open, to count cycles, instructions, cache misses,
+    branch misses and dTLB read misses for the calling thread, in user space only. Each counter is opened on its
+    own, so one the cpu or the VM doesn't have leaves the rest working, and if none can be opened the counters
+    are just empty: every read succeeds with nothing in it and perf_counters_has says which ones are real.
+    Most VMs don't pass the counters through at all, and a perf_event_paranoid over 2 turns them off too.
+
+    The counters run from the moment they're opened. perf_counters_read takes a sample of all of them, and the
+    counts for a region are the difference of a sample before it and a sample after it:
+
+    perf_sample before, after;
+    perf_counters_read(&counters, &before);
+    ...region...
+    perf_counters_read(&counters, &after);
+    perf_sample counts = perf_sample_delta(&after, &before);
+
+    When there are more counters than the cpu has registers for, the kernel takes turns between them, and each is
+    scaled up by how long it was really counting. Those counts are estimates, but the ratios between them hold.
+    NOTE: A read is a system call per counter, about a microsecond for all of them, so measure regions long
+    enough for that not to matter, or subtract what an empty region reads.
+    NOTE: Counters only count the thread that opened them.
+*/
+
+PUBLIC
+enum perf_counter_kind{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    ///Last level cache misses, as the cpu defines them
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    ///Data TLB misses on reads
+    PERF_DTLB_MISSES,
+    PERF_COUNTER_COUNT,
+};
+typedef enum perf_counter_kind perf_counter_kind;
+
+PUBLIC
+struct perf_counters{
+    ///One per counter, or -1 if it couldn't be opened
+    INTERNAL
+    int fds[PERF_COUNTER_COUNT];
+    ///Why each one couldn't be opened, as an errno, or 0 if it was
+    int errors[PERF_COUNTER_COUNT];
+    ///How many were opened
+    u32 available;
+};
+typedef struct perf_counters perf_counters;
+
+///What every counter had counted at one moment, or the difference between two of those.
+///Counters that aren't open are always 0.
+PUBLIC
+struct perf_sample{
+    u64 values[PERF_COUNTER_COUNT];
+};
+typedef struct perf_sample perf_sample;
+
+///Whether the unavailable counters have been explained already, so it's only printed once per process
+INTERNAL
+_Atomic bool perf_counters_explained = false;
+
+///The counter's name, as a JSON key and a column heading
+PUBLIC
+str perf_counter_name(perf_counter_kind kind){
+    switch(kind){
+        case PERF_CYCLES: return "cycles";
+        case PERF_INSTRUCTIONS: return "instructions";
+        case PERF_CACHE_MISSES: return "cache_misses";
+        case PERF_BRANCH_MISSES: return "branch_misses";
+        case PERF_DTLB_MISSES: return "dtlb_misses";
+        default: return "unknown";
+    }
+}
+
+HELPER
+void perf_counter_attr(perf_counter_kind kind, OUT struct perf_event_attr* attr){
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    switch(kind){
+        case PERF_CYCLES: attr->config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PERF_INSTRUCTIONS: attr->config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PERF_CACHE_MISSES: attr->config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case PERF_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case PERF_DTLB_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default: break;
+    }
+    ///User space only, which is all perf_event_paranoid 2 allows, and all that's wanted anyway
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+///Opens every counter it can for the calling thread. Returns false if none could be opened, which isn't an error:
+///the counters still work, they're just empty. The first time none or only some open, why is printed.
+PUBLIC
+bool perf_counters_open(OUT perf_counters* counters){
+    counters->available = 0;
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        struct perf_event_attr attr;
+        perf_counter_attr((perf_counter_kind)kind, &attr);
+        counters->fds[kind] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        counters->errors[kind] = counters->fds[kind] < 0 ? errno : 0;
+        counters->available += counters->fds[kind] >= 0;
+    }
+    if(counters->available < PERF_COUNTER_COUNT && !atomic_exchange_explicit(&perf_counters_explained, true, memory_order_relaxed)){
+        printf("Only %u of %i hardware counters could be opened:", counters->available, PERF_COUNTER_COUNT);
+        for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+            if(counters->fds[kind] < 0){
+                printf(" %s (%s)", perf_counter_name((perf_counter_kind)kind), strerror(counters->errors[kind]));
+            }
+        }
+        printf(". ENOENT means the cpu or the VM doesn't have it, EACCES that /proc/sys/kernel/perf_event_paranoid is too high.\n");
+    }
+    return counters->available > 0;
+}
+
+PUBLIC
+RECEIVER(counters)
+void perf_counters_close(perf_counters* counters){
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        if(counters->fds[kind] >= 0){
+            close(counters->fds[kind]);
+            counters->fds[kind] = -1;
+        }
+    }
+    counters->available = 0;
+}
+
+PUBLIC
+RECEIVER(counters)
+bool perf_counters_has(perf_counters* counters, perf_counter_kind kind){
+    return counters->fds[kind] >= 0;
+}
+
+///Samples every open counter into [sample]. Returns false if none are open, and [sample] is all 0.
+PUBLIC
+RECEIVER(counters)
+bool perf_counters_read(perf_counters* counters, OUT perf_sample* sample){
+    memset(sample, 0, sizeof(*sample));
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        if(counters->fds[kind] < 0){
+            continue;
+        }
+        ///The count, how long it's been open, and how long of that it was really counting
+        u64 read_values[3];
+        if(read(counters->fds[kind], read_values, sizeof(read_values)) != sizeof(read_values) || read_values[2] == 0){
+            continue;
+        }
+        sample->values[kind] = read_values[2] == read_values[1]
+            ? read_values[0]
+            : (u64)((unsigned __int128)read_values[0] * read_values[1] / read_values[2]);
+    }
+    return counters->available > 0;
+}
+
+///The counts from [start] to [end]
+PUBLIC
+perf_sample perf_sample_delta(perf_sample* end, perf_sample* start){
+    perf_sample delta;
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        delta.values[kind] = end->values[kind] > start->values[kind] ? end->values[kind] - start->values[kind] : 0;
+    }
+    return delta;
+}
@@ -0,0 +1,361 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    A lock-free skip list that maps u64 keys to void* values, kept in key order.
+    Any number of threads can insert, look up, remove and scan at the same time without a lock.
+
+    Every node is linked into level 0 and, with probability 1/4 per level, into each level above it,
+    so a lookup skips over most of the list on the way down.
+
+    level 3:  head ------------------------------------------> 40 --------------------------> NULL
+    level 2:  head ----------------> 17 ---------------------> 40 ----------------> 71 -----> NULL
+    level 1:  head ------> 8 ------> 17 ------> 23 ----------> 40 ------> 52 -----> 71 -----> NULL
+    level 0:  head -> 3 -> 8 -> 11 -> 17 -> 20 -> 23 -> 31 -> 40 -> 44 -> 52 -> 60 -> 71 -> NULL
+
+    Removal first marks the low bit of each of a node's next pointers, top level down. The node is
+    logically gone once level 0 is marked, and whoever walks past a marked node next snips it out.
+
+    Nodes come out of a pool reserved from an arena_alloc when the skip list is created, handed out by
+    an atomic bump, so allocation is lock-free too. Removed nodes are never reused, which means a reader
+    can never see a node change under it, but also that the pool only ever fills up.
+    Size the pool for every insert the skip list will see over its lifetime, not just for the live keys.
+*/
+
+///The most levels a node can have. With p = 1/4 this is plenty for 4 billion keys.
+#define SKIPLIST_MAX_LEVEL 16
+
+typedef struct skiplist_node skiplist_node;
+INTERNAL
+struct skiplist_node{
+    u64 key;
+    _Atomic(void*) value;
+    u32 level_count;
+    ///The next node at every level this node is in. The low bit marks this node as removed at that level.
+    _Atomic uintptr_t next[];
+};
+
+PUBLIC
+EXTENSION(arena)
+struct skiplist{
+    ///The first node at every level. Its key is never compared.
+    INTERNAL
+    skiplist_node* head;
+    ///The pool that nodes are bumped out of
+    INTERNAL
+    u8* pool;
+    INTERNAL
+    u32 pool_size;
+    INTERNAL
+    _Atomic u32 pool_used;
+    ///Number of keys currently in the skip list
+    INTERNAL
+    _Atomic u32 count;
+};
+typedef struct skiplist skiplist;
+
+#define SKIPLIST_MARK ((uintptr_t)1)
+
+INTERNAL
+skiplist_node* skiplist_unmark(uintptr_t link){
+    return (skiplist_node*)(link & ~SKIPLIST_MARK);
+}
+
+INTERNAL
+bool skiplist_marked(uintptr_t link){
+    return (link & SKIPLIST_MARK) != 0;
+}
+
+///Bumps a node with [level_count] levels out of the pool. Returns NULL once the pool is used up.
+INTERNAL
+RECEIVER(_skiplist)
+skiplist_node* skiplist_alloc_node(skiplist* _skiplist, u32 level_count){
+    u32 size = sizeof(skiplist_node) + level_count * sizeof(uintptr_t);
+    size = (size + 7) & ~7u;
+    ///Only moves [pool_used] on when the node fits, so failed inserts on a used up pool can't wrap it around into live nodes
+    u32 offset = atomic_load_explicit(&_skiplist->pool_used, memory_order_relaxed);
+    do{
+        if(size > _skiplist->pool_size - offset){
+            return NULL;
+        }
+    }while(!atomic_compare_exchange_weak_explicit(&_skiplist->pool_used, &offset, offset + size, memory_order_relaxed, memory_order_relaxed));
+    skiplist_node* node = (skiplist_node*)(_skiplist->pool + offset);
+    node->level_count = level_count;
+    return node;
+}
+
+///Creates a new skip list in [arena], with a pool of [pool_size] bytes for its nodes.
+///A node with n levels takes 24 + 8n bytes, and nodes average 1.33 levels.
+PUBLIC
+RECEIVER(arena)
+skiplist* create_skiplist(arena_alloc* arena, u32 pool_size){
+    skiplist _skiplist;
+    _skiplist.pool = arena_reserve_aligned(arena, pool_size, 64);
+    if(_skiplist.pool == NULL){
+        return NULL;
+    }
+    _skiplist.pool_size = pool_size;
+    atomic_init(&_skiplist.pool_used, 0);
+    atomic_init(&_skiplist.count, 0);
+    skiplist* ptr = arena_put(arena, &_skiplist, sizeof(skiplist));
+    if(ptr == NULL){
+        return NULL;
+    }
+    ptr->head = skiplist_alloc_node(ptr, SKIPLIST_MAX_LEVEL);
+    if(ptr->head == NULL){
+        printf("Skip list pool of %i bytes is too small to even hold its head\n", pool_size);
+        return NULL;
+    }
+    ptr->head->key = 0;
+    atomic_init(&ptr->head->value, NULL);
+    for(u32 level = 0; level < SKIPLIST_MAX_LEVEL; level++){
+        atomic_init(&ptr->head->next[level], (uintptr_t)0);
+    }
+    return ptr;
+}
+
+///Picks how many levels a new node gets: 1 + the number of times a 1 in 4 chance comes up in a row.
+///Each thread has its own generator so there is nothing shared to contend on.
+INTERNAL
+u32 skiplist_random_level(){
+    static _Thread_local u64 state = 0;
+    if(state == 0){
+        state = ((u64)(uintptr_t)&state * 0x9e3779b97f4a7c15ull) | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    u32 level = 1 + (u32)__builtin_ctzll(state | (1ull << 62)) / 2;
+    return level > SKIPLIST_MAX_LEVEL ? SKIPLIST_MAX_LEVEL : level;
+}
+
+///Finds, at every level, the last node with a key below [key] and the node after it, snipping out
+///every removed node it passes. Returns whether the node after it at level 0 has [key].
+INTERNAL
+RECEIVER(_skiplist)
+bool skiplist_find(skiplist* _skiplist, u64 key, OUT skiplist_node** preds, OUT skiplist_node** succs){
+retry:;
+    skiplist_node* pred = _skiplist->head;
+    skiplist_node* curr = NULL;
+    for(i32 level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--){
+        curr = skiplist_unmark(atomic_load_explicit(&pred->next[level], memory_order_acquire));
+        while(curr != NULL){
+            uintptr_t succ = atomic_load_explicit(&curr->next[level], memory_order_acquire);
+            while(skiplist_marked(succ)){
+                ///curr is being removed, so link pred straight to what comes after it
+                uintptr_t expected = (uintptr_t)curr;
+                if(!atomic_compare_exchange_strong_explicit(
+                    &pred->next[level], &expected, (uintptr_t)skiplist_unmark(succ),
+                    memory_order_acq_rel, memory_order_acquire
+                )){
+                    goto retry;
+                }
+                curr = skiplist_unmark(succ);
+                if(curr == NULL){
+                    break;
+                }
+                succ = atomic_load_explicit(&curr->next[level], memory_order_acquire);
+            }
+            if(curr == NULL || curr->key >= key){
+                break;
+            }
+            pred = curr;
+            curr = skiplist_unmark(succ);
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return curr != NULL && curr->key == key;
+}
+
+///Inserts [key] with [value]. If [key] is already in the skip list, its value is replaced instead.
+///Returns false only if the node pool is used up.
+PUBLIC
+RECEIVER(_skiplist)
+bool skiplist_put(skiplist* _skiplist, u64 key, void* value){
+    skiplist_node* preds[SKIPLIST_MAX_LEVEL];
+    skiplist_node* succs[SKIPLIST_MAX_LEVEL];
+    skiplist_node* node = NULL;
+    u32 level_count = skiplist_random_level();
+    for(;;){
+        if(skiplist_find(_skiplist, key, preds, succs)){
+            atomic_store_explicit(&succs[0]->value, value, memory_order_release);
+            return true;
+        }
+        ///The node is only allocated once, no matter how many times linking it in has to be retried
+        if(node == NULL){
+            node = skiplist_alloc_node(_skiplist, level_count);
+            if(node == NULL){
+                printf("Skip list node pool of %i bytes is used up\n", _skiplist->pool_size);
+                return false;
+            }
+            node->key = key;
+            atomic_init(&node->value, value);
+        }
+        for(u32 level = 0; level < level_count; level++){
+            atomic_init(&node->next[level], (uintptr_t)succs[level]);
+        }
+        ///Level 0 is the one that counts. Once this succeeds the key is in the skip list.
+        uintptr_t expected = (uintptr_t)succs[0];
+        if(atomic_compare_exchange_strong_explicit(
+            &preds[0]->next[0], &expected, (uintptr_t)node,
+            memory_order_acq_rel, memory_order_acquire
+        )){
+            break;
+        }
+    }
+    atomic_fetch_add_explicit(&_skiplist->count, 1, memory_order_relaxed);
+    ///The upper levels are only shortcuts, so link them in one at a time, finding new neighbours when one changes
+    for(u32 level = 1; level < level_count; level++){
+        for(;;){
+            uintptr_t next = atomic_load_explicit(&node->next[level], memory_order_acquire);
+            if(skiplist_marked(next)){
+                ///Someone has started removing this node, so there's no point linking it any higher
+                return true;
+            }
+            if(next != (uintptr_t)succs[level] && !atomic_compare_exchange_strong_explicit(
+                &node->next[level], &next, (uintptr_t)succs[level],
+                memory_order_acq_rel, memory_order_acquire
+            )){
+                return true;
+            }
+            uintptr_t expected = (uintptr_t)succs[level];
+            if(atomic_compare_exchange_strong_explicit(
+                &preds[level]->next[level], &expected, (uintptr_t)node,
+                memory_order_acq_rel, memory_order_acquire
+            )){
+                break;
+            }
+            skiplist_find(_skiplist, key, preds, succs);
+            if(succs[0] != node){
+                ///It was removed while we were linking it
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+///Gets the value for [key], or NULL if it's not in the skip list. This never writes to shared memory.
+PUBLIC
+RECEIVER(_skiplist)
+void* skiplist_get(skiplist* _skiplist, u64 key){
+    skiplist_node* pred = _skiplist->head;
+    skiplist_node* curr = NULL;
+    for(i32 level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--){
+        curr = skiplist_unmark(atomic_load_explicit(&pred->next[level], memory_order_acquire));
+        while(curr != NULL){
+            uintptr_t succ = atomic_load_explicit(&curr->next[level], memory_order_acquire);
+            if(skiplist_marked(succ)){
+                curr = skiplist_unmark(succ);
+                continue;
+            }
+            if(curr->key >= key){
+                break;
+            }
+            pred = curr;
+            curr = skiplist_unmark(succ);
+        }
+    }
+    if(curr == NULL || curr->key != key){
+        return NULL;
+    }
+    return atomic_load_explicit(&curr->value, memory_order_acquire);
+}
+
+///Whether [key] is in the skip list
+PUBLIC
+RECEIVER(_skiplist)
+bool skiplist_contains(skiplist* _skiplist, u64 key){
+    skiplist_node* preds[SKIPLIST_MAX_LEVEL];
+    skiplist_node* succs[SKIPLIST_MAX_LEVEL];
+    return skiplist_find(_skiplist, key, preds, succs);
+}
+
+///Removes [key]. Returns whether this call was the one that removed it.
+PUBLIC
+RECEIVER(_skiplist)
+bool skiplist_remove(skiplist* _skiplist, u64 key){
+    skiplist_node* preds[SKIPLIST_MAX_LEVEL];
+    skiplist_node* succs[SKIPLIST_MAX_LEVEL];
+    if(!skiplist_find(_skiplist, key, preds, succs)){
+        return false;
+    }
+    skiplist_node* node = succs[0];
+    ///Mark the upper levels first, so nobody links anything new after this node on the way down
+    for(u32 level = node->level_count - 1; level >= 1; level--){
+        uintptr_t next = atomic_load_explicit(&node->next[level], memory_order_acquire);
+        while(!skiplist_marked(next)){
+            atomic_compare_exchange_weak_explicit(
+                &node->next[level], &next, next | SKIPLIST_MARK,
+                memory_order_acq_rel, memory_order_acquire
+            );
+        }
+    }
+    uintptr_t next = atomic_load_explicit(&node->next[0], memory_order_acquire);
+    for(;;){
+        if(skiplist_marked(next)){
+            ///Another thread got to level 0 first
+            return false;
+        }
+        if(atomic_compare_exchange_weak_explicit(
+            &node->next[0], &next, next | SKIPLIST_MARK,
+            memory_order_acq_rel, memory_order_acquire
+        )){
+            atomic_fetch_sub_explicit(&_skiplist->count, 1, memory_order_relaxed);
+            ///Walk past it once so it gets snipped out of every level
+            skiplist_find(_skiplist, key, preds, succs);
+            return true;
+        }
+    }
+}
+
+///Calls [visit] with every key in [low, high] and its value, in key order, until [visit] returns false.
+///Keys inserted or removed during the scan may or may not be seen, but every key that is in
+///the skip list for the whole scan will be. Returns the number of keys visited.
+PUBLIC
+RECEIVER(_skiplist)
+u32 skiplist_scan(skiplist* _skiplist, u64 low, u64 high, bool (*visit)(u64 key, void* value, void* ctx), void* ctx){
+    ///Walk down to the first node at or after [low], same as skiplist_get
+    skiplist_node* pred = _skiplist->head;
+    skiplist_node* curr = NULL;
+    for(i32 level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--){
+        curr = skiplist_unmark(atomic_load_explicit(&pred->next[level], memory_order_acquire));
+        while(curr != NULL){
+            uintptr_t succ = atomic_load_explicit(&curr->next[level], memory_order_acquire);
+            if(skiplist_marked(succ)){
+                curr = skiplist_unmark(succ);
+                continue;
+            }
+            if(curr->key >= low){
+                break;
+            }
+            pred = curr;
+            curr = skiplist_unmark(succ);
+        }
+    }
+    u32 visited = 0;
+    while(curr != NULL && curr->key <= high){
+        uintptr_t succ = atomic_load_explicit(&curr->next[0], memory_order_acquire);
+        if(!skiplist_marked(succ)){
+            visited += 1;
+            if(!visit(curr->key, atomic_load_explicit(&curr->value, memory_order_acquire), ctx)){
+                break;
+            }
+        }
+        curr = skiplist_unmark(succ);
+    }
+    return visited;
+}
+
+///Gets the number of keys in the skip list. This is only exact while nobody is changing it.
+PUBLIC
+RECEIVER(_skiplist)
+u32 skiplist_count(skiplist* _skiplist){
+    return atomic_load_explicit(&_skiplist->count, memory_order_relaxed);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "commons.h"
+
 ///A stack allocator is an allocator on the stack. This allocator will allocate 4KB of
 ///stack/temporary memory to be used. This uses the stack's natural semantics to
 ///deallocate automatically when it's finished at the end of its declaring scope.
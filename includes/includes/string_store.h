@@ -2,8 +2,10 @@
 
 #include "commons.h"
 #include "stack.h"
+#include "trace.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 struct string{
     u32 length;
@@ -66,6 +68,7 @@ string* string_store_alloc(string_store* store){
 ///Put the string into the store and do string formatting if necessary.
 ///~alex, 9:20 AM PST, 11/14/2020
 string* string_store_put(string_store* store, str str_data, ...){
+    TRACE_ZONE("string_store_put");
     va_list args;
     va_start(args, str_data);
 
@@ -88,6 +91,7 @@ string* string_store_get(string_store* Store, u32 index){
 }
 
 void varg_string_store_concat_str(string* dest, str src, va_list args){
+    TRACE_ZONE("string_store_concat_str");
     char buffer[1024];
     // str str_data = va_arg(args, str);
     // printf("str_data: %s\n", str_data);
@@ -113,16 +117,16 @@ void string_store_concat_str(string* dest, str src, ...){
     va_end(args);
 }
 
+///Appends [src] to [dest], formatted with everything after it, the same as string_store_concat_str.
+///[src] doesn't have to be terminated, so it's copied into one that is first, cut off at 1023 characters.
 void string_store_concat(string* dest, string* src, ...){
+    TRACE_ZONE("string_store_concat");
     va_list args;
     va_start(args, src);
-
-    char* dest_str = dest->data + dest->length;
-    char* src_str = src->data + src->length;
-    while(src != 0){
-        *dest++ = *src++;
-        dest->length++;
-    }
-    vsprintf(dest_str, dest_str, args);
+    char format[1024];
+    u32 length = src->length < sizeof(format) - 1 ? src->length : sizeof(format) - 1;
+    memcpy(format, src->data, length);
+    format[length] = '\0';
+    varg_string_store_concat_str(dest, format, args);
     va_end(args);
 }
\ No newline at end of file
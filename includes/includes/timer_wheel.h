@@ -0,0 +1,429 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include "ilist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+    A hierarchical timer wheel, for huge numbers of timeouts that are mostly cancelled before they fire.
+    Adding and cancelling a timer are O(1), and so is every tick the wheel advances, however many timers there are.
+
+    Time is counted in ticks of [tick_ns]. The wheel has TIMER_LEVELS levels of 64 slots, and level L
+    slot S holds the timers whose deadline has S as its L-th group of 6 bits, and the same higher bits as now.
+    Which level a timer goes in is the highest group where its deadline and now differ.
+
+    level 2 |  0 |  1 | .. | 63 |      every slot is 4096 ticks
+    level 1 |  0 |  1 | .. | 63 |      every slot is 64 ticks
+    level 0 |  0 |  1 | .. | 63 |      every slot is 1 tick
+               ^ now & 63
+
+    Every slot is an ilist of timers. When now reaches the start of a slot on a higher level, its timers
+    are cascaded down to where they now belong, and when now reaches a slot on level 0, its timers fire.
+    A timer moves down at most once per level, so the cascading costs O(1) per timer over its lifetime.
+    Every level also has a bitmap of which slots have timers, so advancing jumps straight to the next
+    slot that has anything in it instead of stepping through empty ticks one by one.
+
+    The expired timers of a tick are spliced out as a batch and their callbacks run one after the other.
+    A callback may add timers, and cancel any timer, including ones in the same batch that haven't run yet.
+
+    Timers come from a pool: batches of TIMER_BATCH are reserved from the wheel's arena, and a timer goes
+    back on the free list when it fires or is cancelled. A handle carries the generation of the timer
+    it was given for, so cancelling a timer that already fired, even if its memory is in use again, does nothing.
+
+    Time comes from a timer_clock, which is either the monotonic clock or a manual clock that only
+    moves when the caller says so, for tests.
+*/
+
+#define TIMER_LEVELS 11
+#define TIMER_SLOTS 64
+#define TIMER_SLOT_BITS 6
+///How many timers are reserved from the arena at once when the free list is empty
+#define TIMER_BATCH 64
+///How many bytes of timers the wheel's arena grows by
+#define TIMER_BLOCK (1024 * 1024)
+///The level of a timer that is in the batch being expired
+#define TIMER_EXPIRING 0xff
+
+typedef struct timer_wheel timer_wheel;
+
+///What a timer calls when it fires
+typedef void (*timer_fn)(timer_wheel* wheel, void* arg);
+
+///Gets the time in nanoseconds. Only differences between two calls matter.
+typedef u64 (*timer_clock_fn)(void* ctx);
+
+PUBLIC
+struct timer_clock{
+    timer_clock_fn now;
+    void* ctx;
+};
+typedef struct timer_clock timer_clock;
+
+PUBLIC
+struct timer{
+    ///The slot list the timer is in, or the free list
+    INTERNAL
+    ilist_node link;
+    ///The tick the timer fires on
+    INTERNAL
+    u64 deadline;
+    INTERNAL
+    timer_fn fn;
+    INTERNAL
+    void* arg;
+    ///Bumped every time the timer is freed, so old handles to it stop working
+    INTERNAL
+    u32 generation;
+    ///Where the timer is, so cancelling it can clear the slot's bit
+    INTERNAL
+    u8 level;
+    INTERNAL
+    u8 slot;
+};
+typedef struct timer timer;
+
+///What timer_add returns, to cancel the timer with. [node] is NULL if the timer could not be added.
+PUBLIC
+struct timer_handle{
+    timer* node;
+    u32 generation;
+};
+typedef struct timer_handle timer_handle;
+
+PUBLIC
+struct timer_wheel{
+    INTERNAL
+    ilist slots[TIMER_LEVELS][TIMER_SLOTS];
+    ///Which slots of every level have timers in them
+    INTERNAL
+    u64 occupied[TIMER_LEVELS];
+    ///The timers of the tick being expired, which have not run yet
+    INTERNAL
+    ilist expiring;
+    ///The last tick that has been expired
+    INTERNAL
+    u64 now;
+    INTERNAL
+    u64 tick_ns;
+    ///What the clock said at tick 0
+    INTERNAL
+    u64 start_ns;
+    INTERNAL
+    timer_clock clock;
+    ///How many timers are waiting to fire
+    INTERNAL
+    u64 count;
+    ///Where timers come from. More blocks are adopted into it as it fills up.
+    INTERNAL
+    arena_alloc* timers;
+    ///The block new batches of timers are reserved from
+    INTERNAL
+    arena_alloc* timer_block;
+    ///Freed timers, linked through [link.next]
+    INTERNAL
+    timer* free_timers;
+};
+
+HELPER
+u64 timer_clock_monotonic_now(void* ctx){
+    (void)ctx;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+HELPER
+u64 timer_clock_manual_now(void* ctx){
+    return *(u64*)ctx;
+}
+
+///The monotonic clock
+PUBLIC
+timer_clock timer_clock_monotonic(){
+    return (timer_clock){ timer_clock_monotonic_now, NULL };
+}
+
+///A clock that reads whatever is in [now_ns]. Time only passes when the caller changes it.
+///LIFETIME: [now_ns] must outlive the wheel.
+PUBLIC
+timer_clock timer_clock_manual(u64* now_ns){
+    return (timer_clock){ timer_clock_manual_now, now_ns };
+}
+
+///Creates a wheel that counts time in ticks of [tick_ns] from [clock], starting now.
+///Deadlines are rounded up to whole ticks, so [tick_ns] is also how late a timer can fire.
+PUBLIC
+timer_wheel* timer_wheel_init(u64 tick_ns, timer_clock clock){
+    if(tick_ns == 0){
+        printf("A timer wheel's tick can't be 0 ns\n");
+        return NULL;
+    }
+    timer_wheel* wheel = malloc(sizeof(timer_wheel));
+    if(wheel == NULL){
+        return NULL;
+    }
+    wheel->timers = arena_init(TIMER_BLOCK);
+    if(wheel->timers == NULL){
+        free(wheel);
+        return NULL;
+    }
+    wheel->timer_block = wheel->timers;
+    wheel->free_timers = NULL;
+    for(u32 level = 0; level < TIMER_LEVELS; level++){
+        for(u32 slot = 0; slot < TIMER_SLOTS; slot++){
+            ilist_init(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    ilist_init(&wheel->expiring);
+    wheel->now = 0;
+    wheel->count = 0;
+    wheel->tick_ns = tick_ns;
+    wheel->clock = clock;
+    wheel->start_ns = clock.now(clock.ctx);
+    return wheel;
+}
+
+///Frees the wheel and every timer in it, without running them
+PUBLIC
+RECEIVER(wheel)
+void timer_wheel_deinit(timer_wheel* wheel){
+    arena_deinit(wheel->timers);
+    free(wheel);
+}
+
+///How many timers are waiting to fire
+PUBLIC
+RECEIVER(wheel)
+u64 timer_wheel_count(timer_wheel* wheel){
+    return wheel->count;
+}
+
+///The tick the clock is at now
+PUBLIC
+RECEIVER(wheel)
+u64 timer_wheel_clock_tick(timer_wheel* wheel){
+    return (wheel->clock.now(wheel->clock.ctx) - wheel->start_ns) / wheel->tick_ns;
+}
+
+///Gets a free timer. When there are none, a batch of TIMER_BATCH timers is reserved from the wheel's
+///arena in one go and threaded onto the free list, starting a new block when the current one is full.
+INTERNAL
+RECEIVER(wheel)
+timer* timer_alloc(timer_wheel* wheel){
+    if(wheel->free_timers == NULL){
+        u32 batch_size = sizeof(timer) * TIMER_BATCH + _Alignof(timer) - 1;
+        if(wheel->timer_block->size - wheel->timer_block->capacity < batch_size){
+            arena_alloc* block = arena_init(TIMER_BLOCK);
+            if(block == NULL){
+                return NULL;
+            }
+            arena_adopt(wheel->timers, block);
+            wheel->timer_block = block;
+        }
+        timer* batch = arena_reserve_aligned(wheel->timer_block, sizeof(timer) * TIMER_BATCH, _Alignof(timer));
+        for(u32 i = TIMER_BATCH; i-- > 0;){
+            batch[i].generation = 0;
+            batch[i].link.next = (ilist_node*)wheel->free_timers;
+            wheel->free_timers = &batch[i];
+        }
+    }
+    timer* node = wheel->free_timers;
+    wheel->free_timers = (timer*)node->link.next;
+    return node;
+}
+
+INTERNAL
+RECEIVER(wheel)
+void timer_free(timer_wheel* wheel, timer* node){
+    node->generation += 1;
+    node->link.next = (ilist_node*)wheel->free_timers;
+    wheel->free_timers = node;
+}
+
+///Puts [node] in the slot its deadline belongs in, relative to now, or in the batch being expired if it's due
+INTERNAL
+RECEIVER(wheel)
+void timer_place(timer_wheel* wheel, timer* node){
+    if(node->deadline <= wheel->now){
+        node->level = TIMER_EXPIRING;
+        ilist_push_back(&wheel->expiring, &node->link);
+        return;
+    }
+    u32 level = (63 - __builtin_clzll(node->deadline ^ wheel->now)) / TIMER_SLOT_BITS;
+    u32 slot = (node->deadline >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+    node->level = level;
+    node->slot = slot;
+    ilist_push_back(&wheel->slots[level][slot], &node->link);
+    wheel->occupied[level] |= 1ull << slot;
+}
+
+///Adds a timer that calls [fn] with [arg] once the tick [deadline] has passed.
+///A deadline that has already been expired fires on the next tick.
+PUBLIC
+RECEIVER(wheel)
+timer_handle timer_add_at(timer_wheel* wheel, u64 deadline, timer_fn fn, void* arg){
+    timer* node = timer_alloc(wheel);
+    if(node == NULL){
+        printf("Could not get memory for a timer\n");
+        return (timer_handle){ NULL, 0 };
+    }
+    node->deadline = deadline > wheel->now ? deadline : wheel->now + 1;
+    node->fn = fn;
+    node->arg = arg;
+    timer_place(wheel, node);
+    wheel->count += 1;
+    return (timer_handle){ node, node->generation };
+}
+
+///Adds a timer that calls [fn] with [arg] once [delay_ns] have passed on the wheel's clock
+PUBLIC
+RECEIVER(wheel)
+timer_handle timer_add(timer_wheel* wheel, u64 delay_ns, timer_fn fn, void* arg){
+    u64 elapsed = wheel->clock.now(wheel->clock.ctx) - wheel->start_ns;
+    return timer_add_at(wheel, (elapsed + delay_ns + wheel->tick_ns - 1) / wheel->tick_ns, fn, arg);
+}
+
+///Whether [handle]'s timer has yet to fire and hasn't been cancelled
+PUBLIC
+RECEIVER(wheel)
+bool timer_pending(timer_wheel* wheel, timer_handle handle){
+    (void)wheel;
+    return handle.node != NULL && handle.node->generation == handle.generation;
+}
+
+///Cancels [handle]'s timer. Returns false if it already fired or was cancelled.
+PUBLIC
+RECEIVER(wheel)
+bool timer_cancel(timer_wheel* wheel, timer_handle handle){
+    if(!timer_pending(wheel, handle)){
+        return false;
+    }
+    timer* node = handle.node;
+    ilist_unlink(&node->link);
+    if(node->level != TIMER_EXPIRING && ilist_empty(&wheel->slots[node->level][node->slot])){
+        wheel->occupied[node->level] &= ~(1ull << node->slot);
+    }
+    wheel->count -= 1;
+    timer_free(wheel, node);
+    return true;
+}
+
+///Moves every timer out of a slot that now has been reached, into the slot it belongs in now
+INTERNAL
+RECEIVER(wheel)
+void timer_cascade(timer_wheel* wheel, u32 level, u32 slot){
+    ilist pending;
+    ilist_init(&pending);
+    ilist_splice_back(&pending, &wheel->slots[level][slot]);
+    wheel->occupied[level] &= ~(1ull << slot);
+    ilist_node* node;
+    while((node = ilist_pop_front(&pending)) != NULL){
+        ///The timers are scattered all over the pool, so fetch the next one while this one is placed
+        __builtin_prefetch(pending.head.next->next);
+        timer_place(wheel, ILIST_CONTAINER(node, timer, link));
+    }
+}
+
+///Runs every timer in the batch being expired. Returns how many ran.
+INTERNAL
+RECEIVER(wheel)
+u64 timer_run_expiring(timer_wheel* wheel){
+    u64 fired = 0;
+    ilist_node* node;
+    while((node = ilist_pop_front(&wheel->expiring)) != NULL){
+        timer* expired = ILIST_CONTAINER(node, timer, link);
+        __builtin_prefetch(wheel->expiring.head.next->next);
+        timer_fn fn = expired->fn;
+        void* arg = expired->arg;
+        wheel->count -= 1;
+        ///Freed before it runs, so the callback can reuse it by adding a timer
+        timer_free(wheel, expired);
+        fn(wheel, arg);
+        fired += 1;
+    }
+    return fired;
+}
+
+///The next tick after now where a slot has timers in it, or UINT64_MAX if the wheel is empty
+INTERNAL
+RECEIVER(wheel)
+u64 timer_next_event(timer_wheel* wheel){
+    u64 next = UINT64_MAX;
+    for(u32 level = 0; level < TIMER_LEVELS; level++){
+        if(wheel->occupied[level] == 0){
+            continue;
+        }
+        ///Everything on a level comes after now's slot on it, so the lowest set bit is the next one reached
+        u32 shift = level * TIMER_SLOT_BITS;
+        u64 slot = (u64)__builtin_ctzll(wheel->occupied[level]);
+        u64 above = shift + TIMER_SLOT_BITS >= 64 ? 0 : (wheel->now >> (shift + TIMER_SLOT_BITS)) << (shift + TIMER_SLOT_BITS);
+        u64 tick = above | (slot << shift);
+        if(tick < next){
+            next = tick;
+        }
+    }
+    return next;
+}
+
+///Expires everything up to and including [tick], running the callbacks of every timer that's due, a tick's batch at a time.
+///Ticks that have no timers are skipped without looking at them. Returns how many timers fired.
+PUBLIC
+RECEIVER(wheel)
+u64 timer_advance_to(timer_wheel* wheel, u64 tick){
+    u64 fired = timer_run_expiring(wheel);
+    while(wheel->now < tick){
+        u64 next = timer_next_event(wheel);
+        if(next > tick){
+            wheel->now = tick;
+            break;
+        }
+        wheel->now = next;
+        ///Higher levels first, so a timer can cascade more than one level down in the same tick
+        for(u32 level = TIMER_LEVELS; level-- > 1;){
+            u32 shift = level * TIMER_SLOT_BITS;
+            if((wheel->now & ((1ull << shift) - 1)) != 0){
+                continue;
+            }
+            u32 slot = (wheel->now >> shift) & (TIMER_SLOTS - 1);
+            if(wheel->occupied[level] & (1ull << slot)){
+                timer_cascade(wheel, level, slot);
+            }
+        }
+        u32 slot = wheel->now & (TIMER_SLOTS - 1);
+        if(wheel->occupied[0] & (1ull << slot)){
+            ilist_splice_back(&wheel->expiring, &wheel->slots[0][slot]);
+            wheel->occupied[0] &= ~(1ull << slot);
+        }
+        fired += timer_run_expiring(wheel);
+    }
+    return fired;
+}
+
+///Expires everything up to what the clock says now. Call this every tick, or whenever timer_wheel_next_deadline says to.
+PUBLIC
+RECEIVER(wheel)
+u64 timer_advance(timer_wheel* wheel){
+    return timer_advance_to(wheel, timer_wheel_clock_tick(wheel));
+}
+
+///How many ns from now until the earliest timer might be due, to sleep that long,
+///or UINT64_MAX if there are no timers. Timers on a higher level count as due when they cascade,
+///so this can be early, but never late.
+PUBLIC
+RECEIVER(wheel)
+u64 timer_wheel_next_deadline(timer_wheel* wheel){
+    if(!ilist_empty(&wheel->expiring)){
+        return 0;
+    }
+    u64 next = timer_next_event(wheel);
+    if(next == UINT64_MAX){
+        return UINT64_MAX;
+    }
+    u64 at = next * wheel->tick_ns;
+    u64 elapsed = wheel->clock.now(wheel->clock.ctx) - wheel->start_ns;
+    return at > elapsed ? at - elapsed : 0;
+}
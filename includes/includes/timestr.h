@@ -1,16 +1,10 @@
 #pragma once
 
 #include "string_store.h"
-#include <time.h>
+#include "clock.h"
 
+///Gets the time now as text, like "Mon Oct 19 12:00:01 2026", from the coarse clock.
+///LIFETIME: The text belongs to the calling thread and changes on its next call. See clock_date_string.
 str get_now_time_string(){
-    time_t rawtime;
-    struct tm* timeinfo;
-
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    str time_str = asctime(timeinfo);
-    u32 time_len = string_length(time_str);
-    time_str[time_len-1] = 0;
-    return time_str;
-}
\ No newline at end of file
+    return clock_date_string(clock_coarse_real_ns(), 0);
+}
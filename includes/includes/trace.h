@@ -0,0 +1,317 @@
+#pragma once
+
+#include "commons.h"
+
+/*
+    Scoped timing zones for finding where the time goes in hot code, with a trace Perfetto and chrome://tracing can open.
+
+    TRACE_ZONE declares a local that reads the TSC, and reads it again when the enclosing scope is left, however it's
+    left, through the cleanup attribute. The pair goes into the calling thread's ring as one event. Rings are per thread,
+    so recording takes no lock and no atomic read-modify-write, and each keeps the last TRACE_RING_EVENTS events,
+    writing over the oldest.
+
+    void* map_get(...){
+        TRACE_ZONE("map_get");                  |------------- map_get -------------|
+        ...                                        |-- arena_put --|
+    }
+
+    TRACE_ZONE_ARG adds one named integer to the zone, like a size or a count. TRACE_INSTANT marks a single moment.
+    TRACE_ZONE_COUNTERS also reads the thread's hardware counters (see perf_counters.h) at both ends, and records what
+    each counted as a counter event at the end of the zone, which shows as a graph under the zone's name. Reading them
+    is a system call per counter, so it's for zones that take microseconds, not for the containers' hot paths.
+    Where there are no counters, it's a plain TRACE_ZONE.
+    trace_dump writes every ring as Chrome trace event JSON, one complete ("X") event per zone.
+
+    Everything here is only compiled with TRACING defined. Without it, every macro is empty, none of their arguments
+    are evaluated, and this header includes nothing, so the containers and allocators can be instrumented for free.
+    LIFETIME: Names are kept as pointers until the dump, so they have to be string literals.
+*/
+
+#ifdef TRACING
+
+#include "clock.h"
+#include "perf_counters.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+///How many events each thread's ring keeps. A power of two.
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 65536
+#endif
+
+PUBLIC
+enum trace_event_kind{
+    TRACE_EVENT_ZONE,
+    TRACE_EVENT_INSTANT,
+    ///What one counter counted over a zone, as [arg], with the counter's name as [arg_name]
+    TRACE_EVENT_COUNTER,
+};
+typedef enum trace_event_kind trace_event_kind;
+
+PUBLIC
+struct trace_event{
+    str name;
+    ///The name of the zone's integer, or NULL if it has none
+    str arg_name;
+    i64 arg;
+    ///clock_tsc at the start and the end of the zone. The same for an instant.
+    u64 start;
+    u64 end;
+    trace_event_kind kind;
+};
+typedef struct trace_event trace_event;
+
+INTERNAL
+struct trace_ring{
+    ///The thread's id as the kernel knows it, which is what the trace shows
+    u32 tid;
+    ///How many events have ever been written. Only its thread writes this.
+    _Atomic u64 written;
+    ///The ring of the thread that started tracing before this one
+    struct trace_ring* next;
+    trace_event events[TRACE_RING_EVENTS];
+};
+typedef struct trace_ring trace_ring;
+
+///Every thread's ring, newest first. Rings outlive their threads, so their events are still in the dump.
+INTERNAL
+_Atomic(trace_ring*) trace_rings = NULL;
+INTERNAL
+_Thread_local trace_ring* trace_thread_ring = NULL;
+
+///Gets this thread's ring, making it the first time. Returns NULL if there's no memory for it.
+INTERNAL
+trace_ring* trace_this_ring(){
+    trace_ring* ring = trace_thread_ring;
+    if(ring != NULL){
+        return ring;
+    }
+    ring = malloc(sizeof(trace_ring));
+    if(ring == NULL){
+        return NULL;
+    }
+    ring->tid = (u32)syscall(SYS_gettid);
+    atomic_init(&ring->written, 0);
+    ring->next = atomic_load_explicit(&trace_rings, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(&trace_rings, &ring->next, ring, memory_order_release, memory_order_relaxed)){
+    }
+    trace_thread_ring = ring;
+    return ring;
+}
+
+INTERNAL
+void trace_record(trace_event* event){
+    trace_ring* ring = trace_this_ring();
+    if(ring == NULL){
+        return;
+    }
+    u64 written = atomic_load_explicit(&ring->written, memory_order_relaxed);
+    ring->events[written & (TRACE_RING_EVENTS - 1)] = *event;
+    atomic_store_explicit(&ring->written, written + 1, memory_order_release);
+}
+
+///A zone that has started. TRACE_ZONE makes these.
+PUBLIC
+struct trace_zone{
+    str name;
+    str arg_name;
+    i64 arg;
+    u64 start;
+};
+typedef struct trace_zone trace_zone;
+
+PUBLIC
+trace_zone trace_zone_begin(str name, str arg_name, i64 arg){
+    return (trace_zone){ name, arg_name, arg, clock_tsc() };
+}
+
+///Ends [zone] and records it. The cleanup attribute calls this when a TRACE_ZONE goes out of scope.
+PUBLIC
+void trace_zone_end(trace_zone* zone){
+    trace_event event = { zone->name, zone->arg_name, zone->arg, zone->start, clock_tsc(), TRACE_EVENT_ZONE };
+    trace_record(&event);
+}
+
+PUBLIC
+void trace_instant(str name, str arg_name, i64 arg){
+    u64 now = clock_tsc();
+    trace_event event = { name, arg_name, arg, now, now, TRACE_EVENT_INSTANT };
+    trace_record(&event);
+}
+
+///A zone that has started, with the thread's counters as they were when it did. TRACE_ZONE_COUNTERS makes these.
+PUBLIC
+struct trace_counted_zone{
+    trace_zone zone;
+    perf_sample start;
+};
+typedef struct trace_counted_zone trace_counted_zone;
+
+INTERNAL
+pthread_key_t trace_counters_key;
+INTERNAL
+pthread_once_t trace_counters_once = PTHREAD_ONCE_INIT;
+///This thread's counters, or NULL before its first counted zone
+INTERNAL
+_Thread_local perf_counters* trace_thread_counters = NULL;
+
+HELPER
+void trace_close_counters(void* counters){
+    perf_counters_close(counters);
+    free(counters);
+}
+
+HELPER
+void trace_make_counters_key(){
+    pthread_key_create(&trace_counters_key, trace_close_counters);
+}
+
+///Gets this thread's counters, opening them the first time. They're closed when the thread exits.
+///Returns NULL if there's no memory for them. Counters that can't be opened are just empty.
+INTERNAL
+perf_counters* trace_this_counters(){
+    perf_counters* counters = trace_thread_counters;
+    if(counters != NULL){
+        return counters;
+    }
+    counters = malloc(sizeof(perf_counters));
+    if(counters == NULL){
+        return NULL;
+    }
+    perf_counters_open(counters);
+    pthread_once(&trace_counters_once, trace_make_counters_key);
+    pthread_setspecific(trace_counters_key, counters);
+    trace_thread_counters = counters;
+    return counters;
+}
+
+PUBLIC
+trace_counted_zone trace_counted_zone_begin(str name){
+    trace_counted_zone zone;
+    perf_counters* counters = trace_this_counters();
+    if(counters != NULL){
+        perf_counters_read(counters, &zone.start);
+    }
+    ///Started after the counters are read, so the zone doesn't include reading them
+    zone.zone = trace_zone_begin(name, NULL, 0);
+    return zone;
+}
+
+///Ends [zone] and records it, then one counter event for each counter that's open.
+///The cleanup attribute calls this when a TRACE_ZONE_COUNTERS goes out of scope.
+PUBLIC
+void trace_counted_zone_end(trace_counted_zone* zone){
+    u64 end = clock_tsc();
+    perf_counters* counters = trace_thread_counters;
+    perf_sample now;
+    bool counted = counters != NULL && perf_counters_read(counters, &now);
+    trace_event event = { zone->zone.name, NULL, 0, zone->zone.start, end, TRACE_EVENT_ZONE };
+    trace_record(&event);
+    if(!counted){
+        return;
+    }
+    perf_sample counts = perf_sample_delta(&now, &zone->start);
+    for(u32 kind = 0; kind < PERF_COUNTER_COUNT; kind++){
+        if(perf_counters_has(counters, (perf_counter_kind)kind)){
+            trace_event counter = { zone->zone.name, perf_counter_name((perf_counter_kind)kind), (i64)counts.values[kind], end, end, TRACE_EVENT_COUNTER };
+            trace_record(&counter);
+        }
+    }
+}
+
+#define TRACE_JOIN(a, b) TRACE_JOIN_AT(a, b)
+#define TRACE_JOIN_AT(a, b) a##b
+///Times from here to the end of the enclosing scope as a zone called [name]
+#define TRACE_ZONE(name) \
+    trace_zone TRACE_JOIN(trace_zone_at_, __COUNTER__) __attribute__((cleanup(trace_zone_end))) = trace_zone_begin(name, NULL, 0)
+///TRACE_ZONE, with [value] shown as [arg_name] on the zone
+#define TRACE_ZONE_ARG(name, arg_name, value) \
+    trace_zone TRACE_JOIN(trace_zone_at_, __COUNTER__) __attribute__((cleanup(trace_zone_end))) = trace_zone_begin(name, arg_name, (i64)(value))
+///TRACE_ZONE, with what the thread's hardware counters counted over it
+#define TRACE_ZONE_COUNTERS(name) \
+    trace_counted_zone TRACE_JOIN(trace_zone_at_, __COUNTER__) __attribute__((cleanup(trace_counted_zone_end))) = trace_counted_zone_begin(name)
+#define TRACE_INSTANT(name) trace_instant(name, NULL, 0)
+#define TRACE_INSTANT_ARG(name, arg_name, value) trace_instant(name, arg_name, (i64)(value))
+
+///Writes [text] as a JSON string, quotes and all
+HELPER
+void trace_write_string(FILE* out, str text){
+    fputc('"', out);
+    for(; *text != 0; text++){
+        if(*text == '"' || *text == '\\'){
+            fputc('\\', out);
+            fputc(*text, out);
+        }else if((u8)*text < 0x20){
+            fprintf(out, "\\u%04x", (u8)*text);
+        }else{
+            fputc(*text, out);
+        }
+    }
+    fputc('"', out);
+}
+
+///Writes every thread's events to [path] as Chrome trace event JSON. Returns false if the file can't be written.
+///Timestamps are CLOCK_MONOTONIC in microseconds, with the nanoseconds after the point.
+///NOTE: Events a thread records while this runs may be cut in half in the dump, so stop tracing threads first if that matters.
+PUBLIC
+bool trace_dump(str path){
+    FILE* out = fopen(path, "w");
+    if(out == NULL){
+        printf("Could not open %s to dump the trace into\n", path);
+        return false;
+    }
+    u32 pid = (u32)getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    for(trace_ring* ring = atomic_load_explicit(&trace_rings, memory_order_acquire); ring != NULL; ring = ring->next){
+        u64 written = atomic_load_explicit(&ring->written, memory_order_acquire);
+        u64 oldest = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+        for(u64 i = oldest; i < written; i++){
+            trace_event* event = &ring->events[i & (TRACE_RING_EVENTS - 1)];
+            u64 start = clock_tsc_to_mono_ns(event->start);
+            fprintf(out, "%s\n{\"name\":", first ? "" : ",");
+            first = false;
+            trace_write_string(out, event->name);
+            fprintf(out, ",\"pid\":%u,\"tid\":%u,\"ts\":%llu.%03llu", pid, ring->tid,
+                (unsigned long long)(start / 1000), (unsigned long long)(start % 1000));
+            if(event->kind == TRACE_EVENT_ZONE){
+                u64 duration = clock_tsc_to_mono_ns(event->end) - start;
+                fprintf(out, ",\"ph\":\"X\",\"dur\":%llu.%03llu", (unsigned long long)(duration / 1000), (unsigned long long)(duration % 1000));
+            }else if(event->kind == TRACE_EVENT_COUNTER){
+                fprintf(out, ",\"ph\":\"C\"");
+            }else{
+                fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+            }
+            if(event->arg_name != NULL){
+                fprintf(out, ",\"args\":{");
+                trace_write_string(out, event->arg_name);
+                fprintf(out, ":%lld}", (long long)event->arg);
+            }
+            fputc('}', out);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    bool written = !ferror(out);
+    if(fclose(out) != 0 || !written){
+        printf("Could not write the trace to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_ZONE_ARG(name, arg_name, value)
+#define TRACE_ZONE_COUNTERS(name)
+#define TRACE_INSTANT(name)
+#define TRACE_INSTANT_ARG(name, arg_name, value)
+///There's nothing to dump
+#define trace_dump(path) false
+
+#endif
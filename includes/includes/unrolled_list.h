@@ -0,0 +1,236 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+    An unrolled list is a list that packs many elements into each chunk instead of giving every
+    element its own entry. Chunks are cache line aligned and elements are packed one after another,
+    so iterating walks forward through memory and only follows a pointer once per chunk.
+
+    |--------------------------------|----------------|----------------|-------|------------|
+    |      unrolled_chunk (16)       | unrolled_entry | unrolled_entry |  ...  |   unused   |
+    |--------------------------------|----------------|----------------|-------|------------|
+    | next (8) | count (4) | used (4)| size | data    | size | data    |       |            |
+    |--------------------------------|----------------|----------------|-------|------------|
+
+    Every entry is padded so the next one starts on an 8 byte boundary.
+    An element too big for a chunk gets a chunk of its own that's just big enough.
+
+    Like list, this uses a greedy arena, so chunks live as long as the arena does.
+    This has the same shape as list: create_unrolled_list, unrolled_list_add, create_unrolled_list_iter
+    and unrolled_list_iter_next, and the entries handed out by the iterator have [size] and [data] like list_entry.
+*/
+
+///The size of a chunk including its header. Define this before including to change it.
+#ifndef UNROLLED_CHUNK_SIZE
+#define UNROLLED_CHUNK_SIZE 256
+#endif
+#define UNROLLED_CHUNK_ALIGN 64
+#define UNROLLED_ENTRY_ALIGN 8
+
+typedef struct unrolled_chunk unrolled_chunk;
+INTERNAL
+struct unrolled_chunk{
+    ///The next chunk in the list or NULL if this is the last
+    unrolled_chunk* next;
+    ///Number of entries in this chunk
+    u32 count;
+    ///Number of bytes used after this header, including padding
+    u32 used;
+};
+
+///An element in an unrolled list. The data immediately follows the size.
+PUBLIC
+struct unrolled_entry{
+    u32 size;
+    u32 reserved;
+    u8 data[];
+};
+typedef struct unrolled_entry unrolled_entry;
+
+PUBLIC
+EXTENSION(arena_alloc*)
+struct unrolled_list{
+    ///The arena chunks are reserved from
+    INTERNAL
+    arena_alloc* arena;
+    ///Number of elements currently added to this list
+    INTERNAL
+    u32 element_count;
+    ///The first chunk. This is NULL until the first element is added
+    INTERNAL
+    unrolled_chunk* first_chunk;
+    ///The chunk that elements are being added to
+    INTERNAL
+    unrolled_chunk* last_chunk;
+    ///The payload capacity of the last chunk, which is only bigger than the default for oversized elements
+    INTERNAL
+    u32 last_capacity;
+    ///The stride of every entry if they have all been the same size so far, otherwise 0.
+    ///When this is set, the iterator can step to the next entry without waiting on a load of the current one's size.
+    INTERNAL
+    u32 uniform_stride;
+};
+typedef struct unrolled_list unrolled_list;
+
+///Gets the number of bytes an entry of [size] takes up in a chunk, including its header and padding
+INTERNAL
+u32 unrolled_entry_stride(u32 size){
+    u32 stride = sizeof(unrolled_entry) + size;
+    return (stride + UNROLLED_ENTRY_ALIGN - 1) & ~(UNROLLED_ENTRY_ALIGN - 1);
+}
+
+///Creates a new unrolled list with the given greedy arena pointer.
+///When arena_deinit is called with list->arena, this list will also be deinitialized.
+PUBLIC
+RECEIVER(arena)
+unrolled_list* create_unrolled_list(arena_alloc* arena){
+    unrolled_list _list;
+    _list.arena = arena;
+    _list.element_count = 0;
+    _list.first_chunk = NULL;
+    _list.last_chunk = NULL;
+    _list.last_capacity = 0;
+    _list.uniform_stride = 0;
+    return arena_put(arena, &_list, sizeof(unrolled_list));
+}
+
+///Reserves a new chunk that can hold at least [stride] bytes of entries and links it to the end of the list
+INTERNAL
+RECEIVER(_list)
+unrolled_chunk* unrolled_list_new_chunk(unrolled_list* _list, u32 stride){
+    u32 chunk_size = UNROLLED_CHUNK_SIZE;
+    if(stride > chunk_size - sizeof(unrolled_chunk)){
+        chunk_size = (sizeof(unrolled_chunk) + stride + UNROLLED_CHUNK_ALIGN - 1) & ~(UNROLLED_CHUNK_ALIGN - 1);
+    }
+    unrolled_chunk* chunk = arena_reserve_aligned(_list->arena, chunk_size, UNROLLED_CHUNK_ALIGN);
+    if(chunk == NULL){
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->count = 0;
+    chunk->used = 0;
+    if(_list->first_chunk == NULL){
+        _list->first_chunk = chunk;
+    }else{
+        _list->last_chunk->next = chunk;
+    }
+    _list->last_chunk = chunk;
+    _list->last_capacity = chunk_size - sizeof(unrolled_chunk);
+    return chunk;
+}
+
+///Adds a new element to the end of the list with the given data and size.
+///The element is packed into the last chunk if it fits, otherwise a new chunk is started.
+///Returns a pointer to the copied data.
+PUBLIC
+RECEIVER(_list)
+void* unrolled_list_add(unrolled_list* _list, void* data, u32 size){
+    if(size > _list->arena->size){
+        printf("Expected a list data size within the size of the arena but instead found %i\n", size);
+        return NULL;
+    }
+    u32 stride = unrolled_entry_stride(size);
+    if(_list->element_count == 0){
+        _list->uniform_stride = stride;
+    }else if(_list->uniform_stride != stride){
+        _list->uniform_stride = 0;
+    }
+    unrolled_chunk* chunk = _list->last_chunk;
+    if(chunk == NULL || chunk->used + stride > _list->last_capacity){
+        chunk = unrolled_list_new_chunk(_list, stride);
+        if(chunk == NULL){
+            return NULL;
+        }
+    }
+    unrolled_entry* entry = (unrolled_entry*)((u8*)(chunk + 1) + chunk->used);
+    entry->size = size;
+    entry->reserved = 0;
+    memcpy(entry->data, data, size);
+    chunk->used += stride;
+    chunk->count += 1;
+    _list->element_count += 1;
+    return entry->data;
+}
+
+///An unrolled list iterator. This keeps track of the chunk being walked and how far into it we are.
+PUBLIC
+EXTENSION(unrolled_list*)
+struct unrolled_list_iter{
+    INTERNAL
+    unrolled_list* _list;
+    ///The chunk of the current iteration
+    INTERNAL
+    unrolled_chunk* curr_chunk;
+    ///The offset of the next entry in [curr_chunk], after its header
+    INTERNAL
+    u32 offset;
+};
+typedef struct unrolled_list_iter unrolled_list_iter;
+
+///Creates a new unrolled_list_iter from the given list
+///NOTE: This returns an unrolled_list_iter on the stack
+PUBLIC
+RECEIVER(_list)
+unrolled_list_iter create_unrolled_list_iter(unrolled_list* _list){
+    unrolled_list_iter iter;
+    iter._list = _list;
+    iter.curr_chunk = _list->first_chunk;
+    iter.offset = 0;
+    return iter;
+}
+
+///Gets the next entry in the list, or NULL once every entry has been seen.
+///Moving into a chunk prefetches the one after it, so the pointer chase is hidden
+///behind the work done on the current chunk.
+PUBLIC
+RECEIVER(iter)
+unrolled_entry* unrolled_list_iter_next(unrolled_list_iter* iter){
+    unrolled_chunk* chunk = iter->curr_chunk;
+    while(chunk != NULL && iter->offset >= chunk->used){
+        chunk = chunk->next;
+        iter->curr_chunk = chunk;
+        iter->offset = 0;
+        if(chunk != NULL && chunk->next != NULL){
+            __builtin_prefetch(chunk->next);
+        }
+    }
+    if(chunk == NULL){
+        return NULL;
+    }
+    unrolled_entry* entry = (unrolled_entry*)((u8*)(chunk + 1) + iter->offset);
+    u32 stride = iter->_list->uniform_stride;
+    iter->offset += stride != 0 ? stride : unrolled_entry_stride(entry->size);
+    return entry;
+}
+
+///Gets the data at the given index, or NULL if it doesn't exist.
+///Whole chunks are skipped by their count, so this only walks entries inside the chunk that holds [idx].
+PUBLIC
+RECEIVER(_list)
+void* unrolled_list_get(unrolled_list* _list, u32 idx){
+    if(idx >= _list->element_count){
+        return NULL;
+    }
+    unrolled_chunk* chunk = _list->first_chunk;
+    while(idx >= chunk->count){
+        idx -= chunk->count;
+        chunk = chunk->next;
+    }
+    u8* entry = (u8*)(chunk + 1);
+    while(idx != 0){
+        entry += unrolled_entry_stride(((unrolled_entry*)entry)->size);
+        idx -= 1;
+    }
+    return ((unrolled_entry*)entry)->data;
+}
+
+///Gets the number of elements in the list
+PUBLIC
+RECEIVER(_list)
+u32 unrolled_list_count(unrolled_list* _list){
+    return _list->element_count;
+}
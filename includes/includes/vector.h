@@ -0,0 +1,317 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include "list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    A vector is a contiguous, growable array of elements that are all the same size.
+    Unlike list, there is no header per element and elements sit right next to each other,
+    so indexing is O(1) and iterating streams through dense memory.
+
+    |-----------|-----------|-----------|-----------|---------------------------|
+    | element 0 | element 1 | element 2 |    ...    |   unused capacity         |
+    |-----------|-----------|-----------|-----------|---------------------------|
+    ^ data                                          ^ data + count * element_size
+
+    The elements can either live on the heap or in an arena_alloc.
+    When the vector is full, its capacity is doubled. On the heap this is a realloc.
+    In an arena, a new block is reserved and the elements are copied over. The old block can't be
+    given back to the arena, so reserve up front with vector_reserve if you know how many you need.
+*/
+
+#define VECTOR_ALIGN 16
+
+///NOTE: This is returned on the stack by create_vector, like list_iter.
+///      Keep it wherever it needs to live, and pass it around by pointer.
+PUBLIC
+EXTENSION(arena)
+struct vector{
+    ///The arena the elements are reserved in, or NULL if they are on the heap
+    INTERNAL
+    arena_alloc* arena;
+    ///The size of every element
+    INTERNAL
+    u32 element_size;
+    ///Number of elements currently in the vector
+    INTERNAL
+    u32 count;
+    ///Number of elements that fit before the vector has to grow
+    INTERNAL
+    u32 capacity;
+    INTERNAL
+    u8* data;
+};
+typedef struct vector vector;
+
+///Makes sure there is room for at least [capacity] elements, moving the elements if it has to.
+///Returns false if the memory could not be had, in which case the vector is left as it was.
+PUBLIC
+RECEIVER(vec)
+bool vector_reserve(vector* vec, u32 capacity){
+    if(capacity <= vec->capacity){
+        return true;
+    }
+    u64 bytes = (u64)capacity * vec->element_size;
+    if(bytes > 0xffffffffu){
+        printf("Cannot reserve %i elements of size %i in a vector\n", capacity, vec->element_size);
+        return false;
+    }
+    u8* data;
+    if(vec->arena == NULL){
+        data = realloc(vec->data, (size_t)bytes);
+    }else{
+        data = arena_reserve_aligned(vec->arena, (u32)bytes, VECTOR_ALIGN);
+        if(data != NULL && vec->count != 0){
+            memcpy(data, vec->data, (size_t)vec->count * vec->element_size);
+        }
+    }
+    if(data == NULL){
+        printf("Could not grow vector to %i elements\n", capacity);
+        return false;
+    }
+    vec->data = data;
+    vec->capacity = capacity;
+    return true;
+}
+
+///Creates a new vector of elements of [element_size] bytes with room for [capacity] elements.
+///If [arena] is NULL, the elements are kept on the heap and vector_deinit must be called.
+PUBLIC
+RECEIVER(arena)
+vector create_vector(arena_alloc* arena, u32 element_size, u32 capacity){
+    vector vec = { arena, element_size, 0, 0, NULL };
+    if(element_size == 0){
+        printf("Cannot create a vector of 0 sized elements\n");
+        return vec;
+    }
+    if(capacity != 0){
+        vector_reserve(&vec, capacity);
+    }
+    return vec;
+}
+
+///Frees the elements if they are on the heap. Elements in an arena go away with the arena.
+PUBLIC
+RECEIVER(vec)
+void vector_deinit(vector* vec){
+    if(vec->arena == NULL){
+        free(vec->data);
+    }
+    vec->data = NULL;
+    vec->count = 0;
+    vec->capacity = 0;
+}
+
+///Makes room for [extra] more elements, at least doubling the capacity when it has to grow,
+///so that pushing n elements one at a time costs amortized O(n).
+///Returns false if the vector would need more than 0xffffffff elements.
+INTERNAL
+RECEIVER(vec)
+bool vector_grow(vector* vec, u32 extra){
+    ///In 64 bits, so a large [extra] can't wrap around and look like it fits
+    u64 needed = (u64)vec->count + extra;
+    if(needed <= vec->capacity){
+        return true;
+    }
+    if(needed > 0xffffffffu){
+        printf("Cannot grow a vector of %u elements by %u more\n", vec->count, extra);
+        return false;
+    }
+    u64 wanted = (u64)vec->capacity * 2;
+    if(wanted < 8){
+        wanted = 8;
+    }
+    if(wanted < needed){
+        wanted = needed;
+    }
+    if(wanted > 0xffffffffu){
+        wanted = 0xffffffffu;
+    }
+    return vector_reserve(vec, (u32)wanted);
+}
+
+///Copies one element. Where [element_size] is known after inlining, the compiler turns this into plain loads and stores.
+INTERNAL
+void vector_copy_element(void* dest, void* src, u32 element_size){
+    memcpy(dest, src, element_size);
+}
+
+///Gets a pointer to the element at [idx] without any bounds check. [type] must be the element type.
+///This is the fast path for hot loops where the index is already known to be in range.
+///EXAMPLE: u32 value = VECTOR_AT(&vec, u32, i);
+#define VECTOR_AT(vec, type, idx) (((type*)(vec)->data)[idx])
+
+///Gets the element at [idx], or NULL if it's out of range
+PUBLIC
+RECEIVER(vec)
+void* vector_get(vector* vec, u32 idx){
+    if(idx >= vec->count){
+        return NULL;
+    }
+    return vec->data + (size_t)idx * vec->element_size;
+}
+
+///Gets the number of elements in the vector
+PUBLIC
+RECEIVER(vec)
+u32 vector_count(vector* vec){
+    return vec->count;
+}
+
+///Copies one element onto the end of the vector and returns where it was copied to
+PUBLIC
+RECEIVER(vec)
+void* vector_push(vector* vec, void* data){
+    if(!vector_grow(vec, 1)){
+        return NULL;
+    }
+    void* dest = vec->data + (size_t)vec->count * vec->element_size;
+    vector_copy_element(dest, data, vec->element_size);
+    vec->count += 1;
+    return dest;
+}
+
+///Copies [count] contiguous elements onto the end of the vector with a single memcpy.
+///Returns where the first one was copied to.
+PUBLIC
+RECEIVER(vec)
+void* vector_append(vector* vec, void* data, u32 count){
+    if(!vector_grow(vec, count)){
+        return NULL;
+    }
+    void* dest = vec->data + (size_t)vec->count * vec->element_size;
+    memcpy(dest, data, (size_t)count * vec->element_size);
+    vec->count += count;
+    return dest;
+}
+
+///Inserts [count] contiguous elements before [idx], shifting everything after it up in one memmove.
+///[idx] can be vector_count to insert at the end.
+PUBLIC
+RECEIVER(vec)
+void* vector_insert(vector* vec, u32 idx, void* data, u32 count){
+    if(idx > vec->count){
+        printf("Index %i given is not within vector indices %i\n", idx, vec->count);
+        return NULL;
+    }
+    if(!vector_grow(vec, count)){
+        return NULL;
+    }
+    u8* dest = vec->data + (size_t)idx * vec->element_size;
+    memmove(dest + (size_t)count * vec->element_size, dest, (size_t)(vec->count - idx) * vec->element_size);
+    memcpy(dest, data, (size_t)count * vec->element_size);
+    vec->count += count;
+    return dest;
+}
+
+///Removes [count] elements starting at [idx], shifting everything after them down in one memmove.
+///Returns how many elements were actually removed.
+PUBLIC
+RECEIVER(vec)
+u32 vector_erase(vector* vec, u32 idx, u32 count){
+    if(idx >= vec->count){
+        return 0;
+    }
+    if(count > vec->count - idx){
+        count = vec->count - idx;
+    }
+    u8* dest = vec->data + (size_t)idx * vec->element_size;
+    u32 after = vec->count - idx - count;
+    memmove(dest, dest + (size_t)count * vec->element_size, (size_t)after * vec->element_size);
+    vec->count -= count;
+    return count;
+}
+
+///Removes the last element, copying it into [out] if [out] is not NULL.
+///Returns false if the vector is empty.
+PUBLIC
+RECEIVER(vec)
+bool vector_pop(vector* vec, OUT void* out){
+    if(vec->count == 0){
+        return false;
+    }
+    vec->count -= 1;
+    if(out != NULL){
+        vector_copy_element(out, vec->data + (size_t)vec->count * vec->element_size, vec->element_size);
+    }
+    return true;
+}
+
+///Removes every element but keeps the capacity
+PUBLIC
+RECEIVER(vec)
+void vector_clear(vector* vec){
+    vec->count = 0;
+}
+
+///Copies every element the list iterator can see onto the end of the vector.
+///Every element in the list has to be the same size as the vector's elements.
+///Returns false, without copying anything, if one isn't.
+PUBLIC
+RECEIVER(vec)
+bool vector_append_list(vector* vec, list* _list){
+    list_iter iter = create_list_iter(_list);
+    list_entry* next = list_iter_next(&iter);
+    while(next != NULL){
+        if(next->size != vec->element_size){
+            printf("Expected list elements of size %i but found one of size %i\n", vec->element_size, next->size);
+            return false;
+        }
+        next = list_iter_next(&iter);
+    }
+    ///In 64 bits, so a long list can't wrap the count around and reserve too little
+    u64 needed = (u64)vec->count + _list->element_count;
+    if(needed > 0xffffffffu){
+        printf("Cannot append %u elements to a vector of %u\n", _list->element_count, vec->count);
+        return false;
+    }
+    if(!vector_reserve(vec, (u32)needed)){
+        return false;
+    }
+    iter = create_list_iter(_list);
+    next = list_iter_next(&iter);
+    while(next != NULL){
+        vector_copy_element(vec->data + (size_t)vec->count * vec->element_size, next->data, vec->element_size);
+        vec->count += 1;
+        next = list_iter_next(&iter);
+    }
+    return true;
+}
+
+///A vector iterator. This has the same shape as list_iter so loops over a list can be moved
+///over to a vector by swapping the names.
+PUBLIC
+EXTENSION(vector*)
+struct vector_iter{
+    INTERNAL
+    vector* vec;
+    ///The index of the element the next call to vector_iter_next returns
+    INTERNAL
+    u32 idx;
+};
+typedef struct vector_iter vector_iter;
+
+///Creates a new vector_iter from the given vector
+///NOTE: This returns a vector_iter on the stack
+PUBLIC
+RECEIVER(vec)
+vector_iter create_vector_iter(vector* vec){
+    vector_iter iter = { vec, 0 };
+    return iter;
+}
+
+///Gets the next element, or NULL once every element has been seen
+PUBLIC
+RECEIVER(iter)
+void* vector_iter_next(vector_iter* iter){
+    if(iter->idx >= iter->vec->count){
+        return NULL;
+    }
+    void* element = iter->vec->data + (size_t)iter->idx * iter->vec->element_size;
+    iter->idx += 1;
+    return element;
+}
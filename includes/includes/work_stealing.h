@@ -0,0 +1,562 @@
+#pragma once
+
+#include "commons.h"
+#include "arena.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+    A work-stealing scheduler for lots of small fork-join tasks, where thread_pool from parallel.h only
+    runs one flat job at a time.
+
+    Every worker owns a Chase-Lev deque of tasks. The owner pushes and pops at the bottom without ever
+    contending with anyone unless the deque is down to its last task, and idle workers steal from the top,
+    which is where the oldest and usually biggest tasks are.
+
+    |--------------------|--------------------|-------------------------------------------|
+    | top (padded)       | bottom (padded)    | slots, mask, frames, free frames, pool    |
+    |--------------------|--------------------|-------------------------------------------|
+    thieves CAS this      only the owner writes  only the owner touches, apart from slots
+
+    A task is spawned by a worker and must be joined by that same worker, in the reverse order of spawning,
+    which is what falls out of ordinary recursive code. While it waits in ws_join, a worker pops and runs
+    its own tasks and then steals other workers' tasks, so it never blocks while there is work anywhere.
+
+    Task frames are one cache line each, with the arguments stored inline, and come from a per-worker arena.
+    A joined frame goes back onto its worker's free list, so after warming up spawning never allocates.
+
+    Workers with nothing to steal spin, then yield, then park on a futex until something is spawned.
+*/
+
+#define WS_CACHE_LINE 64
+///How many task pointers fit in each worker's deque. A spawn into a full deque runs the task right away instead.
+#ifndef WS_DEQUE_CAPACITY
+#define WS_DEQUE_CAPACITY 4096
+#endif
+///How many bytes of arguments a task frame holds
+#define WS_TASK_ARGS 40
+///How many frames a worker reserves at once when its free list runs dry
+#define WS_FRAME_BATCH 32
+///How many bytes of frames each worker's arena grows by
+#define WS_FRAME_BLOCK (64 * 1024)
+///How many times an idle worker fails to steal before it parks
+#define WS_DEFAULT_SPIN 256
+///How many of those failures just pause the cpu before the rest yield it
+#define WS_PAUSE_SPIN 16
+
+typedef struct ws_worker ws_worker;
+typedef struct ws_pool ws_pool;
+
+///The body of a task. [args] points at the copy of the arguments in the task's frame,
+///which is copied back out by ws_join, so a task can return results by writing into it.
+typedef void (*ws_task_fn)(ws_worker* worker, void* args);
+
+PUBLIC
+struct ws_task{
+    INTERNAL
+    ws_task_fn fn;
+    ///Set once the task has run
+    INTERNAL
+    _Atomic u32 done;
+    ///The next frame on the free list, while this frame is free
+    INTERNAL
+    struct ws_task* next_free;
+    INTERNAL
+    _Alignas(8) u8 args[WS_TASK_ARGS];
+};
+typedef struct ws_task ws_task;
+_Static_assert(sizeof(ws_task) == WS_CACHE_LINE, "A task frame should be exactly one cache line");
+
+PUBLIC
+struct ws_worker{
+    ///The oldest task, the next one a thief takes
+    INTERNAL
+    _Alignas(WS_CACHE_LINE) _Atomic i64 top;
+    ///One past the newest task. Only the owner writes this.
+    INTERNAL
+    _Alignas(WS_CACHE_LINE) _Atomic i64 bottom;
+
+    INTERNAL
+    _Alignas(WS_CACHE_LINE) _Atomic(ws_task*)* slots;
+    INTERNAL
+    i64 mask;
+    INTERNAL
+    ws_pool* pool;
+    ///Owns every frame block this worker reserved
+    INTERNAL
+    arena_alloc* frames;
+    ///The block frames are currently reserved from
+    INTERNAL
+    arena_alloc* frame_block;
+    INTERNAL
+    ws_task* free_frames;
+    INTERNAL
+    u32 index;
+    ///The state of the xorshift picking who to steal from
+    INTERNAL
+    u64 rng;
+    ///How many tasks this worker stole
+    INTERNAL
+    u64 steals;
+    INTERNAL
+    pthread_t thread;
+};
+
+PUBLIC
+struct ws_pool{
+    ///Number of workers, including the caller of ws_pool_run as worker 0. Never changes once the threads are started,
+    ///since they pick who to steal from by it.
+    INTERNAL
+    u32 worker_count;
+    ///How many workers have a thread, counting worker 0, which ws_pool_deinit joins. Less than [worker_count] only if
+    ///pthread_create failed, and then the rest just never have anything to steal, since only a worker's own thread pushes.
+    INTERNAL
+    u32 started;
+    INTERNAL
+    ws_worker* workers;
+    INTERNAL
+    u32 spin_limit;
+    ///How many workers are parked, and the futex they park on
+    INTERNAL
+    _Alignas(WS_CACHE_LINE) _Atomic u32 sleepers;
+    INTERNAL
+    _Atomic u32 wake;
+    INTERNAL
+    _Atomic u32 stopping;
+};
+
+INTERNAL
+void ws_futex_wait(_Atomic u32* addr, u32 expected){
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+///Bumps a wake counter and wakes up to [count] threads parked on it
+INTERNAL
+void ws_futex_wake(_Atomic u32* addr, u32 count){
+    atomic_fetch_add(addr, 1);
+    syscall(SYS_futex, (u32*)addr, FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : (int)count, NULL, NULL, 0);
+}
+
+///Waits a little before trying again, pausing at first and then giving up the cpu
+INTERNAL
+void ws_backoff(u32 spins){
+    if(spins >= WS_PAUSE_SPIN){
+        sched_yield();
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+///Wakes one parked worker, if there are any.
+///NOTE: This can race with a worker that is just about to park and miss it. That only costs parallelism,
+///since a task nobody steals is still run by the worker that spawned it when it joins.
+INTERNAL
+RECEIVER(pool)
+void ws_wake_one(ws_pool* pool){
+    if(atomic_load_explicit(&pool->sleepers, memory_order_relaxed) != 0){
+        ws_futex_wake(&pool->wake, 1);
+    }
+}
+
+///Pushes [task] onto the bottom of the worker's deque. Returns false if the deque is full. Owner only.
+INTERNAL
+RECEIVER(worker)
+bool ws_push(ws_worker* worker, ws_task* task){
+    i64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+    i64 top = atomic_load_explicit(&worker->top, memory_order_acquire);
+    if(bottom - top > worker->mask){
+        return false;
+    }
+    atomic_store_explicit(&worker->slots[bottom & worker->mask], task, memory_order_relaxed);
+    ///Release so a thief that sees the new bottom also sees the task and its arguments
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+///Pops the newest task off the bottom of the worker's deque, or returns NULL if it's empty. Owner only.
+INTERNAL
+RECEIVER(worker)
+ws_task* ws_pop(ws_worker* worker){
+    i64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&worker->bottom, bottom, memory_order_relaxed);
+    ///Taking the slot has to be visible before we look at top, or a thief could take it at the same time
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 top = atomic_load_explicit(&worker->top, memory_order_relaxed);
+    if(top > bottom){
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    ws_task* task = atomic_load_explicit(&worker->slots[bottom & worker->mask], memory_order_relaxed);
+    if(top == bottom){
+        ///The last task, so race the thieves for it
+        if(!atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)){
+            task = NULL;
+        }
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+///Steals the oldest task off the top of [victim]'s deque, or returns NULL if it's empty or another thief won
+INTERNAL
+RECEIVER(victim)
+ws_task* ws_steal(ws_worker* victim){
+    i64 top = atomic_load_explicit(&victim->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 bottom = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+    if(top >= bottom){
+        return NULL;
+    }
+    ws_task* task = atomic_load_explicit(&victim->slots[top & victim->mask], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&victim->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)){
+        return NULL;
+    }
+    return task;
+}
+
+///Tries to steal from every other worker once, starting from a random one
+INTERNAL
+RECEIVER(worker)
+ws_task* ws_steal_any(ws_worker* worker){
+    ws_pool* pool = worker->pool;
+    if(pool->worker_count < 2){
+        return NULL;
+    }
+    worker->rng ^= worker->rng << 13;
+    worker->rng ^= worker->rng >> 7;
+    worker->rng ^= worker->rng << 17;
+    u32 start = (u32)(worker->rng % pool->worker_count);
+    for(u32 i = 0; i < pool->worker_count; i++){
+        ws_worker* victim = &pool->workers[(start + i) % pool->worker_count];
+        if(victim == worker){
+            continue;
+        }
+        ws_task* task = ws_steal(victim);
+        if(task != NULL){
+            worker->steals += 1;
+            ///There's more where that came from, so get someone else stealing too
+            if(atomic_load_explicit(&victim->bottom, memory_order_relaxed) > atomic_load_explicit(&victim->top, memory_order_relaxed)){
+                ws_wake_one(pool);
+            }
+            return task;
+        }
+    }
+    return NULL;
+}
+
+///Checks whether any worker has a task waiting, without taking it
+INTERNAL
+RECEIVER(pool)
+bool ws_any_work(ws_pool* pool){
+    for(u32 i = 0; i < pool->worker_count; i++){
+        ws_worker* worker = &pool->workers[i];
+        if(atomic_load_explicit(&worker->bottom, memory_order_acquire) > atomic_load_explicit(&worker->top, memory_order_acquire)){
+            return true;
+        }
+    }
+    return false;
+}
+
+INTERNAL
+RECEIVER(worker)
+void ws_run(ws_worker* worker, ws_task* task){
+    task->fn(worker, task->args);
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+
+///Gets a free frame. When there are none, a batch of WS_FRAME_BATCH frames is reserved from the worker's
+///arena in one go and threaded onto the free list, starting a new block when the current one is full.
+INTERNAL
+RECEIVER(worker)
+ws_task* ws_frame_alloc(ws_worker* worker){
+    if(worker->free_frames == NULL){
+        u32 batch_size = sizeof(ws_task) * WS_FRAME_BATCH + WS_CACHE_LINE - 1;
+        if(worker->frame_block->size - worker->frame_block->capacity < batch_size){
+            arena_alloc* block = arena_init(WS_FRAME_BLOCK);
+            if(block == NULL){
+                return NULL;
+            }
+            arena_adopt(worker->frames, block);
+            worker->frame_block = block;
+        }
+        ws_task* batch = arena_reserve_aligned(worker->frame_block, sizeof(ws_task) * WS_FRAME_BATCH, WS_CACHE_LINE);
+        for(u32 i = WS_FRAME_BATCH; i-- > 0;){
+            batch[i].next_free = worker->free_frames;
+            worker->free_frames = &batch[i];
+        }
+    }
+    ws_task* task = worker->free_frames;
+    worker->free_frames = task->next_free;
+    return task;
+}
+
+INTERNAL
+RECEIVER(worker)
+void ws_frame_free(ws_worker* worker, ws_task* task){
+    task->next_free = worker->free_frames;
+    worker->free_frames = task;
+}
+
+///What a worker thread does between tasks: steal, and park when there is nothing to steal
+INTERNAL
+void* ws_worker_main(void* arg){
+    ws_worker* worker = (ws_worker*)arg;
+    ws_pool* pool = worker->pool;
+    u32 spins = 0;
+    while(!atomic_load_explicit(&pool->stopping, memory_order_acquire)){
+        ws_task* task = ws_steal_any(worker);
+        if(task != NULL){
+            ws_run(worker, task);
+            spins = 0;
+            continue;
+        }
+        if(spins < pool->spin_limit){
+            ws_backoff(spins++);
+            continue;
+        }
+        ///Read the wake counter before checking for work, so a spawn after the check makes the wait return at once
+        u32 wake = atomic_load_explicit(&pool->wake, memory_order_acquire);
+        atomic_fetch_add(&pool->sleepers, 1);
+        if(!ws_any_work(pool) && !atomic_load(&pool->stopping)){
+            ws_futex_wait(&pool->wake, wake);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        spins = 0;
+    }
+    return NULL;
+}
+
+///Creates a pool of [thread_count] workers, including the caller of ws_pool_run.
+///If [thread_count] is 0, one worker per online cpu is used.
+///MEM: Borrowed-always
+///LIFETIME: This persists until it's passed into ws_pool_deinit
+PUBLIC
+ws_pool* ws_pool_init(u32 thread_count){
+    if(thread_count == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (u32)cpus : 1;
+    }
+    ws_pool* pool = (ws_pool*)aligned_alloc(WS_CACHE_LINE, sizeof(ws_pool));
+    ws_worker* workers = (ws_worker*)aligned_alloc(WS_CACHE_LINE, sizeof(ws_worker) * thread_count);
+    if(pool == NULL || workers == NULL){
+        printf("Could not allocate a pool of %i workers\n", thread_count);
+        free(pool);
+        free(workers);
+        return NULL;
+    }
+    memset(pool, 0, sizeof(ws_pool));
+    memset(workers, 0, sizeof(ws_worker) * thread_count);
+    pool->worker_count = thread_count;
+    pool->workers = workers;
+    pool->spin_limit = WS_DEFAULT_SPIN;
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->wake, 0);
+    atomic_init(&pool->stopping, 0);
+    for(u32 i = 0; i < thread_count; i++){
+        ws_worker* worker = &workers[i];
+        atomic_init(&worker->top, 0);
+        atomic_init(&worker->bottom, 0);
+        worker->slots = (_Atomic(ws_task*)*)calloc(WS_DEQUE_CAPACITY, sizeof(ws_task*));
+        worker->mask = WS_DEQUE_CAPACITY - 1;
+        worker->pool = pool;
+        worker->frames = arena_init(WS_FRAME_BLOCK);
+        worker->frame_block = worker->frames;
+        worker->index = i;
+        ///Any odd number works as an xorshift seed, as long as every worker gets a different one
+        worker->rng = 0x9E3779B97F4A7C15ull * (i + 1) | 1;
+        if(worker->slots == NULL || worker->frames == NULL){
+            printf("Could not allocate worker %i of %i\n", i, thread_count);
+            ///No thread is started yet, so only what every worker up to this one got has to be freed
+            for(u32 j = 0; j <= i; j++){
+                free(workers[j].slots);
+                if(workers[j].frames != NULL){
+                    arena_deinit(workers[j].frames);
+                }
+            }
+            free(workers);
+            free(pool);
+            return NULL;
+        }
+    }
+    pool->started = 1;
+    for(u32 i = 1; i < thread_count; i++){
+        if(pthread_create(&workers[i].thread, NULL, ws_worker_main, &workers[i]) != 0){
+            printf("Could only start %i of %i workers\n", i, thread_count);
+            break;
+        }
+        pool->started = i + 1;
+    }
+    return pool;
+}
+
+///Stops and joins every worker and frees the pool along with every task frame
+PUBLIC
+RECEIVER(pool)
+void ws_pool_deinit(ws_pool* pool){
+    if(pool == NULL){
+        return;
+    }
+    atomic_store(&pool->stopping, 1);
+    ws_futex_wake(&pool->wake, UINT_MAX);
+    for(u32 i = 1; i < pool->started; i++){
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for(u32 i = 0; i < pool->worker_count; i++){
+        free(pool->workers[i].slots);
+        if(pool->workers[i].frames != NULL){
+            arena_deinit(pool->workers[i].frames);
+        }
+    }
+    free(pool->workers);
+    free(pool);
+}
+
+///Sets how many times an idle worker fails to steal before it parks
+PUBLIC
+RECEIVER(pool)
+void ws_pool_set_spin(ws_pool* pool, u32 spin_limit){
+    pool->spin_limit = spin_limit;
+}
+
+///Gets how many tasks were stolen across every worker so far
+PUBLIC
+RECEIVER(pool)
+u64 ws_pool_steals(ws_pool* pool){
+    u64 steals = 0;
+    for(u32 i = 0; i < pool->worker_count; i++){
+        steals += pool->workers[i].steals;
+    }
+    return steals;
+}
+
+///Gets which worker this is, in [0, worker_count). Handy for indexing per-worker partial results.
+PUBLIC
+RECEIVER(worker)
+u32 ws_worker_index(ws_worker* worker){
+    return worker->index;
+}
+
+///Runs [fn] with [args] on the calling thread as worker 0, and returns once it does.
+///Everything it spawns must be joined before it returns. Only one thread may call this on a pool at a time.
+PUBLIC
+RECEIVER(pool)
+void ws_pool_run(ws_pool* pool, ws_task_fn fn, void* args){
+    fn(&pool->workers[0], args);
+}
+
+///Spawns a task running [fn] with a copy of the [args_size] bytes at [args], which any worker may pick up.
+///The returned task must be passed to ws_join by this same worker.
+///If the worker's deque is full, or there's no frame for it, the task runs before this returns.
+PUBLIC
+RECEIVER(worker)
+ws_task* ws_spawn(ws_worker* worker, ws_task_fn fn, void* args, u32 args_size){
+    if(args_size > WS_TASK_ARGS){
+        printf("Task arguments of %i bytes don't fit in a %i byte frame, running it inline\n", args_size, WS_TASK_ARGS);
+        fn(worker, args);
+        return NULL;
+    }
+    ws_task* task = ws_frame_alloc(worker);
+    if(task == NULL){
+        fn(worker, args);
+        return NULL;
+    }
+    task->fn = fn;
+    atomic_store_explicit(&task->done, 0, memory_order_relaxed);
+    memcpy(task->args, args, args_size);
+    if(!ws_push(worker, task)){
+        ws_run(worker, task);
+        return task;
+    }
+    ws_wake_one(worker->pool);
+    return task;
+}
+
+///Waits for [task] to finish, running other tasks in the meantime, then copies its arguments into [args]
+///unless it's NULL, and frees its frame. [args] must be as big as what was given to ws_spawn.
+///NOTE: If ws_spawn had no frame for the task, it ran it on the caller's own copy of the arguments
+///and returned NULL, and joining NULL does nothing.
+PUBLIC
+RECEIVER(worker)
+void ws_join(ws_worker* worker, ws_task* task, OUT void* args, u32 args_size){
+    if(task == NULL){
+        return;
+    }
+    u32 spins = 0;
+    while(!atomic_load_explicit(&task->done, memory_order_acquire)){
+        ///Usually the task is still the newest one in our own deque, and this runs it right here
+        ws_task* next = ws_pop(worker);
+        if(next == NULL){
+            next = ws_steal_any(worker);
+        }
+        if(next != NULL){
+            ws_run(worker, next);
+            spins = 0;
+            continue;
+        }
+        ///It was stolen and there is nothing else to do until the thief finishes it
+        ws_backoff(spins++);
+    }
+    if(args != NULL){
+        memcpy(args, task->args, args_size);
+    }
+    ws_frame_free(worker, task);
+}
+
+///The body of a ws_parallel_for, called with a [first, end) range
+typedef void (*ws_range_fn)(ws_worker* worker, u64 first, u64 end, void* ctx);
+
+INTERNAL
+struct ws_range_args{
+    ws_range_fn body;
+    void* ctx;
+    u64 first;
+    u64 end;
+    u64 grain;
+};
+typedef struct ws_range_args ws_range_args;
+
+void ws_parallel_for(ws_worker* worker, u64 first, u64 end, u64 grain, ws_range_fn body, void* ctx);
+
+INTERNAL
+void ws_range_task(ws_worker* worker, void* args){
+    ws_range_args* range = (ws_range_args*)args;
+    ws_parallel_for(worker, range->first, range->end, range->grain, range->body, range->ctx);
+}
+
+///Calls [body] over [first, end) split into ranges of at most [grain] elements, in parallel.
+///The range is halved recursively, so thieves take the biggest halves first.
+///If [grain] is 0, it's picked so there are about 8 ranges per worker.
+PUBLIC
+RECEIVER(worker)
+void ws_parallel_for(ws_worker* worker, u64 first, u64 end, u64 grain, ws_range_fn body, void* ctx){
+    if(grain == 0){
+        grain = (end - first) / ((u64)worker->pool->worker_count * 8);
+        grain = grain == 0 ? 1 : grain;
+    }
+    ///Spawn the right half and keep splitting the left, so each level costs one frame and no recursion
+    ws_task* pending[64];
+    u32 pending_count = 0;
+    while(end - first > grain && pending_count < 64){
+        u64 mid = first + (end - first) / 2;
+        ws_range_args right = { body, ctx, mid, end, grain };
+        pending[pending_count++] = ws_spawn(worker, ws_range_task, &right, sizeof(right));
+        end = mid;
+    }
+    body(worker, first, end, ctx);
+    while(pending_count != 0){
+        ws_join(worker, pending[--pending_count], NULL, 0);
+    }
+}
@@ -0,0 +1,262 @@
+///Turns a file written by binlog.h into text, one line per record, in the order they are in the file:
+///[Mon Oct 19 12:00:01.123456 2026][server.c:42][INFO]: request 7 took 0.007 ms from 10.0.0.1
+///The formatting is log_format's, so it prints what printf would have.
+///Build: gcc -O2 -pthread -I../includes/includes binlog_decode.c -o binlog_decode
+///Run:   ./binlog_decode file.binlog [min level, 0 to 4]
+#include "binlog.h"
+#include <sys/stat.h>
+
+///The longest a decoded message can be. Longer ones are cut off.
+#define DECODE_MAX_LINE 4096
+
+///The text of one call site, as the file has it
+typedef struct{
+    str file;
+    str format;
+    u32 line;
+    u32 level;
+} decode_site;
+
+typedef struct{
+    u8* data;
+    u64 size;
+    u32 chunk_size;
+    ///Indexed by site id, which count up from 1
+    decode_site* sites;
+    u32 site_capacity;
+    binlog_record clock;
+    binlog_clock calibration;
+} decode_file;
+
+///Gets the next record at [*at], moving [*at] past it. Returns false at the end of the file.
+bool decode_next(decode_file* file, u64* at, OUT binlog_record* record, OUT u8** payload){
+    for(;;){
+        u64 left_in_chunk = file->chunk_size - *at % file->chunk_size;
+        if(left_in_chunk < sizeof(binlog_record)){
+            *at += left_in_chunk;
+            continue;
+        }
+        if(*at + sizeof(binlog_record) > file->size){
+            return false;
+        }
+        memcpy(record, file->data + *at, sizeof(binlog_record));
+        ///Padding before a record that went to the next chunk, or room that was never written: the unused end of
+        ///the last chunk, or room a thread took and hadn't filled in yet when the process died. How big that was
+        ///is lost, but records never cross chunks, so the next chunk starts with a whole one again and only the
+        ///rest of this chunk is skipped. The end of what was written runs into the end of the file this way.
+        if(record->size < sizeof(binlog_record) || record->size > left_in_chunk || *at + record->size > file->size
+            || record->site == BINLOG_SITE_PADDING){
+            *at += left_in_chunk;
+            continue;
+        }
+        *payload = file->data + *at + sizeof(binlog_record);
+        *at += record->size;
+        return true;
+    }
+}
+
+void decode_add_site(decode_file* file, u8* payload, u32 size){
+    if(size < sizeof(binlog_site_text)){
+        return;
+    }
+    binlog_site_text text;
+    memcpy(&text, payload, sizeof(text));
+    if(text.id >= file->site_capacity){
+        u32 capacity = file->site_capacity == 0 ? 256 : file->site_capacity;
+        while(capacity <= text.id){
+            capacity *= 2;
+        }
+        file->sites = realloc(file->sites, sizeof(decode_site) * capacity);
+        memset(file->sites + file->site_capacity, 0, sizeof(decode_site) * (capacity - file->site_capacity));
+        file->site_capacity = capacity;
+    }
+    ///Both strings are terminated in the file, as long as it isn't cut off halfway through
+    str file_name = (str)payload + sizeof(text);
+    str end = (str)payload + size;
+    str format = memchr(file_name, 0, (size_t)(end - file_name));
+    if(format == NULL || memchr(format + 1, 0, (size_t)(end - format - 1)) == NULL){
+        return;
+    }
+    file->sites[text.id] = (decode_site){ file_name, format + 1, text.line, text.level };
+}
+
+///Which type printf wants for [conversion]
+log_arg_type decode_wanted(char conversion){
+    switch(conversion){
+        case 's':
+            return LOG_ARG_STRING;
+        case 'p':
+            return LOG_ARG_POINTER;
+        case 'u': case 'o': case 'x': case 'X':
+            return LOG_ARG_UINT;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            return LOG_ARG_DOUBLE;
+        default:
+            return LOG_ARG_INT;
+    }
+}
+
+///Turns one encoded argument into log_format's form, as the type [wanted] by its conversion,
+///the way printf would have taken it. Returns the bytes written to [dest], or 0 if there are no arguments left.
+u32 decode_arg(u8** args, u8* end, log_arg_type wanted, OUT u8* dest, u32 capacity){
+    if(*args >= end){
+        return 0;
+    }
+    log_arg_type type = (log_arg_type)((*args)[0] & 0xf);
+    u32 size = (*args)[0] >> 4;
+    if(type == LOG_ARG_STRING){
+        u16 length;
+        memcpy(&length, *args + 1, sizeof(length));
+        if(*args + 1 + sizeof(length) + length > end || capacity < 1 + sizeof(length) + length){
+            *args = end;
+            return 0;
+        }
+        ///A string prints as itself whatever the conversion, since log_format prints it with %s
+        memcpy(dest, *args, 1 + sizeof(length) + length);
+        *args += 1 + sizeof(length) + length;
+        return 1 + sizeof(length) + length;
+    }
+    if(size == 0 || size > 8 || *args + 1 + size > end){
+        *args = end;
+        return 0;
+    }
+    u64 bits = 0;
+    memcpy(&bits, *args + 1, size);
+    *args += 1 + size;
+    if(wanted == LOG_ARG_STRING){
+        ///%s with something that isn't a string, which printf would have crashed on
+        u16 length = 3;
+        dest[0] = LOG_ARG_STRING;
+        memcpy(dest + 1, &length, sizeof(length));
+        memcpy(dest + 1 + sizeof(length), "(?)", 3);
+        return 1 + sizeof(length) + 3;
+    }
+    if(type == LOG_ARG_DOUBLE){
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if(wanted != LOG_ARG_DOUBLE){
+            bits = (u64)(i64)value;
+            type = wanted;
+        }
+    }else if(wanted == LOG_ARG_DOUBLE){
+        double value = type == LOG_ARG_INT ? (double)(i64)bits : (double)bits;
+        memcpy(&bits, &value, sizeof(bits));
+        type = LOG_ARG_DOUBLE;
+    }else{
+        ///Read at the width it was passed with, signed or not as the conversion says, like %x of -1 is ffffffff
+        if(wanted == LOG_ARG_INT && size < 8 && (bits >> (size * 8 - 1)) & 1){
+            bits |= ~0ull << (size * 8);
+        }
+        type = wanted;
+    }
+    return log_put_arg(dest, capacity, type, &bits, sizeof(bits));
+}
+
+///Prints one call's record
+void decode_print(decode_file* file, binlog_record* record, u8* payload, u32 min_level){
+    decode_site* site = record->site < file->site_capacity ? &file->sites[record->site] : NULL;
+    if(site != NULL && site->format == NULL){
+        site = NULL;
+    }
+    if(site != NULL && site->level < min_level){
+        return;
+    }
+    ///Walk the conversions to know the type each argument is wanted as, the same way log_capture would have
+    u8 args[BINLOG_MAX_ARGS * 2];
+    u32 used = 0;
+    u8* cursor_args = payload;
+    u8* end = payload + record->size - sizeof(binlog_record);
+    if(site != NULL){
+        str cursor = site->format;
+        log_spec spec;
+        while(log_next_spec(&cursor, &spec) && cursor_args < end){
+            if(!log_known_conversion(spec.conversion) || spec.conversion == '%'){
+                continue;
+            }
+            if(spec.star_width){
+                used += decode_arg(&cursor_args, end, LOG_ARG_INT, args + used, sizeof(args) - used);
+            }
+            if(spec.star_precision){
+                used += decode_arg(&cursor_args, end, LOG_ARG_INT, args + used, sizeof(args) - used);
+            }
+            if(spec.conversion == 'n'){
+                ///log_format doesn't take an argument for %n, so the pointer is thrown away
+                u8 ignored[16];
+                decode_arg(&cursor_args, end, LOG_ARG_POINTER, ignored, sizeof(ignored));
+                continue;
+            }
+            used += decode_arg(&cursor_args, end, decode_wanted(spec.conversion), args + used, sizeof(args) - used);
+        }
+    }
+
+    i64 ticks = (i64)(record->tsc - file->clock.tsc);
+    u64 real_ns = file->calibration.real_ns + (i64)(((__int128)ticks * file->calibration.mult) >> 32);
+    char message[DECODE_MAX_LINE];
+    if(site == NULL){
+        printf("[%s][?][?]: record from unknown site %u\n", clock_date_string(real_ns, 6), record->site);
+        return;
+    }
+    log_format(site->format, args, used, message, sizeof(message));
+    printf("[%s][%s:%u][%s]: %s\n", clock_date_string(real_ns, 6), site->file, site->line, binlog_level_name(site->level), message);
+}
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        printf("usage: %s file.binlog [min level, 0 to 4]\n", argv[0]);
+        return 1;
+    }
+    u32 min_level = argc > 2 ? (u32)atoi(argv[2]) : 0;
+    int fd = open(argv[1], O_RDONLY);
+    if(fd < 0){
+        printf("Could not open %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    decode_file file = { 0 };
+    file.size = (u64)info.st_size;
+    if(file.size < sizeof(binlog_header)){
+        printf("%s is too small to be a binlog\n", argv[1]);
+        return 1;
+    }
+    file.data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(file.data == MAP_FAILED){
+        printf("Could not map %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    binlog_header header;
+    memcpy(&header, file.data, sizeof(header));
+    if(memcmp(header.magic, BINLOG_MAGIC, sizeof(header.magic)) != 0 || header.version != BINLOG_VERSION || header.chunk_size < sizeof(binlog_header)){
+        printf("%s is not a binlog this decoder knows\n", argv[1]);
+        return 1;
+    }
+    file.chunk_size = header.chunk_size;
+
+    ///Every site's text first, so a record whose text was written after it by another thread still decodes
+    binlog_record record;
+    u8* payload;
+    u64 at = sizeof(binlog_header);
+    while(decode_next(&file, &at, &record, &payload)){
+        if(record.site == BINLOG_SITE_TEXT){
+            decode_add_site(&file, payload, record.size - sizeof(binlog_record));
+        }
+    }
+    at = sizeof(binlog_header);
+    while(decode_next(&file, &at, &record, &payload)){
+        if(record.site == BINLOG_SITE_TEXT){
+            continue;
+        }
+        if(record.site == BINLOG_SITE_CLOCK){
+            if(record.size >= sizeof(binlog_record) + sizeof(binlog_clock)){
+                file.clock = record;
+                memcpy(&file.calibration, payload, sizeof(binlog_clock));
+            }
+            continue;
+        }
+        decode_print(&file, &record, payload, min_level);
+    }
+    munmap(file.data, file.size);
+    close(fd);
+    free(file.sites);
+    return 0;
+}